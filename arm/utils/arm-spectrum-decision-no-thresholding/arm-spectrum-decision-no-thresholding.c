@@ -23,6 +23,21 @@
 **                Spectrum decision is simple: If all FFT bins are below
 **                the threshold -> transmit.
 **
+**                --mask file restricts the decision to the bins listed in a spectral
+**                mask file (see spectral-mask.h). The FPGA still thresholds every
+**                bin, only the threshold exceeded flags of masked bins are checked.
+**
+**                Stage times of every loop go into latency histograms (see
+**                latency-hist.h), reported as p50 / p99 / p99.9 / max at exit.
+**                --latency file also writes them out, JSON for a .json name,
+**                otherwise CSV.
+**
+**                --loops N runs N loops back to back (no 1 second pause) and exits,
+**                for benchmarking (see crash-bench).
+**
+**                --trace file records the DMA, decision and TX enable of every loop
+**                and writes them out as a Chrome trace (see trace.h).
+**
 **                Lab setup for this program
 **                  Run GNU Radio Companion program that has both a USRP Source and Sink.
 **                  USRP Source should be tuned to 130MHz with +30 gain, USRP Sink 75MHz with 0 gain.
@@ -54,6 +69,10 @@
 #include <crash-kmod.h>
 #include <libcrash.h>
 #include <arm_neon.h>
+#include "spectral-mask.h"
+#include "crash-wait.h"
+#include "latency-hist.h"
+#include "trace.h"
 
 // Global variable used to kill final loop
 int loop_prog = 0;
@@ -70,6 +89,8 @@ int main (int argc, char **argv) {
   int j = 0;
   uint temp_int = 0;
   uint num_loops = 0;
+  uint num_timeouts = 0;
+  uint max_loops = 0;
   bool interrupt_flag = false;
   uint number_samples = 0;
   uint decim_rate = 0;
@@ -83,15 +104,23 @@ int main (int argc, char **argv) {
   int threshold_exceeded_index = 0;
   uint32_t start_thresholding;
   uint32_t stop_thresholding;
-  uint32_t start_overhead;
-  uint32_t stop_overhead;
+  uint32_t overhead;
+  char *latency_file = NULL;
+  char *trace_file = NULL;
+  struct latency_hist *hists[3];
+  uint num_hists = 0;
   uint32_t start_dma;
   uint32_t stop_dma;
-  float dma_time[30];
-  float thresholding_time[30];
+  struct latency_hist dma_hist;
+  struct latency_hist thresholding_hist;
+  struct latency_hist loop_hist;
+  struct timespec loop_start_ts;
+  struct timespec loop_stop_ts;
   uint32x4_t integers;
   uint32x4_t thresholds;
   uint32x4_t compares;
+  char *mask_file = NULL;
+  struct spectral_mask mask;
   struct crash_plblock *spec_sense;
   struct crash_plblock *usrp_intf_tx;
 
@@ -102,15 +131,19 @@ int main (int argc, char **argv) {
          We distinguish them by their indices. */
       {"interrupt",   no_argument,       0, 'i'},
       {"loop prog",   no_argument,       0, 'l'},
+      {"loops",       required_argument, 0, 'N'},
       {"decim",       required_argument, 0, 'd'},
       {"fft size",    required_argument, 0, 'k'},
       {"threshold",   required_argument, 0, 't'},
+      {"mask",        required_argument, 0, 'M'},
+      {"latency",     required_argument, 0, 'L'},
+      {"trace",       required_argument, 0, 'T'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "ild:k:t:",
+    c = getopt_long (argc, argv, "ilN:d:k:t:M:L:T:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -122,6 +155,10 @@ int main (int argc, char **argv) {
       case 'l':
         loop_prog = 1;
         break;
+      case 'N':
+        max_loops = atoi(optarg);
+        loop_prog = 1;
+        break;
       case 'd':
         decim_rate = atoi(optarg);
         break;
@@ -131,6 +168,15 @@ int main (int argc, char **argv) {
       case 't':
         threshold = atof(optarg);
         break;
+      case 'M':
+        mask_file = optarg;
+        break;
+      case 'L':
+        latency_file = optarg;
+        break;
+      case 'T':
+        trace_file = optarg;
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -176,6 +222,13 @@ int main (int argc, char **argv) {
 
   number_samples = (uint)pow(2.0,(double)fft_size);
 
+  if (mask_file != NULL) {
+    if (spectral_mask_load(&mask, mask_file, number_samples) != 0) {
+      return -1;
+    }
+    spectral_mask_print(&mask);
+  }
+
   // Set Ctrl-C handler
   signal(SIGINT, ctrl_c);
 
@@ -203,11 +256,25 @@ int main (int argc, char **argv) {
 
   fft_mag = (float *)spec_sense->dma_buff;
   fft_data = (uint32_t *)spec_sense->dma_buff;
-  start_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  stop_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  printf("Overhead (us): %f\n",(1e6/150e6)*(stop_overhead - start_overhead));
+  // Every loop starts with crash_reset(), so the trace uses CLOCK_MONOTONIC_RAW
+  if (trace_file != NULL && trace_init(trace_file, "arm-spectrum-decision-no-thresholding", NULL) != 0) {
+    crash_close(usrp_intf_tx);
+    crash_close(spec_sense);
+    return -1;
+  }
+  // Cost of the counter reads around each timed stage, subtracted from every sample
+  overhead = latency_read_overhead(usrp_intf_tx);
+  printf("Overhead (us): %f\n",(1e6/150e6)*overhead);
+  latency_hist_init(&dma_hist, "DMA Time", overhead);
+  hists[num_hists++] = &dma_hist;
+  latency_hist_init(&thresholding_hist, "Thresholding Time", overhead);
+  hists[num_hists++] = &thresholding_hist;
+  // Whole loop, the measured decision rate in crash-bench
+  latency_hist_init(&loop_hist, "Loop Time", 0);
+  hists[num_hists++] = &loop_hist;
 
   do {
+    clock_gettime(CLOCK_MONOTONIC, &loop_start_ts);
     // Global Reset to get us to a clean slate
     crash_reset(usrp_intf_tx);
 
@@ -217,28 +284,28 @@ int main (int argc, char **argv) {
     // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
     // as the next steps recalibrate the interface and are ignored if issued while it is
     // currently calibrating.
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set RX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_RX_RESET_CAL);
     //printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set TX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
     //printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set USRP TX / RX Modes
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
     // Setup RX path
     crash_set_bit(usrp_intf_tx->regs, USRP_RX_FIFO_BYPASS);                       // Bypass RX FIFO so stale data in the FIFO does not cause latency
@@ -302,15 +369,24 @@ int main (int argc, char **argv) {
     memcpy(&temp_int,&threshold,sizeof(float));                                   // Copy float value to an int without a cast
     crash_write_reg(spec_sense->regs,SPEC_SENSE_THRESHOLD,temp_int);              // Threshold level in single precision floating point
 
-    crash_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
+    trace_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
 
     // First, loop until threshold is exceeded
     j = 0;
     while (threshold_exceeded == 0) {
-      crash_read(spec_sense, SPEC_SENSE_PLBLOCK_ID, number_samples);
+      trace_crash_read(spec_sense, SPEC_SENSE_PLBLOCK_ID, number_samples);
       // Lower 32-bits of 64-bit AXI xfer is FFT magnitude data. Upper 32-bit are the FFT bin index
       // and threshold exceeded flag (bit 31). So, we use 2*i to index this buffer.
-      for (i = 0; i < number_samples; i++) {
+      if (mask_file != NULL) {
+        threshold_exceeded_index = spectral_mask_flags(&mask, fft_data);
+        if (threshold_exceeded_index >= 0) {
+          threshold_exceeded = 1;
+          threshold_exceeded_mag = fft_mag[2*threshold_exceeded_index];
+        } else {
+          threshold_exceeded_index = 0;
+        }
+      }
+      for (i = 0; i < number_samples && mask_file == NULL; i++) {
         // Bit 31 is set when threshold is exceeded, but the lower bits contain the FFT bin number.
         // So if the value is >= than 0x80000000, we atleast know that the bit 31 is set.
         if (fft_data[2*i+1] >= 0x80000000) {
@@ -321,8 +397,10 @@ int main (int argc, char **argv) {
           break;
         }
       }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (j > 10) {
         printf("TIMEOUT: Threshold never exceeded\n");
+        num_timeouts++;
         goto cleanup;
       }
       j++;
@@ -338,8 +416,12 @@ int main (int argc, char **argv) {
     // Second, loop until threshold is not exceeded
     while (threshold_exceeded == 1) {
       threshold_exceeded = 0;
-      crash_read(spec_sense, SPEC_SENSE_PLBLOCK_ID, number_samples);
-      for (i = 0; i < number_samples/4; i++) {
+      trace_crash_read(spec_sense, SPEC_SENSE_PLBLOCK_ID, number_samples);
+      if (mask_file != NULL && spectral_mask_flags(&mask, fft_data) >= 0) {
+        // Do not break loop
+        threshold_exceeded = 1;
+      }
+      for (i = 0; i < number_samples/4 && mask_file == NULL; i++) {
         // NEON GCC Intrinsic to do a 4x unsigned integer greater-than or equal to compare
         // We use the number explained in the loop above here for the comparison
         integers[0] = fft_data[8*i+1];
@@ -353,8 +435,10 @@ int main (int argc, char **argv) {
           break;
         }
       }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (threshold_exceeded == 0) {
         // Enable TX
+        TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
         crash_set_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);
       }
     }
@@ -370,7 +454,12 @@ int main (int argc, char **argv) {
     thresholds[2] = 0x88000000;
     thresholds[3] = 0x88000000;
     start_thresholding = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    for (i = 0; i < number_samples/4; i++) {
+    // The FPGA flags cannot be forced off here, so the masked scan can end early if a
+    // masked bin is over the threshold
+    if (mask_file != NULL) {
+      spectral_mask_flags(&mask, fft_data);
+    }
+    for (i = 0; i < number_samples/4 && mask_file == NULL; i++) {
       integers[0] = fft_data[8*i+1];
       integers[1] = fft_data[8*i+3];
       integers[2] = fft_data[8*i+5];
@@ -386,15 +475,12 @@ int main (int argc, char **argv) {
     printf("Threshold:\t\t\t%f\n",threshold);
     printf("Threshold Exceeded Index:\t%d\n",threshold_exceeded_index);
     printf("Threshold Exceeded Mag:\t\t%f\n",threshold_exceeded_mag);
-    printf("DMA Time (us): %f\n",(1e6/150e6)*(stop_dma - start_dma));
-    printf("Thresholding Time (us): %f\n",(1e6/150e6)*(stop_thresholding - start_thresholding));
+    printf("DMA Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_dma,stop_dma));
+    printf("Thresholding Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_thresholding,stop_thresholding));
 
-    // Keep track of times so we can report an average at the end
-    if (num_loops < 30) {
-      dma_time[num_loops] = (1e6/150e6)*(stop_dma - start_dma);
-      thresholding_time[num_loops] = (1e6/150e6)*(stop_thresholding - start_thresholding);
-    }
-    num_loops++;
+    // Every loop goes into the latency histograms
+    latency_hist_record_interval(&dma_hist, start_dma, stop_dma);
+    latency_hist_record_interval(&thresholding_hist, start_thresholding, stop_thresholding);
 
     if (loop_prog == 1) {
       printf("Ctrl-C to end program after this loop\n");
@@ -408,36 +494,42 @@ int main (int argc, char **argv) {
     //}
 
 cleanup:
-    crash_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
-    crash_clear_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                      // Disable FFT
+    // Timed out loops count too, so --loops always ends
+    num_loops++;
+    trace_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    trace_clear_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                      // Disable FFT
+    TRACE(TRACE_TX_ENABLE, "TX Enable", 0);
     crash_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);                           // Disable TX
     threshold_exceeded = 0;
     threshold_exceeded_mag = 0.0;
     threshold_exceeded_index = 0;
-    sleep(1);
-  } while (loop_prog == 1);
-
-  float dma_time_avg = 0.0;
-  float thresholding_time_avg = 0.0;
-  if (num_loops > 30) {
-    for (i = 0; i < 30; i++) {
-      dma_time_avg += dma_time[i];
-      thresholding_time_avg += thresholding_time[i];
-    }
-    dma_time_avg = dma_time_avg/30;
-    thresholding_time_avg = thresholding_time_avg/30;
-  } else {
-    for (i = 0; i < num_loops; i++) {
-      dma_time_avg += dma_time[i];
-      thresholding_time_avg += thresholding_time[i];
+    clock_gettime(CLOCK_MONOTONIC, &loop_stop_ts);
+    latency_hist_record_timespec(&loop_hist, &loop_start_ts, &loop_stop_ts);
+    // --loops runs back to back, so the loop rate and CPU use are not diluted by the pause
+    if (max_loops == 0) {
+      sleep(1);
     }
-    dma_time_avg = dma_time_avg/num_loops;
-    thresholding_time_avg = thresholding_time_avg/num_loops;
-  }
+  } while (loop_prog == 1 && (max_loops == 0 || num_loops < max_loops));
+
   printf("Number of loops: %d\n",num_loops);
-  printf("Average DMA time (us): %f\n",dma_time_avg);
-  printf("Average Thresholding time (us): %f\n",thresholding_time_avg);
+  if (num_timeouts > 0) {
+    printf("Number of timeouts: %d\n",num_timeouts);
+  }
+  latency_hist_print(&dma_hist);
+  latency_hist_print(&thresholding_hist);
+  latency_hist_print(&loop_hist);
+  if (latency_file != NULL) {
+    latency_hist_export(latency_file, hists, num_hists);
+  }
+  if (trace_file != NULL) {
+    trace_print_stats();
+    trace_dump();
+    trace_free();
+  }
 
+  if (mask_file != NULL) {
+    spectral_mask_free(&mask);
+  }
   crash_close(usrp_intf_tx);
   crash_close(spec_sense);
   return 0;
@@ -20,9 +20,58 @@
 **                library of FFT kernels to speed up FFT computation. Additional optimizations
 **                using NEON SIMD instructions to speed up magnitude calculation.
 **
+**                FFTW plans are made once with FFTW_MEASURE (--patient for FFTW_PATIENT)
+**                and the wisdom is saved to a file (--wisdom) so later runs skip planning.
+**
+**                --ring N runs the spectrum decision loop on a ring of N DMA buffers
+**                so the next frame transfers while the current one is transformed
+**                and thresholded. Frame rate and dropped frames are reported.
+**
+**                --two-core splits the spectrum decision loop across both cores: one
+**                thread captures frames off the DMA ring and the other runs the FFT
+**                and threshold. Uses --ring buffers (default 8).
+**
+**                --average N switches the spectrum decision to a Welch averaged PSD
+**                of N windowed, overlapping FFT segments (--window hann|blackman,
+**                --overlap 50|75) to cut down on false alarms. Frame rate and
+**                detection latency are reported.
+**
+**                --mask file restricts the decision to the bins listed in a spectral
+**                mask file (see spectral-mask.h), so only the channels we might
+**                transmit on are checked.
+**
+**                The magnitude / threshold kernel is selectable with --kernel:
+**                  0: Original kernel, computes sqrt(I^2 + Q^2) for every bin
+**                  1: Compares I^2 + Q^2 against threshold^2 using deinterleaving
+**                     loads and only computes the magnitude of the bin that
+**                     exceeded the threshold (default)
+**                --cache noncacheable|coherent sets the Datamover cache policy for
+**                the DMA buffers (see dma-cache.h). Without it the kernel module
+**                default is used.
+**
+**                --benchmark compares the cycle counts of the kernels at every FFT
+**                size from 64 to 4096 and exits.
+**
+**                --format q15 receives packed 16-bit I/Q samples instead of complex
+**                floats (see sample-format.h), halving the DMA time per frame, and
+**                runs a Q15 FFT / threshold with NEON int16 arithmetic. Not
+**                available with --average or --mask.
+**
 **                Spectrum decision is simple: If all FFT bins are below
 **                the threshold -> transmit.
 **
+**                Stage times of every loop go into latency histograms (see
+**                latency-hist.h), reported as p50 / p99 / p99.9 / max at exit.
+**                --latency file also writes them out, JSON for a .json name,
+**                otherwise CSV.
+**
+**                --loops N runs N loops back to back (no 1 second pause) and exits,
+**                for benchmarking (see crash-bench).
+**
+**                --trace file records the DMA, FFT, decision and TX enable of every
+**                frame on each thread and writes them out as a Chrome trace (see
+**                trace.h).
+**
 **                Lab setup for this program
 **                  Run GNU Radio Companion program that has both a USRP Source and Sink.
 **                  USRP Source should be tuned to 130MHz with +30 gain, USRP Sink 75MHz with 0 gain.
@@ -54,23 +103,149 @@
 #include <fftw3.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
-#include <arm_neon.h>
+#include "fft-plan-cache.h"
+#include "frame-ring.h"
+#include "pipeline.h"
+#include "welch.h"
+#include "spectral-mask.h"
+#include "threshold-kernels.h"
+#include "sample-format.h"
+#include "fft-q15.h"
+#include "crash-wait.h"
+#include "latency-hist.h"
+#include "trace.h"
+#include "dma-cache.h"
+
+#define BENCHMARK_RUNS            1000
+#define TWO_CORE_DEFAULT_BUFFS    8
 
 // Global variable used to kill final loop
 int loop_prog = 0;
 
+// State shared with the compute thread in two core mode
+struct sensing_ctx {
+  fftwf_plan plan;
+  fftwf_complex *out;
+  uint number_samples;
+  float threshold;
+  threshold_kernel_t kernel;
+  struct welch *welch;             // NULL when not averaging
+  struct spectral_mask *mask;     // NULL to check every bin
+  struct fft_q15 *q15;            // NULL for float samples
+  struct crash_plblock *usrp_intf_tx;
+};
+
+// Cleared by Ctrl-C. loop_prog is 0 for a single run, so it cannot tell the two core
+// pipeline to stop.
+int pipeline_prog = 1;
+
 void ctrl_c(int dummy)
 {
     loop_prog = 0;
+    pipeline_prog = 0;
     return;
 }
 
+// Compute side of the two core pipeline. Stops the pipeline once TX is enabled.
+int sensing_compute(void *buff, uint64_t seq, void *arg)
+{
+  struct sensing_ctx *ctx = (struct sensing_ctx *)arg;
+  uint32_t start_welch;
+  int decision;
+
+  if (ctx->welch != NULL) {
+    start_welch = crash_read_reg(ctx->usrp_intf_tx->regs,DMA_DEBUG_CNT);
+    decision = welch_push_frame(ctx->welch, (fftwf_complex *)buff, seq, ctx->threshold, NULL);
+    ctx->welch->compute_cycles += dma_debug_cnt_delta(start_welch,crash_read_reg(ctx->usrp_intf_tx->regs,DMA_DEBUG_CNT));
+    // Keep going until a complete PSD is below the threshold
+    if (decision != -1) {
+      return 0;
+    }
+  } else if (ctx->q15 != NULL) {
+    fft_q15_execute(ctx->q15, (int16_t *)buff);
+    decision = fft_q15_threshold(ctx->q15, ctx->threshold, NULL);
+    if (decision != -1) {
+      return 0;
+    }
+  } else {
+    fft_plan_cache_execute(ctx->plan, (fftwf_complex *)buff, ctx->out);
+    if (ctx->mask != NULL) {
+      decision = spectral_mask_complex(ctx->mask, (float *)ctx->out, ctx->threshold, NULL);
+    } else {
+      decision = ctx->kernel((float *)ctx->out, ctx->number_samples, ctx->threshold, NULL);
+    }
+    if (decision != -1) {
+      return 0;
+    }
+  }
+  // Enable TX
+  TRACE(TRACE_DECISION, "Decision", 0);
+  TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
+  crash_set_bit(ctx->usrp_intf_tx->regs,USRP_TX_ENABLE);
+  return 1;
+}
+
+// Compare the threshold kernels at every FFT size using the 150 MHz counter in the FPGA.
+// The threshold is set so no bin can exceed it, i.e. every kernel has to scan the entire
+// FFT output.
+void benchmark_kernels(struct crash_plblock *plblock)
+{
+  int i;
+  int k;
+  int run;
+  uint n;
+  uint32_t start;
+  uint32_t stop;
+  uint32_t overhead;
+  uint64_t cycles[NUM_THRESHOLD_KERNELS];
+  fftwf_complex *fft_out;
+
+  fft_out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*4096);
+  for (i = 0; i < 4096; i++) {
+    fft_out[i][0] = (float)rand()/RAND_MAX - 0.5;
+    fft_out[i][1] = (float)rand()/RAND_MAX - 0.5;
+  }
+
+  start = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+  stop = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+  overhead = dma_debug_cnt_delta(start, stop);
+
+  printf("FFT Size");
+  for (k = 0; k < NUM_THRESHOLD_KERNELS; k++) {
+    printf("\t%s (cycles)\t%s (us)",threshold_kernel_names[k],threshold_kernel_names[k]);
+  }
+  printf("\tSpeedup\n");
+  for (n = 64; n <= 4096; n *= 2) {
+    for (k = 0; k < NUM_THRESHOLD_KERNELS; k++) {
+      cycles[k] = 0;
+      for (run = 0; run < BENCHMARK_RUNS; run++) {
+        start = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+        if (threshold_kernels[k]((float *)fft_out, n, 1000000000.0, NULL) != -1) {
+          printf("This shouldn't happen\n");
+        }
+        stop = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+        cycles[k] += dma_debug_cnt_delta(start, stop) - overhead;
+      }
+    }
+    printf("%d",n);
+    for (k = 0; k < NUM_THRESHOLD_KERNELS; k++) {
+      printf("\t%f\t%f",(float)cycles[k]/BENCHMARK_RUNS,(1e6/150e6)*cycles[k]/BENCHMARK_RUNS);
+    }
+    printf("\t%f\n",(float)cycles[THRESHOLD_KERNEL_SQRT]/cycles[THRESHOLD_KERNEL_SQR]);
+  }
+  fftwf_free(fft_out);
+}
+
 int main (int argc, char **argv) {
   int c = 0;
   int i = 0;
   int j = 0;
   uint num_loops = 0;
+  uint num_timeouts = 0;
+  uint max_loops = 0;
   bool interrupt_flag = false;
+  bool benchmark_flag = false;
+  uint kernel = THRESHOLD_KERNEL_SQR;
   uint number_samples = 0;
   uint decim_rate = 0;
   uint fft_size = 0;
@@ -83,25 +258,48 @@ int main (int argc, char **argv) {
   uint32_t stop_decision;
   uint32_t start_sensing;
   uint32_t stop_sensing;
-  uint32_t start_overhead;
-  uint32_t stop_overhead;
+  uint32_t overhead;
+  char *latency_file = NULL;
+  char *trace_file = NULL;
+  struct latency_hist *hists[4];
+  uint num_hists = 0;
   uint32_t start_dma;
   uint32_t stop_dma;
-  float dma_time[30];
-  float sensing_time[30];
-  float decision_time[30];
-  float32x4_t floats_real;
-  float32x4_t floats_imag;
-  float32x4_t floats_real_sqr;
-  float32x4_t floats_imag_sqr;
-  float32x4_t floats_add;
-  float32x4_t floats_sqroot;
-  float32x4_t thresholds;
-  uint32x4_t compares;
-  uint32_t decisions[4096];
+  struct latency_hist dma_hist;
+  struct latency_hist sensing_hist;
+  struct latency_hist decision_hist;
+  struct latency_hist loop_hist;
+  struct timespec loop_start_ts;
+  struct timespec loop_stop_ts;
+  int decision;
   fftwf_complex *in1;
-  fftwf_complex out[8192];  // Must be 2x max FFT size
+  fftwf_complex *rx_buff;
+  fftwf_complex *out;
   fftwf_plan p1;
+  char *wisdom_file = NULL;
+  unsigned planner_flags = FFTW_MEASURE;
+  uint ring_buffs = 0;
+  struct frame_ring ring;
+  bool two_core = false;
+  struct pipeline pipe;
+  struct sensing_ctx ctx;
+  uint num_avg = 0;
+  int window_type = WELCH_WINDOW_HANN;
+  uint overlap = 50;
+  struct welch welch;
+  int welch_decision;
+  uint32_t start_welch;
+  struct timespec start_loop;
+  struct timespec stop_loop;
+  char *mask_file = NULL;
+  struct spectral_mask mask;
+  int format = SAMPLE_FORMAT_FLOAT;
+  int cache_policy = -1;
+  const char *cache_name = NULL;
+  uint rx_format = SAMPLE_FORMAT_FLOAT;
+  uint number_words = 0;
+  uint samples_per_word = 1;
+  struct fft_q15 q15;
   struct crash_plblock *usrp_intf_tx;
   struct crash_plblock *usrp_intf_rx;
 
@@ -112,15 +310,30 @@ int main (int argc, char **argv) {
          We distinguish them by their indices. */
       {"interrupt",   no_argument,       0, 'i'},
       {"loop prog",   no_argument,       0, 'l'},
+      {"loops",       required_argument, 0, 'N'},
       {"decim",       required_argument, 0, 'd'},
       {"fft size",    required_argument, 0, 'k'},
       {"threshold",   required_argument, 0, 't'},
+      {"wisdom",      required_argument, 0, 'w'},
+      {"patient",     no_argument,       0, 'p'},
+      {"ring",        required_argument, 0, 'r'},
+      {"kernel",      required_argument, 0, 'm'},
+      {"benchmark",   no_argument,       0, 'b'},
+      {"two-core",    no_argument,       0, 'c'},
+      {"average",     required_argument, 0, 'a'},
+      {"window",      required_argument, 0, 'n'},
+      {"overlap",     required_argument, 0, 'o'},
+      {"mask",        required_argument, 0, 'M'},
+      {"latency",     required_argument, 0, 'L'},
+      {"trace",       required_argument, 0, 'T'},
+      {"format",      required_argument, 0, 'f'},
+      {"cache",       required_argument, 0, 'C'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "ild:k:t:",
+    c = getopt_long (argc, argv, "ilN:d:k:t:m:bw:pr:ca:n:o:M:f:C:L:T:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -132,6 +345,10 @@ int main (int argc, char **argv) {
       case 'l':
         loop_prog = 1;
         break;
+      case 'N':
+        max_loops = atoi(optarg);
+        loop_prog = 1;
+        break;
       case 'd':
         decim_rate = atoi(optarg);
         break;
@@ -141,6 +358,48 @@ int main (int argc, char **argv) {
       case 't':
         threshold = atof(optarg);
         break;
+      case 'w':
+        wisdom_file = optarg;
+        break;
+      case 'p':
+        planner_flags = FFTW_PATIENT;
+        break;
+      case 'r':
+        ring_buffs = atoi(optarg);
+        break;
+      case 'm':
+        kernel = atoi(optarg);
+        break;
+      case 'b':
+        benchmark_flag = true;
+        break;
+      case 'c':
+        two_core = true;
+        break;
+      case 'a':
+        num_avg = atoi(optarg);
+        break;
+      case 'n':
+        window_type = welch_window_lookup(optarg);
+        break;
+      case 'o':
+        overlap = atoi(optarg);
+        break;
+      case 'M':
+        mask_file = optarg;
+        break;
+      case 'L':
+        latency_file = optarg;
+        break;
+      case 'T':
+        trace_file = optarg;
+        break;
+      case 'f':
+        format = sample_format_lookup(optarg);
+        break;
+      case 'C':
+        cache_name = optarg;
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -184,8 +443,73 @@ int main (int argc, char **argv) {
     threshold = 1.0;
   }
 
+  if (kernel >= NUM_THRESHOLD_KERNELS) {
+    printf("ERROR: Invalid kernel, must be 0 (sqrt) or 1 (sqr)\n");
+    return -1;
+  }
+
+  if (ring_buffs > 0 && ring_buffs < FRAME_RING_MIN_BUFFS) {
+    printf("ERROR: Ring needs at least %d buffers\n",FRAME_RING_MIN_BUFFS);
+    return -1;
+  }
+
+  if (two_core == true) {
+    if (ring_buffs == 0) {
+      printf("INFO: Ring size not specified, defaulting to %d buffers\n",TWO_CORE_DEFAULT_BUFFS);
+      ring_buffs = TWO_CORE_DEFAULT_BUFFS;
+    }
+    if (ring_buffs < PIPELINE_MIN_BUFFS) {
+      printf("ERROR: Two core mode needs at least %d buffers\n",PIPELINE_MIN_BUFFS);
+      return -1;
+    }
+  }
+
+  if (window_type < 0) {
+    printf("ERROR: Invalid window, must be hann or blackman\n");
+    return -1;
+  }
+
+  if (overlap != 50 && overlap != 75) {
+    printf("ERROR: Overlap must be 50 or 75 percent\n");
+    return -1;
+  }
+
+  if (mask_file != NULL && num_avg > 0) {
+    printf("ERROR: Spectral mask cannot be used with Welch averaging\n");
+    return -1;
+  }
+
+  if (format < 0) {
+    printf("ERROR: Invalid sample format, must be float or q15\n");
+    return -1;
+  }
+
+  if (cache_name != NULL) {
+    cache_policy = dma_cache_policy_lookup(cache_name);
+    if (cache_policy < 0) {
+      printf("ERROR: Invalid cache policy, must be noncacheable or coherent\n");
+      return -1;
+    }
+    if (!dma_cache_supported()) {
+      printf("ERROR: crash-kmod.h does not name the DMA cache bits, --cache is not supported\n");
+      return -1;
+    }
+  }
+
+  if (format == SAMPLE_FORMAT_Q15 && (num_avg > 0 || mask_file != NULL)) {
+    printf("ERROR: Q15 samples cannot be used with Welch averaging or a spectral mask\n");
+    return -1;
+  }
+
   number_samples = (uint)pow(2.0,(double)fft_size);
 
+  if (mask_file != NULL) {
+    if (spectral_mask_load(&mask, mask_file, number_samples) != 0) {
+      return -1;
+    }
+    spectral_mask_print(&mask);
+  }
+
   // Set Ctrl-C handler
   signal(SIGINT, ctrl_c);
 
@@ -211,24 +535,91 @@ int main (int argc, char **argv) {
     return -1;
   }
 
-  in1 = (fftw_complex *)(usrp_intf_rx->dma_buff);
+  if (benchmark_flag == true) {
+    benchmark_kernels(usrp_intf_tx);
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    return 0;
+  }
 
-  start_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  stop_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  printf("Overhead (us): %f\n",(1e6/150e6)*(stop_overhead - start_overhead));
+  // Every loop starts with crash_reset(), so the trace uses CLOCK_MONOTONIC_RAW
+  if (trace_file != NULL && trace_init(trace_file, "arm-spectrum-sensing-opt", NULL) != 0) {
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    return -1;
+  }
 
-  do {
-    // Set threshold for NEON instruction
-    thresholds[0] = threshold;
-    thresholds[1] = threshold;
-    thresholds[2] = threshold;
-    thresholds[3] = threshold;
+  in1 = (fftwf_complex *)(usrp_intf_rx->dma_buff);
+  out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+
+  // Setup FFTW3. The plan is made once and reused for every loop. Planning overwrites
+  // in1 and out, which is fine as neither holds data yet.
+  if (fft_plan_cache_init(wisdom_file, planner_flags) == 1) {
+    printf("INFO: Imported FFTW wisdom\n");
+  }
+  p1 = fft_plan_cache_get(number_samples, in1, out);
+  if (p1 == NULL) {
+    fftwf_free(out);
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    return -1;
+  }
+
+  ctx.plan = p1;
+  ctx.out = out;
+  ctx.number_samples = number_samples;
+  ctx.threshold = threshold;
+  ctx.kernel = threshold_kernels[kernel];
+  ctx.usrp_intf_tx = usrp_intf_tx;
+  ctx.welch = NULL;
+  ctx.mask = (mask_file != NULL) ? &mask : NULL;
+  ctx.q15 = NULL;
+
+  if (format == SAMPLE_FORMAT_Q15) {
+    if (fft_q15_init(&q15, number_samples) != 0) {
+      fft_plan_cache_cleanup();
+      fftwf_free(out);
+      crash_close(usrp_intf_tx);
+      crash_close(usrp_intf_rx);
+      return -1;
+    }
+  }
+
+  if (num_avg > 0) {
+    if (welch_init(&welch, number_samples, window_type, overlap, num_avg) != 0) {
+      fft_plan_cache_cleanup();
+      fftwf_free(out);
+      crash_close(usrp_intf_tx);
+      crash_close(usrp_intf_rx);
+      return -1;
+    }
+    ctx.welch = &welch;
+  }
 
-    // Setup FFTW3
-    p1 = fftwf_plan_dft_1d(fft_size, in1, out, FFTW_FORWARD, FFTW_ESTIMATE);
+  // Cost of the counter reads around each timed stage, subtracted from every sample
+  overhead = latency_read_overhead(usrp_intf_tx);
+  printf("Overhead (us): %f\n",(1e6/150e6)*overhead);
+  latency_hist_init(&dma_hist, "DMA Time", overhead);
+  hists[num_hists++] = &dma_hist;
+  latency_hist_init(&sensing_hist, "Sensing Time", overhead);
+  hists[num_hists++] = &sensing_hist;
+  latency_hist_init(&decision_hist, "Decision Time", overhead);
+  hists[num_hists++] = &decision_hist;
+  // Whole loop, the measured decision rate in crash-bench
+  latency_hist_init(&loop_hist, "Loop Time", 0);
+  hists[num_hists++] = &loop_hist;
+
+  printf("Kernel: %s\n",threshold_kernel_names[kernel]);
+  printf("Sample Format: %s\n",sample_format_names[format]);
+  printf("DMA Cache Policy: %s\n",(cache_policy >= 0) ? dma_cache_policy_names[cache_policy] : "default");
 
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &loop_start_ts);
     // Global Reset to get us to a clean slate
     crash_reset(usrp_intf_tx);
+    if (cache_policy >= 0) {
+      dma_cache_set_policy(usrp_intf_tx, cache_policy);
+    }
 
     if (interrupt_flag == true) {
       crash_set_bit(usrp_intf_tx->regs,DMA_MM2S_INTERRUPT);
@@ -236,34 +627,37 @@ int main (int argc, char **argv) {
     // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
     // as the next steps recalibrate the interface and are ignored if issued while it is
     // currently calibrating.
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set RX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_RX_RESET_CAL);
     //printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set TX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
     //printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set USRP TX / RX Modes
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
     // Setup RX path
     crash_set_bit(usrp_intf_tx->regs, USRP_RX_FIFO_BYPASS);                       // Bypass RX FIFO so stale data in the FIFO does not cause latency
     crash_write_reg(usrp_intf_tx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to spec_sense
-    crash_write_reg(usrp_intf_tx->regs, USRP_RX_PACKET_SIZE, number_samples);     // Set packet size
-    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_FIX2FLOAT_BYPASS);                // Do not bypass fix2float
+    rx_format = sample_format_set(usrp_intf_tx, format);                          // Float or packed Q15 samples
+    samples_per_word = sample_format_samples_per_word(rx_format);
+    number_words = number_samples/samples_per_word;
+    ctx.q15 = (rx_format == SAMPLE_FORMAT_Q15) ? &q15 : NULL;
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_PACKET_SIZE, number_words);       // Set packet size
     if (decim_rate == 1) {
       crash_set_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                      // Bypass CIC Filter
       crash_set_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                       // Bypass HB Filter
@@ -311,64 +705,32 @@ int main (int argc, char **argv) {
     // Load waveform into TX FIFO so it can immediately trigger
     crash_write(usrp_intf_tx, USRP_INTF_PLBLOCK_ID, number_samples);
 
-    crash_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
+    trace_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
 
     // First, loop until threshold is exceeded
     j = 0;
     while (threshold_exceeded == 0) {
-      crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
+      trace_crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
       // Run FFT
-      fftwf_execute(p1);
-      for (i = 0; i < number_samples/4; i++) {
-        // Calculate sqrt(I^2 + Q^2)
-        floats_real[0] = out[4*i][0];
-        floats_real[1] = out[4*i+1][0];
-        floats_real[2] = out[4*i+2][0];
-        floats_real[3] = out[4*i+3][0];
-        floats_real_sqr = vmulq_f32(floats_real, floats_real);
-        floats_imag[0] = out[4*i][1];
-        floats_imag[1] = out[4*i+1][1];
-        floats_imag[2] = out[4*i+2][1];
-        floats_imag[3] = out[4*i+3][1];
-        floats_imag_sqr = vmulq_f32(floats_imag, floats_imag);
-        floats_add = vaddq_f32(floats_real_sqr,floats_imag_sqr);
-        floats_sqroot[0] = sqrt(floats_add[0]);
-        floats_sqroot[1] = sqrt(floats_add[1]);
-        floats_sqroot[2] = sqrt(floats_add[2]);
-        floats_sqroot[3] = sqrt(floats_add[3]);
-        compares = vcageq_f32(floats_sqroot,thresholds);
-        if (compares[0] == -1) {
-          // Do not break loop
-          threshold_exceeded = 1;
-          // Save threshold data
-          threshold_exceeded_mag = floats_sqroot[0];
-          threshold_exceeded_index = 4*i;
-          break;
-        } else if (compares[1] == -1) {
-          // Do not break loop
-          threshold_exceeded = 1;
-          // Save threshold data
-          threshold_exceeded_mag = floats_sqroot[1];
-          threshold_exceeded_index = 4*i+1;
-          break;
-        } else if (compares[2] == -1) {
-          // Do not break loop
-          threshold_exceeded = 1;
-          // Save threshold data
-          threshold_exceeded_mag = floats_sqroot[2];
-          threshold_exceeded_index = 4*i+2;
-          break;
-        } else if (compares[3] == -1) {
-          // Do not break loop
-          threshold_exceeded = 1;
-          // Save threshold data
-          threshold_exceeded_mag = floats_sqroot[3];
-          threshold_exceeded_index = 4*i+3;
-          break;
+      if (rx_format == SAMPLE_FORMAT_Q15) {
+        fft_q15_execute(&q15, (int16_t *)in1);
+        threshold_exceeded_index = fft_q15_threshold(&q15, threshold, &threshold_exceeded_mag);
+      } else {
+        fft_plan_cache_execute(p1, in1, out);
+        if (mask_file != NULL) {
+          threshold_exceeded_index = spectral_mask_complex(&mask, (float *)out, threshold, &threshold_exceeded_mag);
+        } else {
+          threshold_exceeded_index = threshold_kernels[kernel]((float *)out, number_samples, threshold, &threshold_exceeded_mag);
         }
       }
+      if (threshold_exceeded_index != -1) {
+        // Do not break loop
+        threshold_exceeded = 1;
+      }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (j > 10) {
         printf("TIMEOUT: Threshold never exceeded\n");
+        num_timeouts++;
         goto cleanup;
       }
       j++;
@@ -376,84 +738,119 @@ int main (int argc, char **argv) {
     }
 
     // Second, perform specturm sensing and the spectrum decision
+    if (num_avg > 0) {
+      welch_reset(&welch);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_loop);
+    if (two_core == true) {
+      // Packed frames are fewer words, scale the decimation so the expected frame rate
+      // used for the drop counter stays the same
+      if (pipeline_start(&pipe, usrp_intf_rx, USRP_INTF_PLBLOCK_ID, ring_buffs, number_words,
+                         decim_rate*samples_per_word, sensing_compute, &ctx) != 0) {
+        goto cleanup;
+      }
+      pipeline_wait(&pipe, &pipeline_prog);
+      pipeline_stop(&pipe);
+      pipeline_print_stats(&pipe);
+      threshold_exceeded = 0;
+    } else if (ring_buffs > 0) {
+      if (frame_ring_start(&ring, usrp_intf_rx, USRP_INTF_PLBLOCK_ID, ring_buffs, number_words,
+                           decim_rate*samples_per_word) != 0) {
+        goto cleanup;
+      }
+    }
     while (threshold_exceeded == 1) {
       threshold_exceeded = 0;
-      crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
-      // Run FFT
-      fftwf_execute(p1);
-      for (i = 0; i < number_samples/4; i++) {
-        // Calculate sqrt(I^2 + Q^2)
-        floats_real[0] = out[4*i][0];
-        floats_real[1] = out[4*i+1][0];
-        floats_real[2] = out[4*i+2][0];
-        floats_real[3] = out[4*i+3][0];
-        floats_real_sqr = vmulq_f32(floats_real, floats_real);
-        floats_imag[0] = out[4*i][1];
-        floats_imag[1] = out[4*i+1][1];
-        floats_imag[2] = out[4*i+2][1];
-        floats_imag[3] = out[4*i+3][1];
-        floats_imag_sqr = vmulq_f32(floats_imag, floats_imag);
-        floats_add = vaddq_f32(floats_real_sqr,floats_imag_sqr);
-        floats_sqroot[0] = sqrt(floats_add[0]);
-        floats_sqroot[1] = sqrt(floats_add[1]);
-        floats_sqroot[2] = sqrt(floats_add[2]);
-        floats_sqroot[3] = sqrt(floats_add[3]);
-        compares = vcageq_f32(floats_sqroot,thresholds);
+      if (ring_buffs > 0) {
+        // The DMA keeps filling the next buffers in the ring while we work on this one.
+        // Ring buffers are a multiple of 16 bytes apart, so they have the same alignment
+        // as in1 and the cached plan can run on them directly.
+        rx_buff = (fftwf_complex *)frame_ring_next(&ring);
+        if (rx_buff == NULL) {
+          frame_ring_stop(&ring);
+          printf("TIMEOUT: No frames from DMA ring\n");
+          num_timeouts++;
+          goto cleanup;
+        }
+      } else {
+        trace_crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
+        rx_buff = in1;
+      }
+      if (num_avg > 0) {
+        start_welch = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
+        // Only ring frames with consecutive seq are contiguous
+        welch_decision = welch_push_frame(&welch, rx_buff, (ring_buffs > 0) ? ring.seq : WELCH_NO_SEQ,
+                                          threshold, NULL);
+        welch.compute_cycles += dma_debug_cnt_delta(start_welch,crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT));
+        // Keep going until a complete PSD is below the threshold
+        if (welch_decision != -1) {
+          threshold_exceeded = 1;
+        }
+      } else if (rx_format == SAMPLE_FORMAT_Q15) {
+        fft_q15_execute(&q15, (int16_t *)rx_buff);
+        if (fft_q15_threshold(&q15, threshold, NULL) != -1) {
+          // Do not break loop
+          threshold_exceeded = 1;
+        }
+      } else {
+        // Run FFT
+        fft_plan_cache_execute(p1, rx_buff, out);
         // Was the threshold exceeded?
-        if (compares[0] == -1 || compares[1] == -1 || compares[2] == -1 || compares[3] == -1) {
+        if (mask_file != NULL) {
+          decision = spectral_mask_complex(&mask, (float *)out, threshold, NULL);
+        } else {
+          decision = threshold_kernels[kernel]((float *)out, number_samples, threshold, NULL);
+        }
+        if (decision != -1) {
           // Do not break loop
           threshold_exceeded = 1;
-          break;
         }
       }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (threshold_exceeded == 0) {
         // Enable TX
+        TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
         crash_set_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);
       }
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &stop_loop);
+
+    if (two_core == false && ring_buffs > 0) {
+      frame_ring_stop(&ring);
+      frame_ring_print_stats(&ring);
+    }
+    if (num_avg > 0) {
+      welch_print_stats(&welch, (stop_loop.tv_sec - start_loop.tv_sec) +
+                        (stop_loop.tv_nsec - start_loop.tv_nsec)/1e9, decim_rate);
+    }
+
     // Calculate how long the DMA and the thresholding took by using a counter in the FPGA
     // running at 150 MHz.
     start_dma = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
+    crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
     stop_dma = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
 
     // Set a huge threshold so we have to examine every bin
-    thresholds[0] = 1000000000.0;
-    thresholds[1] = 1000000000.0;
-    thresholds[2] = 1000000000.0;
-    thresholds[3] = 1000000000.0;
     start_sensing = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    fftwf_execute(p1);
-    for (i = 0; i < number_samples/4; i++) {
-      floats_real[0] = out[4*i][0];
-      floats_real[1] = out[4*i+1][0];
-      floats_real[2] = out[4*i+2][0];
-      floats_real[3] = out[4*i+3][0];
-      floats_real_sqr = vmulq_f32(floats_real, floats_real);
-      floats_imag[0] = out[4*i][1];
-      floats_imag[1] = out[4*i+1][1];
-      floats_imag[2] = out[4*i+2][1];
-      floats_imag[3] = out[4*i+3][1];
-      floats_imag_sqr = vmulq_f32(floats_imag, floats_imag);
-      floats_add = vaddq_f32(floats_real_sqr,floats_imag_sqr);
-      floats_sqroot[0] = sqrt(floats_add[0]);
-      floats_sqroot[1] = sqrt(floats_add[1]);
-      floats_sqroot[2] = sqrt(floats_add[2]);
-      floats_sqroot[3] = sqrt(floats_add[3]);
-      compares = vcageq_f32(floats_sqroot,thresholds);
-      decisions[4*i] = compares[0];
-      decisions[4*i+1] = compares[1];
-      decisions[4*i+2] = compares[2];
-      decisions[4*i+3] = compares[3];
+    if (rx_format == SAMPLE_FORMAT_Q15) {
+      fft_q15_execute(&q15, (int16_t *)in1);
+      decision = fft_q15_threshold(&q15, 1000000000.0, NULL);
+    } else {
+      fft_plan_cache_execute(p1, in1, out);
+      if (mask_file != NULL) {
+        decision = spectral_mask_complex(&mask, (float *)out, 1000000000.0, NULL);
+      } else {
+        decision = threshold_kernels[kernel]((float *)out, number_samples, 1000000000.0, NULL);
+      }
     }
     stop_sensing = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
 
+    // The kernel fuses the per-bin decision into the magnitude calculation, so all that is
+    // left is to check its result
     start_decision = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    for (i = 0; i < number_samples; i++) {
-        if (decisions[i] == -1) {
-        printf("This shouldn't happen\n");
-      }
+    if (decision != -1) {
+      printf("This shouldn't happen\n");
     }
     stop_decision = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
 
@@ -461,17 +858,14 @@ int main (int argc, char **argv) {
     printf("Threshold:\t\t\t%f\n",threshold);
     printf("Threshold Exceeded Index:\t%d\n",threshold_exceeded_index);
     printf("Threshold Exceeded Mag:\t\t%f\n",threshold_exceeded_mag);
-    printf("DMA Time (us): %f\n",(1e6/150e6)*(stop_dma - start_dma));
-    printf("Sensing Time (us): %f\n",(1e6/150e6)*(stop_sensing - start_sensing));
-    printf("Decision Time (us): %f\n",(1e6/150e6)*(stop_decision - start_decision));
-
-    // Keep track of times so we can report an average at the end
-    if (num_loops < 30) {
-      dma_time[num_loops] = (1e6/150e6)*(stop_dma - start_dma);
-      sensing_time[num_loops] = (1e6/150e6)*(stop_sensing - start_sensing);
-      decision_time[num_loops] = (1e6/150e6)*(stop_decision - start_decision);
-    }
-    num_loops++;
+    printf("DMA Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_dma,stop_dma));
+    printf("Sensing Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_sensing,stop_sensing));
+    printf("Decision Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_decision,stop_decision));
+
+    // Every loop goes into the latency histograms
+    latency_hist_record_interval(&dma_hist, start_dma, stop_dma);
+    latency_hist_record_interval(&sensing_hist, start_sensing, stop_sensing);
+    latency_hist_record_interval(&decision_hist, start_decision, stop_decision);
 
     if (loop_prog == 1) {
       printf("Ctrl-C to end program after this loop\n");
@@ -485,42 +879,50 @@ int main (int argc, char **argv) {
     //}
 
 cleanup:
-    crash_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    // Timed out loops count too, so --loops always ends
+    num_loops++;
+    trace_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    TRACE(TRACE_TX_ENABLE, "TX Enable", 0);
     crash_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);                           // Disable TX
     threshold_exceeded = 0;
     threshold_exceeded_mag = 0.0;
     threshold_exceeded_index = 0;
-    fftwf_destroy_plan(p1);
-    sleep(1);
-  } while (loop_prog == 1);
-
-  float dma_time_avg = 0.0;
-  float sensing_time_avg = 0.0;
-  float decision_time_avg = 0.0;
-  if (num_loops > 30) {
-    for (i = 0; i < 30; i++) {
-      dma_time_avg += dma_time[i];
-      sensing_time_avg += sensing_time[i];
-      decision_time_avg += decision_time[i];
-    }
-    dma_time_avg = dma_time_avg/30;
-    sensing_time_avg = sensing_time_avg/30;
-    decision_time_avg = decision_time_avg/30;
-  } else {
-    for (i = 0; i < num_loops; i++) {
-      dma_time_avg += dma_time[i];
-      sensing_time_avg += sensing_time[i];
-      decision_time_avg += decision_time[i];
+    clock_gettime(CLOCK_MONOTONIC, &loop_stop_ts);
+    latency_hist_record_timespec(&loop_hist, &loop_start_ts, &loop_stop_ts);
+    // --loops runs back to back, so the loop rate and CPU use are not diluted by the pause
+    if (max_loops == 0) {
+      sleep(1);
     }
-    dma_time_avg = dma_time_avg/num_loops;
-    sensing_time_avg = sensing_time_avg/num_loops;
-    decision_time_avg = decision_time_avg/num_loops;
-  }
+  } while (loop_prog == 1 && (max_loops == 0 || num_loops < max_loops));
+
   printf("Number of loops: %d\n",num_loops);
-  printf("Average DMA time (us): %f\n",dma_time_avg);
-  printf("Average Sensing time (us): %f\n",sensing_time_avg);
-  printf("Average Decision time (us): %f\n",decision_time_avg);
+  if (num_timeouts > 0) {
+    printf("Number of timeouts: %d\n",num_timeouts);
+  }
+  latency_hist_print(&dma_hist);
+  latency_hist_print(&sensing_hist);
+  latency_hist_print(&decision_hist);
+  latency_hist_print(&loop_hist);
+  if (latency_file != NULL) {
+    latency_hist_export(latency_file, hists, num_hists);
+  }
+  if (trace_file != NULL) {
+    trace_print_stats();
+    trace_dump();
+    trace_free();
+  }
 
+  if (num_avg > 0) {
+    welch_free(&welch);
+  }
+  if (mask_file != NULL) {
+    spectral_mask_free(&mask);
+  }
+  if (format == SAMPLE_FORMAT_Q15) {
+    fft_q15_free(&q15);
+  }
+  fft_plan_cache_cleanup();
+  fftwf_free(out);
   crash_close(usrp_intf_tx);
   crash_close(usrp_intf_rx);
   return 0;
@@ -17,11 +17,54 @@
 **  File:         arm-spectrum-sense.c
 **  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
 **  Description:  Performs both Spectrum Sensing and the Spectrum Decision. Uses the FFTW3
-**                library of FFT kernels to speed up FFT computation.
+**                library of FFT kernels to speed up FFT computation. FFTW plans are
+**                made once with FFTW_MEASURE (--patient for FFTW_PATIENT) and the
+**                wisdom is saved to a file (--wisdom) so later runs skip planning.
+**
+**                --ring N runs the spectrum decision loop on a ring of N DMA buffers
+**                so the next frame transfers while the current one is transformed
+**                and thresholded. Frame rate and dropped frames are reported.
+**
+**                --two-core splits the spectrum decision loop across both cores: one
+**                thread captures frames off the DMA ring and the other runs the FFT
+**                and threshold. Uses --ring buffers (default 8).
+**
+**                --average N switches the spectrum decision to a Welch averaged PSD
+**                of N windowed, overlapping FFT segments (--window hann|blackman,
+**                --overlap 50|75) to cut down on false alarms. Frame rate and
+**                detection latency are reported.
+**
+**                --mask file restricts the decision to the bins listed in a spectral
+**                mask file (see spectral-mask.h), so only the channels we might
+**                transmit on are checked.
+**
+**                --engine fft|goertzel|sdft|auto selects how the masked bins are
+**                sensed. Goertzel tracks each bin directly instead of running the
+**                full FFT, the sliding DFT (sdft) updates the bins every sample so
+**                the decision is made as soon as the channels clear rather than at
+**                the end of a frame. auto (default) picks FFT or Goertzel from the
+**                number of masked bins and the FFT size.
+**
+**                --format q15 receives packed 16-bit I/Q samples instead of complex
+**                floats (see sample-format.h), halving the DMA time per frame, and
+**                runs a Q15 FFT / threshold with NEON int16 arithmetic. Not
+**                available with --average or --mask.
 **
 **                Spectrum decision is simple: If all FFT bins are below
 **                the threshold -> transmit.
 **
+**                Stage times of every loop go into latency histograms (see
+**                latency-hist.h), reported as p50 / p99 / p99.9 / max at exit.
+**                --latency file also writes them out, JSON for a .json name,
+**                otherwise CSV.
+**
+**                --loops N runs N loops back to back (no 1 second pause) and exits,
+**                for benchmarking (see crash-bench).
+**
+**                --trace file records the DMA, FFT, decision and TX enable of every
+**                frame on each thread and writes them out as a Chrome trace (see
+**                trace.h).
+**
 **                Lab setup for this program
 **                  Run GNU Radio Companion program that has both a USRP Source and Sink.
 **                  USRP Source should be tuned to 130MHz with +30 gain, USRP Sink 75MHz with 0 gain.
@@ -53,21 +96,102 @@
 #include <fftw3.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "fft-plan-cache.h"
+#include "frame-ring.h"
+#include "pipeline.h"
+#include "welch.h"
+#include "spectral-mask.h"
+#include "channel-bank.h"
+#include "sample-format.h"
+#include "fft-q15.h"
+#include "crash-wait.h"
+#include "latency-hist.h"
+#include "trace.h"
+
+#define TWO_CORE_DEFAULT_BUFFS 8
 
 // Global variable used to kill final loop
 int loop_prog = 0;
 
+// State shared with the compute thread in two core mode
+struct sensing_ctx {
+  fftwf_plan plan;
+  fftwf_complex *out;
+  uint number_samples;
+  float threshold;
+  struct welch *welch;             // NULL when not averaging
+  struct spectral_mask *mask;     // NULL to check every bin
+  struct channel_bank *bank;      // NULL when using the FFT
+  struct fft_q15 *q15;            // NULL for float samples
+  struct crash_plblock *usrp_intf_tx;
+};
+
+// Cleared by Ctrl-C. loop_prog is 0 for a single run, so it cannot tell the two core
+// pipeline to stop.
+int pipeline_prog = 1;
+
 void ctrl_c(int dummy)
 {
     loop_prog = 0;
+    pipeline_prog = 0;
     return;
 }
 
+// Compute side of the two core pipeline. Stops the pipeline once TX is enabled.
+int sensing_compute(void *buff, uint64_t seq, void *arg)
+{
+  struct sensing_ctx *ctx = (struct sensing_ctx *)arg;
+  float *fft_out = (float *)ctx->out;
+  float fft_mag;
+  uint32_t start_welch;
+  int i;
+
+  if (ctx->welch != NULL) {
+    start_welch = crash_read_reg(ctx->usrp_intf_tx->regs,DMA_DEBUG_CNT);
+    i = welch_push_frame(ctx->welch, (fftwf_complex *)buff, seq, ctx->threshold, NULL);
+    ctx->welch->compute_cycles += dma_debug_cnt_delta(start_welch,crash_read_reg(ctx->usrp_intf_tx->regs,DMA_DEBUG_CNT));
+    // Keep going until a complete PSD is below the threshold
+    if (i != -1) {
+      return 0;
+    }
+  } else if (ctx->bank != NULL) {
+    // Frames dropped by the pipeline leave a gap the sliding DFT cannot slide across
+    channel_bank_resync(ctx->bank, seq);
+    if (channel_bank_detect(ctx->bank, (float *)buff, ctx->threshold, CHANNEL_BANK_UNTIL_CLEAR, NULL) != -1) {
+      return 0;
+    }
+  } else if (ctx->q15 != NULL) {
+    fft_q15_execute(ctx->q15, (int16_t *)buff);
+    if (fft_q15_threshold(ctx->q15, ctx->threshold, NULL) != -1) {
+      return 0;
+    }
+  } else {
+    fft_plan_cache_execute(ctx->plan, (fftwf_complex *)buff, ctx->out);
+    if (ctx->mask != NULL && spectral_mask_complex(ctx->mask, fft_out, ctx->threshold, NULL) != -1) {
+      return 0;
+    }
+    for (i = 0; i < ctx->number_samples && ctx->mask == NULL; i++) {
+      // Calculate sqrt(I^2 + Q^2)
+      fft_mag = sqrt(fft_out[2*i]*fft_out[2*i] + fft_out[2*i+1]*fft_out[2*i+1]);
+      if (fft_mag > ctx->threshold) {
+        return 0;
+      }
+    }
+  }
+  // Enable TX
+  TRACE(TRACE_DECISION, "Decision", 0);
+  TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
+  crash_set_bit(ctx->usrp_intf_tx->regs,USRP_TX_ENABLE);
+  return 1;
+}
+
 int main (int argc, char **argv) {
   int c = 0;
   int i = 0;
   int j = 0;
   uint num_loops = 0;
+  uint num_timeouts = 0;
+  uint max_loops = 0;
   bool interrupt_flag = false;
   uint number_samples = 0;
   uint decim_rate = 0;
@@ -81,20 +205,51 @@ int main (int argc, char **argv) {
   uint32_t stop_decision;
   uint32_t start_sensing;
   uint32_t stop_sensing;
-  uint32_t start_overhead;
-  uint32_t stop_overhead;
+  uint32_t overhead;
+  char *latency_file = NULL;
+  char *trace_file = NULL;
+  struct latency_hist *hists[4];
+  uint num_hists = 0;
   uint32_t start_dma;
   uint32_t stop_dma;
-  float dma_time[30];
-  float sensing_time[30];
-  float decision_time[30];
+  struct latency_hist dma_hist;
+  struct latency_hist sensing_hist;
+  struct latency_hist decision_hist;
+  struct latency_hist loop_hist;
+  struct timespec loop_start_ts;
+  struct timespec loop_stop_ts;
   float* fft_out_real;
   float* fft_out_imag;
   float fft_mag;
   uint32_t decisions[4096];
   fftwf_complex *in1;
-  fftwf_complex out[8192];  // Must be 2x max FFT size
+  fftwf_complex *rx_buff;
+  fftwf_complex *out;
   fftwf_plan p1;
+  char *wisdom_file = NULL;
+  unsigned planner_flags = FFTW_MEASURE;
+  uint ring_buffs = 0;
+  struct frame_ring ring;
+  bool two_core = false;
+  struct pipeline pipe;
+  struct sensing_ctx ctx;
+  uint num_avg = 0;
+  int window_type = WELCH_WINDOW_HANN;
+  uint overlap = 50;
+  struct welch welch;
+  int welch_decision;
+  uint32_t start_welch;
+  struct timespec start_loop;
+  struct timespec stop_loop;
+  char *mask_file = NULL;
+  struct spectral_mask mask;
+  int engine = CHANNEL_BANK_AUTO;
+  struct channel_bank bank;
+  int format = SAMPLE_FORMAT_FLOAT;
+  uint rx_format = SAMPLE_FORMAT_FLOAT;
+  uint number_words = 0;
+  uint samples_per_word = 1;
+  struct fft_q15 q15;
   struct crash_plblock *usrp_intf_tx;
   struct crash_plblock *usrp_intf_rx;
 
@@ -105,15 +260,28 @@ int main (int argc, char **argv) {
          We distinguish them by their indices. */
       {"interrupt",   no_argument,       0, 'i'},
       {"loop prog",   no_argument,       0, 'l'},
+      {"loops",       required_argument, 0, 'N'},
       {"decim",       required_argument, 0, 'd'},
       {"fft size",    required_argument, 0, 'k'},
       {"threshold",   required_argument, 0, 't'},
+      {"wisdom",      required_argument, 0, 'w'},
+      {"patient",     no_argument,       0, 'p'},
+      {"ring",        required_argument, 0, 'r'},
+      {"two-core",    no_argument,       0, 'c'},
+      {"average",     required_argument, 0, 'a'},
+      {"window",      required_argument, 0, 'n'},
+      {"overlap",     required_argument, 0, 'o'},
+      {"mask",        required_argument, 0, 'M'},
+      {"latency",     required_argument, 0, 'L'},
+      {"trace",       required_argument, 0, 'T'},
+      {"engine",      required_argument, 0, 'e'},
+      {"format",      required_argument, 0, 'f'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "ild:k:t:",
+    c = getopt_long (argc, argv, "ilN:d:k:t:w:pr:ca:n:o:M:e:L:T:f:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -125,6 +293,10 @@ int main (int argc, char **argv) {
       case 'l':
         loop_prog = 1;
         break;
+      case 'N':
+        max_loops = atoi(optarg);
+        loop_prog = 1;
+        break;
       case 'd':
         decim_rate = atoi(optarg);
         break;
@@ -134,6 +306,46 @@ int main (int argc, char **argv) {
       case 't':
         threshold = atof(optarg);
         break;
+      case 'w':
+        wisdom_file = optarg;
+        break;
+      case 'p':
+        planner_flags = FFTW_PATIENT;
+        break;
+      case 'r':
+        ring_buffs = atoi(optarg);
+        break;
+      case 'c':
+        two_core = true;
+        break;
+      case 'a':
+        num_avg = atoi(optarg);
+        break;
+      case 'n':
+        window_type = welch_window_lookup(optarg);
+        break;
+      case 'o':
+        overlap = atoi(optarg);
+        break;
+      case 'M':
+        mask_file = optarg;
+        break;
+      case 'L':
+        latency_file = optarg;
+        break;
+      case 'T':
+        trace_file = optarg;
+        break;
+      case 'e':
+        engine = channel_bank_engine_lookup(optarg);
+        if (engine < 0) {
+          printf("ERROR: Invalid engine, must be fft, goertzel, sdft or auto\n");
+          return -1;
+        }
+        break;
+      case 'f':
+        format = sample_format_lookup(optarg);
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -177,8 +389,72 @@ int main (int argc, char **argv) {
     threshold = 1.0;
   }
 
+  if (ring_buffs > 0 && ring_buffs < FRAME_RING_MIN_BUFFS) {
+    printf("ERROR: Ring needs at least %d buffers\n",FRAME_RING_MIN_BUFFS);
+    return -1;
+  }
+
+  if (two_core == true) {
+    if (ring_buffs == 0) {
+      printf("INFO: Ring size not specified, defaulting to %d buffers\n",TWO_CORE_DEFAULT_BUFFS);
+      ring_buffs = TWO_CORE_DEFAULT_BUFFS;
+    }
+    if (ring_buffs < PIPELINE_MIN_BUFFS) {
+      printf("ERROR: Two core mode needs at least %d buffers\n",PIPELINE_MIN_BUFFS);
+      return -1;
+    }
+  }
+
+  if (window_type < 0) {
+    printf("ERROR: Invalid window, must be hann or blackman\n");
+    return -1;
+  }
+
+  if (overlap != 50 && overlap != 75) {
+    printf("ERROR: Overlap must be 50 or 75 percent\n");
+    return -1;
+  }
+
+  if (mask_file != NULL && num_avg > 0) {
+    printf("ERROR: Spectral mask cannot be used with Welch averaging\n");
+    return -1;
+  }
+
+  if (format < 0) {
+    printf("ERROR: Invalid sample format, must be float or q15\n");
+    return -1;
+  }
+
+  if (format == SAMPLE_FORMAT_Q15 && (num_avg > 0 || mask_file != NULL)) {
+    printf("ERROR: Q15 samples cannot be used with Welch averaging or a spectral mask\n");
+    return -1;
+  }
+
   number_samples = (uint)pow(2.0,(double)fft_size);
 
+  if (mask_file != NULL) {
+    if (spectral_mask_load(&mask, mask_file, number_samples) != 0) {
+      return -1;
+    }
+    spectral_mask_print(&mask);
+  }
+
+  if (engine == CHANNEL_BANK_AUTO) {
+    engine = (mask_file != NULL) ? channel_bank_auto_engine(mask.num_bins, number_samples) : CHANNEL_BANK_FFT;
+  }
+  if (engine != CHANNEL_BANK_FFT) {
+    if (mask_file == NULL) {
+      printf("ERROR: The %s engine needs a spectral mask\n",channel_bank_engine_names[engine]);
+      return -1;
+    }
+    if (channel_bank_init(&bank, engine, &mask) != 0) {
+      spectral_mask_free(&mask);
+      return -1;
+    }
+  }
+  printf("INFO: Sensing engine: %s\n",channel_bank_engine_names[engine]);
+  printf("INFO: Sample format: %s\n",sample_format_names[format]);
+
   // Set Ctrl-C handler
   signal(SIGINT, ctrl_c);
 
@@ -204,18 +480,77 @@ int main (int argc, char **argv) {
     return -1;
   }
 
-  in1 = (fftw_complex *)(usrp_intf_rx->dma_buff);
+  // Every loop starts with crash_reset(), so the trace uses CLOCK_MONOTONIC_RAW
+  if (trace_file != NULL && trace_init(trace_file, "arm-spectrum-sensing", NULL) != 0) {
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    return -1;
+  }
+
+  in1 = (fftwf_complex *)(usrp_intf_rx->dma_buff);
+  out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+
+  // Setup FFTW3. The plan is made once and reused for every loop. Planning overwrites
+  // in1 and out, which is fine as neither holds data yet.
+  if (fft_plan_cache_init(wisdom_file, planner_flags) == 1) {
+    printf("INFO: Imported FFTW wisdom\n");
+  }
+  p1 = fft_plan_cache_get(number_samples, in1, out);
+  if (p1 == NULL) {
+    fftwf_free(out);
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    return -1;
+  }
   fft_out_real = (float *)(&out[0][0]);
   fft_out_imag = (float *)(&out[0][1]);
 
-  start_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  stop_overhead = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-  printf("Overhead (us): %f\n",(1e6/150e6)*(stop_overhead - start_overhead));
+  ctx.plan = p1;
+  ctx.out = out;
+  ctx.number_samples = number_samples;
+  ctx.threshold = threshold;
+  ctx.usrp_intf_tx = usrp_intf_tx;
+  ctx.welch = NULL;
+  ctx.mask = (mask_file != NULL) ? &mask : NULL;
+  ctx.bank = (engine != CHANNEL_BANK_FFT) ? &bank : NULL;
+  ctx.q15 = NULL;
+
+  if (format == SAMPLE_FORMAT_Q15) {
+    if (fft_q15_init(&q15, number_samples) != 0) {
+      fft_plan_cache_cleanup();
+      fftwf_free(out);
+      crash_close(usrp_intf_tx);
+      crash_close(usrp_intf_rx);
+      return -1;
+    }
+  }
 
-  do {
-    // Setup FFTW3
-    p1 = fftwf_plan_dft_1d(fft_size, in1, out, FFTW_FORWARD, FFTW_ESTIMATE);
+  if (num_avg > 0) {
+    if (welch_init(&welch, number_samples, window_type, overlap, num_avg) != 0) {
+      fft_plan_cache_cleanup();
+      fftwf_free(out);
+      crash_close(usrp_intf_tx);
+      crash_close(usrp_intf_rx);
+      return -1;
+    }
+    ctx.welch = &welch;
+  }
+
+  // Cost of the counter reads around each timed stage, subtracted from every sample
+  overhead = latency_read_overhead(usrp_intf_tx);
+  printf("Overhead (us): %f\n",(1e6/150e6)*overhead);
+  latency_hist_init(&dma_hist, "DMA Time", overhead);
+  hists[num_hists++] = &dma_hist;
+  latency_hist_init(&sensing_hist, "Sensing Time", overhead);
+  hists[num_hists++] = &sensing_hist;
+  latency_hist_init(&decision_hist, "Decision Time", overhead);
+  hists[num_hists++] = &decision_hist;
+  // Whole loop, the measured decision rate in crash-bench
+  latency_hist_init(&loop_hist, "Loop Time", 0);
+  hists[num_hists++] = &loop_hist;
 
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &loop_start_ts);
     // Global Reset to get us to a clean slate
     crash_reset(usrp_intf_tx);
 
@@ -225,34 +560,37 @@ int main (int argc, char **argv) {
     // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
     // as the next steps recalibrate the interface and are ignored if issued while it is
     // currently calibrating.
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set RX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_RX_RESET_CAL);
     //printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set TX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
     //printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set USRP TX / RX Modes
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
     // Setup RX path
     crash_set_bit(usrp_intf_tx->regs, USRP_RX_FIFO_BYPASS);                       // Bypass RX FIFO so stale data in the FIFO does not cause latency
     crash_write_reg(usrp_intf_tx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to spec_sense
-    crash_write_reg(usrp_intf_tx->regs, USRP_RX_PACKET_SIZE, number_samples);     // Set packet size
-    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_FIX2FLOAT_BYPASS);                // Do not bypass fix2float
+    rx_format = sample_format_set(usrp_intf_tx, format);                          // Float or packed Q15 samples
+    samples_per_word = sample_format_samples_per_word(rx_format);
+    number_words = number_samples/samples_per_word;
+    ctx.q15 = (rx_format == SAMPLE_FORMAT_Q15) ? &q15 : NULL;
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_PACKET_SIZE, number_words);       // Set packet size
     if (decim_rate == 1) {
       crash_set_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                      // Bypass CIC Filter
       crash_set_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                       // Bypass HB Filter
@@ -298,15 +636,44 @@ int main (int argc, char **argv) {
     // Load waveform into TX FIFO so it can immediately trigger
     crash_write(usrp_intf_tx, USRP_INTF_PLBLOCK_ID, number_samples);
 
-    crash_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
+    trace_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
 
     // First, loop until threshold is exceeded
     j = 0;
     while (threshold_exceeded == 0) {
-      crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
+      trace_crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
+      if (engine != CHANNEL_BANK_FFT) {
+        // Reads are a second apart, so do not slide the DFT across them
+        channel_bank_reset(&bank);
+        threshold_exceeded_index = channel_bank_detect(&bank, (float *)in1, threshold,
+                                                       CHANNEL_BANK_UNTIL_BUSY, &threshold_exceeded_mag);
+        if (threshold_exceeded_index >= 0) {
+          threshold_exceeded = 1;
+        } else {
+          threshold_exceeded_index = 0;
+        }
+      }
       // Run FFT
-      fftwf_execute(p1);
-      for (i = 0; i < number_samples; i++) {
+      if (rx_format == SAMPLE_FORMAT_Q15) {
+        fft_q15_execute(&q15, (int16_t *)in1);
+        threshold_exceeded_index = fft_q15_threshold(&q15, threshold, &threshold_exceeded_mag);
+        if (threshold_exceeded_index >= 0) {
+          threshold_exceeded = 1;
+        } else {
+          threshold_exceeded_index = 0;
+        }
+      } else if (engine == CHANNEL_BANK_FFT) {
+        fft_plan_cache_execute(p1, in1, out);
+      }
+      if (mask_file != NULL && engine == CHANNEL_BANK_FFT) {
+        threshold_exceeded_index = spectral_mask_complex(&mask, fft_out_real, threshold, &threshold_exceeded_mag);
+        if (threshold_exceeded_index >= 0) {
+          threshold_exceeded = 1;
+        } else {
+          threshold_exceeded_index = 0;
+        }
+      }
+      for (i = 0; i < number_samples && mask_file == NULL && rx_format == SAMPLE_FORMAT_FLOAT; i++) {
         // Calculate sqrt(I^2 + Q^2)
         fft_mag = sqrt(fft_out_real[i]*fft_out_real[i] + fft_out_imag[i]*fft_out_imag[i]);
         if (fft_mag > threshold) {
@@ -318,8 +685,10 @@ int main (int argc, char **argv) {
           break;
         }
       }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (j > 10) {
         printf("TIMEOUT: Threshold never exceeded\n");
+        num_timeouts++;
         goto cleanup;
       }
       j++;
@@ -327,43 +696,150 @@ int main (int argc, char **argv) {
     }
 
     // Second, perform specturm sensing and the spectrum decision
+    if (num_avg > 0) {
+      welch_reset(&welch);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_loop);
+    if (two_core == true) {
+      // Packed frames are fewer words, scale the decimation so the expected frame rate
+      // used for the drop counter stays the same
+      if (pipeline_start(&pipe, usrp_intf_rx, USRP_INTF_PLBLOCK_ID, ring_buffs, number_words,
+                         decim_rate*samples_per_word, sensing_compute, &ctx) != 0) {
+        goto cleanup;
+      }
+      pipeline_wait(&pipe, &pipeline_prog);
+      pipeline_stop(&pipe);
+      pipeline_print_stats(&pipe);
+      threshold_exceeded = 0;
+    } else if (ring_buffs > 0) {
+      if (frame_ring_start(&ring, usrp_intf_rx, USRP_INTF_PLBLOCK_ID, ring_buffs, number_words,
+                           decim_rate*samples_per_word) != 0) {
+        goto cleanup;
+      }
+    }
     while (threshold_exceeded == 1) {
       threshold_exceeded = 0;
-      crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
-      // Run FFT
-      fftwf_execute(p1);
-      for (i = 0; i < number_samples; i++) {
-        // Calculate sqrt(I^2 + Q^2)
-        fft_mag = sqrt(fft_out_real[i]*fft_out_real[i] + fft_out_imag[i]*fft_out_imag[i]);
-        // Was the threshold exceeded?
-        if (fft_mag > threshold) {
+      if (ring_buffs > 0) {
+        // The DMA keeps filling the next buffers in the ring while we work on this one.
+        // Ring buffers are a multiple of 16 bytes apart, so they have the same alignment
+        // as in1 and the cached plan can run on them directly.
+        rx_buff = (fftwf_complex *)frame_ring_next(&ring);
+        if (rx_buff == NULL) {
+          frame_ring_stop(&ring);
+          printf("TIMEOUT: No frames from DMA ring\n");
+          num_timeouts++;
+          goto cleanup;
+        }
+      } else {
+        trace_crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
+        rx_buff = in1;
+      }
+      if (num_avg > 0) {
+        start_welch = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
+        // Only ring frames with consecutive seq are contiguous
+        welch_decision = welch_push_frame(&welch, rx_buff, (ring_buffs > 0) ? ring.seq : WELCH_NO_SEQ,
+                                          threshold, NULL);
+        welch.compute_cycles += dma_debug_cnt_delta(start_welch,crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT));
+        // Keep going until a complete PSD is below the threshold
+        if (welch_decision != -1) {
+          threshold_exceeded = 1;
+        }
+      } else if (rx_format == SAMPLE_FORMAT_Q15) {
+        fft_q15_execute(&q15, (int16_t *)rx_buff);
+        if (fft_q15_threshold(&q15, threshold, NULL) != -1) {
           // Do not break loop
           threshold_exceeded = 1;
-          break;
+        }
+      } else if (engine != CHANNEL_BANK_FFT) {
+        // Only ring frames with consecutive seq are contiguous. This also resets the
+        // window left over from the detection phase.
+        if (ring_buffs > 0) {
+          channel_bank_resync(&bank, ring.seq);
+        } else {
+          channel_bank_reset(&bank);
+        }
+        // The sliding DFT returns as soon as the channels clear, without waiting for the
+        // rest of the frame
+        if (channel_bank_detect(&bank, (float *)rx_buff, threshold, CHANNEL_BANK_UNTIL_CLEAR, NULL) != -1) {
+          // Do not break loop
+          threshold_exceeded = 1;
+        }
+      } else {
+        // Run FFT
+        fft_plan_cache_execute(p1, rx_buff, out);
+        if (mask_file != NULL && spectral_mask_complex(&mask, fft_out_real, threshold, NULL) != -1) {
+          // Do not break loop
+          threshold_exceeded = 1;
+        }
+        for (i = 0; i < number_samples && mask_file == NULL; i++) {
+          // Calculate sqrt(I^2 + Q^2)
+          fft_mag = sqrt(fft_out_real[i]*fft_out_real[i] + fft_out_imag[i]*fft_out_imag[i]);
+          // Was the threshold exceeded?
+          if (fft_mag > threshold) {
+            // Do not break loop
+            threshold_exceeded = 1;
+            break;
+          }
         }
       }
+      TRACE(TRACE_DECISION, "Decision", threshold_exceeded);
       if (threshold_exceeded == 0) {
         // Enable TX
+        TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
         crash_set_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);
       }
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &stop_loop);
+
+    if (two_core == false && ring_buffs > 0) {
+      frame_ring_stop(&ring);
+      frame_ring_print_stats(&ring);
+    }
+    if (num_avg > 0) {
+      welch_print_stats(&welch, (stop_loop.tv_sec - start_loop.tv_sec) +
+                        (stop_loop.tv_nsec - start_loop.tv_nsec)/1e9, decim_rate);
+    }
+    if (engine == CHANNEL_BANK_SDFT) {
+      printf("SDFT Decision Sample:\t\t%d of %d\n",bank.decision_sample,number_samples);
+      printf("SDFT Time Saved (us):\t\t%f\n",(number_samples - 1 - bank.decision_sample)*decim_rate/100.0);
+    }
+
     // Calculate how long the DMA and the thresholding took by using a counter in the FPGA
     // running at 150 MHz.
     start_dma = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
+    crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_words);
     stop_dma = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
 
+    if (engine != CHANNEL_BANK_FFT) {
+      channel_bank_reset(&bank);
+    }
     start_sensing = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    fftwf_execute(p1);
-    for (i = 0; i < number_samples; i++) {
+    if (rx_format == SAMPLE_FORMAT_Q15) {
+      // The Q15 threshold runs over every bin, so it is timed with the FFT
+      fft_q15_execute(&q15, (int16_t *)in1);
+      fft_q15_threshold(&q15, 1000000000.0, NULL);
+    } else if (engine != CHANNEL_BANK_FFT) {
+      // Huge threshold so the whole frame is processed
+      channel_bank_detect(&bank, (float *)in1, 1000000000.0, CHANNEL_BANK_UNTIL_BUSY, NULL);
+    } else {
+      fft_plan_cache_execute(p1, in1, out);
+    }
+    for (i = 0; i < number_samples && engine == CHANNEL_BANK_FFT && rx_format == SAMPLE_FORMAT_FLOAT; i++) {
       fft_mag = sqrt(fft_out_real[i]*fft_out_real[i] + fft_out_imag[i]*fft_out_imag[i]);
       decisions[i] = (fft_mag > 100000000.0);
     }
     stop_sensing = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
 
     start_decision = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
-    for (i = 0; i < number_samples; i++) {
+    // The channel bank engines decide as they sense, so there is no separate decision
+    if (mask_file != NULL && engine == CHANNEL_BANK_FFT) {
+      // Masked decision runs straight on the FFT output
+      if (spectral_mask_complex(&mask, fft_out_real, 1000000000.0, NULL) != -1) {
+        printf("This shouldn't happen\n");
+      }
+    }
+    for (i = 0; i < number_samples && mask_file == NULL && rx_format == SAMPLE_FORMAT_FLOAT; i++) {
         if (decisions[i] == 1) {
         printf("This shouldn't happen\n");
       }
@@ -374,17 +850,14 @@ int main (int argc, char **argv) {
     printf("Threshold:\t\t\t%f\n",threshold);
     printf("Threshold Exceeded Index:\t%d\n",threshold_exceeded_index);
     printf("Threshold Exceeded Mag:\t\t%f\n",threshold_exceeded_mag);
-    printf("DMA Time (us): %f\n",(1e6/150e6)*(stop_dma - start_dma));
-    printf("Sensing Time (us): %f\n",(1e6/150e6)*(stop_sensing - start_sensing));
-    printf("Decision Time (us): %f\n",(1e6/150e6)*(stop_decision - start_decision));
-
-    // Keep track of times so we can report an average at the end
-    if (num_loops < 30) {
-      dma_time[num_loops] = (1e6/150e6)*(stop_dma - start_dma);
-      sensing_time[num_loops] = (1e6/150e6)*(stop_sensing - start_sensing);
-      decision_time[num_loops] = (1e6/150e6)*(stop_decision - start_decision);
-    }
-    num_loops++;
+    printf("DMA Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_dma,stop_dma));
+    printf("Sensing Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_sensing,stop_sensing));
+    printf("Decision Time (us): %f\n",(1e6/150e6)*dma_debug_cnt_delta(start_decision,stop_decision));
+
+    // Every loop goes into the latency histograms
+    latency_hist_record_interval(&dma_hist, start_dma, stop_dma);
+    latency_hist_record_interval(&sensing_hist, start_sensing, stop_sensing);
+    latency_hist_record_interval(&decision_hist, start_decision, stop_decision);
 
     if (loop_prog == 1) {
       printf("Ctrl-C to end program after this loop\n");
@@ -398,42 +871,53 @@ int main (int argc, char **argv) {
     //}
 
 cleanup:
-    crash_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    // Timed out loops count too, so --loops always ends
+    num_loops++;
+    trace_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    TRACE(TRACE_TX_ENABLE, "TX Enable", 0);
     crash_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);                           // Disable TX
     threshold_exceeded = 0;
     threshold_exceeded_mag = 0.0;
     threshold_exceeded_index = 0;
-    fftwf_destroy_plan(p1);
-    sleep(1);
-  } while (loop_prog == 1);
-
-  float dma_time_avg = 0.0;
-  float sensing_time_avg = 0.0;
-  float decision_time_avg = 0.0;
-  if (num_loops > 30) {
-    for (i = 0; i < 30; i++) {
-      dma_time_avg += dma_time[i];
-      sensing_time_avg += sensing_time[i];
-      decision_time_avg += decision_time[i];
-    }
-    dma_time_avg = dma_time_avg/30;
-    sensing_time_avg = sensing_time_avg/30;
-    decision_time_avg = decision_time_avg/30;
-  } else {
-    for (i = 0; i < num_loops; i++) {
-      dma_time_avg += dma_time[i];
-      sensing_time_avg += sensing_time[i];
-      decision_time_avg += decision_time[i];
+    clock_gettime(CLOCK_MONOTONIC, &loop_stop_ts);
+    latency_hist_record_timespec(&loop_hist, &loop_start_ts, &loop_stop_ts);
+    // --loops runs back to back, so the loop rate and CPU use are not diluted by the pause
+    if (max_loops == 0) {
+      sleep(1);
     }
-    dma_time_avg = dma_time_avg/num_loops;
-    sensing_time_avg = sensing_time_avg/num_loops;
-    decision_time_avg = decision_time_avg/num_loops;
-  }
+  } while (loop_prog == 1 && (max_loops == 0 || num_loops < max_loops));
+
   printf("Number of loops: %d\n",num_loops);
-  printf("Average DMA time (us): %f\n",dma_time_avg);
-  printf("Average Sensing time (us): %f\n",sensing_time_avg);
-  printf("Average Decision time (us): %f\n",decision_time_avg);
+  if (num_timeouts > 0) {
+    printf("Number of timeouts: %d\n",num_timeouts);
+  }
+  latency_hist_print(&dma_hist);
+  latency_hist_print(&sensing_hist);
+  latency_hist_print(&decision_hist);
+  latency_hist_print(&loop_hist);
+  if (latency_file != NULL) {
+    latency_hist_export(latency_file, hists, num_hists);
+  }
+  if (trace_file != NULL) {
+    trace_print_stats();
+    trace_dump();
+    trace_free();
+  }
 
+  if (num_avg > 0) {
+    welch_free(&welch);
+  }
+  if (engine != CHANNEL_BANK_FFT) {
+    channel_bank_free(&bank);
+  }
+  if (mask_file != NULL) {
+    spectral_mask_free(&mask);
+  }
+  if (format == SAMPLE_FORMAT_Q15) {
+    fft_q15_free(&q15);
+  }
+  fft_plan_cache_cleanup();
+  fftwf_free(out);
   crash_close(usrp_intf_tx);
   crash_close(usrp_intf_rx);
   return 0;
@@ -0,0 +1,297 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         cache-policy-bench.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Compare DMA buffer cache policies (see dma-cache.h). For each
+**                policy this measures:
+**                  - CPU read throughput of the RX DMA buffer
+**                  - FFT rate with the RX DMA buffer as the FFTW input
+**                  - DMA throughput, MM2S from the TX DMA buffer looped back
+**                    through the AXI-Stream crossbar (tdest DMA_PLBLOCK_ID)
+**                    into S2MM on the RX DMA buffer
+**                The CPU measurements are repeated on malloc() memory as a
+**                cached reference.
+**
+**                Only the PL side of the transfer is switched by the policy, the
+**                CPU mapping of the DMA buffers is whatever the kernel module set
+**                up. Coherent reads by the CPU are only faster if that mapping is
+**                cacheable. This tool shows what the running system does.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <fftw3.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "crash-wait.h"
+#include "dma-queue.h"
+#include "dma-cache.h"
+#include "dma-debug-cnt.h"
+
+#define DMA_BATCH                 32
+
+static double now_sec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Best read throughput over runs passes, in MB/s
+double bench_read(const float *buff, uint number_samples, uint runs)
+{
+  volatile float sink;
+  double best = 1e30;
+  double start;
+  double t;
+  float sum;
+  uint run;
+  uint i;
+
+  for (run = 0; run < runs; run++) {
+    start = now_sec();
+    sum = 0.0;
+    for (i = 0; i < 2*number_samples; i += 4) {
+      sum += buff[i] + buff[i+1] + buff[i+2] + buff[i+3];
+    }
+    sink = sum;
+    t = now_sec() - start;
+    if (t < best) best = t;
+  }
+  (void)sink;
+  return 2*number_samples*sizeof(float)/best/1e6;
+}
+
+// Best FFT time over runs, in microseconds
+double bench_fft(fftwf_complex *in, fftwf_complex *out, uint number_samples, uint runs)
+{
+  fftwf_plan plan;
+  double best = 1e30;
+  double start;
+  double t;
+  uint run;
+
+  // FFTW_ESTIMATE does not touch in while planning
+  plan = fftwf_plan_dft_1d(number_samples, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+  for (run = 0; run < runs; run++) {
+    start = now_sec();
+    fftwf_execute(plan);
+    t = now_sec() - start;
+    if (t < best) best = t;
+  }
+  fftwf_destroy_plan(plan);
+  return best*1e6;
+}
+
+// DMA loopback throughput in MB/s, or -1 on timeout
+double bench_dma(struct crash_plblock *usrp_intf_tx, struct crash_plblock *usrp_intf_rx,
+                 uint number_samples, uint num_xfers)
+{
+  struct dma_queue mm2s;
+  struct dma_queue s2mm;
+  struct dma_desc mm2s_descs[DMA_BATCH];
+  struct dma_desc s2mm_descs[DMA_BATCH];
+  uint32_t start;
+  uint32_t stop;
+  uint sent = 0;
+  uint batch;
+  uint i;
+  int ret = 0;
+
+  for (i = 0; i < DMA_BATCH; i++) {
+    mm2s_descs[i].addr = usrp_intf_tx->dma_phys_addr;
+    mm2s_descs[i].bytes = number_samples*sizeof(uint64_t);
+    mm2s_descs[i].tdest = DMA_PLBLOCK_ID;
+    s2mm_descs[i].addr = usrp_intf_rx->dma_phys_addr;
+    s2mm_descs[i].bytes = number_samples*sizeof(uint64_t);
+    s2mm_descs[i].tdest = DMA_PLBLOCK_ID;
+  }
+  dma_queue_init(&s2mm, usrp_intf_rx, DMA_QUEUE_S2MM, false);
+  dma_queue_init(&mm2s, usrp_intf_tx, DMA_QUEUE_MM2S, false);
+
+  start = crash_read_reg(usrp_intf_rx->regs,DMA_DEBUG_CNT);
+  while (sent < num_xfers) {
+    batch = (num_xfers - sent > DMA_BATCH) ? DMA_BATCH : num_xfers - sent;
+    // S2MM first so the looped back stream never waits on a command
+    if (dma_queue_submit_all(&s2mm, s2mm_descs, batch, CRASH_WAIT_TIMEOUT_US) != 0 ||
+        dma_queue_submit_all(&mm2s, mm2s_descs, batch, CRASH_WAIT_TIMEOUT_US) != 0) {
+      ret = -1;
+      break;
+    }
+    sent += batch;
+  }
+  if (dma_queue_stop(&mm2s, CRASH_WAIT_TIMEOUT_US) != 0 || dma_queue_stop(&s2mm, CRASH_WAIT_TIMEOUT_US) != 0) {
+    ret = -1;
+  }
+  stop = crash_read_reg(usrp_intf_rx->regs,DMA_DEBUG_CNT);
+  if (ret != 0) {
+    return -1.0;
+  }
+  // DMA_DEBUG_CNT runs at 150 MHz
+  return (double)num_xfers*number_samples*sizeof(uint64_t)/(dma_debug_cnt_delta(start, stop)/150e6)/1e6;
+}
+
+int main (int argc, char **argv) {
+  int c;
+  uint i;
+  uint number_samples = 0;
+  uint runs = 0;
+  uint num_xfers = 0;
+  bool dma_flag = true;
+  int default_policy;
+  double read_mbs;
+  double fft_us;
+  double dma_mbs;
+  float *ref_buff;
+  fftwf_complex *out;
+  struct crash_plblock *usrp_intf_tx;
+  struct crash_plblock *usrp_intf_rx;
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"samples",     required_argument, 0, 'n'},
+      {"runs",        required_argument, 0, 'r'},
+      {"xfers",       required_argument, 0, 'x'},
+      {"no-dma",      no_argument,       0, 'N'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // 'n' is the short option, ':' means it requires an argument
+    c = getopt_long (argc, argv, "n:r:x:N",
+                     long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+
+    switch (c) {
+      case 'n':
+        number_samples = atoi(optarg);
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 'x':
+        num_xfers = atoi(optarg);
+        break;
+      case 'N':
+        dma_flag = false;
+        break;
+      case '?':
+        /* getopt_long already printed an error message. */
+        break;
+      default:
+        abort ();
+    }
+  }
+  /* Print any remaining command line arguments (not options). */
+  if (optind < argc)
+  {
+    printf ("Invalid options:\n");
+    while (optind < argc) {
+      printf ("\t%s\n", argv[optind++]);
+    }
+    return -1;
+  }
+
+  if (!dma_cache_supported()) {
+    printf("ERROR: crash-kmod.h does not name the DMA cache bits, cannot switch policies\n");
+    return -1;
+  }
+
+  // Check arguments
+  if (number_samples == 0) {
+    printf("INFO: Number of samples not specified, defaulting to 4096\n");
+    number_samples = 4096;
+  }
+
+  if (number_samples*sizeof(uint64_t) > DMA_QUEUE_MAX_BYTES) {
+    printf("ERROR: Number of samples too large\n");
+    return -1;
+  }
+
+  if (runs == 0) {
+    printf("INFO: Number of runs not specified, defaulting to 100\n");
+    runs = 100;
+  }
+
+  if (num_xfers == 0) {
+    printf("INFO: Number of DMA transfers not specified, defaulting to 1024\n");
+    num_xfers = 1024;
+  }
+
+  usrp_intf_tx = crash_open(USRP_INTF_PLBLOCK_ID,WRITE);
+  if (usrp_intf_tx == 0) {
+    printf("ERROR: Failed to allocate usrp_intf_tx plblock\n");
+    return -1;
+  }
+
+  usrp_intf_rx = crash_open(USRP_INTF_PLBLOCK_ID,READ);
+  if (usrp_intf_rx == 0) {
+    crash_close(usrp_intf_tx);
+    printf("ERROR: Failed to allocate usrp_intf_rx plblock\n");
+    return -1;
+  }
+
+  ref_buff = (float *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+  out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+  for (i = 0; i < 2*number_samples; i++) {
+    ref_buff[i] = (float)rand()/RAND_MAX - 0.5;
+  }
+
+  default_policy = dma_cache_get_policy(usrp_intf_rx);
+  printf("Default Policy:\t\t\t%s\n",(default_policy >= 0) ? dma_cache_policy_names[default_policy] : "other");
+  printf("Samples:\t\t\t%d\n",number_samples);
+  printf("\n%-16s%14s%14s%14s\n","Buffer","Read (MB/s)","FFT (us)","DMA (MB/s)");
+
+  read_mbs = bench_read(ref_buff, number_samples, runs);
+  fft_us = bench_fft((fftwf_complex *)ref_buff, out, number_samples, runs);
+  printf("%-16s%14.1f%14.2f%14s\n","malloc",read_mbs,fft_us,"-");
+
+  for (i = 0; i < NUM_DMA_CACHE_POLICIES; i++) {
+    dma_cache_set_policy(usrp_intf_rx, i);
+    // Move data through the buffers under this policy before the CPU reads them
+    dma_mbs = dma_flag ? bench_dma(usrp_intf_tx, usrp_intf_rx, number_samples, num_xfers) : 0.0;
+    read_mbs = bench_read((const float *)usrp_intf_rx->dma_buff, number_samples, runs);
+    fft_us = bench_fft((fftwf_complex *)usrp_intf_rx->dma_buff, out, number_samples, runs);
+    if (!dma_flag) {
+      printf("%-16s%14.1f%14.2f%14s\n",dma_cache_policy_names[i],read_mbs,fft_us,"-");
+    } else if (dma_mbs < 0.0) {
+      printf("%-16s%14.1f%14.2f%14s\n",dma_cache_policy_names[i],read_mbs,fft_us,"TIMEOUT");
+    } else {
+      printf("%-16s%14.1f%14.2f%14.1f\n",dma_cache_policy_names[i],read_mbs,fft_us,dma_mbs);
+    }
+  }
+
+  if (default_policy >= 0) {
+    dma_cache_set_policy(usrp_intf_rx, default_policy);
+  }
+
+  fftwf_free(ref_buff);
+  fftwf_free(out);
+  crash_close(usrp_intf_tx);
+  crash_close(usrp_intf_rx);
+  return 0;
+}
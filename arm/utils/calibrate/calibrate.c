@@ -37,6 +37,7 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "crash-wait.h"
 
 #define XFER_SIZE 1024
 
@@ -68,15 +69,15 @@ int main (int argc, char **argv) {
   //crash_set_bit(usrp_intf_tx->regs,DMA_MM2S_INTERRUPT);
 
   // Wait for USRP DDR interface to finish calibrating (due to reset).
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_TX_LOOPBACK_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   // Setup RX path
   crash_write_reg(usrp_intf_rx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to ps_pl_interface
@@ -107,13 +108,13 @@ int main (int argc, char **argv) {
     crash_write_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT,rx_phase);
     crash_set_bit(usrp_intf_rx->regs,USRP_RX_RESET_CAL);
     crash_clear_bit(usrp_intf_rx->regs,USRP_RX_RESET_CAL);
-    while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
     for (tx_phase = 180; tx_phase < 560; tx_phase += 10) {
       // Set TX phase
       crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,tx_phase);
       crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
       crash_clear_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
-      while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+      crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
       // Transmit & receive test pattern
       crash_write(usrp_intf_tx, USRP_INTF_PLBLOCK_ID, XFER_SIZE);
       crash_set_bit(usrp_intf_tx->regs, USRP_TX_ENABLE);                        // Enable TX
@@ -0,0 +1,268 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         cfar.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  CA-CFAR and OS-CFAR detectors. NEON versions of the gather and
+**                CA-CFAR compare loops are used when building for the Zynq,
+**                plain C versions otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cfar.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+const char *cfar_type_names[NUM_CFAR_TYPES] = {
+  "ca",
+  "os"
+};
+
+int cfar_type_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_CFAR_TYPES; i++) {
+    if (strcmp(name, cfar_type_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int cfar_init(struct cfar *cf, uint type, uint number_samples, uint guard, uint ref,
+              float alpha, uint os_rank)
+{
+  uint ext_len;
+
+  memset(cf, 0, sizeof(struct cfar));
+  if (type >= NUM_CFAR_TYPES) {
+    printf("ERROR: Invalid CFAR type\n");
+    return -1;
+  }
+  if (ref == 0) {
+    printf("ERROR: CFAR needs at least 1 reference bin\n");
+    return -1;
+  }
+  if (2*(guard + ref) >= number_samples) {
+    printf("ERROR: CFAR guard + reference bins must be less than half the FFT size\n");
+    return -1;
+  }
+  if (os_rank == 0) {
+    os_rank = (3*2*ref)/4;
+    if (os_rank == 0) os_rank = 1;
+  }
+  if (os_rank > 2*ref) {
+    printf("ERROR: OS-CFAR rank cannot be greater than %d\n",2*ref);
+    return -1;
+  }
+  cf->type = type;
+  cf->number_samples = number_samples;
+  cf->guard = guard;
+  cf->ref = ref;
+  cf->alpha = alpha;
+  cf->os_rank = os_rank;
+
+  ext_len = number_samples + 2*(guard + ref);
+  cf->ext = (float *)malloc(sizeof(float)*ext_len);
+  cf->prefix = (double *)malloc(sizeof(double)*(ext_len + 1));
+  cf->window = (float *)malloc(sizeof(float)*number_samples);
+  cf->scratch = (float *)malloc(sizeof(float)*2*ref);
+  if (cf->ext == NULL || cf->prefix == NULL || cf->window == NULL || cf->scratch == NULL) {
+    printf("ERROR: Failed to allocate CFAR buffers\n");
+    cfar_free(cf);
+    return -1;
+  }
+  return 0;
+}
+
+// Copy the magnitudes into ext with the last / first w bins wrapped onto the start / end
+static void cfar_gather(struct cfar *cf, const float *fft_mag, uint stride)
+{
+  uint n = cf->number_samples;
+  uint w = cf->guard + cf->ref;
+  float *dst = &cf->ext[w];
+  int i;
+
+#ifdef __ARM_NEON__
+  if (stride == 2) {
+    float32x4x2_t words;
+    // vld2q deinterleaves: val[0] holds the magnitudes, val[1] the upper halves
+    for (i = 0; i < n; i += 4) {
+      words = vld2q_f32(&fft_mag[2*i]);
+      vst1q_f32(&dst[i], words.val[0]);
+    }
+  } else
+#endif
+  {
+    for (i = 0; i < n; i++) {
+      dst[i] = fft_mag[stride*i];
+    }
+  }
+  memcpy(&cf->ext[0], &dst[n - w], sizeof(float)*w);
+  memcpy(&cf->ext[n + w], &dst[0], sizeof(float)*w);
+}
+
+static int cfar_detect_ca(struct cfar *cf, float *mag, float *noise)
+{
+  uint n = cf->number_samples;
+  uint g = cf->guard;
+  uint r = cf->ref;
+  uint w = g + r;
+  uint ext_len = n + 2*w;
+  const double *p = cf->prefix;
+  float *win = cf->window;
+  float scale = cf->alpha/(2*r);
+  double sum = 0.0;
+  int i;
+#ifdef __ARM_NEON__
+  int j;
+  float32x4_t cells;
+  float32x4_t noise_sums;
+  float32x4_t scales;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+#endif
+
+  // Keep the prefix sum in double. Late in the frame it is much larger than any one
+  // window, and in float the difference of two large prefixes loses the small bins.
+  // The prefix sum is the only serial part, everything after it is independent per bin.
+  cf->prefix[0] = 0.0;
+  for (i = 0; i < ext_len; i++) {
+    sum += cf->ext[i];
+    cf->prefix[i+1] = sum;
+  }
+
+  // For bin i (ext index i+w):
+  //   lagging window  = ext[i .. i+r-1]           = p[i+r] - p[i]
+  //   leading window  = ext[i+w+g+1 .. i+2w]      = p[i+2w+1] - p[i+w+g+1]
+  // Only the window sums, which are small, are converted back to float.
+  for (i = 0; i < n; i++) {
+    win[i] = (float)((p[i+r] - p[i]) + (p[i+2*w+1] - p[i+w+g+1]));
+  }
+#ifdef __ARM_NEON__
+  scales = vdupq_n_f32(scale);
+  for (i = 0; i < n; i += 4) {
+    noise_sums = vld1q_f32(&win[i]);
+    cells = vld1q_f32(&cf->ext[i+w]);
+    compares = vcgeq_f32(cells, vmulq_f32(noise_sums, scales));
+    compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+    compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+    if (vget_lane_u32(compares_reduced, 0) != 0) {
+      for (j = 0; j < 4; j++) {
+        if (compares[j] != 0) {
+          if (mag != NULL) *mag = cells[j];
+          if (noise != NULL) *noise = noise_sums[j]/(2*r);
+          return i+j;
+        }
+      }
+    }
+  }
+#else
+  for (i = 0; i < n; i++) {
+    if (cf->ext[i+w] >= scale*win[i]) {
+      if (mag != NULL) *mag = cf->ext[i+w];
+      if (noise != NULL) *noise = win[i]/(2*r);
+      return i;
+    }
+  }
+#endif
+  return -1;
+}
+
+// k-th smallest (0 based) of x[0 .. len-1]. Reorders x.
+static float cfar_quickselect(float *x, int len, int k)
+{
+  int left = 0;
+  int right = len - 1;
+  int i;
+  int store;
+  float pivot;
+  float tmp;
+
+  while (left < right) {
+    // Median of three pivot keeps sorted runs (e.g. filter roll-off) from going quadratic
+    i = left + (right - left)/2;
+    if (x[i] < x[left])     { tmp = x[i]; x[i] = x[left]; x[left] = tmp; }
+    if (x[right] < x[left]) { tmp = x[right]; x[right] = x[left]; x[left] = tmp; }
+    if (x[right] < x[i])    { tmp = x[right]; x[right] = x[i]; x[i] = tmp; }
+    pivot = x[i];
+    tmp = x[i]; x[i] = x[right]; x[right] = tmp;
+    store = left;
+    for (i = left; i < right; i++) {
+      if (x[i] < pivot) {
+        tmp = x[i]; x[i] = x[store]; x[store] = tmp;
+        store++;
+      }
+    }
+    tmp = x[store]; x[store] = x[right]; x[right] = tmp;
+    if (store == k) {
+      return x[store];
+    } else if (store < k) {
+      left = store + 1;
+    } else {
+      right = store - 1;
+    }
+  }
+  return x[k];
+}
+
+static int cfar_detect_os(struct cfar *cf, float *mag, float *noise)
+{
+  uint n = cf->number_samples;
+  uint g = cf->guard;
+  uint r = cf->ref;
+  uint w = g + r;
+  float level;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    memcpy(&cf->scratch[0], &cf->ext[i], sizeof(float)*r);
+    memcpy(&cf->scratch[r], &cf->ext[i+w+g+1], sizeof(float)*r);
+    level = cfar_quickselect(cf->scratch, 2*r, cf->os_rank - 1);
+    if (cf->ext[i+w] >= cf->alpha*level) {
+      if (mag != NULL) *mag = cf->ext[i+w];
+      if (noise != NULL) *noise = level;
+      return i;
+    }
+  }
+  return -1;
+}
+
+int cfar_detect(struct cfar *cf, const float *fft_mag, uint stride, float *mag, float *noise)
+{
+  cfar_gather(cf, fft_mag, stride);
+  if (cf->type == CFAR_OS) {
+    return cfar_detect_os(cf, mag, noise);
+  }
+  return cfar_detect_ca(cf, mag, noise);
+}
+
+void cfar_free(struct cfar *cf)
+{
+  free(cf->ext);
+  free(cf->prefix);
+  free(cf->window);
+  free(cf->scratch);
+  cf->ext = NULL;
+  cf->prefix = NULL;
+  cf->window = NULL;
+  cf->scratch = NULL;
+}
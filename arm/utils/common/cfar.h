@@ -0,0 +1,75 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         cfar.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Constant false alarm rate (CFAR) detectors over a frame of FFT
+**                magnitudes. Instead of one global threshold, each bin is compared
+**                against alpha times the noise level estimated from the ref
+**                reference bins on each side of it, skipping guard bins next to
+**                it so a wide signal does not raise its own noise estimate.
+**
+**                CA-CFAR (cell averaging) uses the mean of the reference bins.
+**                The window sums come from a double precision prefix sum over the
+**                frame, so the cost is O(N) regardless of the guard / reference
+**                sizes.
+**                OS-CFAR (ordered statistic) uses the k-th smallest reference bin,
+**                found with quickselect. It is more robust next to strong
+**                signals but costs O(N*ref).
+**
+**                FFT bins wrap around, so the windows of bins near the edges wrap
+**                to the other end of the frame.
+**
+******************************************************************************/
+#ifndef CFAR_H
+#define CFAR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CFAR_CA                   0
+#define CFAR_OS                   1
+#define NUM_CFAR_TYPES            2
+
+struct cfar {
+  uint type;
+  uint number_samples;
+  uint guard;                     // Guard bins on each side of the cell under test
+  uint ref;                       // Reference bins on each side
+  float alpha;                    // Threshold = alpha * noise estimate
+  uint os_rank;                   // OS-CFAR: k-th smallest of the 2*ref reference bins (1 based)
+  float *ext;                     // Magnitudes with guard + ref bins wrapped onto each end
+  double *prefix;                 // Prefix sum of ext, one longer than ext
+  float *window;                  // CA-CFAR: lagging + leading window sum per bin
+  float *scratch;                 // OS-CFAR reference bins
+};
+
+extern const char *cfar_type_names[NUM_CFAR_TYPES];
+
+// os_rank of 0 defaults to 3/4 of the reference bins
+int cfar_init(struct cfar *cf, uint type, uint number_samples, uint guard, uint ref,
+              float alpha, uint os_rank);
+// Look up a detector by name ("ca", "os"). Returns -1 if unknown.
+int cfar_type_lookup(const char *name);
+// Run the detector over number_samples magnitudes spaced stride floats apart (2 for the
+// spectrum sense block, where the magnitude is the lower half of each 64-bit word).
+// Returns the first bin above its threshold or -1. mag and noise (optional) are set to
+// the magnitude and noise estimate of that bin.
+int cfar_detect(struct cfar *cf, const float *fft_mag, uint stride, float *mag, float *noise);
+void cfar_free(struct cfar *cf);
+
+#endif
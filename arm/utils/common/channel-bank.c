@@ -0,0 +1,343 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         channel-bank.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Goertzel and sliding DFT channel banks. NEON versions process 4
+**                bins at a time when building for the Zynq, plain C versions one
+**                bin at a time otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "channel-bank.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+const char *channel_bank_engine_names[NUM_CHANNEL_BANK_ENGINES] = {
+  "fft",
+  "goertzel",
+  "sdft",
+  "auto"
+};
+
+int channel_bank_engine_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_CHANNEL_BANK_ENGINES; i++) {
+    if (strcmp(name, channel_bank_engine_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint channel_bank_auto_engine(uint num_bins, uint number_samples)
+{
+  // NEON always works on 4 bins, so round K up
+  uint num_lanes = (num_bins + 3) & ~3;
+
+  if (CHANNEL_BANK_GOERTZEL_COST*num_lanes < CHANNEL_BANK_FFT_COST*log2(number_samples)) {
+    return CHANNEL_BANK_GOERTZEL;
+  }
+  return CHANNEL_BANK_FFT;
+}
+
+int channel_bank_init(struct channel_bank *cb, uint engine, const struct spectral_mask *mask)
+{
+  uint n = mask->number_samples;
+  uint lanes;
+  double w;
+  int i;
+
+  memset(cb, 0, sizeof(struct channel_bank));
+  if (engine != CHANNEL_BANK_GOERTZEL && engine != CHANNEL_BANK_SDFT) {
+    printf("ERROR: Channel bank engine must be goertzel or sdft\n");
+    return -1;
+  }
+  lanes = (mask->num_bins + 3) & ~3;
+  cb->engine = engine;
+  cb->number_samples = n;
+  cb->num_bins = mask->num_bins;
+  cb->num_lanes = lanes;
+  cb->bins = (uint32_t *)calloc(lanes, sizeof(uint32_t));
+  cb->weight_sqr = (float *)calloc(lanes, sizeof(float));
+  cb->coeff = (float *)calloc(lanes, sizeof(float));
+  cb->cos_w = (float *)calloc(lanes, sizeof(float));
+  cb->sin_w = (float *)calloc(lanes, sizeof(float));
+  cb->twiddle_re = (float *)calloc(lanes, sizeof(float));
+  cb->twiddle_im = (float *)calloc(lanes, sizeof(float));
+  cb->state = (float *)calloc(4*lanes, sizeof(float));
+  if (engine == CHANNEL_BANK_SDFT) {
+    cb->history = (float *)calloc(2*n, sizeof(float));
+  }
+  if (cb->bins == NULL || cb->weight_sqr == NULL || cb->coeff == NULL || cb->cos_w == NULL ||
+      cb->sin_w == NULL || cb->twiddle_re == NULL || cb->twiddle_im == NULL || cb->state == NULL ||
+      (engine == CHANNEL_BANK_SDFT && cb->history == NULL)) {
+    printf("ERROR: Failed to allocate channel bank\n");
+    channel_bank_free(cb);
+    return -1;
+  }
+
+  for (i = 0; i < mask->num_bins; i++) {
+    w = 2.0*M_PI*mask->bins[i]/n;
+    cb->bins[i] = mask->bins[i];
+    cb->weight_sqr[i] = mask->weights[i]*mask->weights[i];
+    cb->coeff[i] = 2.0*cos(w);
+    cb->cos_w[i] = cos(w);
+    cb->sin_w[i] = sin(w);
+    cb->twiddle_re[i] = CHANNEL_BANK_SDFT_DAMPING*cos(w);
+    cb->twiddle_im[i] = CHANNEL_BANK_SDFT_DAMPING*sin(w);
+  }
+  cb->damping_n = powf(CHANNEL_BANK_SDFT_DAMPING, n);
+  channel_bank_reset(cb);
+  return 0;
+}
+
+void channel_bank_reset(struct channel_bank *cb)
+{
+  memset(cb->state, 0, sizeof(float)*4*cb->num_lanes);
+  if (cb->history != NULL) {
+    memset(cb->history, 0, sizeof(float)*2*cb->number_samples);
+  }
+  cb->history_pos = 0;
+  cb->filled = 0;
+  cb->next_seq = CHANNEL_BANK_NO_SEQ;
+}
+
+void channel_bank_resync(struct channel_bank *cb, uint64_t seq)
+{
+  if (seq != cb->next_seq) {
+    channel_bank_reset(cb);
+  }
+  cb->next_seq = seq + 1;
+}
+
+int channel_bank_goertzel(struct channel_bank *cb, const float *frame, float threshold, float *mag)
+{
+  uint n = cb->number_samples;
+  float threshold_sqr = threshold*threshold;
+  int g;
+  int i;
+#ifdef __ARM_NEON__
+  float32x4_t x_re, x_im;
+  float32x4_t s0_re, s0_im, s1_re, s1_im, s2_re, s2_im;
+  float32x4_t coeff, cos_w, sin_w;
+  float32x4_t mags_sqr;
+  uint32x4_t compares;
+  int j;
+
+  // Bins in the outer loop so the filter state stays in registers
+  for (g = 0; g < cb->num_lanes; g += 4) {
+    coeff = vld1q_f32(&cb->coeff[g]);
+    s1_re = vdupq_n_f32(0.0);
+    s1_im = vdupq_n_f32(0.0);
+    s2_re = vdupq_n_f32(0.0);
+    s2_im = vdupq_n_f32(0.0);
+    for (i = 0; i < n; i++) {
+      // s0 = x + 2*cos(w)*s1 - s2
+      x_re = vdupq_n_f32(frame[2*i]);
+      x_im = vdupq_n_f32(frame[2*i+1]);
+      s0_re = vmlaq_f32(vsubq_f32(x_re, s2_re), coeff, s1_re);
+      s0_im = vmlaq_f32(vsubq_f32(x_im, s2_im), coeff, s1_im);
+      s2_re = s1_re;
+      s2_im = s1_im;
+      s1_re = s0_re;
+      s1_im = s0_im;
+    }
+    // |X| = |s1 - e^(-jw)*s2|
+    cos_w = vld1q_f32(&cb->cos_w[g]);
+    sin_w = vld1q_f32(&cb->sin_w[g]);
+    x_re = vmlsq_f32(vmlsq_f32(s1_re, cos_w, s2_re), sin_w, s2_im);
+    x_im = vmlaq_f32(vmlsq_f32(s1_im, cos_w, s2_im), sin_w, s2_re);
+    mags_sqr = vmlaq_f32(vmulq_f32(x_re, x_re), x_im, x_im);
+    compares = vcgeq_f32(vmulq_f32(mags_sqr, vld1q_f32(&cb->weight_sqr[g])), vdupq_n_f32(threshold_sqr));
+    for (j = 0; j < 4; j++) {
+      if (compares[j] != 0) {
+        if (mag != NULL) *mag = sqrtf(mags_sqr[j]);
+        return cb->bins[g+j];
+      }
+    }
+  }
+#else
+  float s0_re, s0_im, s1_re, s1_im, s2_re, s2_im;
+  float x_re, x_im;
+  float mag_sqr;
+
+  for (g = 0; g < cb->num_bins; g++) {
+    s1_re = s1_im = s2_re = s2_im = 0.0;
+    for (i = 0; i < n; i++) {
+      s0_re = frame[2*i] + cb->coeff[g]*s1_re - s2_re;
+      s0_im = frame[2*i+1] + cb->coeff[g]*s1_im - s2_im;
+      s2_re = s1_re;
+      s2_im = s1_im;
+      s1_re = s0_re;
+      s1_im = s0_im;
+    }
+    x_re = s1_re - cb->cos_w[g]*s2_re - cb->sin_w[g]*s2_im;
+    x_im = s1_im - cb->cos_w[g]*s2_im + cb->sin_w[g]*s2_re;
+    mag_sqr = x_re*x_re + x_im*x_im;
+    if (cb->weight_sqr[g]*mag_sqr >= threshold_sqr) {
+      if (mag != NULL) *mag = sqrtf(mag_sqr);
+      return cb->bins[g];
+    }
+  }
+#endif
+  return -1;
+}
+
+int channel_bank_sdft(struct channel_bank *cb, const float *frame, float threshold, int until)
+{
+  uint n = cb->number_samples;
+  float threshold_sqr = threshold*threshold;
+  float *x_re = &cb->state[0];
+  float *x_im = &cb->state[cb->num_lanes];
+  float d_re;
+  float d_im;
+  float *old;
+  bool busy;
+  int g;
+  int i;
+#ifdef __ARM_NEON__
+  float32x4_t re, im, re_new;
+  float32x4_t t_re, t_im;
+  float32x4_t thresholds;
+  uint32x4_t compares;
+  uint32x4_t any_busy;
+
+  thresholds = vdupq_n_f32(threshold_sqr);
+#else
+  float re_new;
+  float mag_sqr;
+#endif
+
+  for (i = 0; i < n; i++) {
+    // d = x[n] - damping^N * x[n-N]
+    old = &cb->history[2*cb->history_pos];
+    d_re = frame[2*i] - cb->damping_n*old[0];
+    d_im = frame[2*i+1] - cb->damping_n*old[1];
+    old[0] = frame[2*i];
+    old[1] = frame[2*i+1];
+    cb->history_pos = (cb->history_pos + 1 == n) ? 0 : cb->history_pos + 1;
+    if (cb->filled < n) cb->filled++;
+    busy = false;
+
+#ifdef __ARM_NEON__
+    any_busy = vdupq_n_u32(0);
+    for (g = 0; g < cb->num_lanes; g += 4) {
+      // X = damping*e^(jw)*X + d
+      re = vld1q_f32(&x_re[g]);
+      im = vld1q_f32(&x_im[g]);
+      t_re = vld1q_f32(&cb->twiddle_re[g]);
+      t_im = vld1q_f32(&cb->twiddle_im[g]);
+      re_new = vmlsq_f32(vmlaq_f32(vdupq_n_f32(d_re), t_re, re), t_im, im);
+      im = vmlaq_f32(vmlaq_f32(vdupq_n_f32(d_im), t_re, im), t_im, re);
+      vst1q_f32(&x_re[g], re_new);
+      vst1q_f32(&x_im[g], im);
+      compares = vcgeq_f32(vmulq_f32(vmlaq_f32(vmulq_f32(re_new, re_new), im, im),
+                                     vld1q_f32(&cb->weight_sqr[g])), thresholds);
+      any_busy = vorrq_u32(any_busy, compares);
+    }
+    if (vgetq_lane_u32(any_busy, 0) | vgetq_lane_u32(any_busy, 1) |
+        vgetq_lane_u32(any_busy, 2) | vgetq_lane_u32(any_busy, 3)) {
+      busy = true;
+    }
+#else
+    for (g = 0; g < cb->num_bins; g++) {
+      re_new = cb->twiddle_re[g]*x_re[g] - cb->twiddle_im[g]*x_im[g] + d_re;
+      x_im[g] = cb->twiddle_re[g]*x_im[g] + cb->twiddle_im[g]*x_re[g] + d_im;
+      x_re[g] = re_new;
+      mag_sqr = x_re[g]*x_re[g] + x_im[g]*x_im[g];
+      if (cb->weight_sqr[g]*mag_sqr >= threshold_sqr) {
+        busy = true;
+      }
+    }
+#endif
+    // Nothing can be decided until the window holds N samples
+    if (cb->filled < n) continue;
+    if ((until == CHANNEL_BANK_UNTIL_BUSY && busy) ||
+        (until == CHANNEL_BANK_UNTIL_CLEAR && !busy)) {
+      // The rest of the frame is skipped, so the next frame does not continue the window
+      if (i < n - 1) cb->next_seq = CHANNEL_BANK_NO_SEQ;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// First bin of the sliding DFT state over the threshold, or -1
+static int channel_bank_first_busy(struct channel_bank *cb, float threshold, float *mag)
+{
+  float *x_re = &cb->state[0];
+  float *x_im = &cb->state[cb->num_lanes];
+  float mag_sqr;
+  int g;
+
+  for (g = 0; g < cb->num_bins; g++) {
+    mag_sqr = x_re[g]*x_re[g] + x_im[g]*x_im[g];
+    if (cb->weight_sqr[g]*mag_sqr >= threshold*threshold) {
+      if (mag != NULL) *mag = sqrtf(mag_sqr);
+      return cb->bins[g];
+    }
+  }
+  return -1;
+}
+
+int channel_bank_detect(struct channel_bank *cb, const float *frame, float threshold, int until, float *mag)
+{
+  if (cb->engine == CHANNEL_BANK_GOERTZEL) {
+    cb->decision_sample = cb->number_samples - 1;
+    return channel_bank_goertzel(cb, frame, threshold, mag);
+  }
+  cb->decision_sample = channel_bank_sdft(cb, frame, threshold, until);
+  if (cb->decision_sample < 0) {
+    cb->decision_sample = cb->number_samples - 1;
+    // Until the window holds N samples the channel cannot be called clear
+    if (cb->filled < cb->number_samples) {
+      return (until == CHANNEL_BANK_UNTIL_CLEAR) ? cb->bins[0] : -1;
+    }
+  } else if (until == CHANNEL_BANK_UNTIL_CLEAR) {
+    return -1;
+  }
+  return channel_bank_first_busy(cb, threshold, mag);
+}
+
+void channel_bank_free(struct channel_bank *cb)
+{
+  free(cb->bins);
+  free(cb->weight_sqr);
+  free(cb->coeff);
+  free(cb->cos_w);
+  free(cb->sin_w);
+  free(cb->twiddle_re);
+  free(cb->twiddle_im);
+  free(cb->state);
+  free(cb->history);
+  cb->bins = NULL;
+  cb->weight_sqr = NULL;
+  cb->coeff = NULL;
+  cb->cos_w = NULL;
+  cb->sin_w = NULL;
+  cb->twiddle_re = NULL;
+  cb->twiddle_im = NULL;
+  cb->state = NULL;
+  cb->history = NULL;
+}
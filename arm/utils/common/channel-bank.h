@@ -0,0 +1,117 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         channel-bank.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Per-bin sensing engines for when only a few channels are
+**                monitored. Instead of a full FFT, each of the K bins in a
+**                spectral mask is tracked directly from the DMA buffer:
+**
+**                Goertzel: second order IIR per bin, run over a whole frame.
+**                Gives the same X[k] as the FFT of the frame in O(K*N).
+**
+**                Sliding DFT: X[k] is updated every sample from the previous
+**                value, the new sample and the sample leaving the N sample
+**                window, so the decision can be made after any sample instead
+**                of at the end of a frame. The recursion is damped by
+**                CHANNEL_BANK_SDFT_DAMPING to keep float rounding from building
+**                up, which tapers the window slightly (about 4% at N = 4096).
+**
+**                The window only slides over contiguous samples. Frames from
+**                separate crash_read calls, frames the DMA ring dropped and a
+**                frame the sliding DFT stopped early on all leave a gap, so the
+**                window is reset and refilled before the next decision.
+**
+**                Bins are processed 4 at a time with NEON. The bin magnitudes
+**                match the FFT, so the same thresholds and mask weights apply.
+**
+******************************************************************************/
+#ifndef CHANNEL_BANK_H
+#define CHANNEL_BANK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "spectral-mask.h"
+
+#define CHANNEL_BANK_FFT          0
+#define CHANNEL_BANK_GOERTZEL     1
+#define CHANNEL_BANK_SDFT         2
+#define CHANNEL_BANK_AUTO         3
+#define NUM_CHANNEL_BANK_ENGINES  4
+
+// Rough cost in flops per input sample. FFT: 5*log2(N) for a radix-2 complex FFT,
+// Goertzel: 6 per bin (real coefficient, complex state), sliding DFT: 10 per bin
+// (complex twiddle plus the threshold compare).
+#define CHANNEL_BANK_FFT_COST      5
+#define CHANNEL_BANK_GOERTZEL_COST 6
+#define CHANNEL_BANK_SDFT_COST     10
+
+#define CHANNEL_BANK_SDFT_DAMPING  0.99999f
+
+#define CHANNEL_BANK_NO_SEQ       UINT64_MAX
+
+// Sliding DFT stop conditions
+#define CHANNEL_BANK_UNTIL_BUSY   0     // Stop at the first sample where any bin is over
+#define CHANNEL_BANK_UNTIL_CLEAR  1     // Stop at the first sample where all bins are under
+
+struct channel_bank {
+  uint engine;
+  uint number_samples;
+  uint num_bins;                  // K
+  uint num_lanes;                 // K rounded up to a multiple of 4
+  uint32_t *bins;
+  float *weight_sqr;              // weight^2, 0 for the padding lanes so they never trip
+  float *coeff;                   // Goertzel: 2*cos(w)
+  float *cos_w;
+  float *sin_w;
+  float *twiddle_re;              // Sliding DFT: damping * e^(jw)
+  float *twiddle_im;
+  float *state;                   // Goertzel: s1 / s2, sliding DFT: X[k]. re / im per lane.
+  float *history;                 // Sliding DFT: last N samples, interleaved I/Q
+  float damping_n;                // damping^N
+  uint history_pos;
+  uint filled;                    // Samples pushed since reset, up to N
+  uint64_t next_seq;              // DMA frame number that continues the window, CHANNEL_BANK_NO_SEQ if none
+  int decision_sample;            // Sample of the frame the last decision was made on
+};
+
+extern const char *channel_bank_engine_names[NUM_CHANNEL_BANK_ENGINES];
+
+// Pick FFT or Goertzel for K bins of an N point frame based on the cost model above
+uint channel_bank_auto_engine(uint num_bins, uint number_samples);
+// Look up an engine by name ("fft", "goertzel", "sdft", "auto"). Returns -1 if unknown.
+int channel_bank_engine_lookup(const char *name);
+// Track the active bins of a spectral mask with the Goertzel or sliding DFT engine
+int channel_bank_init(struct channel_bank *cb, uint engine, const struct spectral_mask *mask);
+void channel_bank_reset(struct channel_bank *cb);
+// Sliding DFT: reset unless seq (frame_ring / pipeline seq) is the DMA frame right after
+// the last one pushed. Frames from crash_read are never contiguous, reset before each.
+void channel_bank_resync(struct channel_bank *cb, uint64_t seq);
+// Run a frame of number_samples complex samples through the Goertzel filters. Returns the
+// first bin over the threshold or -1. mag (optional) is set to its magnitude.
+int channel_bank_goertzel(struct channel_bank *cb, const float *frame, float threshold, float *mag);
+// Push up to number_samples complex samples through the sliding DFT, stopping at the
+// first sample that meets the until condition once a full window has been seen. Returns
+// the index of that sample or -1 if the whole frame was consumed.
+int channel_bank_sdft(struct channel_bank *cb, const float *frame, float threshold, int until);
+// Run a frame through either engine. Returns the first bin over the threshold or -1 if the
+// channels are clear, i.e. -1 means OK to transmit. The sliding DFT stops early on the
+// until condition and records the sample the decision was made on in decision_sample.
+int channel_bank_detect(struct channel_bank *cb, const float *frame, float threshold, int until, float *mag);
+void channel_bank_free(struct channel_bank *cb);
+
+#endif
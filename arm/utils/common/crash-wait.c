@@ -0,0 +1,271 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-wait.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Blocking waits on CRASH register bits that do not spin a core.
+**
+******************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+
+#define CRASH_WAIT_MIN_SLEEP_NS   10000       // nanosleep() backoff, 10 us to 1 ms
+#define CRASH_WAIT_MAX_SLEEP_NS   1000000
+
+// poll() needs the device fd in crash_plblock and a kernel module whose poll handler is
+// woken by the ps_pl_interface interrupt. Neither is part of the stock libcrash /
+// crash-kmod, so the fd is only used when built with -DCRASH_WAIT_POLL (make POLL=1).
+// Otherwise every wait sleeps with the nanosleep() backoff.
+#ifdef CRASH_WAIT_POLL
+#define CRASH_WAIT_FD(plblock)    ((plblock)->fd)
+#else
+#define CRASH_WAIT_FD(plblock)    (-1)
+#endif
+
+// Waits run on several threads at once (e.g. the pipeline's capture and compute threads),
+// so the stats and the spurious wake count are only updated atomically
+#define CRASH_WAIT_COUNT(field)   __atomic_fetch_add(&crash_wait_stats.field, 1, __ATOMIC_RELAXED)
+#define CRASH_WAIT_POLL_DISABLED() __atomic_load_n(&crash_wait_stats.poll_disabled, __ATOMIC_RELAXED)
+
+struct crash_wait_stats crash_wait_stats;
+
+static uint crash_wait_spurious = 0;
+
+static int64_t crash_wait_elapsed_us(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)(now.tv_sec - start->tv_sec)*1000000 + (now.tv_nsec - start->tv_nsec)/1000;
+}
+
+static void crash_wait_us_to_timespec(int64_t us, struct timespec *ts)
+{
+  ts->tv_sec = us/1000000;
+  ts->tv_nsec = (us % 1000000)*1000;
+}
+
+static void crash_wait_disable_poll(bool have_fd)
+{
+  if (have_fd) {
+    printf("INFO: poll() not usable on the CRASH device, waits fall back to nanosleep()\n");
+  }
+  __atomic_store_n(&crash_wait_stats.poll_disabled, true, __ATOMIC_RELAXED);
+}
+
+// Called when poll() returned ready but nothing happened. If it keeps doing that the
+// driver has no poll support and reports the fd as always ready, so stop using it.
+static void crash_wait_spurious_wake(void)
+{
+  if (__atomic_add_fetch(&crash_wait_spurious, 1, __ATOMIC_RELAXED) >= CRASH_WAIT_MAX_SPURIOUS) {
+    crash_wait_disable_poll(true);
+  }
+}
+
+static int crash_wait_check(const struct crash_wait_cond *conds, uint num_conds)
+{
+  uint i;
+
+  for (i = 0; i < num_conds; i++) {
+    if ((crash_get_bit(conds[i].plblock->regs,conds[i].bit) != 0) == (conds[i].value != 0)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Sleep for at most max_us, returning early on an interrupt from one of the plblocks
+static void crash_wait_sleep(const struct crash_wait_cond *conds, uint num_conds, int64_t max_us,
+                             long *backoff_ns)
+{
+  struct pollfd fds[CRASH_WAIT_MAX_CONDS];
+  struct timespec ts;
+  uint nfds = 0;
+  uint i;
+  uint j;
+  int ret;
+
+  CRASH_WAIT_COUNT(sleeps);
+  if (!CRASH_WAIT_POLL_DISABLED()) {
+    // One entry per device fd, several conditions may share a plblock
+    for (i = 0; i < num_conds; i++) {
+      for (j = 0; j < nfds; j++) {
+        if (fds[j].fd == CRASH_WAIT_FD(conds[i].plblock)) break;
+      }
+      if (j == nfds && CRASH_WAIT_FD(conds[i].plblock) >= 0) {
+        fds[nfds].fd = CRASH_WAIT_FD(conds[i].plblock);
+        fds[nfds].events = POLLIN | POLLPRI;
+        fds[nfds].revents = 0;
+        nfds++;
+      }
+    }
+    if (max_us < 0 || max_us > CRASH_WAIT_POLL_MS*1000) {
+      max_us = CRASH_WAIT_POLL_MS*1000;
+    }
+    crash_wait_us_to_timespec(max_us, &ts);
+    ret = (nfds > 0) ? ppoll(fds, nfds, &ts, NULL) : -1;
+    if (ret == 0) {
+      __atomic_store_n(&crash_wait_spurious, 0, __ATOMIC_RELAXED);
+      return;
+    }
+    if (ret > 0) {
+      CRASH_WAIT_COUNT(wakeups);
+      for (j = 0; j < nfds; j++) {
+        if (fds[j].revents & POLLNVAL) ret = -1;
+      }
+    }
+    if (ret > 0) {
+      // A woken waiter usually finds its condition set
+      if (crash_wait_check(conds, num_conds) >= 0) {
+        __atomic_store_n(&crash_wait_spurious, 0, __ATOMIC_RELAXED);
+      } else {
+        crash_wait_spurious_wake();
+      }
+      if (!CRASH_WAIT_POLL_DISABLED()) {
+        return;
+      }
+    } else {
+      crash_wait_disable_poll(nfds > 0);
+    }
+  }
+  ts.tv_sec = 0;
+  ts.tv_nsec = *backoff_ns;
+  if (max_us >= 0 && max_us*1000 < ts.tv_nsec) {
+    ts.tv_nsec = max_us*1000;
+  }
+  nanosleep(&ts, NULL);
+  if (*backoff_ns < CRASH_WAIT_MAX_SLEEP_NS) {
+    *backoff_ns *= 2;
+  }
+}
+
+int crash_wait_any(const struct crash_wait_cond *conds, uint num_conds, int timeout_us)
+{
+  struct timespec start;
+  uint32_t spin_start;
+  long backoff_ns = CRASH_WAIT_MIN_SLEEP_NS;
+  int64_t elapsed;
+  int index;
+
+  if (num_conds == 0 || num_conds > CRASH_WAIT_MAX_CONDS) {
+    printf("ERROR: Can wait on 1 to %d conditions\n",CRASH_WAIT_MAX_CONDS);
+    return -1;
+  }
+  CRASH_WAIT_COUNT(waits);
+  // Short waits, e.g. a DMA transfer finishing, are cheapest to spin on
+  spin_start = crash_read_reg(conds[0].plblock->regs,DMA_DEBUG_CNT);
+  do {
+    index = crash_wait_check(conds, num_conds);
+    if (index >= 0) {
+      CRASH_WAIT_COUNT(spin_done);
+      return index;
+    }
+  } while (dma_debug_cnt_delta(spin_start, crash_read_reg(conds[0].plblock->regs,DMA_DEBUG_CNT)) <
+           CRASH_WAIT_SPIN_CYCLES);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (1) {
+    elapsed = crash_wait_elapsed_us(&start);
+    if (timeout_us >= 0 && elapsed >= timeout_us) {
+      CRASH_WAIT_COUNT(timeouts);
+      return -1;
+    }
+    crash_wait_sleep(conds, num_conds, (timeout_us >= 0) ? timeout_us - elapsed : -1, &backoff_ns);
+    index = crash_wait_check(conds, num_conds);
+    if (index >= 0) {
+      return index;
+    }
+  }
+}
+
+int crash_wait_bit(struct crash_plblock *plblock, uint bit, uint value, int timeout_us)
+{
+  struct crash_wait_cond cond;
+
+  cond.plblock = plblock;
+  cond.bit = bit;
+  cond.value = value;
+  return (crash_wait_any(&cond, 1, timeout_us) < 0) ? -1 : 0;
+}
+
+void crash_wait_event(struct crash_plblock *plblock, int max_us)
+{
+  struct pollfd fds;
+  struct timespec ts;
+  struct timespec start;
+  int ret;
+
+  if (max_us < 0 || max_us > CRASH_WAIT_POLL_MS*1000) {
+    max_us = CRASH_WAIT_POLL_MS*1000;
+  }
+  crash_wait_us_to_timespec(max_us, &ts);
+  CRASH_WAIT_COUNT(sleeps);
+  if (!CRASH_WAIT_POLL_DISABLED() && CRASH_WAIT_FD(plblock) < 0) {
+    crash_wait_disable_poll(false);
+  }
+  if (!CRASH_WAIT_POLL_DISABLED()) {
+    fds.fd = CRASH_WAIT_FD(plblock);
+    fds.events = POLLIN | POLLPRI;
+    fds.revents = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = ppoll(&fds, 1, &ts, NULL);
+    if (ret == 0) {
+      __atomic_store_n(&crash_wait_spurious, 0, __ATOMIC_RELAXED);
+      return;
+    }
+    if (ret > 0 && !(fds.revents & POLLNVAL)) {
+      CRASH_WAIT_COUNT(wakeups);
+      // There is no condition to check here. Callers only get here after spinning,
+      // so an interrupt is rarely already pending; a wake that did not sleep at all
+      // is most likely an fd that is always ready.
+      if (crash_wait_elapsed_us(&start) >= CRASH_WAIT_MIN_SLEEP_NS/1000) {
+        __atomic_store_n(&crash_wait_spurious, 0, __ATOMIC_RELAXED);
+        return;
+      }
+      crash_wait_spurious_wake();
+      if (!CRASH_WAIT_POLL_DISABLED()) {
+        return;
+      }
+    } else {
+      crash_wait_disable_poll(true);
+    }
+  }
+  nanosleep(&ts, NULL);
+}
+
+void crash_wait_print_stats(void)
+{
+  printf("Waits:\t\t\t\t%llu\n",
+         (unsigned long long)__atomic_load_n(&crash_wait_stats.waits, __ATOMIC_RELAXED));
+  printf("Waits Done Spinning:\t\t%llu\n",
+         (unsigned long long)__atomic_load_n(&crash_wait_stats.spin_done, __ATOMIC_RELAXED));
+  printf("Wait Sleeps / Wakeups:\t\t%llu / %llu\n",
+         (unsigned long long)__atomic_load_n(&crash_wait_stats.sleeps, __ATOMIC_RELAXED),
+         (unsigned long long)__atomic_load_n(&crash_wait_stats.wakeups, __ATOMIC_RELAXED));
+  printf("Wait Timeouts:\t\t\t%llu\n",
+         (unsigned long long)__atomic_load_n(&crash_wait_stats.timeouts, __ATOMIC_RELAXED));
+  printf("Wait Mode:\t\t\t%s\n",CRASH_WAIT_POLL_DISABLED() ? "nanosleep" : "poll");
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-wait.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Blocking waits on CRASH register bits that do not spin a core.
+**
+**                A wait first spins for CRASH_WAIT_SPIN_CYCLES, which keeps the
+**                latency of short DMA waits unchanged, then sleeps with
+**                nanosleep(), backing off from 10 us to 1 ms.
+**
+**                Built with make POLL=1 (-DCRASH_WAIT_POLL), the wait sleeps in
+**                poll() on the plblock device fds instead. This needs a libcrash that exposes
+**                the fd in crash_plblock and a kernel module with a poll handler
+**                woken by the ps_pl_interface interrupt, neither of which the
+**                stock libcrash / crash-kmod provide. With the DMA interrupts
+**                enabled (DMA_S2MM_INTERRUPT / DMA_MM2S_INTERRUPT, the tools' -i
+**                flag) the interrupt wakes the waiter right away; otherwise each
+**                ppoll() is capped at CRASH_WAIT_POLL_MS so bits without an
+**                interrupt (UART busy, calibration) are still seen. If poll()
+**                keeps returning ready without anything happening (no poll
+**                support, the fd always reads ready), waits go back to
+**                nanosleep().
+**
+**                crash_wait_any() waits on bits of several plblocks at once.
+**
+******************************************************************************/
+#ifndef CRASH_WAIT_H
+#define CRASH_WAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+struct crash_plblock;
+
+#define CRASH_WAIT_FOREVER        -1
+#define CRASH_WAIT_TIMEOUT_US     1000000     // Default for callers that want one
+#define CRASH_WAIT_SPIN_CYCLES    1500        // 10 us of DMA_DEBUG_CNT
+#define CRASH_WAIT_POLL_MS        1
+#define CRASH_WAIT_MAX_CONDS      8
+#define CRASH_WAIT_MAX_SPURIOUS   4           // Immediate poll() returns before giving up on it
+
+struct crash_wait_cond {
+  struct crash_plblock *plblock;
+  uint bit;                       // Register bit name, as for crash_get_bit()
+  uint value;                     // Wait until the bit reads this value
+};
+
+struct crash_wait_stats {
+  uint64_t waits;
+  uint64_t spin_done;             // Satisfied while spinning
+  uint64_t sleeps;                // poll() / nanosleep() calls
+  uint64_t wakeups;               // poll() returned ready
+  uint64_t timeouts;
+  bool poll_disabled;             // poll() found unusable, using nanosleep()
+};
+
+// Shared by all threads and updated atomically
+extern struct crash_wait_stats crash_wait_stats;
+
+// Wait until bit reads value. timeout_us < 0 waits forever. Returns 0, or -1 on timeout.
+int crash_wait_bit(struct crash_plblock *plblock, uint bit, uint value, int timeout_us);
+// Wait until any of the conditions holds. Returns its index, or -1 on timeout.
+int crash_wait_any(const struct crash_wait_cond *conds, uint num_conds, int timeout_us);
+// Sleep until the plblock raises an interrupt or max_us (at most CRASH_WAIT_POLL_MS) passes.
+// For callers polling a condition of their own, e.g. a DMA ring.
+void crash_wait_event(struct crash_plblock *plblock, int max_us);
+void crash_wait_print_stats(void);
+
+#endif
@@ -0,0 +1,4 @@
+# Sleep in poll() on the plblock device fds instead of nanosleep(): make POLL=1
+# (see crash-wait.h). Included at the end of a tool Makefile, objects go into the
+# tool's own build-poll directory.
+CFLAGS := $(CFLAGS) -DCRASH_WAIT_POLL
@@ -0,0 +1,99 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         dma-cache.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  DMA buffer cache policy for the ps_pl_interface AXI master.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "dma-cache.h"
+
+struct dma_cache_bits {
+  uint32_t axcache;
+  uint32_t axuser;
+};
+
+// Indexed by policy
+static const struct dma_cache_bits dma_cache_policy_bits[NUM_DMA_CACHE_POLICIES] = {
+  {0x3, 0x00},
+  {0xF, 0x1F}
+};
+
+const char *dma_cache_policy_names[NUM_DMA_CACHE_POLICIES] = {
+  "noncacheable",
+  "coherent"
+};
+
+int dma_cache_policy_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_DMA_CACHE_POLICIES; i++) {
+    if (strcmp(name, dma_cache_policy_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int dma_cache_supported(void)
+{
+#ifdef DMA_AWCACHE
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int dma_cache_set_policy(struct crash_plblock *plblock, uint policy)
+{
+#ifdef DMA_AWCACHE
+  const struct dma_cache_bits *bits = &dma_cache_policy_bits[policy];
+
+  crash_write_reg(plblock->regs,DMA_AWCACHE,bits->axcache);
+  crash_write_reg(plblock->regs,DMA_AWUSER,bits->axuser);
+  crash_write_reg(plblock->regs,DMA_ARCACHE,bits->axcache);
+  crash_write_reg(plblock->regs,DMA_ARUSER,bits->axuser);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int dma_cache_get_policy(struct crash_plblock *plblock)
+{
+#ifdef DMA_AWCACHE
+  uint32_t awcache = crash_read_reg(plblock->regs,DMA_AWCACHE);
+  uint32_t awuser = crash_read_reg(plblock->regs,DMA_AWUSER);
+  uint32_t arcache = crash_read_reg(plblock->regs,DMA_ARCACHE);
+  uint32_t aruser = crash_read_reg(plblock->regs,DMA_ARUSER);
+  int i;
+
+  for (i = 0; i < NUM_DMA_CACHE_POLICIES; i++) {
+    if (awcache == dma_cache_policy_bits[i].axcache && arcache == dma_cache_policy_bits[i].axcache &&
+        awuser == dma_cache_policy_bits[i].axuser && aruser == dma_cache_policy_bits[i].axuser) {
+      return i;
+    }
+  }
+#endif
+  return -1;
+}
@@ -0,0 +1,63 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         dma-cache.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  DMA buffer cache policy for the ps_pl_interface AXI master.
+**
+**                noncacheable: AxCACHE "0011", AxUSER "00000". The Datamover
+**                              reads / writes DDR directly, the CPU must not
+**                              hold any of the buffer in its caches.
+**                coherent:     AxCACHE "1111", AxUSER "11111" (the values
+**                              recommended in ps_pl_interface.vhd). Requests
+**                              through the ACP are shared and snooped by the
+**                              SCU, so DMA data can be read from and written
+**                              to the CPU caches.
+**
+**                The bits live in Control Bank 1 of the global register space
+**                (ctrl_127_reg) and apply to every transfer, not just one
+**                plblock's. A plblock's register window does not reach them, so
+**                they can only be set through the kernel module's DMA_AWCACHE,
+**                DMA_AWUSER, DMA_ARCACHE and DMA_ARUSER registers. With a
+**                crash-kmod.h that lacks those the policy is not supported.
+**
+**                The bits only set up the PL side of the transfer. Whether the
+**                CPU sees dma_buff through a cached mapping is up to the kernel
+**                module.
+**
+******************************************************************************/
+#ifndef DMA_CACHE_H
+#define DMA_CACHE_H
+
+#include <sys/types.h>
+struct crash_plblock;
+
+#define DMA_CACHE_NONCACHEABLE    0
+#define DMA_CACHE_COHERENT        1
+#define NUM_DMA_CACHE_POLICIES    2
+
+extern const char *dma_cache_policy_names[NUM_DMA_CACHE_POLICIES];
+
+// Look up a policy by name ("noncacheable", "coherent"). Returns -1 if unknown.
+int dma_cache_policy_lookup(const char *name);
+// 1 if crash-kmod.h names the cache bits, otherwise the policy cannot be set
+int dma_cache_supported(void);
+// Returns -1 if the policy is not supported
+int dma_cache_set_policy(struct crash_plblock *plblock, uint policy);
+// Policy currently set, or -1 if the cache bits match neither or are not supported
+int dma_cache_get_policy(struct crash_plblock *plblock);
+
+#endif
@@ -0,0 +1,44 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         dma-debug-cnt.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  DMA_DEBUG_CNT, the 150 MHz free running counter in
+**                ps_pl_interface (proc_debug_count).
+**
+**                The counter is 30 bits: it wraps from 2^30-1 to 0, every
+**                ~7.16 seconds, and is cleared by the global reset
+**                (crash_reset()). Differences must be taken modulo 2^30 with
+**                dma_debug_cnt_delta(), a plain 32-bit subtraction adds ~21
+**                seconds at every wrap. Intervals longer than a wrap, or that
+**                span a crash_reset(), cannot be measured with it.
+**
+******************************************************************************/
+#ifndef DMA_DEBUG_CNT_H
+#define DMA_DEBUG_CNT_H
+
+#include <stdint.h>
+
+#define DMA_DEBUG_CNT_MASK        0x3FFFFFFF
+#define DMA_DEBUG_CNT_MHZ         150.0
+
+// stop - start in counter cycles, correct across one wrap
+static inline uint32_t dma_debug_cnt_delta(uint32_t start, uint32_t stop)
+{
+  return (stop - start) & DMA_DEBUG_CNT_MASK;
+}
+
+#endif
@@ -0,0 +1,241 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         dma-queue.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Batched Datamover command submission and completion reaping.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "dma-queue.h"
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+#include "trace.h"
+
+static uint32_t dma_queue_xfer_cnt(struct dma_queue *q)
+{
+  q->reg_reads++;
+  if (q->dir == DMA_QUEUE_MM2S) {
+    return crash_read_reg(q->plblock->regs,DMA_MM2S_XFER_CNT);
+  } else {
+    return crash_read_reg(q->plblock->regs,DMA_S2MM_XFER_CNT);
+  }
+}
+
+int dma_queue_init(struct dma_queue *q, struct crash_plblock *plblock, uint dir, bool verify)
+{
+  uint sts_empty = (dir == DMA_QUEUE_MM2S) ? DMA_MM2S_STS_FIFO_EMPTY : DMA_S2MM_STS_FIFO_EMPTY;
+  uint sts = (dir == DMA_QUEUE_MM2S) ? DMA_MM2S_STS : DMA_S2MM_STS;
+  uint i;
+
+  if (dir != DMA_QUEUE_MM2S && dir != DMA_QUEUE_S2MM) {
+    printf("ERROR: Invalid DMA queue direction %d\n",dir);
+    return -1;
+  }
+  memset(q, 0, sizeof(struct dma_queue));
+  q->plblock = plblock;
+  q->dir = dir;
+  q->verify = verify;
+  if (verify) {
+    // Statuses left over from earlier transfers would be matched to ours
+    crash_clear_bit(plblock->regs,DMA_STS_FIFO_AUTO_READ);
+    for (i = 0; i < DMA_QUEUE_FIFO_DEPTH && !crash_get_bit(plblock->regs,sts_empty); i++) {
+      crash_read_reg(plblock->regs,sts);
+    }
+  } else {
+    // Nobody reads the status FIFOs, keep them from filling up
+    crash_set_bit(plblock->regs,DMA_STS_FIFO_AUTO_READ);
+  }
+  q->xfer_cnt_start = dma_queue_xfer_cnt(q);
+  if (dir == DMA_QUEUE_MM2S) {
+    crash_set_bit(plblock->regs,DMA_MM2S_XFER_EN);
+  } else {
+    crash_set_bit(plblock->regs,DMA_S2MM_XFER_EN);
+  }
+  return 0;
+}
+
+uint dma_queue_submit(struct dma_queue *q, const struct dma_desc *descs, uint n)
+{
+  uint room = DMA_QUEUE_FIFO_DEPTH - dma_queue_outstanding(q);
+  uint32_t cmd;
+  uint i;
+
+  // The total is capped at one FIFO depth rather than per tdest, so the status FIFO
+  // cannot overflow between reaps either
+  if (n > room) {
+    n = room;
+    q->full_stalls++;
+  }
+  for (i = 0; i < n; i++) {
+    cmd = (1 << 31) + ((descs[i].tdest & 0x7) << 23) + (descs[i].bytes & DMA_QUEUE_MAX_BYTES);
+    if (q->dir == DMA_QUEUE_MM2S) {
+      crash_write_reg(q->plblock->regs,DMA_MM2S_CMD_ADDR,descs[i].addr);
+      crash_write_reg(q->plblock->regs,DMA_MM2S_CMD_DATA,cmd);
+    } else {
+      crash_write_reg(q->plblock->regs,DMA_S2MM_CMD_ADDR,descs[i].addr);
+      crash_write_reg(q->plblock->regs,DMA_S2MM_CMD_DATA,cmd);
+    }
+    TRACE(TRACE_DMA_SUBMIT, (q->dir == DMA_QUEUE_MM2S) ? "MM2S" : "S2MM", q->submitted + i);
+  }
+  q->reg_writes += 2*n;
+  q->submitted += n;
+  if (dma_queue_outstanding(q) > q->max_outstanding) {
+    q->max_outstanding = dma_queue_outstanding(q);
+  }
+  return n;
+}
+
+// Pop and check the status bytes of n completed transfers
+static void dma_queue_check_status(struct dma_queue *q, uint n)
+{
+  uint sts_reg = (q->dir == DMA_QUEUE_MM2S) ? DMA_MM2S_STS : DMA_S2MM_STS;
+  uint8_t sts;
+  uint i;
+
+  for (i = 0; i < n; i++) {
+    sts = crash_read_reg(q->plblock->regs,sts_reg) & 0xFF;
+    q->reg_reads++;
+    q->tdest_completed[sts & DMA_QUEUE_STS_TAG & 0x7]++;
+    if (!(sts & DMA_QUEUE_STS_OKAY) || (sts & (DMA_QUEUE_STS_SLVERR | DMA_QUEUE_STS_DECERR |
+                                               DMA_QUEUE_STS_INTERR))) {
+      q->errors++;
+      q->last_error = sts;
+    }
+  }
+}
+
+int dma_queue_reap(struct dma_queue *q, uint min_complete, int timeout_us)
+{
+  struct timespec start;
+  struct timespec now;
+  uint32_t spin_start = 0;
+  uint32_t done;
+  uint reaped = 0;
+  uint n;
+  bool spin_started = false;
+  bool spinning = true;
+
+  if (min_complete > dma_queue_outstanding(q)) {
+    min_complete = dma_queue_outstanding(q);
+  }
+  q->reaps++;
+  while (1) {
+    done = dma_queue_xfer_cnt(q) - q->xfer_cnt_start;
+    n = done - q->completed;
+    if (n > 0) {
+      if (q->verify) {
+        dma_queue_check_status(q, n);
+      }
+      // Completions are only seen at the reap, so they all get its timestamp
+      for (; trace_enabled && q->completed != done; q->completed++) {
+        trace_event(TRACE_DMA_COMPLETE, (q->dir == DMA_QUEUE_MM2S) ? "MM2S" : "S2MM", q->completed);
+      }
+      q->completed = done;
+      reaped += n;
+    }
+    if (reaped >= min_complete) {
+      break;
+    }
+    // Spin briefly, then sleep on the interrupt like crash_wait_bit()
+    if (spinning) {
+      if (!spin_started) {
+        spin_start = crash_read_reg(q->plblock->regs,DMA_DEBUG_CNT);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spin_started = true;
+      } else if (dma_debug_cnt_delta(spin_start, crash_read_reg(q->plblock->regs,DMA_DEBUG_CNT)) >
+                 CRASH_WAIT_SPIN_CYCLES) {
+        spinning = false;
+      }
+    } else {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (timeout_us >= 0 && (now.tv_sec - start.tv_sec)*1000000 +
+                             (now.tv_nsec - start.tv_nsec)/1000 >= timeout_us) {
+        return -1;
+      }
+      crash_wait_event(q->plblock, CRASH_WAIT_POLL_MS*1000);
+    }
+  }
+  if (reaped == 0) {
+    q->empty_reaps++;
+  }
+  return reaped;
+}
+
+int dma_queue_submit_all(struct dma_queue *q, const struct dma_desc *descs, uint n, int timeout_us)
+{
+  uint queued = 0;
+
+  while (1) {
+    queued += dma_queue_submit(q, &descs[queued], n - queued);
+    if (queued == n) {
+      return 0;
+    }
+    // Full, wait for at least one slot
+    if (dma_queue_reap(q, 1, timeout_us) < 0) {
+      return -1;
+    }
+  }
+}
+
+int dma_queue_stop(struct dma_queue *q, int timeout_us)
+{
+  int ret = 0;
+
+  if (dma_queue_reap(q, dma_queue_outstanding(q), timeout_us) < 0) {
+    ret = -1;
+  }
+  if (q->dir == DMA_QUEUE_MM2S) {
+    crash_clear_bit(q->plblock->regs,DMA_MM2S_XFER_EN);
+  } else {
+    crash_clear_bit(q->plblock->regs,DMA_S2MM_XFER_EN);
+  }
+  return ret;
+}
+
+void dma_queue_print_stats(struct dma_queue *q)
+{
+  uint i;
+
+  printf("DMA Queue Direction:\t\t%s\n",(q->dir == DMA_QUEUE_MM2S) ? "MM2S" : "S2MM");
+  printf("DMA Transfers Submitted:\t%u\n",q->submitted);
+  printf("DMA Transfers Completed:\t%u\n",q->completed);
+  printf("DMA Max Outstanding:\t\t%d\n",q->max_outstanding);
+  printf("DMA Reaps (empty):\t\t%llu (%llu)\n",(unsigned long long)q->reaps,
+         (unsigned long long)q->empty_reaps);
+  printf("DMA Full Stalls:\t\t%llu\n",(unsigned long long)q->full_stalls);
+  if (q->completed > 0) {
+    printf("DMA Register Accesses / Xfer:\t%f\n",(double)(q->reg_reads + q->reg_writes)/q->completed);
+  }
+  if (q->verify) {
+    printf("DMA Errors:\t\t\t%llu\n",(unsigned long long)q->errors);
+    if (q->errors > 0) {
+      printf("DMA Last Error Status:\t\t0x%02X\n",q->last_error);
+    }
+    for (i = 0; i < DMA_QUEUE_NUM_TDEST; i++) {
+      if (q->tdest_completed[i] > 0) {
+        printf("DMA Transfers tdest %d:\t\t%llu\n",i,(unsigned long long)q->tdest_completed[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,108 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         dma-queue.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Batched Datamover command submission and completion reaping.
+**
+**                ps_pl_interface queues up to DMA_QUEUE_FIFO_DEPTH commands per
+**                tdest and direction (control banks 2 / 3 for MM2S, 4 / 5 for
+**                S2MM) and runs them back to back while the transfer enable
+**                stays set. Submitting a vector of descriptors therefore costs
+**                two register writes per transfer and nothing else; the enable
+**                is set once for the life of the queue.
+**
+**                Completions are reaped in batches: one read of the transfer
+**                counter (status banks 10 / 11) gives the number finished since
+**                the last reap. With verify set, the status byte of each one is
+**                also popped from the status FIFO (status banks 6 / 7) and
+**                checked for Datamover errors, its tag being the tdest.
+**                Without verify the status FIFOs are left to auto-read.
+**
+**                The queue counts every transfer in its direction, so it must
+**                be the only user of that direction while it is running (not
+**                combined with crash_read() / crash_write() / crash_start_dma()).
+**
+******************************************************************************/
+#ifndef DMA_QUEUE_H
+#define DMA_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+struct crash_plblock;
+
+#define DMA_QUEUE_MM2S            0
+#define DMA_QUEUE_S2MM            1
+#define DMA_QUEUE_FIFO_DEPTH      64          // Command FIFOs and status FIFOs
+#define DMA_QUEUE_MAX_BYTES       0x7FFFFF    // 23-bit transfer size field
+#define DMA_QUEUE_NUM_TDEST       8
+
+// Size of the DMA buffer (dma_buff) libcrash maps for a plblock. Kernel module headers
+// that do not define it get 8 MiB, one maximum size transfer.
+#ifndef CRASH_DMA_BUFF_SIZE
+#define CRASH_DMA_BUFF_SIZE       (DMA_QUEUE_MAX_BYTES + 1)
+#endif
+
+// Datamover status byte
+#define DMA_QUEUE_STS_OKAY        0x80
+#define DMA_QUEUE_STS_SLVERR      0x40
+#define DMA_QUEUE_STS_DECERR      0x20
+#define DMA_QUEUE_STS_INTERR      0x10
+#define DMA_QUEUE_STS_TAG         0x0F
+
+struct dma_desc {
+  uint32_t addr;                  // Physical address
+  uint32_t bytes;
+  uint tdest;                     // MM2S tdest / S2MM tid
+};
+
+struct dma_queue {
+  struct crash_plblock *plblock;
+  uint dir;
+  bool verify;
+  uint32_t xfer_cnt_start;
+  uint32_t submitted;
+  uint32_t completed;
+  uint max_outstanding;
+  uint64_t reaps;
+  uint64_t empty_reaps;
+  uint64_t full_stalls;           // Submits that found the queue full
+  uint64_t reg_writes;
+  uint64_t reg_reads;
+  uint64_t errors;
+  uint8_t last_error;             // Status byte of the last failed transfer
+  uint64_t tdest_completed[DMA_QUEUE_NUM_TDEST];    // Only counted with verify
+};
+
+// Enable transfers in direction dir (DMA_QUEUE_MM2S / DMA_QUEUE_S2MM)
+int dma_queue_init(struct dma_queue *q, struct crash_plblock *plblock, uint dir, bool verify);
+// Queue as many of the n descriptors as there is room for. Returns the number queued.
+uint dma_queue_submit(struct dma_queue *q, const struct dma_desc *descs, uint n);
+// Queue all n descriptors, reaping as needed to make room. Returns -1 on timeout.
+int dma_queue_submit_all(struct dma_queue *q, const struct dma_desc *descs, uint n, int timeout_us);
+// Reap completed transfers, waiting until at least min_complete are done (0 does not wait).
+// Returns the number reaped, or -1 on timeout.
+int dma_queue_reap(struct dma_queue *q, uint min_complete, int timeout_us);
+static inline uint dma_queue_outstanding(struct dma_queue *q)
+{
+  return q->submitted - q->completed;
+}
+// Wait for everything queued to complete and disable transfers in this direction
+int dma_queue_stop(struct dma_queue *q, int timeout_us);
+void dma_queue_print_stats(struct dma_queue *q);
+
+#endif
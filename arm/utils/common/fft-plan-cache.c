@@ -0,0 +1,126 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         fft-plan-cache.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Cache of FFTW3 forward plans with persistent wisdom.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fftw3.h>
+#include "fft-plan-cache.h"
+#include "trace.h"
+
+struct fft_plan_entry {
+  int n;
+  int in_alignment;
+  int out_alignment;
+  bool in_place;
+  fftwf_plan plan;
+};
+
+static struct fft_plan_entry plan_cache[FFT_PLAN_CACHE_SIZE];
+static int num_plans = 0;
+static unsigned flags = FFTW_MEASURE;
+static char wisdom_filename[256] = FFT_WISDOM_FILE;
+
+int fft_plan_cache_init(const char *wisdom_file, unsigned planner_flags)
+{
+  if (wisdom_file != NULL) {
+    strncpy(wisdom_filename, wisdom_file, sizeof(wisdom_filename)-1);
+  }
+  flags = planner_flags;
+  return fftwf_import_wisdom_from_filename(wisdom_filename);
+}
+
+fftwf_plan fft_plan_cache_get(int n, fftwf_complex *in, fftwf_complex *out)
+{
+  int i;
+  int in_alignment = fftwf_alignment_of((float *)in);
+  int out_alignment = fftwf_alignment_of((float *)out);
+  bool in_place = (in == out);
+  fftwf_plan plan;
+
+  for (i = 0; i < num_plans; i++) {
+    if (plan_cache[i].n == n &&
+        plan_cache[i].in_alignment == in_alignment &&
+        plan_cache[i].out_alignment == out_alignment &&
+        plan_cache[i].in_place == in_place) {
+      return plan_cache[i].plan;
+    }
+  }
+
+  if (num_plans == FFT_PLAN_CACHE_SIZE) {
+    printf("ERROR: FFT plan cache full\n");
+    return NULL;
+  }
+
+  // With wisdom for this size this returns almost immediately, otherwise FFTW
+  // times the candidate kernels on the buffers.
+  plan = fftwf_plan_dft_1d(n, in, out, FFTW_FORWARD, flags);
+  if (plan == NULL) {
+    printf("ERROR: Failed to create FFT plan of size %d\n",n);
+    return NULL;
+  }
+  plan_cache[num_plans].n = n;
+  plan_cache[num_plans].in_alignment = in_alignment;
+  plan_cache[num_plans].out_alignment = out_alignment;
+  plan_cache[num_plans].in_place = in_place;
+  plan_cache[num_plans].plan = plan;
+  num_plans++;
+
+  // Save new wisdom right away so it survives the program being killed
+  if (fftwf_export_wisdom_to_filename(wisdom_filename) == 0) {
+    printf("WARNING: Failed to export FFTW wisdom to %s\n",wisdom_filename);
+  }
+  return plan;
+}
+
+// Transform size of a cached plan, for the trace
+static int fft_plan_cache_size(const fftwf_plan plan)
+{
+  int i;
+
+  for (i = 0; i < num_plans; i++) {
+    if (plan_cache[i].plan == plan) {
+      return plan_cache[i].n;
+    }
+  }
+  return 0;
+}
+
+void fft_plan_cache_execute(const fftwf_plan plan, fftwf_complex *in, fftwf_complex *out)
+{
+  TRACE(TRACE_FFT_START, "FFT", fft_plan_cache_size(plan));
+  fftwf_execute_dft(plan, in, out);
+  TRACE(TRACE_FFT_END, "FFT", 0);
+}
+
+void fft_plan_cache_cleanup(void)
+{
+  int i;
+
+  if (num_plans > 0) {
+    fftwf_export_wisdom_to_filename(wisdom_filename);
+  }
+  for (i = 0; i < num_plans; i++) {
+    fftwf_destroy_plan(plan_cache[i].plan);
+  }
+  num_plans = 0;
+}
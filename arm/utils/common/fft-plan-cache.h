@@ -0,0 +1,49 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         fft-plan-cache.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Cache of FFTW3 forward plans keyed by transform size and the
+**                alignment of the input / output buffers. Plans are created
+**                once with FFTW_MEASURE (or FFTW_PATIENT) and the accumulated
+**                wisdom is imported from / exported to a file so restarting a
+**                program does not pay the planning cost again.
+**
+**                Since a cached plan may be reused on any buffers with the same
+**                alignment, run it with fft_plan_cache_execute() rather than
+**                fftwf_execute().
+**
+******************************************************************************/
+#ifndef FFT_PLAN_CACHE_H
+#define FFT_PLAN_CACHE_H
+
+#include <fftw3.h>
+
+#define FFT_PLAN_CACHE_SIZE       16
+#define FFT_WISDOM_FILE           "crash-fftwf.wisdom"
+
+// Import wisdom from wisdom_file (FFT_WISDOM_FILE if NULL). planner_flags are the
+// FFTW planner flags used for every plan created afterwards, e.g. FFTW_MEASURE.
+// Returns 1 if wisdom was imported, 0 if the file did not exist or was invalid.
+int fft_plan_cache_init(const char *wisdom_file, unsigned planner_flags);
+// Get a forward plan of size n that can be executed on in / out (or any buffers with
+// the same alignment). Planning may overwrite the contents of in and out.
+fftwf_plan fft_plan_cache_get(int n, fftwf_complex *in, fftwf_complex *out);
+void fft_plan_cache_execute(const fftwf_plan plan, fftwf_complex *in, fftwf_complex *out);
+// Export wisdom and destroy all cached plans
+void fft_plan_cache_cleanup(void);
+
+#endif
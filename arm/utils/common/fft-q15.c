@@ -0,0 +1,216 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         fft-q15.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Q15 FFT and threshold. Butterflies and the magnitude compare use
+**                NEON int16 multiplies with 32-bit accumulation when building for
+**                the Zynq, plain C otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "fft-q15.h"
+#include "trace.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+static int16_t fft_q15_round(double x)
+{
+  x = round(32767.0*x);
+  if (x > 32767.0) return 32767;
+  if (x < -32768.0) return -32768;
+  return (int16_t)x;
+}
+
+int fft_q15_init(struct fft_q15 *f, uint number_samples)
+{
+  uint h;
+  uint i;
+  uint j;
+  uint rev;
+
+  memset(f, 0, sizeof(struct fft_q15));
+  if (number_samples < 2 || (number_samples & (number_samples - 1)) != 0 || number_samples > 65536) {
+    printf("ERROR: Q15 FFT size must be a power of 2\n");
+    return -1;
+  }
+  f->number_samples = number_samples;
+  while ((1U << f->log2n) < number_samples) f->log2n++;
+
+  // Stage twiddles are stored contiguously so the butterflies can load them as vectors:
+  // stage with span h uses exp(-j*pi*k/h) for k = 0 .. h-1, 1 + 2 + ... + N/2 = N-1 total
+  f->twiddle = (int16_t *)malloc(2*number_samples*sizeof(int16_t));
+  f->bitrev = (uint16_t *)malloc(number_samples*sizeof(uint16_t));
+  f->out = (int16_t *)malloc(2*number_samples*sizeof(int16_t));
+  if (f->twiddle == NULL || f->bitrev == NULL || f->out == NULL) {
+    printf("ERROR: Failed to allocate Q15 FFT buffers\n");
+    fft_q15_free(f);
+    return -1;
+  }
+  for (h = 1; h < number_samples; h *= 2) {
+    for (j = 0; j < h; j++) {
+      f->twiddle[2*(h - 1 + j)] = fft_q15_round(cos(M_PI*j/h));
+      f->twiddle[2*(h - 1 + j) + 1] = fft_q15_round(-sin(M_PI*j/h));
+    }
+  }
+  for (i = 0; i < number_samples; i++) {
+    rev = 0;
+    for (j = 0; j < f->log2n; j++) {
+      rev |= ((i >> j) & 1) << (f->log2n - 1 - j);
+    }
+    f->bitrev[i] = rev;
+  }
+  return 0;
+}
+
+// (a + w*b)/2 and (a - w*b)/2. w*b is Q30, the halving keeps the result in range.
+static inline void fft_q15_butterfly(int16_t *a, int16_t *b, const int16_t *w)
+{
+  int64_t tr = (int32_t)w[0]*b[0] - (int32_t)w[1]*b[1];
+  int64_t ti = (int32_t)w[0]*b[1] + (int32_t)w[1]*b[0];
+  int64_t ar = (int64_t)a[0] << 15;
+  int64_t ai = (int64_t)a[1] << 15;
+  int64_t v[4];
+  int k;
+
+  v[0] = (ar + tr + (1 << 15)) >> 16;
+  v[1] = (ai + ti + (1 << 15)) >> 16;
+  v[2] = (ar - tr + (1 << 15)) >> 16;
+  v[3] = (ai - ti + (1 << 15)) >> 16;
+  for (k = 0; k < 4; k++) {
+    if (v[k] > 32767) v[k] = 32767;
+    if (v[k] < -32768) v[k] = -32768;
+  }
+  a[0] = v[0];
+  a[1] = v[1];
+  b[0] = v[2];
+  b[1] = v[3];
+}
+
+void fft_q15_execute(struct fft_q15 *f, const int16_t *in)
+{
+  const uint32_t *in_iq = (const uint32_t *)in;
+  uint32_t *out_iq = (uint32_t *)f->out;
+  int16_t *x = f->out;
+  const int16_t *tw;
+  uint n = f->number_samples;
+  uint h;
+  uint j;
+  uint k;
+
+  TRACE(TRACE_FFT_START, "FFT Q15", n);
+  // Each sample is one 32-bit I/Q pair
+  for (k = 0; k < n; k++) {
+    out_iq[f->bitrev[k]] = in_iq[k];
+  }
+
+  for (h = 1; h < n; h *= 2) {
+    tw = f->twiddle + 2*(h - 1);
+#ifdef __ARM_NEON__
+    if (h >= 4) {
+      int16x4x2_t a;
+      int16x4x2_t b;
+      int16x4x2_t w;
+      int32x4_t ar;
+      int32x4_t ai;
+      int32x4_t tr;
+      int32x4_t ti;
+      for (k = 0; k < n; k += 2*h) {
+        for (j = 0; j < h; j += 4) {
+          a = vld2_s16(x + 2*(k + j));
+          b = vld2_s16(x + 2*(k + j + h));
+          w = vld2_s16(tw + 2*j);
+          tr = vmlsl_s16(vmull_s16(w.val[0], b.val[0]), w.val[1], b.val[1]);
+          ti = vmlal_s16(vmull_s16(w.val[0], b.val[1]), w.val[1], b.val[0]);
+          ar = vshll_n_s16(a.val[0], 15);
+          ai = vshll_n_s16(a.val[1], 15);
+          a.val[0] = vqrshrn_n_s32(vhaddq_s32(ar, tr), 15);
+          a.val[1] = vqrshrn_n_s32(vhaddq_s32(ai, ti), 15);
+          b.val[0] = vqrshrn_n_s32(vhsubq_s32(ar, tr), 15);
+          b.val[1] = vqrshrn_n_s32(vhsubq_s32(ai, ti), 15);
+          vst2_s16(x + 2*(k + j), a);
+          vst2_s16(x + 2*(k + j + h), b);
+        }
+      }
+      continue;
+    }
+#endif
+    for (k = 0; k < n; k += 2*h) {
+      for (j = 0; j < h; j++) {
+        fft_q15_butterfly(x + 2*(k + j), x + 2*(k + j + h), tw + 2*j);
+      }
+    }
+  }
+  TRACE(TRACE_FFT_END, "FFT Q15", 0);
+}
+
+int fft_q15_threshold(struct fft_q15 *f, float threshold, float *mag)
+{
+  const int16_t *x = f->out;
+  uint n = f->number_samples;
+  uint32_t mag_sq;
+  double thr;
+  uint32_t thr_sq;
+  uint i = 0;
+
+  // Float path magnitudes are N * (Q15 magnitude / 32768)
+  thr = (double)threshold*32768.0/n;
+  thr = ceil(thr*thr);
+  thr_sq = (thr > 4294967295.0) ? 0xFFFFFFFF : (uint32_t)thr;
+
+#ifdef __ARM_NEON__
+  {
+    int16x4x2_t v;
+    uint32x4_t thr_vec = vdupq_n_u32(thr_sq);
+    uint32x4_t cmp;
+    uint32x2_t any;
+    for (; i + 4 <= n; i += 4) {
+      v = vld2_s16(x + 2*i);
+      // I^2 + Q^2 is at most 2^31, unsigned so -32768^2 + -32768^2 does not wrap negative
+      cmp = vcgeq_u32(vreinterpretq_u32_s32(vmlal_s16(vmull_s16(v.val[0], v.val[0]), v.val[1], v.val[1])), thr_vec);
+      any = vorr_u32(vget_low_u32(cmp), vget_high_u32(cmp));
+      if (vget_lane_u32(vpmax_u32(any, any), 0) != 0) {
+        break;
+      }
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    mag_sq = (uint32_t)((int32_t)x[2*i]*x[2*i]) + (uint32_t)((int32_t)x[2*i+1]*x[2*i+1]);
+    if (mag_sq >= thr_sq) {
+      if (mag != NULL) {
+        *mag = sqrtf((float)mag_sq)*n/32768.0;
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+void fft_q15_free(struct fft_q15 *f)
+{
+  free(f->twiddle);
+  free(f->bitrev);
+  free(f->out);
+  f->twiddle = NULL;
+  f->bitrev = NULL;
+  f->out = NULL;
+}
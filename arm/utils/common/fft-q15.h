@@ -0,0 +1,57 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         fft-q15.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Fixed point (Q15) complex FFT and magnitude threshold for frames
+**                of packed 16-bit I/Q samples (see sample-format.h). Samples
+**                are int16 I, Q pairs, i.e. 4 bytes per sample instead of the 8
+**                bytes of complex float.
+**
+**                Radix-2 decimation in time. Every stage halves its output so
+**                the FFT cannot overflow, making the result the DFT / N. The
+**                threshold function takes the same threshold as the float path
+**                (unscaled FFTW output on samples in [-1,1)) and scales it to
+**                match, so thresholds carry over between formats. The 1/N
+**                scaling costs dynamic range: weak signals in large FFTs lose
+**                more precision than in the float path.
+**
+******************************************************************************/
+#ifndef FFT_Q15_H
+#define FFT_Q15_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct fft_q15 {
+  uint number_samples;
+  uint log2n;
+  int16_t *twiddle;               // Per stage twiddles (cos, -sin), stage with span h at 2*(h-1)
+  uint16_t *bitrev;
+  int16_t *out;                   // FFT output, I / Q interleaved
+};
+
+int fft_q15_init(struct fft_q15 *f, uint number_samples);
+// Transform number_samples packed I/Q samples, the result is left in f->out. in can be
+// the DMA buffer, it is only read once.
+void fft_q15_execute(struct fft_q15 *f, const int16_t *in);
+// Returns the first bin of f->out with a magnitude at or above the threshold or -1.
+// mag (optional) is set to that bin's magnitude, both in float FFT units.
+int fft_q15_threshold(struct fft_q15 *f, float threshold, float *mag);
+void fft_q15_free(struct fft_q15 *f);
+
+#endif
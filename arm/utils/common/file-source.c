@@ -0,0 +1,163 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         file-source.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Sequential reader for waveform files of any size using mmap.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "file-source.h"
+
+// Files can be larger than 2 GiB, which needs a 64-bit off_t on the 32-bit ARM
+#if !defined(__LP64__) && (!defined(_FILE_OFFSET_BITS) || _FILE_OFFSET_BITS != 64)
+#error "Build with -D_FILE_OFFSET_BITS=64"
+#endif
+
+int file_source_open(struct file_source *src, const char *filename, size_t window_size,
+                     size_t readahead, bool loop)
+{
+  struct stat st;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+
+  memset(src, 0, sizeof(struct file_source));
+  src->fd = open(filename, O_RDONLY);
+  if (src->fd < 0) {
+    printf("ERROR: Failed to open %s\n",filename);
+    return -1;
+  }
+  if (fstat(src->fd, &st) != 0) {
+    printf("ERROR: Failed to stat %s\n",filename);
+    close(src->fd);
+    src->fd = -1;
+    return -1;
+  }
+  if (st.st_size == 0) {
+    printf("ERROR: %s is empty\n",filename);
+    close(src->fd);
+    src->fd = -1;
+    return -1;
+  }
+  src->file_size = st.st_size;
+  src->loop = loop;
+  src->window_size = (window_size + page_size - 1)/page_size*page_size;
+  src->readahead = readahead;
+  return 0;
+}
+
+// Map the window holding src->pos
+static int file_source_map(struct file_source *src)
+{
+  if (src->window != NULL) {
+    munmap(src->window, src->window_len);
+    src->window = NULL;
+  }
+  // mmap offsets must be page aligned, window_size is a multiple of the page size
+  src->window_offset = src->pos/src->window_size*src->window_size;
+  src->window_len = src->window_size;
+  if (src->window_offset + src->window_len > src->file_size) {
+    src->window_len = src->file_size - src->window_offset;
+  }
+  src->window = (uint8_t *)mmap(NULL, src->window_len, PROT_READ, MAP_SHARED, src->fd,
+                                (off_t)src->window_offset);
+  if (src->window == MAP_FAILED) {
+    printf("ERROR: Failed to map waveform file\n");
+    src->window = NULL;
+    return -1;
+  }
+  madvise(src->window, src->window_len, MADV_SEQUENTIAL);
+  src->advised = src->window_offset;
+  src->remaps++;
+  return 0;
+}
+
+ssize_t file_source_read(struct file_source *src, void *dst, size_t len)
+{
+  uint8_t *out = (uint8_t *)dst;
+  size_t copied = 0;
+  size_t n;
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t advise_end;
+  uint64_t done;
+
+  while (copied < len) {
+    if (src->pos == src->file_size) {
+      if (!src->loop) break;
+      src->pos = 0;
+      src->wraps++;
+    }
+    if (src->window == NULL || src->pos < src->window_offset ||
+        src->pos >= src->window_offset + src->window_len) {
+      if (file_source_map(src) != 0) {
+        return -1;
+      }
+    }
+    // Keep readahead bytes requested ahead of the read position
+    advise_end = src->pos + src->readahead;
+    if (advise_end > src->window_offset + src->window_len) {
+      advise_end = src->window_offset + src->window_len;
+    }
+    if (advise_end > src->advised) {
+      madvise(src->window + (src->advised - src->window_offset),
+              advise_end - src->advised, MADV_WILLNEED);
+      src->advised = advise_end;
+    }
+    n = src->window_offset + src->window_len - src->pos;
+    if (n > len - copied) n = len - copied;
+    memcpy(out + copied, src->window + (src->pos - src->window_offset), n);
+    copied += n;
+    src->pos += n;
+    // Drop consumed pages from the page cache a readahead's worth at a time
+    done = src->pos/page_size*page_size;
+    if (done < src->released) {
+      src->released = 0;    // Wrapped
+    }
+    if (done - src->released >= src->readahead || src->pos == src->file_size) {
+      posix_fadvise(src->fd, (off_t)src->released, (off_t)(done - src->released), POSIX_FADV_DONTNEED);
+      src->released = done;
+    }
+  }
+  src->bytes_read += copied;
+  return copied;
+}
+
+void file_source_close(struct file_source *src)
+{
+  if (src->window != NULL) {
+    munmap(src->window, src->window_len);
+    src->window = NULL;
+  }
+  if (src->fd >= 0) {
+    close(src->fd);
+    src->fd = -1;
+  }
+}
+
+void file_source_print_stats(struct file_source *src)
+{
+  printf("File Size (MB):\t\t\t%f\n",src->file_size/1e6);
+  printf("File Bytes Read (MB):\t\t%f\n",src->bytes_read/1e6);
+  printf("File Windows Mapped:\t\t%llu\n",(unsigned long long)src->remaps);
+  printf("File Loops:\t\t\t%llu\n",(unsigned long long)src->wraps);
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         file-source.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Sequential reader for waveform files of any size using mmap.
+**
+**                The file is mapped a window at a time, so files larger than
+**                the 32-bit address space can be replayed. madvise(SEQUENTIAL)
+**                enables aggressive kernel read-ahead on each window, the next
+**                readahead bytes are requested with MADV_WILLNEED ahead of use
+**                and consumed pages are dropped with POSIX_FADV_DONTNEED so a
+**                long replay does not push everything else out of the page cache.
+**
+**                With loop set, reads wrap to the start of the file.
+**
+******************************************************************************/
+#ifndef FILE_SOURCE_H
+#define FILE_SOURCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define FILE_SOURCE_DEFAULT_WINDOW    (64*1024*1024)
+#define FILE_SOURCE_DEFAULT_READAHEAD (4*1024*1024)
+
+struct file_source {
+  int fd;
+  uint64_t file_size;
+  bool loop;
+  size_t window_size;             // Multiple of the page size
+  size_t readahead;
+  uint8_t *window;                // Current mapping, NULL if none
+  uint64_t window_offset;         // File offset of the mapping
+  size_t window_len;
+  uint64_t pos;                   // Next file offset to read
+  uint64_t advised;               // File offset up to which MADV_WILLNEED was issued
+  uint64_t released;              // File offset up to which pages were dropped from the cache
+  uint64_t bytes_read;
+  uint64_t remaps;
+  uint64_t wraps;
+};
+
+int file_source_open(struct file_source *src, const char *filename, size_t window_size,
+                     size_t readahead, bool loop);
+// Copy up to len bytes to dst. Returns the number of bytes copied, which is only
+// less than len at the end of a file that is not looped, or -1 on error.
+ssize_t file_source_read(struct file_source *src, void *dst, size_t len);
+void file_source_close(struct file_source *src);
+void file_source_print_stats(struct file_source *src);
+
+#endif
@@ -0,0 +1,147 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         frame-ring.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Continuous receive using the libcrash DMA ring buffer.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "frame-ring.h"
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+#include "trace.h"
+
+// Accumulate DMA_DEBUG_CNT into a 64-bit count. Correct as long as we are called at
+// least once per counter wrap (~7 seconds), frame_ring_next() polls far more often.
+static uint32_t frame_ring_update_time(struct frame_ring *ring)
+{
+  uint32_t cnt = crash_read_reg(ring->plblock->regs,DMA_DEBUG_CNT);
+  uint32_t delta = dma_debug_cnt_delta(ring->last_cnt, cnt);
+
+  ring->elapsed_cycles += delta;
+  ring->last_cnt = cnt;
+  return delta;
+}
+
+int frame_ring_start(struct frame_ring *ring, struct crash_plblock *plblock, uint plblock_id,
+                     uint num_buffs, uint number_samples, uint decim_rate)
+{
+  if (num_buffs < FRAME_RING_MIN_BUFFS) {
+    printf("ERROR: Frame ring needs at least %d buffers\n",FRAME_RING_MIN_BUFFS);
+    return -1;
+  }
+  memset(ring, 0, sizeof(struct frame_ring));
+  ring->plblock = plblock;
+  ring->plblock_id = plblock_id;
+  ring->num_buffs = num_buffs;
+  ring->number_samples = number_samples;
+  // ADC runs at 100 MSPS, DMA_DEBUG_CNT at 150 MHz
+  ring->frame_cycles = (uint32_t)(1.5*number_samples*decim_rate);
+  ring->start_xfer = crash_read_reg(plblock->regs,DMA_S2MM_XFER_CNT);
+  if (crash_start_dma(plblock, plblock_id, num_buffs, number_samples) != 0) {
+    printf("ERROR: Failed to start DMA ring\n");
+    return -1;
+  }
+  ring->start_cnt = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+  ring->last_cnt = ring->start_cnt;
+  return 0;
+}
+
+void *frame_ring_next(struct frame_ring *ring)
+{
+  struct dma_buff rx_dma_buff;
+  uint32_t produced;
+  uint slot;
+  uint64_t timeout = 0;
+  uint32_t delta;
+
+  // Spans the wait for the frame, which is all of the DMA the ring consumer sees
+  TRACE(TRACE_DMA_SUBMIT, "DMA Ring", ring->frames);
+  while (1) {
+    rx_dma_buff = crash_get_dma_buffer(ring->plblock, ring->number_samples);
+    delta = frame_ring_update_time(ring);
+    if (rx_dma_buff.num_words > 0) {
+      break;
+    }
+    ring->empty_polls++;
+    ring->wait_cycles += delta;
+    timeout += delta;
+    if (timeout > FRAME_RING_TIMEOUT_CYCLES) {
+      TRACE(TRACE_DMA_COMPLETE, "DMA Ring", ring->frames);
+      return NULL;
+    }
+    // Past the spin period, sleep until the DMA interrupt or at most half a frame
+    if (timeout > CRASH_WAIT_SPIN_CYCLES) {
+      crash_wait_event(ring->plblock, ring->frame_cycles/300);
+    }
+  }
+  TRACE(TRACE_DMA_COMPLETE, "DMA Ring", ring->frames);
+  ring->frames++;
+
+  // Frames the DMA has written so far vs. frames we consumed. Up to num_buffs frames
+  // can be waiting in the ring, anything beyond that was overwritten.
+  produced = crash_read_reg(ring->plblock->regs,DMA_S2MM_XFER_CNT) - ring->start_xfer;
+  // The frame in this buffer is the last one the DMA finished writing to it
+  slot = ((uint8_t *)rx_dma_buff.buff - (uint8_t *)ring->plblock->dma_buff)/
+         (ring->number_samples*sizeof(uint64_t));
+  if (produced > slot) {
+    ring->seq = produced - 1 - ((produced - 1 - slot) % ring->num_buffs);
+  } else {
+    ring->seq = slot;
+  }
+  if (produced > ring->frames + ring->num_buffs &&
+      produced - ring->frames - ring->num_buffs > ring->dropped_frames) {
+    ring->dropped_frames = produced - ring->frames - ring->num_buffs;
+  }
+  return (void *)rx_dma_buff.buff;
+}
+
+bool frame_ring_overwritten(struct frame_ring *ring, uint64_t seq)
+{
+  uint32_t produced = crash_read_reg(ring->plblock->regs,DMA_S2MM_XFER_CNT) - ring->start_xfer;
+
+  // Frame seq + num_buffs goes into the same buffer and starts as soon as the one
+  // before it is done
+  return produced >= seq + ring->num_buffs;
+}
+
+void frame_ring_stop(struct frame_ring *ring)
+{
+  frame_ring_update_time(ring);
+  crash_stop_dma(ring->plblock);
+}
+
+void frame_ring_print_stats(struct frame_ring *ring)
+{
+  double elapsed_sec = ring->elapsed_cycles/150e6;
+
+  printf("Ring Buffers:\t\t\t%d\n",ring->num_buffs);
+  printf("Frames Processed:\t\t%llu\n",(unsigned long long)ring->frames);
+  printf("Frames Dropped:\t\t\t%llu\n",(unsigned long long)ring->dropped_frames);
+  printf("Empty Polls:\t\t\t%llu\n",(unsigned long long)ring->empty_polls);
+  if (elapsed_sec > 0.0) {
+    printf("Frame Rate (frames/s):\t\t%f\n",ring->frames/elapsed_sec);
+    printf("Input Frame Rate (frames/s):\t%f\n",150e6/ring->frame_cycles);
+    printf("DMA Wait (%%):\t\t\t%f\n",100.0*ring->wait_cycles/ring->elapsed_cycles);
+  }
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         frame-ring.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Continuous receive using the libcrash DMA ring buffer
+**                (crash_start_dma / crash_get_dma_buffer). While the caller
+**                processes frame N, the DMA keeps filling the following
+**                buffers in the ring, so DMA time and processing time overlap
+**                instead of adding up.
+**
+**                The number of frames the DMA has written is read from
+**                DMA_S2MM_XFER_CNT. Any frame that was written but never handed
+**                to the caller before the ring wrapped is counted as dropped. The
+**                count covers every S2MM transfer, so nothing else should use
+**                the S2MM channel while the ring runs.
+**
+**                Every frame returned gets its DMA frame number (ring->seq), so
+**                callers can tell whether two frames were contiguous, and
+**                frame_ring_overwritten() tells whether a buffer still held
+**                elsewhere has been reused by the DMA.
+**
+**                Start the ring after RX is enabled. The decimation rate is
+**                only used for the wait timing.
+**
+******************************************************************************/
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+struct crash_plblock;
+
+#define FRAME_RING_MIN_BUFFS      2
+#define FRAME_RING_TIMEOUT_CYCLES 150000000   // 1 second of DMA_DEBUG_CNT
+
+struct frame_ring {
+  struct crash_plblock *plblock;
+  uint plblock_id;
+  uint num_buffs;
+  uint number_samples;
+  uint32_t frame_cycles;          // Time between frames in DMA_DEBUG_CNT cycles
+  uint32_t start_xfer;            // DMA_S2MM_XFER_CNT at frame_ring_start()
+  uint32_t start_cnt;
+  uint32_t last_cnt;
+  uint64_t elapsed_cycles;        // Since frame_ring_start(), extended past the counter wrap
+  uint64_t wait_cycles;           // Time spent in frame_ring_next() waiting on the DMA
+  uint64_t frames;                // Frames handed to the caller
+  uint64_t seq;                   // DMA frame number of the last frame returned
+  uint64_t dropped_frames;
+  uint64_t empty_polls;
+};
+
+// Start continuous DMA into a ring of num_buffs buffers of number_samples 64-bit words.
+// decim_rate is only used to compute the expected frame interval for the waits.
+int frame_ring_start(struct frame_ring *ring, struct crash_plblock *plblock, uint plblock_id,
+                     uint num_buffs, uint number_samples, uint decim_rate);
+// Wait for the next filled buffer. Returns NULL if no frame arrived within
+// FRAME_RING_TIMEOUT_CYCLES.
+void *frame_ring_next(struct frame_ring *ring);
+// True once the DMA has started writing over the buffer that held frame seq, i.e. the
+// frame's data can no longer be trusted
+bool frame_ring_overwritten(struct frame_ring *ring, uint64_t seq);
+void frame_ring_stop(struct frame_ring *ring);
+void frame_ring_print_stats(struct frame_ring *ring);
+
+#endif
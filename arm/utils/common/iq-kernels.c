@@ -0,0 +1,223 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         iq-kernels.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Vectorized sample conversion kernels.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "iq-kernels.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+// Scalar equivalents of VCVT.S32.F32 and VQMOVN.S32
+static inline int32_t iq_sat_s32(float x)
+{
+  if (x != x) return 0;
+  if (x >= 2147483647.0f) return INT32_MAX;
+  if (x <= -2147483648.0f) return INT32_MIN;
+  return (int32_t)x;
+}
+
+static inline int16_t iq_sat_s16(float x)
+{
+  int32_t y = iq_sat_s32(x);
+
+  if (y > INT16_MAX) return INT16_MAX;
+  if (y < INT16_MIN) return INT16_MIN;
+  return (int16_t)y;
+}
+
+void iq_deinterleave(const float *iq, float *re, float *im, uint n)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  float32x4x2_t samples;
+
+  for (; i + 4 <= n; i += 4) {
+    samples = vld2q_f32(&iq[2*i]);
+    vst1q_f32(&re[i], samples.val[0]);
+    vst1q_f32(&im[i], samples.val[1]);
+  }
+#endif
+  for (; i < n; i++) {
+    re[i] = iq[2*i];
+    im[i] = iq[2*i+1];
+  }
+}
+
+void iq_interleave(const float *re, const float *im, float *iq, uint n)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  float32x4x2_t samples;
+
+  for (; i + 4 <= n; i += 4) {
+    samples.val[0] = vld1q_f32(&re[i]);
+    samples.val[1] = vld1q_f32(&im[i]);
+    vst2q_f32(&iq[2*i], samples);
+  }
+#endif
+  for (; i < n; i++) {
+    iq[2*i] = re[i];
+    iq[2*i+1] = im[i];
+  }
+}
+
+void iq_conj(const float *in, float *out, uint n)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  // Flip the sign bit of the odd (imaginary) lanes
+  const uint32_t sign_bits[4] = {0, 0x80000000, 0, 0x80000000};
+  uint32x4_t sign = vld1q_u32(sign_bits);
+  uint32x4_t a;
+  uint32x4_t b;
+
+  for (; i + 4 <= n; i += 4) {
+    a = vreinterpretq_u32_f32(vld1q_f32(&in[2*i]));
+    b = vreinterpretq_u32_f32(vld1q_f32(&in[2*i+4]));
+    vst1q_f32(&out[2*i], vreinterpretq_f32_u32(veorq_u32(a, sign)));
+    vst1q_f32(&out[2*i+4], vreinterpretq_f32_u32(veorq_u32(b, sign)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[2*i] = in[2*i];
+    out[2*i+1] = -in[2*i+1];
+  }
+}
+
+void iq_fill(float *out, uint n, float re, float im)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  float32x4x2_t samples;
+
+  samples.val[0] = vdupq_n_f32(re);
+  samples.val[1] = vdupq_n_f32(im);
+  for (; i + 4 <= n; i += 4) {
+    vst2q_f32(&out[2*i], samples);
+  }
+#endif
+  for (; i < n; i++) {
+    out[2*i] = re;
+    out[2*i+1] = im;
+  }
+}
+
+void iq_ramp_s32(int32_t *out, uint n, int32_t re_start, int32_t im_start)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  const int32_t offsets[4] = {0, 1, 2, 3};
+  int32x4x2_t samples;
+  int32x4_t step = vdupq_n_s32(4);
+
+  samples.val[0] = vaddq_s32(vdupq_n_s32(re_start), vld1q_s32(offsets));
+  samples.val[1] = vaddq_s32(vdupq_n_s32(im_start), vld1q_s32(offsets));
+  for (; i + 4 <= n; i += 4) {
+    vst2q_s32(&out[2*i], samples);
+    samples.val[0] = vaddq_s32(samples.val[0], step);
+    samples.val[1] = vaddq_s32(samples.val[1], step);
+  }
+#endif
+  for (; i < n; i++) {
+    out[2*i] = re_start + i;
+    out[2*i+1] = im_start + i;
+  }
+}
+
+void iq_scale(const float *in, float *out, uint n, float scale)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  // Two independent vectors per iteration hide the multiply latency
+  for (; i + 8 <= n; i += 8) {
+    vst1q_f32(&out[i], vmulq_n_f32(vld1q_f32(&in[i]), scale));
+    vst1q_f32(&out[i+4], vmulq_n_f32(vld1q_f32(&in[i+4]), scale));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = in[i]*scale;
+  }
+}
+
+void iq_s16_to_float(const int16_t *in, float *out, uint n, float scale)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  int16x8_t values;
+
+  for (; i + 8 <= n; i += 8) {
+    values = vld1q_s16(&in[i]);
+    vst1q_f32(&out[i], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(values))), scale));
+    vst1q_f32(&out[i+4], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(values))), scale));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = in[i]*scale;
+  }
+}
+
+void iq_float_to_s16(const float *in, int16_t *out, uint n, float scale)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  int32x4_t low;
+  int32x4_t high;
+
+  for (; i + 8 <= n; i += 8) {
+    low = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i]), scale));
+    high = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i+4]), scale));
+    vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = iq_sat_s16(in[i]*scale);
+  }
+}
+
+void iq_s32_to_float(const int32_t *in, float *out, uint n, float scale)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  for (; i + 8 <= n; i += 8) {
+    vst1q_f32(&out[i], vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(&in[i])), scale));
+    vst1q_f32(&out[i+4], vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(&in[i+4])), scale));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = in[i]*scale;
+  }
+}
+
+void iq_float_to_s32(const float *in, int32_t *out, uint n, float scale)
+{
+  uint i = 0;
+#ifdef __ARM_NEON__
+  for (; i + 8 <= n; i += 8) {
+    vst1q_s32(&out[i], vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i]), scale)));
+    vst1q_s32(&out[i+4], vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i+4]), scale)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = iq_sat_s32(in[i]*scale);
+  }
+}
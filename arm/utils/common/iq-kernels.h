@@ -0,0 +1,55 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         iq-kernels.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Vectorized sample conversion kernels. NEON versions are used
+**                when building for the Zynq, plain C versions otherwise. Both
+**                handle any length, NEON builds finish the tail in C.
+**
+**                Complex samples are interleaved pairs of 32-bit values, the
+**                layout of the usrp_intf DMA words and of fftwf_complex:
+**                iq[2*k] is the real part, iq[2*k+1] the imaginary part.
+**
+**                Float to integer conversions truncate toward zero and saturate
+**                (as VCVT / VQMOVN do), NaN converts to 0.
+**
+**                Input and output may be the same buffer for iq_scale() and
+**                iq_conj(). Otherwise buffers must not overlap.
+**
+******************************************************************************/
+#ifndef IQ_KERNELS_H
+#define IQ_KERNELS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// n complex samples
+void iq_deinterleave(const float *iq, float *re, float *im, uint n);
+void iq_interleave(const float *re, const float *im, float *iq, uint n);
+void iq_conj(const float *in, float *out, uint n);
+void iq_fill(float *out, uint n, float re, float im);
+// out[2*k] = re_start + k, out[2*k+1] = im_start + k
+void iq_ramp_s32(int32_t *out, uint n, int32_t re_start, int32_t im_start);
+
+// n scalar values, out = in*scale
+void iq_scale(const float *in, float *out, uint n, float scale);
+void iq_s16_to_float(const int16_t *in, float *out, uint n, float scale);
+void iq_float_to_s16(const float *in, int16_t *out, uint n, float scale);
+void iq_s32_to_float(const int32_t *in, float *out, uint n, float scale);
+void iq_float_to_s32(const float *in, int32_t *out, uint n, float scale);
+
+#endif
@@ -0,0 +1,197 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         latency-hist.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Log-bucketed latency histograms over DMA_DEBUG_CNT.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "latency-hist.h"
+
+// Lowest value and width of a bucket in cycles
+static void latency_hist_bucket_range(uint bucket, uint32_t *low, uint32_t *width)
+{
+  uint shift;
+
+  if (bucket < LATENCY_HIST_SUB_BUCKETS) {
+    *low = bucket;
+    *width = 1;
+    return;
+  }
+  shift = (bucket >> LATENCY_HIST_SUB_BITS) - 1;
+  *low = (uint32_t)(LATENCY_HIST_SUB_BUCKETS + (bucket & (LATENCY_HIST_SUB_BUCKETS - 1))) << shift;
+  *width = 1 << shift;
+}
+
+uint32_t latency_read_overhead(struct crash_plblock *plblock)
+{
+  uint32_t best = UINT32_MAX;
+  uint32_t start;
+  uint32_t stop;
+  int i;
+
+  for (i = 0; i < LATENCY_OVERHEAD_RUNS; i++) {
+    start = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+    stop = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+    if (dma_debug_cnt_delta(start, stop) < best) best = dma_debug_cnt_delta(start, stop);
+  }
+  return best;
+}
+
+void latency_hist_init(struct latency_hist *h, const char *name, uint32_t overhead)
+{
+  memset(h, 0, sizeof(struct latency_hist));
+  h->name = name;
+  h->overhead = overhead;
+  h->min = UINT32_MAX;
+}
+
+void latency_hist_reset(struct latency_hist *h)
+{
+  latency_hist_init(h, h->name, h->overhead);
+}
+
+double latency_hist_percentile(const struct latency_hist *h, double p)
+{
+  uint64_t rank;
+  uint64_t seen = 0;
+  uint32_t low;
+  uint32_t width;
+  double value;
+  uint i;
+
+  if (h->count == 0) {
+    return 0.0;
+  }
+  // Smallest value with at least p% of the samples at or below it
+  rank = (uint64_t)(p/100.0*h->count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > h->count) rank = h->count;
+  for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  // Report the middle of the bucket, kept inside the range actually seen
+  latency_hist_bucket_range(i, &low, &width);
+  value = low + (width - 1)/2.0;
+  if (value < h->min) value = h->min;
+  if (value > h->max) value = h->max;
+  return value/LATENCY_HIST_CLK_MHZ;
+}
+
+double latency_hist_mean(const struct latency_hist *h)
+{
+  return (h->count > 0) ? (double)h->sum/h->count/LATENCY_HIST_CLK_MHZ : 0.0;
+}
+
+void latency_hist_print(const struct latency_hist *h)
+{
+  printf("%s (us):\tcount %llu, mean %.3f, p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",h->name,
+         (unsigned long long)h->count,latency_hist_mean(h),latency_hist_percentile(h, 50.0),
+         latency_hist_percentile(h, 99.0),latency_hist_percentile(h, 99.9),
+         (h->count > 0) ? h->max/LATENCY_HIST_CLK_MHZ : 0.0);
+}
+
+int latency_hist_write_csv(FILE *fp, struct latency_hist **hists, uint num_hists)
+{
+  uint32_t low;
+  uint32_t width;
+  uint i;
+  uint k;
+
+  // Summary rows have an empty bucket range, bucket rows only cover non-empty buckets
+  fprintf(fp,"stage,count,mean_us,p50_us,p99_us,p999_us,min_us,max_us,bucket_low_us,bucket_high_us\n");
+  for (k = 0; k < num_hists; k++) {
+    fprintf(fp,"%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,,\n",hists[k]->name,
+            (unsigned long long)hists[k]->count,latency_hist_mean(hists[k]),
+            latency_hist_percentile(hists[k], 50.0),latency_hist_percentile(hists[k], 99.0),
+            latency_hist_percentile(hists[k], 99.9),
+            (hists[k]->count > 0) ? hists[k]->min/LATENCY_HIST_CLK_MHZ : 0.0,
+            hists[k]->max/LATENCY_HIST_CLK_MHZ);
+  }
+  for (k = 0; k < num_hists; k++) {
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+      if (hists[k]->buckets[i] == 0) continue;
+      latency_hist_bucket_range(i, &low, &width);
+      fprintf(fp,"%s,%u,,,,,,,%.3f,%.3f\n",hists[k]->name,hists[k]->buckets[i],
+              low/LATENCY_HIST_CLK_MHZ,((double)low + width)/LATENCY_HIST_CLK_MHZ);
+    }
+  }
+  return ferror(fp) ? -1 : 0;
+}
+
+int latency_hist_write_json(FILE *fp, struct latency_hist **hists, uint num_hists)
+{
+  uint32_t low;
+  uint32_t width;
+  uint i;
+  uint k;
+  uint n;
+
+  fprintf(fp,"{\n  \"clock_mhz\": %.1f,\n  \"stages\": [\n",LATENCY_HIST_CLK_MHZ);
+  for (k = 0; k < num_hists; k++) {
+    fprintf(fp,"    {\"name\": \"%s\", \"count\": %llu, \"overhead_cycles\": %u, \"mean_us\": %.3f, "
+            "\"p50_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"min_us\": %.3f, \"max_us\": %.3f,\n",
+            hists[k]->name,(unsigned long long)hists[k]->count,hists[k]->overhead,latency_hist_mean(hists[k]),
+            latency_hist_percentile(hists[k], 50.0),latency_hist_percentile(hists[k], 99.0),
+            latency_hist_percentile(hists[k], 99.9),
+            (hists[k]->count > 0) ? hists[k]->min/LATENCY_HIST_CLK_MHZ : 0.0,
+            hists[k]->max/LATENCY_HIST_CLK_MHZ);
+    // [low_us, high_us, count] for every non-empty bucket
+    fprintf(fp,"     \"buckets\": [");
+    n = 0;
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+      if (hists[k]->buckets[i] == 0) continue;
+      latency_hist_bucket_range(i, &low, &width);
+      fprintf(fp,"%s[%.3f, %.3f, %u]",(n++ > 0) ? ", " : "",low/LATENCY_HIST_CLK_MHZ,
+              ((double)low + width)/LATENCY_HIST_CLK_MHZ,hists[k]->buckets[i]);
+    }
+    fprintf(fp,"]}%s\n",(k + 1 < num_hists) ? "," : "");
+  }
+  fprintf(fp,"  ]\n}\n");
+  return ferror(fp) ? -1 : 0;
+}
+
+int latency_hist_export(const char *filename, struct latency_hist **hists, uint num_hists)
+{
+  FILE *fp;
+  size_t len = strlen(filename);
+  int ret;
+
+  fp = fopen(filename,"w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open latency file %s\n",filename);
+    return -1;
+  }
+  if (len >= 5 && strcmp(&filename[len-5], ".json") == 0) {
+    ret = latency_hist_write_json(fp, hists, num_hists);
+  } else {
+    ret = latency_hist_write_csv(fp, hists, num_hists);
+  }
+  if (fclose(fp) != 0 || ret != 0) {
+    printf("ERROR: Failed to write latency file %s\n",filename);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         latency-hist.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Log-bucketed latency histograms over the 150 MHz DMA_DEBUG_CNT
+**                counter.
+**
+**                Values are DMA_DEBUG_CNT cycles. Each power of two is split into
+**                LATENCY_HIST_SUB_BUCKETS linear buckets, so percentiles are
+**                within about 3% of the true value at any scale. Values below
+**                LATENCY_HIST_SUB_BUCKETS cycles are exact. Count, sum, min and
+**                max are kept exactly.
+**
+**                Intervals are stop - start modulo 2^30 (dma_debug_cnt_delta()),
+**                correct across a counter wrap for anything under the ~7.16
+**                second wrap period and not spanning a crash_reset(). The
+**                cost of the two counter reads bracketing the interval
+**                (latency_read_overhead()) is subtracted from each sample.
+**                Recording is a subtract, a CLZ and an increment.
+**
+******************************************************************************/
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "dma-debug-cnt.h"
+struct crash_plblock;
+
+#define LATENCY_HIST_SUB_BITS     5
+#define LATENCY_HIST_SUB_BUCKETS  (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_BUCKETS      ((32 - LATENCY_HIST_SUB_BITS + 1)*LATENCY_HIST_SUB_BUCKETS)
+#define LATENCY_HIST_CLK_MHZ      DMA_DEBUG_CNT_MHZ
+#define LATENCY_OVERHEAD_RUNS     100
+
+struct latency_hist {
+  const char *name;
+  uint32_t overhead;              // Subtracted from every interval
+  uint64_t count;
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  uint32_t buckets[LATENCY_HIST_BUCKETS];
+};
+
+// Minimum cycles between two back to back DMA_DEBUG_CNT reads
+uint32_t latency_read_overhead(struct crash_plblock *plblock);
+
+void latency_hist_init(struct latency_hist *h, const char *name, uint32_t overhead);
+void latency_hist_reset(struct latency_hist *h);
+
+static inline uint latency_hist_bucket(uint32_t cycles)
+{
+  uint shift;
+
+  if (cycles < LATENCY_HIST_SUB_BUCKETS) {
+    return cycles;
+  }
+  shift = 31 - __builtin_clz(cycles) - LATENCY_HIST_SUB_BITS;
+  return ((shift + 1) << LATENCY_HIST_SUB_BITS) + ((cycles >> shift) & (LATENCY_HIST_SUB_BUCKETS - 1));
+}
+
+static inline void latency_hist_record(struct latency_hist *h, uint32_t cycles)
+{
+  h->buckets[latency_hist_bucket(cycles)]++;
+  h->count++;
+  h->sum += cycles;
+  if (cycles < h->min) h->min = cycles;
+  if (cycles > h->max) h->max = cycles;
+}
+
+// Record stop - start, less the read overhead
+static inline void latency_hist_record_interval(struct latency_hist *h, uint32_t start, uint32_t stop)
+{
+  uint32_t cycles = dma_debug_cnt_delta(start, stop);
+
+  latency_hist_record(h, (cycles > h->overhead) ? cycles - h->overhead : 0);
+}
+
+// Record a CLOCK_MONOTONIC interval, for spans that cross a crash_reset() or may be
+// longer than a counter wrap, e.g. a whole loop. Saturates at ~28 seconds.
+static inline void latency_hist_record_timespec(struct latency_hist *h, const struct timespec *start,
+                                                const struct timespec *stop)
+{
+  double cycles = ((stop->tv_sec - start->tv_sec)*1e9 + (stop->tv_nsec - start->tv_nsec))*
+                  LATENCY_HIST_CLK_MHZ/1e3;
+
+  latency_hist_record(h, (cycles < UINT32_MAX) ? (uint32_t)cycles : UINT32_MAX);
+}
+
+// p in [0,100]. Returns microseconds.
+double latency_hist_percentile(const struct latency_hist *h, double p);
+double latency_hist_mean(const struct latency_hist *h);
+// One line summary: count, mean, p50, p99, p99.9 and max in microseconds
+void latency_hist_print(const struct latency_hist *h);
+// Write every histogram to file, JSON if the name ends in .json, otherwise CSV
+int latency_hist_export(const char *filename, struct latency_hist **hists, uint num_hists);
+int latency_hist_write_csv(FILE *fp, struct latency_hist **hists, uint num_hists);
+int latency_hist_write_json(FILE *fp, struct latency_hist **hists, uint num_hists);
+
+#endif
@@ -0,0 +1,138 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         noise-floor.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Streaming noise floor estimator and adaptive threshold.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "noise-floor.h"
+
+int noise_floor_init(struct noise_floor *nf, uint number_samples, float quantile,
+                     float margin_db, float smoothing, float hysteresis_db, float threshold)
+{
+  memset(nf, 0, sizeof(struct noise_floor));
+  if (quantile <= 0.0 || quantile >= 1.0) {
+    printf("ERROR: Noise floor quantile must be between 0 and 1\n");
+    return -1;
+  }
+  if (smoothing <= 0.0 || smoothing > 1.0) {
+    printf("ERROR: Noise floor smoothing must be greater than 0 and at most 1\n");
+    return -1;
+  }
+  if (threshold <= 0.0) {
+    printf("ERROR: Noise floor starting threshold must be positive\n");
+    return -1;
+  }
+  nf->number_samples = number_samples;
+  nf->quantile = quantile;
+  nf->margin_db = margin_db;
+  nf->smoothing = smoothing;
+  nf->hysteresis_db = hysteresis_db;
+  nf->threshold = threshold;
+  nf->threshold_db = 20.0*log10f(threshold);
+  nf->hist_min = NOISE_FLOOR_HIST_BINS - 1;
+  nf->hist_max = 0;
+  return 0;
+}
+
+// Center of a histogram bucket as a linear magnitude
+static float noise_floor_bucket_value(uint index)
+{
+  uint32_t bits = (index << NOISE_FLOOR_HIST_SHIFT) | (1 << (NOISE_FLOOR_HIST_SHIFT - 1));
+  float value;
+
+  memcpy(&value,&bits,sizeof(float));
+  return value;
+}
+
+int noise_floor_push_frame(struct noise_floor *nf, const float *fft_mag, uint stride)
+{
+  const uint32_t *mag_bits = (const uint32_t *)fft_mag;
+  uint32_t target;
+  uint32_t count;
+  uint index;
+  uint lo = NOISE_FLOOR_HIST_BINS - 1;
+  uint hi = 0;
+  uint i;
+
+  // Only clear the part of the histogram the last frame touched
+  if (nf->hist_min <= nf->hist_max) {
+    memset(&nf->hist[nf->hist_min], 0, (nf->hist_max - nf->hist_min + 1)*sizeof(uint32_t));
+  }
+  // Magnitudes are never negative, masking the sign bit only guards against -0.0
+  for (i = 0; i < nf->number_samples; i++) {
+    index = (mag_bits[stride*i] & 0x7FFFFFFF) >> NOISE_FLOOR_HIST_SHIFT;
+    nf->hist[index]++;
+    if (index < lo) lo = index;
+    if (index > hi) hi = index;
+  }
+  nf->hist_min = lo;
+  nf->hist_max = hi;
+
+  // Walk up to the quantile
+  target = (uint32_t)(nf->quantile*nf->number_samples);
+  if (target == 0) target = 1;
+  count = 0;
+  for (index = lo; index < hi; index++) {
+    count += nf->hist[index];
+    if (count >= target) break;
+  }
+  // Bucket 0 holds zeros and denormals. A frame whose floor lands there has no input,
+  // and its bucket value (about -800 dB) would drag the floor down with it.
+  if (hi == 0 || index == 0) {
+    return 0;
+  }
+  nf->frame_db = 20.0*log10f(noise_floor_bucket_value(index));
+
+  if (nf->valid) {
+    nf->floor_db += nf->smoothing*(nf->frame_db - nf->floor_db);
+  } else {
+    nf->floor_db = nf->frame_db;
+    nf->floor_min_db = nf->frame_db;
+    nf->floor_max_db = nf->frame_db;
+    nf->valid = true;
+  }
+  if (nf->floor_db < nf->floor_min_db) nf->floor_min_db = nf->floor_db;
+  if (nf->floor_db > nf->floor_max_db) nf->floor_max_db = nf->floor_db;
+  nf->frames++;
+
+  if (fabsf(nf->floor_db + nf->margin_db - nf->threshold_db) < nf->hysteresis_db) {
+    return 0;
+  }
+  nf->threshold_db = nf->floor_db + nf->margin_db;
+  nf->threshold = powf(10.0,nf->threshold_db/20.0);
+  nf->updates++;
+  return 1;
+}
+
+void noise_floor_print_stats(struct noise_floor *nf)
+{
+  printf("Noise Floor Quantile:\t\t%f\n",nf->quantile);
+  printf("Noise Floor Margin (dB):\t%f\n",nf->margin_db);
+  printf("Noise Floor Frames:\t\t%llu\n",(unsigned long long)nf->frames);
+  if (nf->valid) {
+    printf("Noise Floor (dB):\t\t%f\n",nf->floor_db);
+    printf("Noise Floor Min / Max (dB):\t%f / %f\n",nf->floor_min_db,nf->floor_max_db);
+  }
+  printf("Threshold (dB):\t\t\t%f\n",nf->threshold_db);
+  printf("Threshold Updates:\t\t%llu\n",(unsigned long long)nf->updates);
+}
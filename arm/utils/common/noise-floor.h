@@ -0,0 +1,73 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         noise-floor.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Streaming noise floor estimator over frames of FFT magnitudes.
+**                Each frame is binned into a log-domain histogram and the
+**                requested quantile of the bins (the median by default) is taken
+**                as that frame's noise floor. As long as signals occupy fewer
+**                bins than the quantile, they do not move the estimate.
+**
+**                The per-frame floor is smoothed across frames in dB and the
+**                detection threshold is the floor plus a margin. A new threshold
+**                is only reported when it moved by more than the hysteresis, so
+**                the FPGA threshold register is not rewritten every frame.
+**
+**                The histogram index is the float exponent plus the top 4
+**                mantissa bits, i.e. 16 buckets per octave (~0.38 dB), so no
+**                log() is needed per bin.
+**
+******************************************************************************/
+#ifndef NOISE_FLOOR_H
+#define NOISE_FLOOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define NOISE_FLOOR_HIST_SHIFT    19    // Keep exponent + 4 mantissa bits
+#define NOISE_FLOOR_HIST_BINS     (1 << (31 - NOISE_FLOOR_HIST_SHIFT))
+
+struct noise_floor {
+  uint number_samples;
+  float quantile;                 // 0 to 1, fraction of bins at or below the floor
+  float margin_db;                // Threshold = floor + margin
+  float smoothing;                // Weight of the newest frame, 1.0 = no smoothing
+  float hysteresis_db;            // Minimum threshold change before an update
+  uint32_t hist[NOISE_FLOOR_HIST_BINS];
+  uint hist_min;                  // Range of hist used by the last frame, cleared
+  uint hist_max;                  // before the next one
+  bool valid;                     // floor_db holds at least one frame
+  float frame_db;                 // Floor of the last frame
+  float floor_db;                 // Smoothed floor
+  float floor_min_db;
+  float floor_max_db;
+  float threshold_db;
+  float threshold;                // Linear magnitude, as written to SPEC_SENSE_THRESHOLD
+  uint64_t frames;
+  uint64_t updates;
+};
+
+// threshold is the starting threshold, used until the first update
+int noise_floor_init(struct noise_floor *nf, uint number_samples, float quantile,
+                     float margin_db, float smoothing, float hysteresis_db, float threshold);
+// Add a frame of number_samples magnitudes spaced stride floats apart (2 for the spectrum
+// sense block). Returns 1 if nf->threshold changed and should be written out, 0 otherwise.
+int noise_floor_push_frame(struct noise_floor *nf, const float *fft_mag, uint stride);
+void noise_floor_print_stats(struct noise_floor *nf);
+
+#endif
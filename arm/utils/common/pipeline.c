@@ -0,0 +1,209 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         pipeline.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Two core capture / compute pipeline.
+**
+******************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "pipeline.h"
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+#include "trace.h"
+
+// Pin the calling thread to a core and make it real time. Failing to do so (e.g. not
+// running as root) is not fatal, the pipeline just loses its latency guarantees.
+static void pipeline_set_realtime(int cpu, int priority)
+{
+  cpu_set_t cpuset;
+  struct sched_param param;
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+    printf("WARNING: Failed to pin thread to CPU %d\n",cpu);
+  }
+  param.sched_priority = priority;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+    printf("WARNING: Failed to set SCHED_FIFO priority %d\n",priority);
+  }
+}
+
+static void *pipeline_capture(void *arg)
+{
+  struct pipeline *p = (struct pipeline *)arg;
+  struct frame_desc desc;
+  uint depth;
+
+  pipeline_set_realtime(PIPELINE_CAPTURE_CPU, PIPELINE_CAPTURE_PRIORITY);
+  trace_thread_name("Capture");
+
+  while (__atomic_load_n(&p->running, __ATOMIC_ACQUIRE)) {
+    desc.buff = frame_ring_next(&p->ring);
+    if (desc.buff == NULL) {
+      // Timed out, check if we should still be running
+      continue;
+    }
+    desc.seq = p->ring.seq;
+    desc.capture_cnt = p->ring.last_cnt;
+    if (!spsc_queue_push(&p->queue, &desc)) {
+      p->queue_drops++;
+    }
+    depth = spsc_queue_depth(&p->queue);
+    if (depth > p->max_queue_depth) {
+      p->max_queue_depth = depth;
+    }
+  }
+  trace_thread_exit();
+  return NULL;
+}
+
+static void *pipeline_compute(void *arg)
+{
+  struct pipeline *p = (struct pipeline *)arg;
+  struct frame_desc desc;
+  uint32_t queue_cycles;
+  uint32_t idle_start = 0;
+  uint32_t cnt;
+  bool idle = false;
+  int ret;
+
+  pipeline_set_realtime(PIPELINE_COMPUTE_CPU, PIPELINE_COMPUTE_PRIORITY);
+  trace_thread_name("Compute");
+
+  while (__atomic_load_n(&p->running, __ATOMIC_ACQUIRE)) {
+    if (!spsc_queue_pop(&p->queue, &desc)) {
+      // The capture thread pushes right after the DMA interrupt, so spin briefly to
+      // catch it, then sleep until the next interrupt or at most half a frame
+      cnt = crash_read_reg(p->ring.plblock->regs,DMA_DEBUG_CNT);
+      if (!idle) {
+        idle = true;
+        idle_start = cnt;
+      } else if (dma_debug_cnt_delta(idle_start, cnt) > CRASH_WAIT_SPIN_CYCLES) {
+        crash_wait_event(p->ring.plblock, p->ring.frame_cycles/300);
+      }
+      continue;
+    }
+    idle = false;
+    if (frame_ring_overwritten(&p->ring, desc.seq)) {
+      p->stale_drops++;
+      continue;
+    }
+    queue_cycles = dma_debug_cnt_delta(desc.capture_cnt, crash_read_reg(p->ring.plblock->regs,DMA_DEBUG_CNT));
+    if (queue_cycles > p->max_queue_cycles) {
+      p->max_queue_cycles = queue_cycles;
+    }
+    p->frames_computed++;
+    ret = p->compute(desc.buff, desc.seq, p->arg);
+    if (frame_ring_overwritten(&p->ring, desc.seq)) {
+      p->overwritten++;
+    }
+    if (ret != 0) {
+      __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+  trace_thread_exit();
+  return NULL;
+}
+
+int pipeline_start(struct pipeline *p, struct crash_plblock *plblock, uint plblock_id,
+                   uint num_buffs, uint number_samples, uint decim_rate,
+                   pipeline_compute_t compute, void *arg)
+{
+  if (num_buffs < PIPELINE_MIN_BUFFS) {
+    printf("ERROR: Pipeline needs at least %d buffers\n",PIPELINE_MIN_BUFFS);
+    return -1;
+  }
+  memset(p, 0, sizeof(struct pipeline));
+  p->compute = compute;
+  p->arg = arg;
+  // One buffer is being filled by the DMA and one is being computed on
+  if (spsc_queue_init(&p->queue, num_buffs - 2) != 0) {
+    printf("ERROR: Failed to allocate pipeline queue\n");
+    return -1;
+  }
+
+  // Fault in and lock everything now so page faults do not show up in the frame loop
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    perror("mlockall");
+  }
+
+  if (frame_ring_start(&p->ring, plblock, plblock_id, num_buffs, number_samples, decim_rate) != 0) {
+    spsc_queue_free(&p->queue);
+    return -1;
+  }
+  p->running = 1;
+  if (pthread_create(&p->compute_thread, NULL, pipeline_compute, p) != 0) {
+    printf("ERROR: Failed to create compute thread\n");
+    p->running = 0;
+    frame_ring_stop(&p->ring);
+    spsc_queue_free(&p->queue);
+    return -1;
+  }
+  if (pthread_create(&p->capture_thread, NULL, pipeline_capture, p) != 0) {
+    printf("ERROR: Failed to create capture thread\n");
+    __atomic_store_n(&p->running, 0, __ATOMIC_RELEASE);
+    pthread_join(p->compute_thread, NULL);
+    frame_ring_stop(&p->ring);
+    spsc_queue_free(&p->queue);
+    return -1;
+  }
+  return 0;
+}
+
+void pipeline_wait(struct pipeline *p, int *loop_prog)
+{
+  while (!__atomic_load_n(&p->done, __ATOMIC_ACQUIRE)) {
+    if (loop_prog != NULL && *loop_prog == 0) {
+      break;
+    }
+    usleep(1000);
+  }
+}
+
+void pipeline_stop(struct pipeline *p)
+{
+  __atomic_store_n(&p->running, 0, __ATOMIC_RELEASE);
+  pthread_join(p->capture_thread, NULL);
+  pthread_join(p->compute_thread, NULL);
+  frame_ring_stop(&p->ring);
+  spsc_queue_free(&p->queue);
+  munlockall();
+}
+
+void pipeline_print_stats(struct pipeline *p)
+{
+  frame_ring_print_stats(&p->ring);
+  printf("Frames Computed:\t\t%llu\n",(unsigned long long)p->frames_computed);
+  printf("Queue Drops:\t\t\t%llu\n",(unsigned long long)p->queue_drops);
+  printf("Stale Drops:\t\t\t%llu\n",(unsigned long long)p->stale_drops);
+  printf("Overwritten In Compute:\t\t%llu\n",(unsigned long long)p->overwritten);
+  printf("Max Queue Depth:\t\t%llu\n",(unsigned long long)p->max_queue_depth);
+  printf("Max Queue Latency (us):\t\t%f\n",(1e6/150e6)*p->max_queue_cycles);
+}
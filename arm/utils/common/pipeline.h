@@ -0,0 +1,87 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         pipeline.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Two core capture / compute pipeline. A capture thread pinned to
+**                one Cortex-A9 core pulls frames off the DMA ring buffer and
+**                passes their descriptors through a lock-free SPSC queue to a
+**                compute thread pinned to the other core, which runs the
+**                caller's FFT / decision function on each frame.
+**
+**                Both threads run SCHED_FIFO and all memory is locked with
+**                mlockall() so neither is paged or preempted by normal tasks.
+**                Neither spins while idle: both spin for CRASH_WAIT_SPIN_CYCLES
+**                and then sleep in crash_wait_event() until the next DMA
+**                interrupt (or half a frame).
+**
+**                The DMA keeps writing around the ring whether or not a buffer
+**                is still queued, so the queue holds at most num_buffs - 2
+**                frames: one buffer is being filled and one is being processed.
+**                That is only enough while the compute side keeps up. When it
+**                falls behind, new frames are dropped at the queue, and queued
+**                frames whose buffer the DMA has already started reusing are
+**                dropped before compute (frame_ring_overwritten()). A frame
+**                overwritten while being computed on is counted, its result
+**                may be wrong.
+**
+******************************************************************************/
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "frame-ring.h"
+#include "spsc-queue.h"
+
+#define PIPELINE_MIN_BUFFS        4
+#define PIPELINE_CAPTURE_CPU      0
+#define PIPELINE_COMPUTE_CPU      1
+#define PIPELINE_CAPTURE_PRIORITY 99
+#define PIPELINE_COMPUTE_PRIORITY 98
+
+// Called on the compute core for every frame. Return non-zero to stop the pipeline.
+typedef int (*pipeline_compute_t)(void *buff, uint64_t seq, void *arg);
+
+struct pipeline {
+  struct frame_ring ring;
+  struct spsc_queue queue;
+  pipeline_compute_t compute;
+  void *arg;
+  pthread_t capture_thread;
+  pthread_t compute_thread;
+  int running;
+  int done;
+  uint64_t queue_drops;           // Frames dropped because the queue was full
+  uint64_t stale_drops;           // Queued frames the DMA overwrote before compute
+  uint64_t overwritten;           // Frames the DMA overwrote during compute
+  uint64_t frames_computed;
+  uint64_t max_queue_depth;
+  uint32_t max_queue_cycles;      // Worst case time from capture to start of compute
+};
+
+// Lock memory and start the capture and compute threads
+int pipeline_start(struct pipeline *p, struct crash_plblock *plblock, uint plblock_id,
+                   uint num_buffs, uint number_samples, uint decim_rate,
+                   pipeline_compute_t compute, void *arg);
+// Block until the compute function asks to stop or *loop_prog goes to 0
+void pipeline_wait(struct pipeline *p, int *loop_prog);
+void pipeline_stop(struct pipeline *p);
+void pipeline_print_stats(struct pipeline *p);
+
+#endif
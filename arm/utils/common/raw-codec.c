@@ -0,0 +1,289 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         raw-codec.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Raw ADC capture codec. The encoder's transform and the packing of
+**                widths up to 16 bits use NEON when building for the Zynq, plain
+**                C otherwise. The decoder is always plain C.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "raw-codec.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+int raw_codec_init(struct raw_codec *c, uint flags, uint max_values)
+{
+  memset(c, 0, sizeof(struct raw_codec));
+  c->flags = flags;
+  c->max_values = max_values;
+  c->scratch = (uint32_t *)malloc(max_values*sizeof(uint32_t));
+  if (c->scratch == NULL) {
+    printf("ERROR: Failed to allocate codec buffer\n");
+    return -1;
+  }
+  return 0;
+}
+
+size_t raw_codec_max_block_bytes(uint num_values)
+{
+  return sizeof(struct raw_codec_block_header) + num_values*sizeof(uint32_t) + RAW_CODEC_PAD;
+}
+
+void raw_codec_file_header_init(struct raw_codec_file_header *h, uint flags, uint decim_rate,
+                                uint rx_mode)
+{
+  memset(h, 0, sizeof(struct raw_codec_file_header));
+  h->magic = RAW_CODEC_MAGIC;
+  h->version = RAW_CODEC_VERSION;
+  h->header_size = sizeof(struct raw_codec_file_header);
+  h->flags = flags;
+  h->decim_rate = decim_rate;
+  h->rx_mode = rx_mode;
+  h->start_time = (uint64_t)time(NULL);
+}
+
+static inline uint32_t raw_codec_zigzag(int32_t x)
+{
+  return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+}
+
+static inline int32_t raw_codec_unzigzag(uint32_t z)
+{
+  return (int32_t)((z >> 1) ^ (0 - (z & 1)));
+}
+
+// Shift out the common trailing zeros, delta encode (optional) and zigzag into
+// c->scratch. Returns the OR of the results, which gives the packing width.
+static uint32_t raw_codec_transform(struct raw_codec *c, const int32_t *in, uint n, uint shift,
+                                    bool delta, int32_t *first)
+{
+  uint32_t *z = c->scratch;
+  uint32_t acc = 0;
+  int32_t s;
+  uint i = 0;
+
+  if (delta) {
+    first[0] = in[0] >> shift;
+    first[1] = in[1] >> shift;
+    z[0] = 0;
+    z[1] = 0;
+    i = 2;
+  } else {
+    first[0] = 0;
+    first[1] = 0;
+  }
+#ifdef __ARM_NEON__
+  {
+    int32x4_t shift_vec = vdupq_n_s32(-(int32_t)shift);
+    int32x4_t cur;
+    int32x4_t prev;
+    uint32x4_t zz;
+    uint32x4_t acc_vec = vdupq_n_u32(0);
+    uint32x2_t acc2;
+    // Loads at i - 2 give the previous value of the same channel in the same lane
+    for (; i + 4 <= n; i += 4) {
+      cur = vshlq_s32(vld1q_s32(in + i), shift_vec);
+      if (delta) {
+        prev = vshlq_s32(vld1q_s32(in + i - 2), shift_vec);
+        cur = vsubq_s32(cur, prev);
+      }
+      zz = veorq_u32(vreinterpretq_u32_s32(vshlq_n_s32(cur, 1)),
+                     vreinterpretq_u32_s32(vshrq_n_s32(cur, 31)));
+      vst1q_u32(z + i, zz);
+      acc_vec = vorrq_u32(acc_vec, zz);
+    }
+    acc2 = vorr_u32(vget_low_u32(acc_vec), vget_high_u32(acc_vec));
+    acc = vget_lane_u32(acc2, 0) | vget_lane_u32(acc2, 1);
+  }
+#endif
+  for (; i < n; i++) {
+    s = in[i] >> shift;
+    if (delta) {
+      s = (int32_t)((uint32_t)s - (uint32_t)(in[i-2] >> shift));
+    }
+    z[i] = raw_codec_zigzag(s);
+    acc |= z[i];
+  }
+  return acc;
+}
+
+// Pack n values of width bits, LSB first. May write up to RAW_CODEC_PAD bytes past the end.
+static void raw_codec_pack(const uint32_t *z, uint n, uint width, uint8_t *out)
+{
+  uint64_t acc = 0;
+  uint bits = 0;
+  uint i = 0;
+
+#ifdef __ARM_NEON__
+  // 8 values of up to 16 bits are exactly width bytes: pair them up in 32-bit lanes, then
+  // in 64-bit lanes, and join the two 64-bit halves
+  if (width > 0 && width <= 16) {
+    int32x4_t w1 = vdupq_n_s32(width);
+    int64x2_t w2 = vdupq_n_s64(2*width);
+    uint64x2_t low32 = vdupq_n_u64(0xFFFFFFFF);
+    uint32x4x2_t v;
+    uint64x2_t pair;
+    uint64x2_t quad;
+    uint64_t q0;
+    uint64_t q1;
+    uint64_t word[2];
+    for (; i + 8 <= n; i += 8) {
+      v = vld2q_u32(z + i);
+      pair = vreinterpretq_u64_u32(vorrq_u32(v.val[0], vshlq_u32(v.val[1], w1)));
+      quad = vorrq_u64(vandq_u64(pair, low32), vshlq_u64(vshrq_n_u64(pair, 32), w2));
+      q0 = vgetq_lane_u64(quad, 0);
+      q1 = vgetq_lane_u64(quad, 1);
+      if (width < 16) {
+        word[0] = q0 | (q1 << (4*width));
+        word[1] = q1 >> (64 - 4*width);
+      } else {
+        word[0] = q0;
+        word[1] = q1;
+      }
+      memcpy(out, word, 16);
+      out += width;
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    acc |= (uint64_t)z[i] << bits;
+    bits += width;
+    while (bits >= 8) {
+      *out++ = (uint8_t)acc;
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+  if (bits > 0) {
+    *out = (uint8_t)acc;
+  }
+}
+
+size_t raw_codec_encode(struct raw_codec *c, const int32_t *in, uint num_values, uint64_t seq,
+                        uint8_t *out)
+{
+  struct raw_codec_block_header *hdr = (struct raw_codec_block_header *)out;
+  bool delta = (c->flags & RAW_CODEC_FLAG_DELTA) != 0;
+  uint32_t used = 0;
+  uint shift = 0;
+  uint width = 0;
+  uint i;
+
+  if (num_values > c->max_values) {
+    num_values = c->max_values;
+  }
+  num_values &= ~1U;
+
+  // Common trailing zeros, e.g. the unused low bits of MSB aligned ADC samples
+#ifdef __ARM_NEON__
+  {
+    uint32x4_t or_vec = vdupq_n_u32(0);
+    uint32x2_t or2;
+    for (i = 0; i + 4 <= num_values; i += 4) {
+      or_vec = vorrq_u32(or_vec, vld1q_u32((const uint32_t *)in + i));
+    }
+    or2 = vorr_u32(vget_low_u32(or_vec), vget_high_u32(or_vec));
+    used = vget_lane_u32(or2, 0) | vget_lane_u32(or2, 1);
+  }
+#else
+  i = 0;
+#endif
+  for (; i < num_values; i++) {
+    used |= (uint32_t)in[i];
+  }
+  if (used != 0) {
+    shift = __builtin_ctz(used);
+  }
+
+  memset(hdr, 0, sizeof(struct raw_codec_block_header));
+  used = raw_codec_transform(c, in, num_values, shift, delta, hdr->first);
+  if (used != 0) {
+    width = 32 - __builtin_clz(used);
+  }
+
+  hdr->magic = RAW_CODEC_BLOCK_MAGIC;
+  hdr->seq = (uint32_t)seq;
+  hdr->num_values = num_values;
+  hdr->payload_bytes = ((uint64_t)num_values*width + 7)/8;
+  hdr->shift = shift;
+  hdr->width = width;
+  hdr->flags = delta ? RAW_CODEC_FLAG_DELTA : 0;
+  raw_codec_pack(c->scratch, num_values, width, out + sizeof(struct raw_codec_block_header));
+
+  c->blocks++;
+  c->bytes_in += num_values*sizeof(uint32_t);
+  c->bytes_out += sizeof(struct raw_codec_block_header) + hdr->payload_bytes;
+  c->width_sum += width;
+  return sizeof(struct raw_codec_block_header) + hdr->payload_bytes;
+}
+
+int raw_codec_decode(const struct raw_codec_block_header *hdr, const uint8_t *payload, int32_t *out)
+{
+  uint64_t acc = 0;
+  uint bits = 0;
+  uint64_t mask;
+  int32_t prev[2];
+  int32_t s;
+  uint i;
+
+  if (hdr->magic != RAW_CODEC_BLOCK_MAGIC || hdr->width > 32 || hdr->shift > 31 ||
+      hdr->payload_bytes != ((uint64_t)hdr->num_values*hdr->width + 7)/8) {
+    return -1;
+  }
+  mask = (hdr->width == 32) ? 0xFFFFFFFF : ((1ULL << hdr->width) - 1);
+  prev[0] = hdr->first[0];
+  prev[1] = hdr->first[1];
+  for (i = 0; i < hdr->num_values; i++) {
+    while (bits < hdr->width) {
+      acc |= (uint64_t)(*payload++) << bits;
+      bits += 8;
+    }
+    s = raw_codec_unzigzag((uint32_t)(acc & mask));
+    acc >>= hdr->width;
+    bits -= hdr->width;
+    if (hdr->flags & RAW_CODEC_FLAG_DELTA) {
+      s = (int32_t)((uint32_t)s + (uint32_t)prev[i & 1]);
+      prev[i & 1] = s;
+    }
+    out[i] = (int32_t)((uint32_t)s << hdr->shift);
+  }
+  return 0;
+}
+
+void raw_codec_print_stats(struct raw_codec *c, uint number_samples, uint decim_rate)
+{
+  printf("Codec Delta Encoding:\t\t%s\n",(c->flags & RAW_CODEC_FLAG_DELTA) ? "yes" : "no");
+  printf("Codec Blocks:\t\t\t%llu\n",(unsigned long long)c->blocks);
+  if (c->blocks > 0 && c->bytes_out > 0) {
+    printf("Codec Average Width (bits):\t%f\n",(double)c->width_sum/c->blocks);
+    printf("Codec Compression Ratio:\t%f\n",(double)c->bytes_in/c->bytes_out);
+    printf("Codec Encode / Frame (us):\t%f\n",(1e6/150e6)*c->encode_cycles/c->blocks);
+  }
+  printf("Frame Period (us):\t\t%f\n",number_samples*decim_rate/100.0);
+}
+
+void raw_codec_free(struct raw_codec *c)
+{
+  free(c->scratch);
+  c->scratch = NULL;
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         raw-codec.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Lossless codec and container for raw ADC captures.
+**
+**                With RX_ADC_RAW_MODE and the fix2float bypass, each I and Q value
+**                is a 32-bit word holding only 14 significant bits. Every block
+**                (one DMA frame) is reduced to the bits it actually uses:
+**                  1. shift:  trailing zero bits common to every value are dropped
+**                  2. delta:  optionally, each value is replaced by its difference
+**                             from the previous value of the same channel (I / Q)
+**                  3. width:  values are zigzag mapped to unsigned and bit-packed
+**                             at the width of the largest one
+**                so a raw capture shrinks to ~14/32 of its size, less with delta
+**                encoding on oversampled signals. The shift and width are chosen
+**                per block, so any input is encoded losslessly.
+**
+**                File layout: one raw_codec_file_header followed by blocks, each a
+**                raw_codec_block_header and payload_bytes of packed values, LSB
+**                first. The block sequence number is the DMA frame number of the
+**                frame the block was encoded from, so frames dropped by the ring
+**                and blocks dropped by the writer both show up as gaps.
+**
+**                The encoder uses NEON on the Zynq, the decoder is plain C so it
+**                also builds on the host (see raw-decode).
+**
+******************************************************************************/
+#ifndef RAW_CODEC_H
+#define RAW_CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RAW_CODEC_MAGIC           0x50435243    // "CRCP"
+#define RAW_CODEC_BLOCK_MAGIC     0x4B4C4243    // "CBLK"
+#define RAW_CODEC_VERSION         1
+#define RAW_CODEC_FLAG_DELTA      0x1
+#define RAW_CODEC_PAD             16            // Packer may write this far past the payload
+
+struct raw_codec_file_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t flags;
+  uint32_t decim_rate;
+  uint32_t rx_mode;               // USRP RX mode, e.g. RX_ADC_RAW_MODE
+  uint32_t reserved;
+  uint64_t start_time;            // Seconds since the epoch
+};
+
+struct raw_codec_block_header {
+  uint32_t magic;
+  uint32_t seq;                   // DMA frame number (frame_ring seq), modulo 2^32
+  uint32_t num_values;            // I and Q values, i.e. 2 per sample
+  uint32_t payload_bytes;
+  int32_t first[2];               // Delta reference for I and Q (shifted)
+  uint8_t shift;
+  uint8_t width;
+  uint8_t flags;
+  uint8_t reserved[5];
+};
+
+struct raw_codec {
+  uint flags;
+  uint max_values;
+  uint32_t *scratch;              // Transformed values before packing
+  uint64_t blocks;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t width_sum;
+  uint64_t encode_cycles;         // Filled in by the caller, used for the stats only
+};
+
+int raw_codec_init(struct raw_codec *c, uint flags, uint max_values);
+// Worst case size of an encoded block, including the header and packer slack
+size_t raw_codec_max_block_bytes(uint num_values);
+void raw_codec_file_header_init(struct raw_codec_file_header *h, uint flags, uint decim_rate,
+                                uint rx_mode);
+// Encode num_values (even) 32-bit values of DMA frame seq into out, which must hold
+// raw_codec_max_block_bytes(). Returns the encoded size (header + payload).
+size_t raw_codec_encode(struct raw_codec *c, const int32_t *in, uint num_values, uint64_t seq,
+                        uint8_t *out);
+// Decode one block's payload into hdr->num_values values. Returns -1 if the header is invalid.
+int raw_codec_decode(const struct raw_codec_block_header *hdr, const uint8_t *payload, int32_t *out);
+void raw_codec_print_stats(struct raw_codec *c, uint number_samples, uint decim_rate);
+void raw_codec_free(struct raw_codec *c);
+
+#endif
@@ -0,0 +1,236 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         reg-prof.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Register access profiler wrappers and the exit report.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "reg-prof.h"
+
+#define REG_PROF_READ             0
+#define REG_PROF_WRITE            1
+#define REG_PROF_WAIT             2
+
+static struct reg_prof_entry reg_prof_entries[REG_PROF_MAX_NAMES];
+static uint reg_prof_num_entries;
+static struct reg_prof_entry reg_prof_other = { "(other)" };
+static pthread_mutex_t reg_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t reg_prof_once = PTHREAD_ONCE_INIT;
+static uint64_t reg_prof_start_ns;
+static uint64_t reg_prof_overhead_ns;
+
+static inline uint64_t reg_prof_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// Minimum time between two back to back clock reads, subtracted from every call
+static void reg_prof_init(void)
+{
+  uint64_t start;
+  uint64_t cycles;
+  uint i;
+
+  reg_prof_overhead_ns = UINT64_MAX;
+  for (i = 0; i < REG_PROF_CAL_RUNS; i++) {
+    start = reg_prof_now();
+    cycles = reg_prof_now() - start;
+    if (cycles < reg_prof_overhead_ns) reg_prof_overhead_ns = cycles;
+  }
+  reg_prof_start_ns = reg_prof_now();
+  atexit(reg_prof_report);
+}
+
+// Names are string literals, so the same name from different files may have different
+// pointers. Hash the string, compare the pointer first.
+static struct reg_prof_entry *reg_prof_lookup(const char *name)
+{
+  struct reg_prof_entry *e;
+  uint32_t hash = 5381;
+  const char *c;
+  uint i;
+
+  for (c = name; *c != '\0'; c++) {
+    hash = hash*33 + (uint8_t)*c;
+  }
+  for (i = 0; i < REG_PROF_MAX_NAMES; i++) {
+    e = &reg_prof_entries[(hash + i) & (REG_PROF_MAX_NAMES - 1)];
+    if (e->name == NULL) {
+      e->name = name;
+      reg_prof_num_entries++;
+      return e;
+    }
+    if (e->name == name || strcmp(e->name, name) == 0) {
+      return e;
+    }
+  }
+  return &reg_prof_other;
+}
+
+static void reg_prof_record(const char *name, uint type, uint64_t start, uint64_t stop)
+{
+  struct reg_prof_entry *e;
+  uint64_t ns = stop - start;
+
+  ns = (ns > reg_prof_overhead_ns) ? ns - reg_prof_overhead_ns : 0;
+  pthread_mutex_lock(&reg_prof_lock);
+  e = reg_prof_lookup(name);
+  if (type == REG_PROF_WAIT) {
+    e->waits++;
+    e->wait_ns += ns;
+  } else {
+    if (type == REG_PROF_READ) {
+      e->reads++;
+    } else {
+      e->writes++;
+    }
+    e->access_ns += ns;
+  }
+  if (ns > e->max_ns) e->max_ns = ns;
+  pthread_mutex_unlock(&reg_prof_lock);
+}
+
+uint32_t reg_prof_read_reg(uint32_t *regs, uint reg, const char *name)
+{
+  uint64_t start;
+  uint32_t value;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  value = crash_read_reg(regs, reg);
+  reg_prof_record(name, REG_PROF_READ, start, reg_prof_now());
+  return value;
+}
+
+void reg_prof_write_reg(uint32_t *regs, uint reg, uint32_t value, const char *name)
+{
+  uint64_t start;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  crash_write_reg(regs, reg, value);
+  reg_prof_record(name, REG_PROF_WRITE, start, reg_prof_now());
+}
+
+void reg_prof_set_bit(uint32_t *regs, uint bit, const char *name)
+{
+  uint64_t start;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  crash_set_bit(regs, bit);
+  reg_prof_record(name, REG_PROF_WRITE, start, reg_prof_now());
+}
+
+void reg_prof_clear_bit(uint32_t *regs, uint bit, const char *name)
+{
+  uint64_t start;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  crash_clear_bit(regs, bit);
+  reg_prof_record(name, REG_PROF_WRITE, start, reg_prof_now());
+}
+
+uint32_t reg_prof_get_bit(uint32_t *regs, uint bit, const char *name)
+{
+  uint64_t start;
+  uint32_t value;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  value = crash_get_bit(regs, bit);
+  reg_prof_record(name, REG_PROF_READ, start, reg_prof_now());
+  return value;
+}
+
+int reg_prof_wait_bit(struct crash_plblock *plblock, uint bit, uint value, int timeout_us, const char *name)
+{
+  uint64_t start;
+  int ret;
+
+  pthread_once(&reg_prof_once, reg_prof_init);
+  start = reg_prof_now();
+  ret = crash_wait_bit(plblock, bit, value, timeout_us);
+  reg_prof_record(name, REG_PROF_WAIT, start, reg_prof_now());
+  return ret;
+}
+
+static int reg_prof_compare(const void *a, const void *b)
+{
+  const struct reg_prof_entry *ea = *(const struct reg_prof_entry **)a;
+  const struct reg_prof_entry *eb = *(const struct reg_prof_entry **)b;
+  uint64_t ta = ea->access_ns + ea->wait_ns;
+  uint64_t tb = eb->access_ns + eb->wait_ns;
+
+  return (ta < tb) - (ta > tb);
+}
+
+void reg_prof_report(void)
+{
+  struct reg_prof_entry *sorted[REG_PROF_MAX_NAMES + 1];
+  struct reg_prof_entry *e;
+  uint64_t accesses = 0;
+  uint64_t access_ns = 0;
+  uint64_t wait_ns = 0;
+  uint64_t elapsed_ns;
+  uint num_sorted = 0;
+  uint i;
+
+  pthread_mutex_lock(&reg_prof_lock);
+  elapsed_ns = reg_prof_now() - reg_prof_start_ns;
+  for (i = 0; i < REG_PROF_MAX_NAMES; i++) {
+    if (reg_prof_entries[i].name != NULL) {
+      sorted[num_sorted++] = &reg_prof_entries[i];
+    }
+  }
+  if (reg_prof_other.reads + reg_prof_other.writes + reg_prof_other.waits > 0) {
+    sorted[num_sorted++] = &reg_prof_other;
+  }
+  qsort(sorted, num_sorted, sizeof(struct reg_prof_entry *), reg_prof_compare);
+
+  printf("\n%-40s%10s%10s%8s%14s%14s%12s%8s\n","Register","Reads","Writes","Waits",
+         "Access (us)","Wait (us)","Max (us)","%");
+  for (i = 0; i < num_sorted; i++) {
+    e = sorted[i];
+    accesses += e->reads + e->writes;
+    access_ns += e->access_ns;
+    wait_ns += e->wait_ns;
+  }
+  for (i = 0; i < num_sorted; i++) {
+    e = sorted[i];
+    printf("%-40s%10llu%10llu%8llu%14.1f%14.1f%12.1f%8.2f\n",e->name,
+           (unsigned long long)e->reads,(unsigned long long)e->writes,
+           (unsigned long long)e->waits,e->access_ns*1e-3,e->wait_ns*1e-3,e->max_ns*1e-3,
+           (access_ns + wait_ns > 0) ? 100.0*(e->access_ns + e->wait_ns)/(access_ns + wait_ns) : 0.0);
+  }
+  printf("Register Accesses:\t\t%llu\n",(unsigned long long)accesses);
+  printf("Register Access Time (us):\t%f\n",access_ns*1e-3);
+  printf("Register Wait Time (us):\t%f\n",wait_ns*1e-3);
+  printf("Profiled Time (us):\t\t%f\n",elapsed_ns*1e-3);
+  printf("Profiler Overhead (ns):\t\t%llu\n",(unsigned long long)reg_prof_overhead_ns);
+  pthread_mutex_unlock(&reg_prof_lock);
+}
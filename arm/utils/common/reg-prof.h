@@ -0,0 +1,86 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         reg-prof.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Register access profiler, built in with make PROF=1 (see
+**                reg-prof.mk).
+**
+**                Every source is compiled with this header included first. It
+**                replaces crash_read_reg(), crash_write_reg(), crash_set_bit(),
+**                crash_clear_bit(), crash_get_bit() and crash_wait_bit() with
+**                wrappers that time the call and record it against the register
+**                name as written at the call site. Waits are recorded separately
+**                from accesses, so the time spent polling USRP_UART_BUSY or
+**                *_CAL_COMPLETE shows up on its own. The ranked report is printed
+**                when the program exits.
+**
+**                DMA_DEBUG_CNT reads are passed straight through: they are the
+**                timestamps of the latency histograms and traces, which must not
+**                include the profiler's own clock reads. For the same reason
+**                trace.c and latency-hist.c are built without the wrappers, as
+**                are the sources that define _GNU_SOURCE (crash-wait.c,
+**                pipeline.c, stream-writer.c), since this header would otherwise
+**                pull in the system headers ahead of it.
+**
+**                Times are CLOCK_MONOTONIC_RAW, less the cost of the two clock
+**                reads around each call. Register names are only known at
+**                compile time (they are enum values), which is why this is a
+**                compile flag rather than an LD_PRELOAD library.
+**
+******************************************************************************/
+#ifndef REG_PROF_H
+#define REG_PROF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "crash-wait.h"
+
+#define REG_PROF_MAX_NAMES        256         // Power of 2
+#define REG_PROF_CAL_RUNS         100
+
+struct reg_prof_entry {
+  const char *name;
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t waits;
+  uint64_t access_ns;
+  uint64_t wait_ns;
+  uint64_t max_ns;
+};
+
+uint32_t reg_prof_read_reg(uint32_t *regs, uint reg, const char *name);
+void reg_prof_write_reg(uint32_t *regs, uint reg, uint32_t value, const char *name);
+void reg_prof_set_bit(uint32_t *regs, uint bit, const char *name);
+void reg_prof_clear_bit(uint32_t *regs, uint bit, const char *name);
+uint32_t reg_prof_get_bit(uint32_t *regs, uint bit, const char *name);
+int reg_prof_wait_bit(struct crash_plblock *plblock, uint bit, uint value, int timeout_us, const char *name);
+// Print the accesses ranked by total time. Called at exit.
+void reg_prof_report(void);
+
+#ifdef REG_PROF
+#define crash_read_reg(regs, reg) \
+  ((reg) == DMA_DEBUG_CNT ? crash_read_reg(regs, reg) : reg_prof_read_reg(regs, reg, #reg))
+#define crash_write_reg(regs, reg, value) reg_prof_write_reg(regs, reg, value, #reg)
+#define crash_set_bit(regs, bit) reg_prof_set_bit(regs, bit, #bit)
+#define crash_clear_bit(regs, bit) reg_prof_clear_bit(regs, bit, #bit)
+#define crash_get_bit(regs, bit) reg_prof_get_bit(regs, bit, #bit)
+#define crash_wait_bit(plblock, bit, value, timeout_us) reg_prof_wait_bit(plblock, bit, value, timeout_us, #bit)
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+# Profile register accesses by name: make PROF=1 (see reg-prof.h)
+# Included at the end of a tool Makefile. Every source is built with reg-prof.h
+# included first, into the tool's own build-prof directory.
+REG_PROF_CFLAGS = -DREG_PROF -include $(COMMON)/reg-prof.h
+
+CFLAGS := $(CFLAGS) $(REG_PROF_CFLAGS)
+OBJECTS := $(OBJECTS) $(BUILD)/reg-prof.o
+LIBS := $(LIBS) -lpthread
+
+$(BUILD)/$(TARGET): $(BUILD)/reg-prof.o
+
+# These call the real functions. crash-wait's own polling is recorded as the wait,
+# trace and latency-hist only read DMA_DEBUG_CNT for timestamps, and pipeline and
+# stream-writer define _GNU_SOURCE before their first system header.
+REG_PROF_EXCLUDE = reg-prof.o crash-wait.o trace.o latency-hist.o pipeline.o stream-writer.o
+$(addprefix $(BUILD)/,$(REG_PROF_EXCLUDE)): CFLAGS := $(filter-out $(REG_PROF_CFLAGS),$(CFLAGS))
@@ -0,0 +1,71 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         sample-format.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  RX sample format selection.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "sample-format.h"
+
+// Control Bank 2, bit 30, the bit after USRP_TX_HB_BYPASS. Older kernel module headers
+// do not define it.
+#ifndef USRP_RX_PACK16
+#define USRP_RX_PACK16 (USRP_TX_HB_BYPASS + 1)
+#endif
+
+const char *sample_format_names[NUM_SAMPLE_FORMATS] = {
+  "float",
+  "q15"
+};
+
+int sample_format_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_SAMPLE_FORMATS; i++) {
+    if (strcmp(name, sample_format_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint sample_format_samples_per_word(uint format)
+{
+  return (format == SAMPLE_FORMAT_Q15) ? 2 : 1;
+}
+
+uint sample_format_set(struct crash_plblock *usrp_intf, uint format)
+{
+  if (format == SAMPLE_FORMAT_Q15) {
+    crash_set_bit(usrp_intf->regs, USRP_RX_FIX2FLOAT_BYPASS);                   // Bypass fix2float
+    crash_set_bit(usrp_intf->regs, USRP_RX_PACK16);                             // Pack two samples per word
+    if (crash_get_bit(usrp_intf->regs, USRP_RX_PACK16)) {
+      return SAMPLE_FORMAT_Q15;
+    }
+    printf("INFO: Bitstream does not support 16-bit RX packing, using float samples\n");
+  }
+  crash_clear_bit(usrp_intf->regs, USRP_RX_PACK16);
+  crash_clear_bit(usrp_intf->regs, USRP_RX_FIX2FLOAT_BYPASS);                   // Do not bypass fix2float
+  return SAMPLE_FORMAT_FLOAT;
+}
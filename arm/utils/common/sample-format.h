@@ -0,0 +1,51 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         sample-format.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  RX sample format selection for the usrp_intf plblock.
+**
+**                float: fix2float enabled, one complex float sample per 64-bit
+**                       DMA word (the default in every tool).
+**                q15:   fix2float bypassed and RX packing enabled (Control Bank 2,
+**                       bit 30), two int16 I/Q samples per 64-bit DMA word. Half
+**                       the bytes per sample, so half the DMA time per frame.
+**
+**                The format is negotiated: packing is requested and read back, and
+**                bitstreams without it fall back to float.
+**
+******************************************************************************/
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+struct crash_plblock;
+
+#define SAMPLE_FORMAT_FLOAT       0
+#define SAMPLE_FORMAT_Q15         1
+#define NUM_SAMPLE_FORMATS        2
+
+extern const char *sample_format_names[NUM_SAMPLE_FORMATS];
+
+// Look up a format by name ("float", "q15"). Returns -1 if unknown.
+int sample_format_lookup(const char *name);
+// Samples per 64-bit DMA word
+uint sample_format_samples_per_word(uint format);
+// Configure the RX path of usrp_intf for format. Returns the format actually in effect.
+uint sample_format_set(struct crash_plblock *usrp_intf, uint format);
+
+#endif
@@ -0,0 +1,345 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         spectral-mask.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Band of interest masks for the spectrum decision. NEON versions
+**                of the kernels run over the compacted ranges when building for
+**                the Zynq, plain C versions over the active bin list otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "spectral-mask.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#define SPECTRAL_MASK_LINE_LEN    256
+
+// Build the range and bin lists from a per-bin weight table
+static int spectral_mask_compact(struct spectral_mask *m, const float *table)
+{
+  uint n = m->number_samples;
+  int i;
+
+  m->num_ranges = 0;
+  m->num_bins = 0;
+  for (i = 0; i < n; i++) {
+    if (table[i] == 0.0) continue;
+    m->num_bins++;
+    if (i == 0 || table[i] != table[i-1]) m->num_ranges++;
+  }
+  if (m->num_bins == 0) {
+    printf("ERROR: Spectral mask has no active bins\n");
+    return -1;
+  }
+  m->ranges = (struct mask_range *)malloc(sizeof(struct mask_range)*m->num_ranges);
+  m->bins = (uint32_t *)malloc(sizeof(uint32_t)*m->num_bins);
+  m->weights = (float *)malloc(sizeof(float)*m->num_bins);
+  if (m->ranges == NULL || m->bins == NULL || m->weights == NULL) {
+    printf("ERROR: Failed to allocate spectral mask\n");
+    return -1;
+  }
+
+  m->num_ranges = 0;
+  m->num_bins = 0;
+  for (i = 0; i < n; i++) {
+    if (table[i] == 0.0) continue;
+    if (i == 0 || table[i] != table[i-1]) {
+      m->ranges[m->num_ranges].start = i;
+      m->ranges[m->num_ranges].len = 0;
+      m->ranges[m->num_ranges].weight = table[i];
+      m->num_ranges++;
+    }
+    m->ranges[m->num_ranges-1].len++;
+    m->bins[m->num_bins] = i;
+    m->weights[m->num_bins] = table[i];
+    m->num_bins++;
+  }
+  return 0;
+}
+
+int spectral_mask_load(struct spectral_mask *m, const char *filename, uint number_samples)
+{
+  FILE *fp;
+  char line[SPECTRAL_MASK_LINE_LEN];
+  char *comment;
+  char *token;
+  char *rest;
+  float *table;
+  int start;
+  int end;
+  float weight;
+  int fields;
+  int line_num = 0;
+  uint next_bin = 0;
+  int i;
+  int ret = -1;
+
+  memset(m, 0, sizeof(struct spectral_mask));
+  m->number_samples = number_samples;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open spectral mask file %s\n",filename);
+    return -1;
+  }
+  table = (float *)calloc(number_samples, sizeof(float));
+  if (table == NULL) {
+    printf("ERROR: Failed to allocate spectral mask\n");
+    fclose(fp);
+    return -1;
+  }
+
+  while (fgets(line, SPECTRAL_MASK_LINE_LEN, fp) != NULL) {
+    line_num++;
+    comment = strchr(line, '#');
+    if (comment != NULL) *comment = '\0';
+    token = line;
+    while (isspace((unsigned char)*token)) token++;
+    if (*token == '\0') {
+      // Blank line or comment
+      continue;
+    }
+    // Bare weight. Checked with strtof first, a leading integer parse would read
+    // ".5" as nothing and "-0.5" as "-0".
+    weight = strtof(token, &rest);
+    if (rest != token) {
+      while (isspace((unsigned char)*rest)) rest++;
+      if (*rest == '\0') {
+        if (weight < 0.0 || next_bin >= number_samples) {
+          printf("ERROR: %s:%d: Invalid weight or too many bins\n",filename,line_num);
+          goto fail;
+        }
+        table[next_bin++] = weight;
+        continue;
+      }
+    }
+    weight = 1.0;
+    fields = sscanf(token, "%d %d %f", &start, &end, &weight);
+    if (fields < 2) {
+      printf("ERROR: %s:%d: Expected a weight or a bin range\n",filename,line_num);
+      goto fail;
+    }
+    if (start < 0 || end < start || end >= number_samples || weight < 0.0) {
+      printf("ERROR: %s:%d: Invalid bin range %d - %d for FFT size %d\n",
+             filename,line_num,start,end,number_samples);
+      goto fail;
+    }
+    for (i = start; i <= end; i++) {
+      table[i] = weight;
+    }
+  }
+
+  if (spectral_mask_compact(m, table) == 0) {
+    ret = 0;
+  }
+fail:
+  if (ret != 0) spectral_mask_free(m);
+  free(table);
+  fclose(fp);
+  return ret;
+}
+
+int spectral_mask_mag(const struct spectral_mask *m, const float *fft_mag, uint stride,
+                      float threshold, float *mag)
+{
+  int i;
+#ifdef __ARM_NEON__
+  const struct mask_range *r;
+  float32x4x2_t words;
+  float32x4_t cells;
+  float32x4_t weights;
+  float32x4_t thresholds;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+  int j;
+  int k;
+
+  thresholds = vdupq_n_f32(threshold);
+  for (k = 0; k < m->num_ranges; k++) {
+    r = &m->ranges[k];
+    weights = vdupq_n_f32(r->weight);
+    i = r->start;
+    if (stride == 2) {
+      for (; i + 4 <= r->start + r->len; i += 4) {
+        words = vld2q_f32(&fft_mag[2*i]);
+        cells = vmulq_f32(words.val[0], weights);
+        compares = vcgeq_f32(cells, thresholds);
+        compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+        compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+        if (vget_lane_u32(compares_reduced, 0) != 0) {
+          for (j = 0; j < 4; j++) {
+            if (compares[j] != 0) {
+              if (mag != NULL) *mag = words.val[0][j];
+              return i+j;
+            }
+          }
+        }
+      }
+    }
+    // Remainder of the range
+    for (; i < r->start + r->len; i++) {
+      if (r->weight*fft_mag[stride*i] >= threshold) {
+        if (mag != NULL) *mag = fft_mag[stride*i];
+        return i;
+      }
+    }
+  }
+#else
+  uint bin;
+
+  for (i = 0; i < m->num_bins; i++) {
+    bin = m->bins[i];
+    if (m->weights[i]*fft_mag[stride*bin] >= threshold) {
+      if (mag != NULL) *mag = fft_mag[stride*bin];
+      return bin;
+    }
+  }
+#endif
+  return -1;
+}
+
+int spectral_mask_complex(const struct spectral_mask *m, const float *fft_out,
+                          float threshold, float *mag)
+{
+  int i;
+  float mag_sqr;
+  float threshold_sqr = threshold*threshold;
+#ifdef __ARM_NEON__
+  const struct mask_range *r;
+  float32x4x2_t bins;
+  float32x4_t mags_sqr;
+  float32x4_t thresholds;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+  float range_threshold_sqr;
+  int j;
+  int k;
+
+  for (k = 0; k < m->num_ranges; k++) {
+    r = &m->ranges[k];
+    // weight * |X| >= threshold  <=>  |X|^2 >= (threshold / weight)^2
+    range_threshold_sqr = threshold_sqr/(r->weight*r->weight);
+    thresholds = vdupq_n_f32(range_threshold_sqr);
+    i = r->start;
+    for (; i + 4 <= r->start + r->len; i += 4) {
+      bins = vld2q_f32(&fft_out[2*i]);
+      mags_sqr = vmulq_f32(bins.val[0], bins.val[0]);
+      mags_sqr = vmlaq_f32(mags_sqr, bins.val[1], bins.val[1]);
+      compares = vcgeq_f32(mags_sqr, thresholds);
+      compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+      compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+      if (vget_lane_u32(compares_reduced, 0) != 0) {
+        for (j = 0; j < 4; j++) {
+          if (compares[j] != 0) {
+            if (mag != NULL) *mag = sqrtf(mags_sqr[j]);
+            return i+j;
+          }
+        }
+      }
+    }
+    // Remainder of the range
+    for (; i < r->start + r->len; i++) {
+      mag_sqr = fft_out[2*i]*fft_out[2*i] + fft_out[2*i+1]*fft_out[2*i+1];
+      if (mag_sqr >= range_threshold_sqr) {
+        if (mag != NULL) *mag = sqrtf(mag_sqr);
+        return i;
+      }
+    }
+  }
+#else
+  uint bin;
+  float weight;
+
+  for (i = 0; i < m->num_bins; i++) {
+    bin = m->bins[i];
+    weight = m->weights[i];
+    mag_sqr = fft_out[2*bin]*fft_out[2*bin] + fft_out[2*bin+1]*fft_out[2*bin+1];
+    if (weight*weight*mag_sqr >= threshold_sqr) {
+      if (mag != NULL) *mag = sqrtf(mag_sqr);
+      return bin;
+    }
+  }
+#endif
+  return -1;
+}
+
+int spectral_mask_flags(const struct spectral_mask *m, const uint32_t *fft_data)
+{
+  int i;
+#ifdef __ARM_NEON__
+  const struct mask_range *r;
+  uint32x4x2_t words;
+  uint32x4_t flags;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+  int j;
+  int k;
+
+  flags = vdupq_n_u32(0x80000000);
+  for (k = 0; k < m->num_ranges; k++) {
+    r = &m->ranges[k];
+    i = r->start;
+    for (; i + 4 <= r->start + r->len; i += 4) {
+      // val[1] holds the upper words: threshold exceeded flag (bit 31) and bin number
+      words = vld2q_u32(&fft_data[2*i]);
+      compares = vcgeq_u32(words.val[1], flags);
+      compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+      compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+      if (vget_lane_u32(compares_reduced, 0) != 0) {
+        for (j = 0; j < 4; j++) {
+          if (compares[j] != 0) return i+j;
+        }
+      }
+    }
+    for (; i < r->start + r->len; i++) {
+      if (fft_data[2*i+1] >= 0x80000000) return i;
+    }
+  }
+#else
+  for (i = 0; i < m->num_bins; i++) {
+    if (fft_data[2*m->bins[i]+1] >= 0x80000000) return m->bins[i];
+  }
+#endif
+  return -1;
+}
+
+void spectral_mask_print(const struct spectral_mask *m)
+{
+  int i;
+
+  printf("Spectral Mask: %d of %d bins in %d ranges\n",m->num_bins,m->number_samples,m->num_ranges);
+  for (i = 0; i < m->num_ranges; i++) {
+    printf("  %d - %d\tweight %f\n",m->ranges[i].start,
+           m->ranges[i].start + m->ranges[i].len - 1,m->ranges[i].weight);
+  }
+}
+
+void spectral_mask_free(struct spectral_mask *m)
+{
+  free(m->ranges);
+  free(m->bins);
+  free(m->weights);
+  m->ranges = NULL;
+  m->bins = NULL;
+  m->weights = NULL;
+}
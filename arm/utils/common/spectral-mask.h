@@ -0,0 +1,76 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         spectral-mask.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Band of interest masks for the spectrum decision. A mask file
+**                lists the FFT bins we care about, so the decision kernels skip
+**                the rest of the spectrum and the work per frame scales with the
+**                monitored bandwidth instead of the FFT size.
+**
+**                Mask file format, one entry per line, '#' starts a comment:
+**                  start end          Bins start to end (inclusive), weight 1.0
+**                  start end weight   Bins start to end with a weight
+**                  weight             Weight of the next bin in order, so a file
+**                                     of bare weights is a per-bin weight table
+**                Later lines override earlier ones and a weight of 0 removes
+**                bins from the mask.
+**
+**                A bin is over the threshold when weight * magnitude >= threshold.
+**
+**                When loaded, the mask is compacted into runs of bins with the
+**                same weight (used by the NEON kernels) and a contiguous list of
+**                active bins (used by the plain C kernels).
+**
+******************************************************************************/
+#ifndef SPECTRAL_MASK_H
+#define SPECTRAL_MASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct mask_range {
+  uint start;
+  uint len;
+  float weight;
+};
+
+struct spectral_mask {
+  uint number_samples;
+  uint num_ranges;
+  struct mask_range *ranges;      // Sorted runs of active bins with equal weight
+  uint num_bins;
+  uint32_t *bins;                 // Active bins in order
+  float *weights;                 // Weight of each entry in bins
+};
+
+int spectral_mask_load(struct spectral_mask *m, const char *filename, uint number_samples);
+// FFT magnitudes spaced stride floats apart (2 for the spectrum sense block output).
+// Returns the first masked bin over the threshold or -1. mag (optional) is set to its
+// unweighted magnitude.
+int spectral_mask_mag(const struct spectral_mask *m, const float *fft_mag, uint stride,
+                      float threshold, float *mag);
+// Interleaved complex FFTW output
+int spectral_mask_complex(const struct spectral_mask *m, const float *fft_out,
+                          float threshold, float *mag);
+// Spectrum sense block output with FPGA thresholding, checks the threshold exceeded flag
+// (bit 31 of the upper word). Weights do not apply as the FPGA threshold is global.
+int spectral_mask_flags(const struct spectral_mask *m, const uint32_t *fft_data);
+void spectral_mask_print(const struct spectral_mask *m);
+void spectral_mask_free(struct spectral_mask *m);
+
+#endif
@@ -0,0 +1,103 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         spsc-queue.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Lock-free single producer / single consumer queue of DMA frame
+**                descriptors. Only the producer writes head and only the
+**                consumer writes tail, so acquire / release ordering on those
+**                two indices is all the synchronization needed. The functions
+**                are inline as they sit in the per-frame path.
+**
+******************************************************************************/
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define SPSC_CACHE_LINE           32    // Cortex-A9 L1 line size
+
+struct frame_desc {
+  void *buff;                     // DMA buffer holding the frame
+  uint64_t seq;                   // DMA frame number (frame_ring seq)
+  uint32_t capture_cnt;           // DMA_DEBUG_CNT when the frame was captured
+};
+
+struct spsc_queue {
+  struct frame_desc *descs;
+  uint size;                      // Power of 2
+  uint mask;
+  uint max_depth;                 // Push fails once this many descriptors are queued
+  // Keep the indices on separate cache lines so the two cores do not share them
+  uint head __attribute__((aligned(SPSC_CACHE_LINE)));
+  uint tail __attribute__((aligned(SPSC_CACHE_LINE)));
+};
+
+static inline int spsc_queue_init(struct spsc_queue *q, uint max_depth)
+{
+  q->size = 1;
+  while (q->size < max_depth) q->size <<= 1;
+  q->mask = q->size - 1;
+  q->max_depth = max_depth;
+  q->head = 0;
+  q->tail = 0;
+  q->descs = (struct frame_desc *)malloc(q->size*sizeof(struct frame_desc));
+  return (q->descs == NULL) ? -1 : 0;
+}
+
+static inline void spsc_queue_free(struct spsc_queue *q)
+{
+  free(q->descs);
+  q->descs = NULL;
+}
+
+// Producer only. Returns false if the queue is full.
+static inline bool spsc_queue_push(struct spsc_queue *q, const struct frame_desc *desc)
+{
+  uint head = q->head;
+  uint tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+  if (head - tail >= q->max_depth) {
+    return false;
+  }
+  q->descs[head & q->mask] = *desc;
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Consumer only. Returns false if the queue is empty.
+static inline bool spsc_queue_pop(struct spsc_queue *q, struct frame_desc *desc)
+{
+  uint tail = q->tail;
+  uint head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+  if (head == tail) {
+    return false;
+  }
+  *desc = q->descs[tail & q->mask];
+  __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static inline uint spsc_queue_depth(struct spsc_queue *q)
+{
+  return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,266 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         stream-writer.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Block pool and writer thread for streaming captures to a file.
+**
+******************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "stream-writer.h"
+
+// Files can be larger than 2 GiB, which needs a 64-bit off_t on the 32-bit ARM
+#if !defined(__LP64__) && (!defined(_FILE_OFFSET_BITS) || _FILE_OFFSET_BITS != 64)
+#error "Build with -D_FILE_OFFSET_BITS=64"
+#endif
+
+#define STREAM_WRITER_IDLE_US     500
+
+static double stream_writer_elapsed(struct timespec *start, struct timespec *stop)
+{
+  return (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec)/1e9;
+}
+
+// Write a whole block, retrying short writes
+static int stream_writer_write(struct stream_writer *w, const char *buff, size_t len)
+{
+  ssize_t ret;
+
+  while (len > 0) {
+    ret = write(w->fd, buff, len);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buff += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+static void *stream_writer_thread(void *arg)
+{
+  struct stream_writer *w = (struct stream_writer *)arg;
+  struct frame_desc desc;
+  size_t len;
+
+  while (1) {
+    if (!spsc_queue_pop(&w->full, &desc)) {
+      // Only exit once everything queued before the stop has been written
+      if (!__atomic_load_n(&w->running, __ATOMIC_ACQUIRE) && spsc_queue_depth(&w->full) == 0) {
+        break;
+      }
+      usleep(STREAM_WRITER_IDLE_US);
+      continue;
+    }
+    len = (size_t)desc.seq;
+    // O_DIRECT needs whole aligned blocks, only the last block can be partial and the
+    // file is truncated back to the real length on close
+    if (w->direct) {
+      len = (len + STREAM_WRITER_ALIGN - 1) & ~((size_t)STREAM_WRITER_ALIGN - 1);
+    }
+    if (stream_writer_write(w, (const char *)desc.buff, len) != 0) {
+      w->write_errors++;
+    }
+    w->blocks_written++;
+    spsc_queue_push(&w->empty, &desc);
+  }
+  return NULL;
+}
+
+int stream_writer_open(struct stream_writer *w, const char *filename, size_t block_size,
+                       uint num_blocks, bool direct)
+{
+  struct frame_desc desc;
+  uint i;
+
+  memset(w, 0, sizeof(struct stream_writer));
+  w->fd = -1;
+  if (num_blocks < STREAM_WRITER_MIN_BLOCKS) {
+    printf("ERROR: Stream writer needs at least %d blocks\n",STREAM_WRITER_MIN_BLOCKS);
+    return -1;
+  }
+  w->block_size = (block_size + STREAM_WRITER_ALIGN - 1) & ~((size_t)STREAM_WRITER_ALIGN - 1);
+  w->num_blocks = num_blocks;
+
+  if (direct) {
+    w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (w->fd < 0) {
+      printf("INFO: O_DIRECT not supported for %s, using buffered writes\n",filename);
+    } else {
+      w->direct = true;
+    }
+  }
+  if (w->fd < 0) {
+    w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (w->fd < 0) {
+    printf("ERROR: Failed to open %s\n",filename);
+    return -1;
+  }
+
+  if (spsc_queue_init(&w->full, num_blocks) != 0 || spsc_queue_init(&w->empty, num_blocks) != 0) {
+    printf("ERROR: Failed to allocate stream writer queues\n");
+    goto error;
+  }
+  w->blocks = (void **)calloc(num_blocks, sizeof(void *));
+  if (w->blocks == NULL) {
+    printf("ERROR: Failed to allocate stream writer blocks\n");
+    goto error;
+  }
+  for (i = 0; i < num_blocks; i++) {
+    if (posix_memalign(&w->blocks[i], STREAM_WRITER_ALIGN, w->block_size) != 0) {
+      printf("ERROR: Failed to allocate stream writer blocks\n");
+      goto error;
+    }
+    desc.buff = w->blocks[i];
+    desc.seq = 0;
+    spsc_queue_push(&w->empty, &desc);
+  }
+
+  w->running = 1;
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+  if (pthread_create(&w->thread, NULL, stream_writer_thread, w) != 0) {
+    printf("ERROR: Failed to start stream writer thread\n");
+    w->running = 0;
+    goto error;
+  }
+  return 0;
+
+error:
+  if (w->blocks != NULL) {
+    for (i = 0; i < num_blocks; i++) {
+      free(w->blocks[i]);
+    }
+    free(w->blocks);
+    w->blocks = NULL;
+  }
+  spsc_queue_free(&w->full);
+  spsc_queue_free(&w->empty);
+  close(w->fd);
+  w->fd = -1;
+  return -1;
+}
+
+static void stream_writer_submit(struct stream_writer *w)
+{
+  struct frame_desc desc;
+  uint depth;
+
+  desc.buff = w->cur;
+  desc.seq = w->cur_fill;
+  // Cannot fail, there are only num_blocks blocks in total
+  spsc_queue_push(&w->full, &desc);
+  depth = spsc_queue_depth(&w->full);
+  if (depth > w->max_queue_depth) {
+    w->max_queue_depth = depth;
+  }
+  w->cur = NULL;
+  w->cur_fill = 0;
+}
+
+int stream_writer_append(struct stream_writer *w, const void *data, size_t len)
+{
+  const char *src = (const char *)data;
+  struct frame_desc desc;
+  size_t room = (w->cur != NULL) ? w->block_size - w->cur_fill : 0;
+  size_t needed;
+  size_t n;
+
+  // Make sure the whole frame fits before copying any of it, so overruns drop whole
+  // frames rather than leaving a gap in the middle of one
+  if (len > room) {
+    needed = (len - room + w->block_size - 1)/w->block_size;
+    if (spsc_queue_depth(&w->empty) < needed) {
+      w->overruns++;
+      return -1;
+    }
+  }
+  while (len > 0) {
+    if (w->cur == NULL) {
+      spsc_queue_pop(&w->empty, &desc);
+      w->cur = desc.buff;
+    }
+    n = w->block_size - w->cur_fill;
+    if (n > len) n = len;
+    memcpy((char *)w->cur + w->cur_fill, src, n);
+    w->cur_fill += n;
+    src += n;
+    len -= n;
+    w->bytes_captured += n;
+    if (w->cur_fill == w->block_size) {
+      stream_writer_submit(w);
+    }
+  }
+  w->frames++;
+  return 0;
+}
+
+void stream_writer_close(struct stream_writer *w)
+{
+  uint i;
+
+  if (w->fd < 0) {
+    return;
+  }
+  if (w->cur != NULL && w->cur_fill > 0) {
+    stream_writer_submit(w);
+  }
+  __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+  pthread_join(w->thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+  // Drop the O_DIRECT padding of the last block
+  if (w->direct && ftruncate(w->fd, w->bytes_captured) != 0) {
+    printf("WARNING: Failed to truncate padding from the end of the file\n");
+  }
+  close(w->fd);
+  w->fd = -1;
+  for (i = 0; i < w->num_blocks; i++) {
+    free(w->blocks[i]);
+  }
+  free(w->blocks);
+  w->blocks = NULL;
+  spsc_queue_free(&w->full);
+  spsc_queue_free(&w->empty);
+}
+
+void stream_writer_print_stats(struct stream_writer *w)
+{
+  double elapsed_sec = stream_writer_elapsed(&w->start, &w->stop);
+
+  printf("Write Mode:\t\t\t%s\n",w->direct ? "O_DIRECT" : "buffered");
+  printf("Block Size (KB):\t\t%d\n",(int)(w->block_size/1024));
+  printf("Blocks:\t\t\t\t%d\n",w->num_blocks);
+  printf("Frames Written:\t\t\t%llu\n",(unsigned long long)w->frames);
+  printf("Bytes Written:\t\t\t%llu\n",(unsigned long long)w->bytes_captured);
+  printf("Writer Overruns (frames):\t%llu\n",(unsigned long long)w->overruns);
+  printf("Write Errors:\t\t\t%llu\n",(unsigned long long)w->write_errors);
+  printf("Max Queued Blocks:\t\t%d\n",w->max_queue_depth);
+  if (elapsed_sec > 0.0) {
+    printf("Sustained Rate (MB/s):\t\t%f\n",w->bytes_captured/elapsed_sec/1e6);
+  }
+}
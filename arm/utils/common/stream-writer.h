@@ -0,0 +1,78 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         stream-writer.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Streams captured frames to a file from a separate writer thread.
+**
+**                The DMA ring reuses its buffers once it wraps, so frames are
+**                copied out of the DMA buffer into a pool of large, page aligned
+**                blocks. Full blocks go to the writer thread through a lock-free
+**                SPSC queue and come back through a second one once written.
+**                Large aligned writes keep storage at its sequential rate and
+**                allow O_DIRECT, which skips the page cache copy.
+**
+**                If storage falls behind and no free block is left, the frame is
+**                dropped and counted as an overrun instead of stalling capture.
+**
+******************************************************************************/
+#ifndef STREAM_WRITER_H
+#define STREAM_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include "spsc-queue.h"
+
+#define STREAM_WRITER_ALIGN       4096  // O_DIRECT buffer / length / offset alignment
+#define STREAM_WRITER_MIN_BLOCKS  2
+
+struct stream_writer {
+  int fd;
+  bool direct;                    // File opened with O_DIRECT
+  size_t block_size;
+  uint num_blocks;
+  void **blocks;
+  struct spsc_queue full;         // Capture -> writer, seq holds the bytes used
+  struct spsc_queue empty;        // Writer -> capture
+  void *cur;                      // Block being filled, NULL if none
+  size_t cur_fill;
+  pthread_t thread;
+  int running;
+  struct timespec start;
+  struct timespec stop;
+  uint64_t bytes_captured;        // Accepted by stream_writer_append()
+  uint64_t blocks_written;
+  uint64_t frames;
+  uint64_t overruns;              // Frames dropped because no free block was left
+  uint64_t write_errors;
+  uint max_queue_depth;
+};
+
+// block_size is rounded up to STREAM_WRITER_ALIGN. direct requests O_DIRECT, falling back
+// to buffered writes if the file system does not support it.
+int stream_writer_open(struct stream_writer *w, const char *filename, size_t block_size,
+                       uint num_blocks, bool direct);
+// Copy a frame into the block pool. Returns -1 if it was dropped due to an overrun.
+int stream_writer_append(struct stream_writer *w, const void *data, size_t len);
+// Flush the last partial block, stop the writer thread and close the file
+void stream_writer_close(struct stream_writer *w);
+void stream_writer_print_stats(struct stream_writer *w);
+
+#endif
@@ -0,0 +1,48 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         sweep.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Comma separated parameter sweep lists.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "sweep.h"
+
+int sweep_parse_list(char *list, char **entries, uint max)
+{
+  uint n = 0;
+  char *tok;
+
+  for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    if (n == max) {
+      printf("ERROR: Too many entries in list (max %d)\n",max);
+      return -1;
+    }
+    entries[n++] = tok;
+  }
+  return n;
+}
+
+int sweep_fft_log2(uint fft_size)
+{
+  int k = 0;
+
+  if (fft_size == 0 || (fft_size & (fft_size - 1)) != 0) return -1;
+  while ((1U << k) < fft_size) k++;
+  return k;
+}
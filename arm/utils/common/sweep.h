@@ -0,0 +1,34 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         sweep.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Comma separated parameter sweep lists, shared by the benchmark
+**                drivers (crash-bench, turnaround).
+**
+******************************************************************************/
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <sys/types.h>
+
+// Split a comma separated list in place into at most max entries. Returns the number
+// of entries, -1 if there are more than max.
+int sweep_parse_list(char *list, char **entries, uint max);
+// log2 of the FFT size, -1 if it is not a power of 2
+int sweep_fft_log2(uint fft_size);
+
+#endif
@@ -0,0 +1,157 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         threshold-kernels.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Magnitude threshold kernels for FFTW complex output. The NEON
+**                versions are used when building for the Zynq, plain C versions
+**                otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "threshold-kernels.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+const threshold_kernel_t threshold_kernels[NUM_THRESHOLD_KERNELS] = {
+  threshold_mag_sqrt,
+  threshold_mag_sqr
+};
+
+const char *threshold_kernel_names[NUM_THRESHOLD_KERNELS] = {
+  "sqrt",
+  "sqr"
+};
+
+int threshold_mag_sqrt(const float *fft_out, uint number_samples, float threshold, float *mag)
+{
+  int i;
+#ifdef __ARM_NEON__
+  int j;
+  float32x4_t floats_real;
+  float32x4_t floats_imag;
+  float32x4_t floats_real_sqr;
+  float32x4_t floats_imag_sqr;
+  float32x4_t floats_add;
+  float32x4_t floats_sqroot;
+  float32x4_t thresholds;
+  uint32x4_t compares;
+
+  // Set threshold for NEON instruction
+  thresholds[0] = threshold;
+  thresholds[1] = threshold;
+  thresholds[2] = threshold;
+  thresholds[3] = threshold;
+
+  for (i = 0; i < number_samples/4; i++) {
+    // Calculate sqrt(I^2 + Q^2)
+    floats_real[0] = fft_out[8*i];
+    floats_real[1] = fft_out[8*i+2];
+    floats_real[2] = fft_out[8*i+4];
+    floats_real[3] = fft_out[8*i+6];
+    floats_real_sqr = vmulq_f32(floats_real, floats_real);
+    floats_imag[0] = fft_out[8*i+1];
+    floats_imag[1] = fft_out[8*i+3];
+    floats_imag[2] = fft_out[8*i+5];
+    floats_imag[3] = fft_out[8*i+7];
+    floats_imag_sqr = vmulq_f32(floats_imag, floats_imag);
+    floats_add = vaddq_f32(floats_real_sqr,floats_imag_sqr);
+    floats_sqroot[0] = sqrt(floats_add[0]);
+    floats_sqroot[1] = sqrt(floats_add[1]);
+    floats_sqroot[2] = sqrt(floats_add[2]);
+    floats_sqroot[3] = sqrt(floats_add[3]);
+    compares = vcageq_f32(floats_sqroot,thresholds);
+    for (j = 0; j < 4; j++) {
+      if (compares[j] != 0) {
+        if (mag != NULL) *mag = floats_sqroot[j];
+        return 4*i+j;
+      }
+    }
+  }
+#else
+  float fft_mag;
+
+  for (i = 0; i < number_samples; i++) {
+    fft_mag = sqrt(fft_out[2*i]*fft_out[2*i] + fft_out[2*i+1]*fft_out[2*i+1]);
+    if (fft_mag >= threshold) {
+      if (mag != NULL) *mag = fft_mag;
+      return i;
+    }
+  }
+#endif
+  return -1;
+}
+
+int threshold_mag_sqr(const float *fft_out, uint number_samples, float threshold, float *mag)
+{
+  int i;
+  int j;
+  float threshold_sqr = threshold*threshold;
+  float mag_sqr;
+#ifdef __ARM_NEON__
+  float32x4x2_t bins_low;
+  float32x4x2_t bins_high;
+  float32x4_t mag_sqr_low;
+  float32x4_t mag_sqr_high;
+  float32x4_t thresholds;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+
+  thresholds = vdupq_n_f32(threshold_sqr);
+
+  // 8 bins per iteration. number_samples is a power of 2 and at least 64.
+  for (i = 0; i < number_samples; i += 8) {
+    // vld2q deinterleaves I/Q: val[0] holds the real parts, val[1] the imaginary parts
+    bins_low = vld2q_f32(&fft_out[2*i]);
+    bins_high = vld2q_f32(&fft_out[2*i+8]);
+    // I^2 + Q^2, no square root needed as we compare against threshold^2
+    mag_sqr_low = vmulq_f32(bins_low.val[0], bins_low.val[0]);
+    mag_sqr_low = vmlaq_f32(mag_sqr_low, bins_low.val[1], bins_low.val[1]);
+    mag_sqr_high = vmulq_f32(bins_high.val[0], bins_high.val[0]);
+    mag_sqr_high = vmlaq_f32(mag_sqr_high, bins_high.val[1], bins_high.val[1]);
+    // OR-reduce the 8 compare results down to a single lane so the common case
+    // (nothing exceeded) costs one branch per 8 bins
+    compares = vorrq_u32(vcgeq_f32(mag_sqr_low, thresholds), vcgeq_f32(mag_sqr_high, thresholds));
+    compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+    compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+    if (vget_lane_u32(compares_reduced, 0) != 0) {
+      // Rare path: find the bin that tripped and compute its exact magnitude
+      for (j = i; j < i+8; j++) {
+        mag_sqr = fft_out[2*j]*fft_out[2*j] + fft_out[2*j+1]*fft_out[2*j+1];
+        if (mag_sqr >= threshold_sqr) {
+          if (mag != NULL) *mag = sqrtf(mag_sqr);
+          return j;
+        }
+      }
+    }
+  }
+#else
+  for (i = 0; i < number_samples; i += 8) {
+    for (j = i; j < i+8; j++) {
+      mag_sqr = fft_out[2*j]*fft_out[2*j] + fft_out[2*j+1]*fft_out[2*j+1];
+      if (mag_sqr >= threshold_sqr) {
+        if (mag != NULL) *mag = sqrtf(mag_sqr);
+        return j;
+      }
+    }
+  }
+#endif
+  return -1;
+}
@@ -0,0 +1,43 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         threshold-kernels.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Magnitude threshold kernels for FFTW complex output. Each
+**                kernel scans number_samples bins of interleaved I/Q data and
+**                returns the index of the first bin whose magnitude is greater
+**                than or equal to the threshold, or -1 if no bin exceeded it.
+**                If mag is not NULL, the magnitude of that bin is stored there.
+**
+******************************************************************************/
+#ifndef THRESHOLD_KERNELS_H
+#define THRESHOLD_KERNELS_H
+
+#include <sys/types.h>
+
+#define THRESHOLD_KERNEL_SQRT     0     // Original kernel: per-lane loads, sqrt() per bin
+#define THRESHOLD_KERNEL_SQR      1     // Deinterleaving loads, compares |X|^2 against threshold^2
+#define NUM_THRESHOLD_KERNELS     2
+
+typedef int (*threshold_kernel_t)(const float *fft_out, uint number_samples, float threshold, float *mag);
+
+int threshold_mag_sqrt(const float *fft_out, uint number_samples, float threshold, float *mag);
+int threshold_mag_sqr(const float *fft_out, uint number_samples, float threshold, float *mag);
+
+extern const threshold_kernel_t threshold_kernels[NUM_THRESHOLD_KERNELS];
+extern const char *threshold_kernel_names[NUM_THRESHOLD_KERNELS];
+
+#endif
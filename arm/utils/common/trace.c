@@ -0,0 +1,356 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         trace.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Per-thread trace rings and the Chrome trace JSON dump.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "trace.h"
+#include "dma-debug-cnt.h"
+
+#define TRACE_CAL_EVENTS          1000
+
+bool trace_enabled = false;
+
+static const char *trace_filename;
+static const char *trace_process_name;
+static uint32_t *trace_clock_regs;
+static uint64_t trace_clock_last;         // Latest DMA_DEBUG_CNT extended to 64 bits
+static struct trace_ring *trace_rings[TRACE_MAX_THREADS];
+static uint trace_num_rings;
+static uint32_t trace_dma_seq;
+static double trace_event_ns;
+static __thread struct trace_ring *trace_self;
+static __thread bool trace_no_ring;
+
+static struct trace_ring *trace_ring_create(void)
+{
+  struct trace_ring *r;
+  uint slot;
+
+  if (trace_no_ring) {
+    return NULL;
+  }
+  slot = __atomic_fetch_add(&trace_num_rings, 1, __ATOMIC_ACQ_REL);
+  if (slot >= TRACE_MAX_THREADS) {
+    // Not counted, the dump only walks the slots that exist
+    __atomic_fetch_sub(&trace_num_rings, 1, __ATOMIC_ACQ_REL);
+    trace_no_ring = true;
+    return NULL;
+  }
+  r = (struct trace_ring *)calloc(1, sizeof(struct trace_ring));
+  if (r != NULL) {
+    r->events = (struct trace_event *)malloc(TRACE_RING_EVENTS*sizeof(struct trace_event));
+  }
+  if (r == NULL || r->events == NULL) {
+    printf("ERROR: Failed to allocate trace ring\n");
+    free(r);
+    trace_no_ring = true;
+    return NULL;
+  }
+  // Touch every page now rather than on the first pass around the ring
+  memset(r->events, 0, TRACE_RING_EVENTS*sizeof(struct trace_event));
+  r->tid = syscall(SYS_gettid);
+  r->active = 1;
+  snprintf(r->name, sizeof(r->name), "%d", r->tid);
+  __atomic_store_n(&trace_rings[slot], r, __ATOMIC_RELEASE);
+  trace_self = r;
+  return r;
+}
+
+// DMA_DEBUG_CNT extended to 64 bits. One extension is shared by every thread, so
+// their timestamps line up. A read that lost the race with a newer one from another
+// thread is placed just before it instead of a wrap later.
+static inline uint64_t trace_clock_extend(uint32_t cnt)
+{
+  uint64_t last = __atomic_load_n(&trace_clock_last, __ATOMIC_ACQUIRE);
+  uint64_t now;
+  uint32_t delta;
+
+  do {
+    delta = dma_debug_cnt_delta((uint32_t)last, cnt);
+    if (delta > DMA_DEBUG_CNT_MASK/2) {
+      return last - (DMA_DEBUG_CNT_MASK + 1 - delta);
+    }
+    now = last + delta;
+  } while (!__atomic_compare_exchange_n(&trace_clock_last, &last, now, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return now;
+}
+
+static inline uint64_t trace_now(void)
+{
+  struct timespec ts;
+
+  if (trace_clock_regs != NULL) {
+    return trace_clock_extend(crash_read_reg(trace_clock_regs,DMA_DEBUG_CNT));
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static inline void trace_record(struct trace_ring *r, uint type, const char *name, uint32_t arg)
+{
+  struct trace_event *e = &r->events[r->head & (TRACE_RING_EVENTS - 1)];
+
+  e->ts = trace_now();
+  e->name = name;
+  e->type = type;
+  e->arg = arg;
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_event(uint type, const char *name, uint32_t arg)
+{
+  struct trace_ring *r = trace_self;
+
+  if (r == NULL && (r = trace_ring_create()) == NULL) {
+    return;
+  }
+  trace_record(r, type, name, arg);
+}
+
+// Time TRACE_CAL_EVENTS events into a scratch ring, so the cost of recording is known
+static double trace_calibrate(void)
+{
+  struct trace_ring r;
+  struct trace_event events[TRACE_CAL_EVENTS];
+  struct timespec start;
+  struct timespec stop;
+  uint i;
+
+  memset(&r, 0, sizeof(struct trace_ring));
+  r.events = events;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  for (i = 0; i < TRACE_CAL_EVENTS; i++) {
+    // Ring is larger than events[], so wrap it by hand
+    r.head = i;
+    trace_record(&r, TRACE_BEGIN, "Calibrate", i);
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &stop);
+  return ((stop.tv_sec - start.tv_sec)*1e9 + (stop.tv_nsec - start.tv_nsec))/TRACE_CAL_EVENTS;
+}
+
+int trace_init(const char *filename, const char *process_name, struct crash_plblock *clock)
+{
+  trace_filename = filename;
+  trace_process_name = process_name;
+  trace_clock_regs = (clock != NULL) ? clock->regs : NULL;
+  if (clock != NULL) {
+    trace_clock_last = crash_read_reg(clock->regs,DMA_DEBUG_CNT);
+  }
+  trace_event_ns = trace_calibrate();
+  if (trace_ring_create() == NULL) {
+    return -1;
+  }
+  trace_enabled = true;
+  trace_thread_name("main");
+  return 0;
+}
+
+void trace_thread_name(const char *name)
+{
+  struct trace_ring *r = trace_self;
+  uint num_rings = __atomic_load_n(&trace_num_rings, __ATOMIC_ACQUIRE);
+  int idle;
+  uint k;
+
+  if (!trace_enabled) {
+    return;
+  }
+  // Take over the ring of an exited thread with the same name, so threads that are
+  // restarted every loop stay on one track
+  for (k = 0; k < num_rings && r == NULL; k++) {
+    r = __atomic_load_n(&trace_rings[k], __ATOMIC_ACQUIRE);
+    idle = 0;
+    if (r == NULL || strncmp(r->name, name, sizeof(r->name) - 1) != 0 ||
+        !__atomic_compare_exchange_n(&r->active, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      r = NULL;
+    }
+  }
+  if (r != NULL) {
+    trace_self = r;
+  } else if ((r = trace_ring_create()) == NULL) {
+    return;
+  }
+  snprintf(r->name, sizeof(r->name), "%s", name);
+}
+
+void trace_thread_exit(void)
+{
+  if (trace_self != NULL) {
+    __atomic_store_n(&trace_self->active, 0, __ATOMIC_RELEASE);
+    trace_self = NULL;
+  }
+}
+
+int trace_crash_read(struct crash_plblock *plblock, uint plblock_id, uint num_words)
+{
+  uint32_t seq;
+  int ret;
+
+  if (!trace_enabled) {
+    return crash_read(plblock, plblock_id, num_words);
+  }
+  seq = __atomic_fetch_add(&trace_dma_seq, 1, __ATOMIC_RELAXED);
+  trace_event(TRACE_DMA_SUBMIT, "crash_read", seq);
+  ret = crash_read(plblock, plblock_id, num_words);
+  trace_event(TRACE_DMA_COMPLETE, "crash_read", seq);
+  return ret;
+}
+
+// Events [first, head) of a ring, the older ones having been overwritten
+static uint32_t trace_ring_first(struct trace_ring *r, uint32_t head)
+{
+  return (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0;
+}
+
+static void trace_write_event(FILE *fp, struct trace_event *e, double ts_us, int pid, int tid)
+{
+  switch (e->type) {
+    case TRACE_REG_WRITE:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"reg\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d, \"args\": {\"value\": \"0x%08x\"}}",e->name,ts_us,pid,tid,e->arg);
+      break;
+    case TRACE_DMA_SUBMIT:
+    case TRACE_DMA_COMPLETE:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"dma\", \"ph\": \"%s\", \"id\": %u, \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d}",e->name,(e->type == TRACE_DMA_SUBMIT) ? "b" : "e",e->arg,ts_us,pid,tid);
+      break;
+    case TRACE_FFT_START:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"fft\", \"ph\": \"B\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d, \"args\": {\"size\": %u}}",e->name,ts_us,pid,tid,e->arg);
+      break;
+    case TRACE_FFT_END:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"fft\", \"ph\": \"E\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d}",e->name,ts_us,pid,tid);
+      break;
+    case TRACE_DECISION:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"decision\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d, \"args\": {\"exceeded\": %u}}",e->name,ts_us,pid,tid,e->arg);
+      break;
+    case TRACE_TX_ENABLE:
+      // Process scope, so it is drawn across every thread
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"tx\", \"ph\": \"i\", \"s\": \"p\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d, \"args\": {\"enable\": %u}}",e->name,ts_us,pid,tid,e->arg);
+      break;
+    default:
+      fprintf(fp,"{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"%s\", \"ts\": %.3f, "
+              "\"pid\": %d, \"tid\": %d, \"args\": {\"arg\": %u}}",e->name,
+              (e->type == TRACE_END) ? "E" : "B",ts_us,pid,tid,e->arg);
+      break;
+  }
+}
+
+int trace_dump(void)
+{
+  struct trace_ring *r;
+  FILE *fp;
+  uint64_t t0 = UINT64_MAX;
+  uint32_t heads[TRACE_MAX_THREADS];
+  uint32_t i;
+  double ticks_per_us = (trace_clock_regs != NULL) ? DMA_DEBUG_CNT_MHZ : 1000.0;
+  int pid = getpid();
+  uint num_rings = __atomic_load_n(&trace_num_rings, __ATOMIC_ACQUIRE);
+  uint k;
+
+  if (trace_filename == NULL) {
+    return 0;
+  }
+  // Timestamps are written relative to the oldest event still in any ring
+  for (k = 0; k < num_rings; k++) {
+    r = __atomic_load_n(&trace_rings[k], __ATOMIC_ACQUIRE);
+    heads[k] = (r != NULL) ? __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) : 0;
+    if (heads[k] > 0 && r->events[trace_ring_first(r, heads[k]) & (TRACE_RING_EVENTS - 1)].ts < t0) {
+      t0 = r->events[trace_ring_first(r, heads[k]) & (TRACE_RING_EVENTS - 1)].ts;
+    }
+  }
+
+  fp = fopen(trace_filename,"w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open trace file %s\n",trace_filename);
+    return -1;
+  }
+  fprintf(fp,"{\"displayTimeUnit\": \"ns\",\n \"otherData\": {\"clock\": \"%s\", \"event_cost_ns\": %.1f},\n"
+          " \"traceEvents\": [\n",(trace_clock_regs != NULL) ? "DMA_DEBUG_CNT" : "CLOCK_MONOTONIC_RAW",
+          trace_event_ns);
+  fprintf(fp,"{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+          pid,(trace_process_name != NULL) ? trace_process_name : "crash");
+  for (k = 0; k < num_rings; k++) {
+    r = trace_rings[k];
+    if (r == NULL) continue;
+    fprintf(fp,",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+            pid,r->tid,r->name);
+    for (i = trace_ring_first(r, heads[k]); i != heads[k]; i++) {
+      fprintf(fp,",\n");
+      trace_write_event(fp, &r->events[i & (TRACE_RING_EVENTS - 1)],
+                        (r->events[i & (TRACE_RING_EVENTS - 1)].ts - t0)/ticks_per_us, pid, r->tid);
+    }
+  }
+  fprintf(fp,"\n]}\n");
+  if (fclose(fp) != 0) {
+    printf("ERROR: Failed to write trace file %s\n",trace_filename);
+    return -1;
+  }
+  return 0;
+}
+
+void trace_print_stats(void)
+{
+  struct trace_ring *r;
+  uint64_t events = 0;
+  uint64_t overwritten = 0;
+  uint num_rings = __atomic_load_n(&trace_num_rings, __ATOMIC_ACQUIRE);
+  uint k;
+
+  for (k = 0; k < num_rings; k++) {
+    r = __atomic_load_n(&trace_rings[k], __ATOMIC_ACQUIRE);
+    if (r == NULL) continue;
+    events += r->head;
+    overwritten += trace_ring_first(r, r->head);
+  }
+  printf("Trace Threads:\t\t\t%d\n",num_rings);
+  printf("Trace Events:\t\t\t%llu\n",(unsigned long long)events);
+  printf("Trace Events Overwritten:\t%llu\n",(unsigned long long)overwritten);
+  printf("Trace Event Cost (ns):\t\t%f\n",trace_event_ns);
+}
+
+void trace_free(void)
+{
+  uint k;
+
+  trace_enabled = false;
+  for (k = 0; k < trace_num_rings; k++) {
+    if (trace_rings[k] != NULL) {
+      free(trace_rings[k]->events);
+      free(trace_rings[k]);
+      trace_rings[k] = NULL;
+    }
+  }
+  trace_num_rings = 0;
+  trace_self = NULL;
+}
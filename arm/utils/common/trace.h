@@ -0,0 +1,110 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         trace.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Timestamped event recorder for the sense-to-transmit loop,
+**                dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+**
+**                Every thread records into its own ring of TRACE_RING_EVENTS
+**                events, so recording takes no locks: one timestamp read and a
+**                24 byte store. When a ring fills the oldest events are
+**                overwritten, so the dump holds the last TRACE_RING_EVENTS of
+**                each thread. Until trace_init() is called TRACE() is a single
+**                branch, so the common modules can be instrumented for free.
+**
+**                Timestamps are CLOCK_MONOTONIC_RAW nanoseconds, or DMA_DEBUG_CNT
+**                cycles (150 MHz) when trace_init() is given a plblock. The
+**                counter is extended to 64 bits once for all threads, which is
+**                correct as long as some thread records at least once per
+**                counter wrap (~7.16 seconds) and nothing calls crash_reset()
+**                while tracing. The tools reset every loop, so they use the
+**                monotonic clock.
+**
+**                A thread that calls trace_thread_exit() before it returns hands its
+**                ring to the next thread given the same name, so threads started
+**                every loop show up as one track and do not use up the
+**                TRACE_MAX_THREADS rings.
+**
+**                Names must be string literals (or otherwise outlive the dump),
+**                only the pointer is recorded. trace_dump() must be called after
+**                the recording threads have stopped.
+**
+******************************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+struct crash_plblock;
+
+#define TRACE_RING_EVENTS         65536       // Per thread, power of 2
+#define TRACE_MAX_THREADS         8
+
+// Event types. DMA submit / complete pairs are matched on name and arg (the transfer
+// number), so several transfers can be outstanding at once.
+#define TRACE_REG_WRITE           0           // arg: value written
+#define TRACE_DMA_SUBMIT          1           // arg: transfer number
+#define TRACE_DMA_COMPLETE        2           // arg: transfer number
+#define TRACE_FFT_START           3           // arg: FFT size
+#define TRACE_FFT_END             4
+#define TRACE_DECISION            5           // arg: 1 if the threshold was exceeded
+#define TRACE_TX_ENABLE           6           // arg: 1 enable, 0 disable
+#define TRACE_BEGIN               7           // Any other stage
+#define TRACE_END                 8
+
+struct trace_event {
+  uint64_t ts;
+  const char *name;
+  uint32_t type;
+  uint32_t arg;
+};
+
+struct trace_ring {
+  struct trace_event *events;
+  uint32_t head;                  // Total events recorded, only written by the owner
+  int active;                     // Owned by a running thread
+  int tid;
+  char name[16];
+};
+
+extern bool trace_enabled;
+
+#define TRACE(type, name, arg) do { if (trace_enabled) trace_event(type, name, arg); } while (0)
+
+// Register writes that also go into the trace, named after the register
+#define trace_write_reg(regs, reg, value) do { TRACE(TRACE_REG_WRITE, #reg, value); crash_write_reg(regs, reg, value); } while (0)
+#define trace_set_bit(regs, bit) do { TRACE(TRACE_REG_WRITE, #bit, 1); crash_set_bit(regs, bit); } while (0)
+#define trace_clear_bit(regs, bit) do { TRACE(TRACE_REG_WRITE, #bit, 0); crash_clear_bit(regs, bit); } while (0)
+
+// Start recording, to be written to filename by trace_dump(). clock is the plblock to
+// read DMA_DEBUG_CNT from, NULL for CLOCK_MONOTONIC_RAW. Only pass a plblock if
+// crash_reset() is not called until trace_dump().
+int trace_init(const char *filename, const char *process_name, struct crash_plblock *clock);
+void trace_event(uint type, const char *name, uint32_t arg);
+// Name the calling thread in the trace. Also sets up its ring, so call it at thread
+// start to keep the allocation out of the first recorded event. No-op until trace_init().
+void trace_thread_name(const char *name);
+// Give up the calling thread's ring, to be reused by the next thread of the same name
+void trace_thread_exit(void);
+// crash_read() between a DMA submit and complete event
+int trace_crash_read(struct crash_plblock *plblock, uint plblock_id, uint num_words);
+int trace_dump(void);
+void trace_print_stats(void);
+void trace_free(void);
+
+#endif
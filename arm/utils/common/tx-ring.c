@@ -0,0 +1,165 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         tx-ring.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Continuous transmit through a ring of MM2S transfers.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "tx-ring.h"
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+
+// Accumulate DMA_DEBUG_CNT into a 64-bit count, see frame-ring.c
+static uint32_t tx_ring_update_time(struct tx_ring *ring)
+{
+  uint32_t cnt = crash_read_reg(ring->plblock->regs,DMA_DEBUG_CNT);
+  uint32_t delta = dma_debug_cnt_delta(ring->last_cnt, cnt);
+
+  ring->elapsed_cycles += delta;
+  ring->last_cnt = cnt;
+  return delta;
+}
+
+// Transfers completed since the ring started
+static uint32_t tx_ring_update_completed(struct tx_ring *ring)
+{
+  dma_queue_reap(&ring->queue, 0, 0);
+  ring->completed = ring->queue.completed;
+  return ring->completed;
+}
+
+int tx_ring_start(struct tx_ring *ring, struct crash_plblock *plblock, uint plblock_id,
+                  uint num_buffs, uint number_samples, uint interp_rate)
+{
+  if (num_buffs < TX_RING_MIN_BUFFS || num_buffs > TX_RING_MAX_BUFFS) {
+    printf("ERROR: TX ring needs %d to %d buffers\n",TX_RING_MIN_BUFFS,TX_RING_MAX_BUFFS);
+    return -1;
+  }
+  // Transfer size field is 23 bits
+  if ((uint64_t)number_samples*sizeof(uint64_t) > DMA_QUEUE_MAX_BYTES) {
+    printf("ERROR: TX ring transfer size too large\n");
+    return -1;
+  }
+  if ((uint64_t)num_buffs*number_samples*sizeof(uint64_t) > CRASH_DMA_BUFF_SIZE) {
+    printf("ERROR: TX ring of %d x %d samples does not fit in the DMA buffer\n",num_buffs,number_samples);
+    return -1;
+  }
+  memset(ring, 0, sizeof(struct tx_ring));
+  ring->plblock = plblock;
+  ring->plblock_id = plblock_id;
+  ring->num_buffs = num_buffs;
+  ring->number_samples = number_samples;
+  ring->min_in_flight = num_buffs;
+  // DAC runs at 100 MSPS, DMA_DEBUG_CNT at 150 MHz
+  ring->frame_cycles = (uint32_t)(1.5*number_samples*interp_rate);
+  ring->last_cnt = crash_read_reg(plblock->regs,DMA_DEBUG_CNT);
+  return dma_queue_init(&ring->queue, plblock, DMA_QUEUE_MM2S, false);
+}
+
+void *tx_ring_next(struct tx_ring *ring)
+{
+  uint64_t timeout = 0;
+  uint32_t delta;
+
+  // A slot is free once the transfer queued num_buffs submits ago has completed
+  while (ring->queued - tx_ring_update_completed(ring) >= ring->num_buffs) {
+    delta = tx_ring_update_time(ring);
+    ring->full_polls++;
+    ring->wait_cycles += delta;
+    timeout += delta;
+    if (timeout > TX_RING_TIMEOUT_CYCLES) {
+      return NULL;
+    }
+    // Past the spin period, sleep until the DMA interrupt or at most half a frame
+    if (timeout > CRASH_WAIT_SPIN_CYCLES) {
+      crash_wait_event(ring->plblock, ring->frame_cycles/300);
+    }
+  }
+  return (char *)ring->plblock->dma_buff +
+         (size_t)(ring->queued % ring->num_buffs)*ring->number_samples*sizeof(uint64_t);
+}
+
+void tx_ring_submit(struct tx_ring *ring)
+{
+  uint32_t offset = (ring->queued % ring->num_buffs)*ring->number_samples*sizeof(uint64_t);
+  struct dma_desc desc;
+  uint in_flight = ring->queued - tx_ring_update_completed(ring);
+
+  // Once the ring has been primed, nothing left in flight means the DAC has been starved
+  if (ring->queued >= ring->num_buffs) {
+    if (in_flight == 0) {
+      ring->underruns++;
+    }
+    if (in_flight < ring->min_in_flight) {
+      ring->min_in_flight = in_flight;
+    }
+  }
+  desc.addr = ring->plblock->dma_phys_addr + offset;
+  desc.bytes = ring->number_samples*sizeof(uint64_t);
+  desc.tdest = ring->plblock_id;
+  // Never full here, tx_ring_next() waited for the slot
+  dma_queue_submit(&ring->queue, &desc, 1);
+  ring->queued++;
+  ring->frames++;
+  tx_ring_update_time(ring);
+}
+
+int tx_ring_drain(struct tx_ring *ring)
+{
+  uint64_t timeout = 0;
+
+  while (tx_ring_update_completed(ring) != ring->queued) {
+    timeout += tx_ring_update_time(ring);
+    if (timeout > TX_RING_TIMEOUT_CYCLES) {
+      return -1;
+    }
+    if (timeout > CRASH_WAIT_SPIN_CYCLES) {
+      crash_wait_event(ring->plblock, ring->frame_cycles/300);
+    }
+  }
+  return 0;
+}
+
+void tx_ring_stop(struct tx_ring *ring)
+{
+  tx_ring_update_time(ring);
+  // Anything still queued was abandoned by the caller, do not wait on it
+  dma_queue_stop(&ring->queue, 0);
+}
+
+void tx_ring_print_stats(struct tx_ring *ring)
+{
+  double elapsed_sec = ring->elapsed_cycles/150e6;
+
+  printf("TX Ring Buffers:\t\t%d\n",ring->num_buffs);
+  printf("Frames Sent:\t\t\t%llu\n",(unsigned long long)ring->frames);
+  printf("Underruns:\t\t\t%llu\n",(unsigned long long)ring->underruns);
+  printf("Min Frames In Flight:\t\t%d\n",ring->min_in_flight);
+  printf("Full Polls:\t\t\t%llu\n",(unsigned long long)ring->full_polls);
+  if (elapsed_sec > 0.0) {
+    printf("Frame Rate (frames/s):\t\t%f\n",ring->frames/elapsed_sec);
+    printf("Output Frame Rate (frames/s):\t%f\n",150e6/ring->frame_cycles);
+    printf("DMA Wait (%%):\t\t\t%f\n",100.0*ring->wait_cycles/ring->elapsed_cycles);
+  }
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         tx-ring.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Continuous transmit through a ring of MM2S transfers.
+**
+**                The plblock DMA buffer is split into num_buffs slots. Each
+**                filled slot is queued as its own transfer in the ps_pl_interface
+**                MM2S command FIFO (control banks 2 / 3), so the Datamover moves
+**                straight on to the next slot while the caller refills the ones
+**                already sent. Completed transfers are counted from the MM2S
+**                transfer counter, which tells which slots can be reused.
+**
+**                Fill all num_buffs slots before enabling TX. After that, if
+**                every queued transfer has completed by the time the next slot
+**                is submitted, the DMA ran out of data and the DAC went dry;
+**                this is counted as an underrun.
+**
+******************************************************************************/
+#ifndef TX_RING_H
+#define TX_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "dma-queue.h"
+struct crash_plblock;
+
+#define TX_RING_MIN_BUFFS         2
+#define TX_RING_MAX_BUFFS         DMA_QUEUE_FIFO_DEPTH
+#define TX_RING_TIMEOUT_CYCLES    150000000   // 1 second of DMA_DEBUG_CNT
+
+struct tx_ring {
+  struct crash_plblock *plblock;
+  uint plblock_id;
+  uint num_buffs;
+  uint number_samples;
+  uint32_t frame_cycles;          // Time to play out one slot in DMA_DEBUG_CNT cycles
+  struct dma_queue queue;
+  uint32_t queued;                // Transfers queued since tx_ring_start()
+  uint32_t completed;
+  uint32_t last_cnt;
+  uint64_t elapsed_cycles;
+  uint64_t wait_cycles;           // Time spent in tx_ring_next() waiting for a free slot
+  uint64_t frames;
+  uint64_t underruns;
+  uint64_t full_polls;
+  uint min_in_flight;             // Lowest number of queued transfers seen at submit
+};
+
+// Split the DMA buffer into num_buffs slots of number_samples 64-bit words and enable MM2S.
+// interp_rate is only used to compute the expected play out rate for the stats.
+int tx_ring_start(struct tx_ring *ring, struct crash_plblock *plblock, uint plblock_id,
+                  uint num_buffs, uint number_samples, uint interp_rate);
+// Wait for a free slot to fill. Returns NULL if no transfer completed within
+// TX_RING_TIMEOUT_CYCLES.
+void *tx_ring_next(struct tx_ring *ring);
+// Queue the slot returned by the last tx_ring_next()
+void tx_ring_submit(struct tx_ring *ring);
+// Wait until every queued transfer has completed, returns -1 on timeout
+int tx_ring_drain(struct tx_ring *ring);
+void tx_ring_stop(struct tx_ring *ring);
+void tx_ring_print_stats(struct tx_ring *ring);
+
+#endif
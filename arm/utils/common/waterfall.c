@@ -0,0 +1,374 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         waterfall.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Compact spectrogram (waterfall) log for long occupancy surveys.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "stream-writer.h"
+#include "waterfall.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#define WATERFALL_DB_PER_OCTAVE   6.0205999f    // 20*log10(2)
+#define WATERFALL_APPEND_RETRIES  1000          // 1 ms apart
+
+// Least squares fit of log2(m) for m in [1,2), max error ~2e-4 (~0.001 dB), well
+// below the smallest useful dB step
+#define WATERFALL_LOG2_C0         -2.4968058f
+#define WATERFALL_LOG2_C1         4.0284505f
+#define WATERFALL_LOG2_C2         -2.0811285f
+#define WATERFALL_LOG2_C3         0.62884138f
+#define WATERFALL_LOG2_C4         -0.079153816f
+
+static void waterfall_free_buffers(struct waterfall *wf)
+{
+  free(wf->accum);
+  free(wf->chunk);
+  free(wf->index);
+  wf->accum = NULL;
+  wf->chunk = NULL;
+  wf->index = NULL;
+}
+
+// The index and trailer are small but must not be lost, wait for the writer to free a block
+static int waterfall_append_retry(struct waterfall *wf, const void *data, size_t len)
+{
+  uint retries;
+
+  for (retries = 0; retries < WATERFALL_APPEND_RETRIES; retries++) {
+    if (stream_writer_append(wf->writer, data, len) == 0) {
+      return 0;
+    }
+    usleep(1000);
+  }
+  return -1;
+}
+
+static uint64_t waterfall_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+int waterfall_open(struct waterfall *wf, struct stream_writer *writer, uint num_bins,
+                   uint decim_rate, uint bits, float db_min, float db_step, uint row_mode,
+                   uint frames_per_row, uint rows_per_chunk)
+{
+  struct waterfall_file_header header;
+
+  memset(wf, 0, sizeof(struct waterfall));
+  if (bits != 8 && bits != 16) {
+    printf("ERROR: Waterfall codes must be 8 or 16 bits\n");
+    return -1;
+  }
+  if (db_step <= 0.0) {
+    printf("ERROR: Waterfall dB step must be positive\n");
+    return -1;
+  }
+  if (row_mode != WATERFALL_ROW_MEAN && row_mode != WATERFALL_ROW_PEAK) {
+    printf("ERROR: Invalid waterfall row mode %d\n",row_mode);
+    return -1;
+  }
+  if (frames_per_row == 0 || rows_per_chunk == 0) {
+    printf("ERROR: Waterfall frames per row and rows per chunk must be at least 1\n");
+    return -1;
+  }
+  wf->writer = writer;
+  wf->num_bins = num_bins;
+  wf->decim_rate = decim_rate;
+  wf->bits = bits;
+  wf->row_mode = row_mode;
+  wf->frames_per_row = frames_per_row;
+  wf->rows_per_chunk = rows_per_chunk;
+  wf->db_min = db_min;
+  wf->db_step = db_step;
+  wf->accum = (float *)malloc(num_bins*sizeof(float));
+  wf->chunk = (uint8_t *)malloc(sizeof(struct waterfall_chunk_header) +
+                                (size_t)rows_per_chunk*num_bins*(bits/8));
+  wf->index_size = 64;
+  wf->index = (struct waterfall_index_entry *)malloc(wf->index_size*sizeof(struct waterfall_index_entry));
+  if (wf->accum == NULL || wf->chunk == NULL || wf->index == NULL) {
+    printf("ERROR: Failed to allocate waterfall buffers\n");
+    waterfall_free_buffers(wf);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = WATERFALL_MAGIC;
+  header.version = WATERFALL_VERSION;
+  header.header_size = sizeof(struct waterfall_file_header);
+  header.chunk_header_size = sizeof(struct waterfall_chunk_header);
+  if (stream_writer_append(writer, &header, sizeof(header)) != 0) {
+    printf("ERROR: Failed to write waterfall header\n");
+    waterfall_free_buffers(wf);
+    return -1;
+  }
+  wf->offset = sizeof(header);
+  return 0;
+}
+
+#ifdef __ARM_NEON__
+// Codes for 4 magnitudes, saturated to 16 bits
+static inline uint16x4_t waterfall_quantize_neon(const float *mag, float32x4_t scale,
+                                                 float32x4_t offset, float32x4_t max_code)
+{
+  uint32x4_t value_bits = vreinterpretq_u32_f32(vld1q_f32(mag));
+  float32x4_t exponent;
+  float32x4_t mantissa;
+  float32x4_t poly;
+  float32x4_t codes;
+
+  // Split into exponent and a mantissa in [1,2)
+  exponent = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(value_bits,23)),
+                                     vdupq_n_s32(127)));
+  mantissa = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(value_bits,vdupq_n_u32(0x007FFFFF)),
+                                             vdupq_n_u32(0x3F800000)));
+  poly = vmlaq_f32(vdupq_n_f32(WATERFALL_LOG2_C3),mantissa,vdupq_n_f32(WATERFALL_LOG2_C4));
+  poly = vmlaq_f32(vdupq_n_f32(WATERFALL_LOG2_C2),mantissa,poly);
+  poly = vmlaq_f32(vdupq_n_f32(WATERFALL_LOG2_C1),mantissa,poly);
+  poly = vmlaq_f32(vdupq_n_f32(WATERFALL_LOG2_C0),mantissa,poly);
+  codes = vmlaq_f32(offset,vaddq_f32(exponent,poly),scale);
+  codes = vminq_f32(vmaxq_f32(codes,vdupq_n_f32(0.0f)),max_code);
+  return vqmovn_u32(vcvtq_u32_f32(codes));
+}
+#endif
+
+void waterfall_quantize(const float *mag, uint num_bins, float db_min, float db_step, uint bits,
+                        void *codes)
+{
+  // code = (WATERFALL_DB_PER_OCTAVE*log2(mag) - db_min)/db_step, +0.5 to round
+  const float scale = WATERFALL_DB_PER_OCTAVE/db_step;
+  const float offset = 0.5f - db_min/db_step;
+  const float max_code = (bits == 8) ? 255.0f : 65535.0f;
+  uint8_t *codes8 = (uint8_t *)codes;
+  uint16_t *codes16 = (uint16_t *)codes;
+  union { float f; uint32_t u; } x;
+  float m;
+  float code;
+  uint i = 0;
+#ifdef __ARM_NEON__
+  uint16x8_t codes_u16;
+
+  for (i = 0; i + 8 <= num_bins; i += 8) {
+    codes_u16 = vcombine_u16(
+        waterfall_quantize_neon(&mag[i],vdupq_n_f32(scale),vdupq_n_f32(offset),vdupq_n_f32(max_code)),
+        waterfall_quantize_neon(&mag[i+4],vdupq_n_f32(scale),vdupq_n_f32(offset),vdupq_n_f32(max_code)));
+    if (bits == 8) {
+      vst1_u8(&codes8[i],vqmovn_u16(codes_u16));
+    } else {
+      vst1q_u16(&codes16[i],codes_u16);
+    }
+  }
+#endif
+  for (; i < num_bins; i++) {
+    x.f = mag[i];
+    code = (float)((int)(x.u >> 23) - 127);
+    x.u = (x.u & 0x007FFFFF) | 0x3F800000;
+    m = x.f;
+    code += WATERFALL_LOG2_C0 + m*(WATERFALL_LOG2_C1 + m*(WATERFALL_LOG2_C2 +
+            m*(WATERFALL_LOG2_C3 + m*WATERFALL_LOG2_C4)));
+    code = code*scale + offset;
+    if (code < 0.0f) code = 0.0f;
+    if (code > max_code) code = max_code;
+    if (bits == 8) {
+      codes8[i] = (uint8_t)code;
+    } else {
+      codes16[i] = (uint16_t)code;
+    }
+  }
+}
+
+// Hand the current chunk to the writer and record it in the index
+static void waterfall_flush_chunk(struct waterfall *wf)
+{
+  struct waterfall_chunk_header *hdr = (struct waterfall_chunk_header *)wf->chunk;
+  struct waterfall_index_entry *index;
+  size_t len;
+
+  if (wf->chunk_rows == 0) {
+    return;
+  }
+  hdr->num_rows = wf->chunk_rows;
+  len = sizeof(struct waterfall_chunk_header) + (size_t)wf->chunk_rows*wf->num_bins*(wf->bits/8);
+  if (stream_writer_append(wf->writer, wf->chunk, len) != 0) {
+    // Storage fell behind, the chunk is lost. Carry its frames over as dropped.
+    wf->lost_chunks++;
+    wf->pending_dropped += wf->chunk_rows*wf->frames_per_row + hdr->dropped_frames;
+    wf->chunk_rows = 0;
+    return;
+  }
+  if (wf->num_chunks == wf->index_size) {
+    index = (struct waterfall_index_entry *)realloc(wf->index,
+              2*wf->index_size*sizeof(struct waterfall_index_entry));
+    if (index != NULL) {
+      wf->index = index;
+      wf->index_size *= 2;
+    }
+  }
+  if (wf->num_chunks < wf->index_size) {
+    wf->index[wf->num_chunks].offset = wf->offset;
+    wf->index[wf->num_chunks].start_time_ns = hdr->start_time_ns;
+    wf->index[wf->num_chunks].num_rows = hdr->num_rows;
+    wf->index[wf->num_chunks].reserved = 0;
+    wf->num_chunks++;
+  }
+  wf->offset += len;
+  wf->chunk_rows = 0;
+}
+
+int waterfall_push_frame(struct waterfall *wf, const float *fft_mag, uint stride, uint dropped)
+{
+  struct waterfall_chunk_header *hdr = (struct waterfall_chunk_header *)wf->chunk;
+  uint8_t *row;
+  float inv;
+  uint i;
+  int ret = 0;
+
+  wf->pending_dropped += dropped;
+  wf->frames += dropped;
+  // Start a new chunk, its header holds all settings needed to decode it
+  if (wf->chunk_rows == 0 && wf->accum_frames == 0) {
+    memset(hdr, 0, sizeof(struct waterfall_chunk_header));
+    hdr->magic = WATERFALL_CHUNK_MAGIC;
+    hdr->seq = wf->num_chunks + wf->lost_chunks;
+    hdr->num_bins = wf->num_bins;
+    hdr->decim_rate = wf->decim_rate;
+    hdr->frames_per_row = wf->frames_per_row;
+    hdr->bits = wf->bits;
+    hdr->row_mode = wf->row_mode;
+    hdr->db_min = wf->db_min;
+    hdr->db_step = wf->db_step;
+    hdr->dropped_frames = wf->pending_dropped;
+    hdr->start_time_ns = waterfall_now_ns();
+    // ADC runs at 100 MSPS, i.e. 10 ns per sample before decimation
+    hdr->row_period_ns = 10ULL*wf->num_bins*wf->decim_rate*wf->frames_per_row;
+    hdr->first_frame = wf->frames;
+    wf->pending_dropped = 0;
+  }
+
+  if (wf->accum_frames == 0) {
+    for (i = 0; i < wf->num_bins; i++) {
+      wf->accum[i] = fft_mag[stride*i];
+    }
+  } else if (wf->row_mode == WATERFALL_ROW_PEAK) {
+    for (i = 0; i < wf->num_bins; i++) {
+      if (fft_mag[stride*i] > wf->accum[i]) wf->accum[i] = fft_mag[stride*i];
+    }
+  } else {
+    for (i = 0; i < wf->num_bins; i++) {
+      wf->accum[i] += fft_mag[stride*i];
+    }
+  }
+  wf->accum_frames++;
+  wf->frames++;
+  if (wf->accum_frames < wf->frames_per_row) {
+    return 0;
+  }
+
+  if (wf->row_mode == WATERFALL_ROW_MEAN && wf->frames_per_row > 1) {
+    inv = 1.0f/wf->frames_per_row;
+    for (i = 0; i < wf->num_bins; i++) {
+      wf->accum[i] *= inv;
+    }
+  }
+  row = wf->chunk + sizeof(struct waterfall_chunk_header) +
+        (size_t)wf->chunk_rows*wf->num_bins*(wf->bits/8);
+  waterfall_quantize(wf->accum, wf->num_bins, wf->db_min, wf->db_step, wf->bits, row);
+  wf->accum_frames = 0;
+  wf->chunk_rows++;
+  wf->rows++;
+  if (wf->chunk_rows == wf->rows_per_chunk) {
+    waterfall_flush_chunk(wf);
+    ret = 1;
+  }
+  return ret;
+}
+
+void waterfall_close(struct waterfall *wf)
+{
+  struct waterfall_trailer trailer;
+
+  if (wf->chunk == NULL) {
+    return;
+  }
+  // A partially accumulated row is dropped, it would not match frames_per_row
+  waterfall_flush_chunk(wf);
+  trailer.magic = WATERFALL_INDEX_MAGIC;
+  trailer.num_chunks = wf->num_chunks;
+  trailer.index_offset = wf->offset;
+  if (waterfall_append_retry(wf, wf->index, wf->num_chunks*sizeof(struct waterfall_index_entry)) != 0 ||
+      waterfall_append_retry(wf, &trailer, sizeof(trailer)) != 0) {
+    printf("ERROR: Failed to write waterfall index\n");
+  }
+  waterfall_free_buffers(wf);
+}
+
+void waterfall_print_stats(struct waterfall *wf)
+{
+  printf("Waterfall Bits / dB Step:\t%d / %f\n",wf->bits,wf->db_step);
+  printf("Waterfall Frames / Row:\t\t%d (%s)\n",wf->frames_per_row,
+         (wf->row_mode == WATERFALL_ROW_PEAK) ? "peak" : "mean");
+  printf("Waterfall Rows:\t\t\t%llu\n",(unsigned long long)wf->rows);
+  printf("Waterfall Chunks:\t\t%d\n",wf->num_chunks);
+  printf("Waterfall Lost Chunks:\t\t%llu\n",(unsigned long long)wf->lost_chunks);
+  if (wf->offset > 0) {
+    printf("Waterfall Size Ratio:\t\t%f\n",
+           (double)wf->rows*wf->frames_per_row*wf->num_bins*sizeof(uint64_t)/wf->offset);
+  }
+  if (wf->rows > 0) {
+    printf("Quantize / Row (us):\t\t%f\n",(1e6/150e6)*wf->quantize_cycles/wf->rows);
+  }
+}
+
+int waterfall_read_index(FILE *fp, struct waterfall_index_entry **index)
+{
+  struct waterfall_file_header header;
+  struct waterfall_trailer trailer;
+
+  *index = NULL;
+  if (fseek(fp, 0, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.magic != WATERFALL_MAGIC || header.version != WATERFALL_VERSION) {
+    return -1;
+  }
+  if (fseek(fp, -(long)sizeof(trailer), SEEK_END) != 0 ||
+      fread(&trailer, sizeof(trailer), 1, fp) != 1 || trailer.magic != WATERFALL_INDEX_MAGIC) {
+    return -1;
+  }
+  *index = (struct waterfall_index_entry *)malloc((trailer.num_chunks + 1)*
+                                                  sizeof(struct waterfall_index_entry));
+  if (*index == NULL) {
+    return -1;
+  }
+  if (fseek(fp, (long)trailer.index_offset, SEEK_SET) != 0 ||
+      fread(*index, sizeof(struct waterfall_index_entry), trailer.num_chunks, fp) != trailer.num_chunks) {
+    free(*index);
+    *index = NULL;
+    return -1;
+  }
+  return trailer.num_chunks;
+}
@@ -0,0 +1,141 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         waterfall.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Compact spectrogram (waterfall) log for long occupancy surveys.
+**
+**                Each FFT magnitude frame (or the mean / peak of several, see
+**                frames_per_row) becomes one row of 8 or 16-bit codes:
+**                  code = (20*log10(magnitude) - db_min) / db_step
+**                clamped to the code range, with 0 meaning "at or below db_min".
+**                A 4096 point row is 4 or 8 KB instead of 32 KB of raw words.
+**
+**                Rows are grouped in chunks. Every chunk header repeats the
+**                settings (FFT size, decimation, dB scale) and carries the wall
+**                clock time of its first row and the frames dropped before it,
+**                so a chunk can be interpreted on its own. On close, an index of
+**                chunk offsets and start times is appended, followed by a fixed
+**                size trailer pointing at it, so readers can seek straight to a
+**                time range without scanning the file.
+**
+**                File layout:
+**                  waterfall_file_header
+**                  { waterfall_chunk_header, num_rows * num_bins codes } ...
+**                  waterfall_index_entry[num_chunks]
+**                  waterfall_trailer
+**
+******************************************************************************/
+#ifndef WATERFALL_H
+#define WATERFALL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+struct stream_writer;
+
+#define WATERFALL_MAGIC           0x46544157    // "WATF"
+#define WATERFALL_CHUNK_MAGIC     0x4B4E4843    // "CHNK"
+#define WATERFALL_INDEX_MAGIC     0x58444E49    // "INDX"
+#define WATERFALL_VERSION         1
+
+#define WATERFALL_ROW_MEAN        0
+#define WATERFALL_ROW_PEAK        1
+
+struct waterfall_file_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t chunk_header_size;
+  uint32_t reserved;
+};
+
+struct waterfall_chunk_header {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t num_rows;
+  uint32_t num_bins;              // FFT size
+  uint32_t decim_rate;
+  uint32_t frames_per_row;
+  uint8_t bits;                   // 8 or 16
+  uint8_t row_mode;               // WATERFALL_ROW_MEAN / WATERFALL_ROW_PEAK
+  uint8_t reserved[2];
+  float db_min;
+  float db_step;
+  uint32_t dropped_frames;        // Frames lost between the previous chunk and this one
+  uint64_t start_time_ns;         // Wall clock time of the first row, ns since the epoch
+  uint64_t row_period_ns;
+  uint64_t first_frame;           // Frame number of the first row since the capture started
+};
+
+struct waterfall_index_entry {
+  uint64_t offset;                // File offset of the chunk header
+  uint64_t start_time_ns;
+  uint32_t num_rows;
+  uint32_t reserved;
+};
+
+struct waterfall_trailer {
+  uint32_t magic;
+  uint32_t num_chunks;
+  uint64_t index_offset;
+};
+
+struct waterfall {
+  struct stream_writer *writer;
+  uint num_bins;
+  uint decim_rate;
+  uint bits;
+  uint row_mode;
+  uint frames_per_row;
+  uint rows_per_chunk;
+  float db_min;
+  float db_step;
+  float *accum;                   // Linear magnitudes of the row being built
+  uint accum_frames;
+  uint8_t *chunk;                 // Chunk header followed by the codes
+  uint chunk_rows;
+  struct waterfall_index_entry *index;
+  uint index_size;
+  uint num_chunks;
+  uint32_t pending_dropped;
+  uint64_t offset;                // Bytes accepted by the writer so far
+  uint64_t frames;
+  uint64_t rows;
+  uint64_t lost_chunks;           // Chunks dropped by writer overruns
+  uint64_t quantize_cycles;       // Filled in by the caller, used for the stats only
+};
+
+int waterfall_open(struct waterfall *wf, struct stream_writer *writer, uint num_bins,
+                   uint decim_rate, uint bits, float db_min, float db_step, uint row_mode,
+                   uint frames_per_row, uint rows_per_chunk);
+// Add one magnitude frame (magnitude every stride floats). dropped is the number of
+// frames lost since the previous call. Returns 1 when a chunk was handed to the writer.
+int waterfall_push_frame(struct waterfall *wf, const float *fft_mag, uint stride, uint dropped);
+// Quantize num_bins linear magnitudes to 8-bit or 16-bit codes
+void waterfall_quantize(const float *mag, uint num_bins, float db_min, float db_step, uint bits,
+                        void *codes);
+// Flush the last partial chunk and append the index and trailer. Does not close the writer.
+void waterfall_close(struct waterfall *wf);
+void waterfall_print_stats(struct waterfall *wf);
+
+// Reader side, plain C for host tools. Reads the index into a malloc'd array.
+// Returns the number of chunks or -1 if fp does not hold a complete waterfall log.
+int waterfall_read_index(FILE *fp, struct waterfall_index_entry **index);
+
+#endif
@@ -0,0 +1,295 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         welch.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Welch averaged power spectral density. NEON versions of the
+**                window, power accumulate and threshold loops are used when
+**                building for the Zynq, plain C versions otherwise.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+#include "fft-plan-cache.h"
+#include "welch.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+const char *welch_window_names[NUM_WELCH_WINDOWS] = {
+  "hann",
+  "blackman"
+};
+
+int welch_window_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_WELCH_WINDOWS; i++) {
+    if (strcmp(name, welch_window_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void welch_make_window(float *window, uint n, uint window_type)
+{
+  int i;
+  double x;
+  double sum = 0.0;
+
+  for (i = 0; i < n; i++) {
+    x = 2.0*M_PI*i/n;
+    if (window_type == WELCH_WINDOW_BLACKMAN) {
+      window[i] = 0.42 - 0.5*cos(x) + 0.08*cos(2.0*x);
+    } else {
+      window[i] = 0.5 - 0.5*cos(x);
+    }
+    sum += window[i];
+  }
+  // Unity coherent gain relative to the rectangular window
+  for (i = 0; i < n; i++) {
+    window[i] = window[i]*n/sum;
+  }
+}
+
+int welch_init(struct welch *w, uint number_samples, uint window_type, uint overlap, uint num_avg)
+{
+  memset(w, 0, sizeof(struct welch));
+  if (window_type >= NUM_WELCH_WINDOWS) {
+    printf("ERROR: Invalid window\n");
+    return -1;
+  }
+  if (overlap != 50 && overlap != 75) {
+    printf("ERROR: Overlap must be 50 or 75 percent\n");
+    return -1;
+  }
+  if (num_avg == 0) {
+    printf("ERROR: Number of averages must be at least 1\n");
+    return -1;
+  }
+  w->number_samples = number_samples;
+  w->hop = (overlap == 50) ? number_samples/2 : number_samples/4;
+  w->num_avg = num_avg;
+  w->window_type = window_type;
+  w->window = (float *)fftwf_malloc(sizeof(float)*number_samples);
+  w->history = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*2*number_samples);
+  w->seg = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+  w->out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*number_samples);
+  w->psd = (float *)fftwf_malloc(sizeof(float)*number_samples);
+  if (w->window == NULL || w->history == NULL || w->seg == NULL || w->out == NULL || w->psd == NULL) {
+    printf("ERROR: Failed to allocate Welch buffers\n");
+    welch_free(w);
+    return -1;
+  }
+  welch_make_window(w->window, number_samples, window_type);
+  w->plan = fft_plan_cache_get(number_samples, w->seg, w->out);
+  if (w->plan == NULL) {
+    welch_free(w);
+    return -1;
+  }
+  welch_reset(w);
+  return 0;
+}
+
+void welch_reset(struct welch *w)
+{
+  memset(w->history, 0, sizeof(fftwf_complex)*2*w->number_samples);
+  memset(w->psd, 0, sizeof(float)*w->number_samples);
+  w->seg_count = 0;
+  w->primed = false;
+  w->next_seq = WELCH_NO_SEQ;
+}
+
+// seg = x * window
+static void welch_apply_window(float *seg, const float *x, const float *window, uint n)
+{
+  int i;
+#ifdef __ARM_NEON__
+  float32x4x2_t samples;
+  float32x4_t coeffs;
+
+  for (i = 0; i < n; i += 4) {
+    samples = vld2q_f32(&x[2*i]);
+    coeffs = vld1q_f32(&window[i]);
+    samples.val[0] = vmulq_f32(samples.val[0], coeffs);
+    samples.val[1] = vmulq_f32(samples.val[1], coeffs);
+    vst2q_f32(&seg[2*i], samples);
+  }
+#else
+  for (i = 0; i < n; i++) {
+    seg[2*i] = x[2*i]*window[i];
+    seg[2*i+1] = x[2*i+1]*window[i];
+  }
+#endif
+}
+
+// psd += I^2 + Q^2
+static void welch_accumulate(float *psd, const float *fft_out, uint n)
+{
+  int i;
+#ifdef __ARM_NEON__
+  float32x4x2_t bins;
+  float32x4_t acc;
+
+  for (i = 0; i < n; i += 4) {
+    bins = vld2q_f32(&fft_out[2*i]);
+    acc = vld1q_f32(&psd[i]);
+    acc = vmlaq_f32(acc, bins.val[0], bins.val[0]);
+    acc = vmlaq_f32(acc, bins.val[1], bins.val[1]);
+    vst1q_f32(&psd[i], acc);
+  }
+#else
+  for (i = 0; i < n; i++) {
+    psd[i] += fft_out[2*i]*fft_out[2*i] + fft_out[2*i+1]*fft_out[2*i+1];
+  }
+#endif
+}
+
+int welch_threshold_psd(const float *psd, uint number_samples, uint num_avg, float threshold, float *mag)
+{
+  int i;
+  int j;
+  // Compare the sum against threshold^2 * num_avg instead of dividing every bin
+  float threshold_sum = threshold*threshold*num_avg;
+#ifdef __ARM_NEON__
+  float32x4_t thresholds;
+  uint32x4_t compares;
+  uint32x2_t compares_reduced;
+
+  thresholds = vdupq_n_f32(threshold_sum);
+
+  // 8 bins per iteration. number_samples is a power of 2 and at least 64.
+  for (i = 0; i < number_samples; i += 8) {
+    compares = vorrq_u32(vcgeq_f32(vld1q_f32(&psd[i]), thresholds),
+                         vcgeq_f32(vld1q_f32(&psd[i+4]), thresholds));
+    compares_reduced = vorr_u32(vget_low_u32(compares), vget_high_u32(compares));
+    compares_reduced = vpmax_u32(compares_reduced, compares_reduced);
+    if (vget_lane_u32(compares_reduced, 0) != 0) {
+      for (j = i; j < i+8; j++) {
+        if (psd[j] >= threshold_sum) {
+          if (mag != NULL) *mag = sqrtf(psd[j]/num_avg);
+          return j;
+        }
+      }
+    }
+  }
+#else
+  for (i = 0; i < number_samples; i += 8) {
+    for (j = i; j < i+8; j++) {
+      if (psd[j] >= threshold_sum) {
+        if (mag != NULL) *mag = sqrtf(psd[j]/num_avg);
+        return j;
+      }
+    }
+  }
+#endif
+  return -1;
+}
+
+int welch_push_frame(struct welch *w, const fftwf_complex *frame, uint64_t seq, float threshold,
+                     float *mag)
+{
+  uint n = w->number_samples;
+  uint offset;
+  int bin;
+  int decision = WELCH_PENDING;
+
+  // A segment must not span two frames that are not back to back
+  if (w->primed && (seq == WELCH_NO_SEQ || seq != w->next_seq)) {
+    w->primed = false;
+    w->gaps++;
+  }
+  w->next_seq = (seq == WELCH_NO_SEQ) ? WELCH_NO_SEQ : seq + 1;
+
+  memcpy(&w->history[n], frame, sizeof(fftwf_complex)*n);
+  w->frames++;
+
+  // Segments start at hop, 2*hop, ..., n within [previous frame | current frame]. The
+  // very first frame has no previous frame, so only the segment at offset n is used.
+  for (offset = (w->primed ? w->hop : n); offset <= n; offset += w->hop) {
+    welch_apply_window((float *)w->seg, (const float *)&w->history[offset], w->window, n);
+    fft_plan_cache_execute(w->plan, w->seg, w->out);
+    welch_accumulate(w->psd, (const float *)w->out, n);
+    w->segments++;
+    w->seg_count++;
+    if (w->seg_count == w->num_avg) {
+      bin = welch_threshold_psd(w->psd, n, w->num_avg, threshold, mag);
+      w->decisions++;
+      if (bin >= 0) {
+        w->detections++;
+      }
+      // Keep the first detection in this frame
+      if (decision < 0) {
+        decision = bin;
+      }
+      memset(w->psd, 0, sizeof(float)*n);
+      w->seg_count = 0;
+    }
+  }
+
+  memcpy(&w->history[0], &w->history[n], sizeof(fftwf_complex)*n);
+  w->primed = true;
+  return decision;
+}
+
+void welch_print_stats(struct welch *w, double elapsed_sec, uint decim_rate)
+{
+  // Time covered by one averaged PSD at the decimated input rate
+  double span_us = (w->number_samples + (w->num_avg - 1)*w->hop)*decim_rate/100.0;
+  double compute_us = 0.0;
+
+  if (w->frames > 0) {
+    compute_us = (1e6/150e6)*w->compute_cycles/w->frames;
+  }
+  printf("Welch Window:\t\t\t%s\n",welch_window_names[w->window_type]);
+  printf("Welch Overlap:\t\t\t%d%%\n",100 - 100*w->hop/w->number_samples);
+  printf("Welch Averages:\t\t\t%d\n",w->num_avg);
+  printf("Welch Frames:\t\t\t%llu\n",(unsigned long long)w->frames);
+  printf("Welch Segments:\t\t\t%llu\n",(unsigned long long)w->segments);
+  printf("Welch Gaps:\t\t\t%llu\n",(unsigned long long)w->gaps);
+  printf("Welch Decisions:\t\t%llu\n",(unsigned long long)w->decisions);
+  printf("Welch Detections:\t\t%llu\n",(unsigned long long)w->detections);
+  if (elapsed_sec > 0.0) {
+    printf("Welch Frame Rate (frames/s):\t%f\n",w->frames/elapsed_sec);
+  }
+  printf("Input Frame Rate (frames/s):\t%f\n",100e6/(w->number_samples*decim_rate));
+  printf("Welch Compute / Frame (us):\t%f\n",compute_us);
+  printf("Frame Period (us):\t\t%f\n",w->number_samples*decim_rate/100.0);
+  // Worst case: the signal appears just after a PSD started, so it is only detected
+  // by the next full PSD
+  printf("Detection Latency (us):\t\t%f - %f\n",span_us + compute_us,
+         span_us + w->num_avg*w->hop*decim_rate/100.0 + compute_us);
+}
+
+void welch_free(struct welch *w)
+{
+  fftwf_free(w->window);
+  fftwf_free(w->history);
+  fftwf_free(w->seg);
+  fftwf_free(w->out);
+  fftwf_free(w->psd);
+  w->window = NULL;
+  w->history = NULL;
+  w->seg = NULL;
+  w->out = NULL;
+  w->psd = NULL;
+}
@@ -0,0 +1,99 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         welch.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Welch averaged power spectral density. Each frame is split into
+**                overlapping windowed segments (50% or 75% overlap), the power of
+**                each segment's FFT is accumulated and the averaged PSD is
+**                compared against the threshold. Averaging trades a little
+**                detection latency for far fewer false alarms than thresholding
+**                a single rectangular window FFT.
+**
+**                Segments span frame boundaries: the previous frame is kept in a
+**                history buffer so a frame of N samples yields N/hop segments.
+**                Only frames with consecutive DMA sequence numbers are stitched
+**                together. After a gap (ring or pipeline drop, separate reads) the
+**                history is dropped, so no segment spans unrelated data. The
+**                partial PSD is kept: its segments are each contiguous, and if it
+**                were cleared too a PSD would never complete while every frame
+**                follows a drop.
+**
+**                Windows are scaled so sum(w) = N, i.e. a tone has the same peak
+**                magnitude as with the rectangular window and existing thresholds
+**                still apply.
+**
+******************************************************************************/
+#ifndef WELCH_H
+#define WELCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <fftw3.h>
+
+#define WELCH_WINDOW_HANN         0
+#define WELCH_WINDOW_BLACKMAN     1
+#define NUM_WELCH_WINDOWS         2
+
+#define WELCH_PENDING             -2    // PSD not complete yet, no decision
+#define WELCH_NO_SEQ              UINT64_MAX
+
+struct welch {
+  uint number_samples;            // Segment / FFT size
+  uint hop;                       // Samples between segment starts
+  uint num_avg;                   // Segments averaged per decision
+  uint seg_count;                 // Segments in the accumulator
+  uint window_type;
+  float *window;
+  fftwf_complex *history;         // Previous frame followed by current frame
+  fftwf_complex *seg;             // Windowed segment, FFT input
+  fftwf_complex *out;
+  float *psd;                     // Accumulated |X|^2
+  fftwf_plan plan;
+  bool primed;                    // History holds a full previous frame
+  uint64_t next_seq;              // DMA frame number that continues the history, WELCH_NO_SEQ if none
+  uint64_t frames;
+  uint64_t segments;
+  uint64_t gaps;                  // Frames that did not continue the history
+  uint64_t decisions;
+  uint64_t detections;
+  uint64_t compute_cycles;        // Filled in by the caller, used for the stats only
+};
+
+extern const char *welch_window_names[NUM_WELCH_WINDOWS];
+
+// overlap is in percent and must be 50 or 75. FFT plans come from fft-plan-cache, so
+// fft_plan_cache_init() must be called first.
+int welch_init(struct welch *w, uint number_samples, uint window_type, uint overlap, uint num_avg);
+// Look up a window by name ("hann", "blackman"). Returns -1 if unknown.
+int welch_window_lookup(const char *name);
+// Clear the accumulator and history, e.g. when the DMA stream restarts
+void welch_reset(struct welch *w);
+// Process one frame of number_samples complex samples. seq is the frame_ring / pipeline
+// seq of the frame: unless it follows the last frame pushed, the history is dropped
+// first. Frames from crash_read are never contiguous, pass WELCH_NO_SEQ.
+// Returns WELCH_PENDING if no PSD was completed, -1 if the PSD was completed and no bin
+// exceeded the threshold, or the first bin that exceeded it. mag (optional) is set to the
+// averaged magnitude of that bin.
+int welch_push_frame(struct welch *w, const fftwf_complex *frame, uint64_t seq, float threshold,
+                     float *mag);
+// Threshold an accumulated PSD of num_avg segments against a magnitude threshold
+int welch_threshold_psd(const float *psd, uint number_samples, uint num_avg, float threshold, float *mag);
+void welch_print_stats(struct welch *w, double elapsed_sec, uint decim_rate);
+void welch_free(struct welch *w);
+
+#endif
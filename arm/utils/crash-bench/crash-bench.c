@@ -0,0 +1,470 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-bench.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Run every spectrum sensing / decision strategy over the same
+**                parameter sweep and collect the results into one table.
+**
+**                Each strategy is the existing program (arm-spectrum-sensing,
+**                arm-spectrum-sensing-opt, arm-spectrum-decision,
+**                arm-spectrum-decision-no-thresholding, fpga-spectrum-decision),
+**                run as a child process with --loops and --latency so it does a
+**                fixed number of back to back loops (without the 1 second pause
+**                between loops) and writes its stage latency histograms.
+**                For every FFT size x decimation rate x threshold point this
+**                records:
+**                  - Exit status (ok, timeout, exit code or signal)
+**                  - Wall time and CPU utilization ((user + sys) / wall) of the run
+**                  - Decisions per second, measured: loops that reached a
+**                    decision over the total "Loop Time" (whole loop bodies)
+**                  - Count, mean, p50, p99, p99.9 and max of every stage
+**
+**                The table is CSV with one row per stage. Runs that produce no
+**                histograms still get a row (empty stage) so failures show up.
+**
+**                The fpga-spectrum-decision stages include waiting on the RF input,
+**                so its decision rate depends on the test signal.
+**
+**                A run that exceeds --timeout is sent SIGINT, which makes the program
+**                finish the current loop and still write its histograms. If it is
+**                still running after a grace period it is killed.
+**
+**                Lab setup is the same as for the individual programs.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "sweep.h"
+
+#define MAX_SWEEP                 16
+#define MAX_STAGES                8
+#define DEFAULT_LOOPS             100
+#define DEFAULT_TIMEOUT_SEC       300
+#define KILL_GRACE_SEC            15
+#define POLL_US                   10000
+#define LOOP_STAGE                "Loop Time"
+
+static const char *strategy_names[] = {
+  "arm-spectrum-sensing",
+  "arm-spectrum-sensing-opt",
+  "arm-spectrum-decision",
+  "arm-spectrum-decision-no-thresholding",
+  "fpga-spectrum-decision",
+};
+#define NUM_STRATEGIES (sizeof(strategy_names)/sizeof(strategy_names[0]))
+
+struct stage_result {
+  char name[64];
+  unsigned long long count;
+  double mean;
+  double p50;
+  double p99;
+  double p999;
+  double min;
+  double max;
+};
+
+struct run_result {
+  char status[32];
+  double wall;
+  double cpu_util;
+  uint num_stages;
+  struct stage_result stages[MAX_STAGES];
+};
+
+// Global variable used to stop the sweep. Ctrl-C also reaches the running program,
+// which finishes its loop, so the current run is still recorded.
+int loop_prog = 1;
+
+void ctrl_c(int dummy)
+{
+    loop_prog = 0;
+    return;
+}
+
+static double now_sec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Reads the stage summary rows of a latency-hist CSV file. Bucket rows leave
+// the mean empty and are skipped.
+int read_latency_csv(const char *filename, struct run_result *r)
+{
+  FILE *fp;
+  char line[512];
+  struct stage_result *s;
+
+  r->num_stages = 0;
+  fp = fopen(filename, "r");
+  if (fp == NULL) return -1;
+  // Header
+  if (fgets(line, sizeof(line), fp) == NULL) {
+    fclose(fp);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL && r->num_stages < MAX_STAGES) {
+    s = &r->stages[r->num_stages];
+    if (sscanf(line, "%63[^,],%llu,%lf,%lf,%lf,%lf,%lf,%lf", s->name, &s->count,
+               &s->mean, &s->p50, &s->p99, &s->p999, &s->min, &s->max) == 8) {
+      r->num_stages++;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+// Fork / exec one program, wait for it with a timeout and collect its resource usage
+int run_strategy(const char *path, char **args, uint timeout_sec, bool verbose,
+                 struct run_result *r)
+{
+  struct rusage ru;
+  pid_t pid;
+  pid_t ret;
+  int status = 0;
+  int fd;
+  double start;
+  double cpu;
+  bool interrupted = false;
+
+  start = now_sec();
+  pid = fork();
+  if (pid < 0) {
+    printf("ERROR: fork() failed\n");
+    return -1;
+  }
+  if (pid == 0) {
+    if (!verbose) {
+      fd = open("/dev/null", O_WRONLY);
+      if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+      }
+    }
+    execv(path, args);
+    _exit(127);
+  }
+
+  memset(&ru, 0, sizeof(struct rusage));
+  while (1) {
+    ret = wait4(pid, &status, WNOHANG, &ru);
+    if (ret == pid) break;
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) {
+      printf("ERROR: wait4() failed\n");
+      return -1;
+    }
+    if (!interrupted && now_sec() - start > timeout_sec) {
+      // Let the program finish its loop and write its histograms
+      kill(pid, SIGINT);
+      interrupted = true;
+    } else if (interrupted && now_sec() - start > timeout_sec + KILL_GRACE_SEC) {
+      kill(pid, SIGKILL);
+    }
+    usleep(POLL_US);
+  }
+
+  r->wall = now_sec() - start;
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+  r->cpu_util = (r->wall > 0.0) ? cpu/r->wall : 0.0;
+  if (interrupted) {
+    snprintf(r->status, sizeof(r->status), "timeout");
+  } else if (WIFSIGNALED(status)) {
+    snprintf(r->status, sizeof(r->status), "signal %d", WTERMSIG(status));
+  } else if (WEXITSTATUS(status) == 127) {
+    snprintf(r->status, sizeof(r->status), "exec failed");
+  } else if (WEXITSTATUS(status) != 0) {
+    snprintf(r->status, sizeof(r->status), "exit %d", WEXITSTATUS(status));
+  } else {
+    snprintf(r->status, sizeof(r->status), "ok");
+  }
+  return 0;
+}
+
+void write_result(FILE *fp, const char *strategy, uint fft_size, uint decim_rate,
+                  float threshold, const struct run_result *r)
+{
+  double loop_us = 0.0;
+  double decisions = 0.0;
+  unsigned long long loops = 0;
+  uint i;
+
+  // The first stage is only recorded by loops that reached a decision, the loop stage
+  // by every loop
+  if (r->num_stages > 0) loops = r->stages[0].count;
+  for (i = 0; i < r->num_stages; i++) {
+    if (strcmp(r->stages[i].name, LOOP_STAGE) == 0) {
+      loop_us = r->stages[i].count*r->stages[i].mean;
+    }
+  }
+  if (loop_us > 0.0) decisions = 1e6*loops/loop_us;
+
+  if (r->num_stages == 0) {
+    fprintf(fp,"%s,%d,%d,%f,%s,%llu,%.3f,%.3f,%.1f,,,,,,,\n",strategy,fft_size,decim_rate,
+            threshold,r->status,loops,r->wall,r->cpu_util,decisions);
+  }
+  for (i = 0; i < r->num_stages; i++) {
+    fprintf(fp,"%s,%d,%d,%f,%s,%llu,%.3f,%.3f,%.1f,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+            strategy,fft_size,decim_rate,threshold,r->status,loops,r->wall,r->cpu_util,
+            decisions,r->stages[i].name,r->stages[i].count,r->stages[i].mean,
+            r->stages[i].p50,r->stages[i].p99,r->stages[i].p999,r->stages[i].max);
+  }
+  fflush(fp);
+
+  printf("%-40s%6d%6d%10.3f%14s%8llu%8.1f%12.1f\n",strategy,fft_size,decim_rate,threshold,
+         r->status,loops,100.0*r->cpu_util,decisions);
+}
+
+int main (int argc, char **argv) {
+  int c;
+  uint i, j, k, m;
+  uint num_loops = 0;
+  uint timeout_sec = 0;
+  bool verbose = false;
+  char *bin_dir = "..";
+  char *output_file = "crash-bench.csv";
+  char default_strategies[256];
+  char default_fft_sizes[] = "64,128,256,512,1024,2048,4096";
+  char default_decims[] = "1,2,16";
+  char default_thresholds[] = "1.0";
+  char *strategy_list = NULL;
+  char *fft_list = default_fft_sizes;
+  char *decim_list = default_decims;
+  char *threshold_list = default_thresholds;
+  char *strategies[MAX_SWEEP];
+  char *fft_strs[MAX_SWEEP];
+  char *decim_strs[MAX_SWEEP];
+  char *threshold_strs[MAX_SWEEP];
+  int num_strategies, num_ffts, num_decims, num_thresholds;
+  uint fft_sizes[MAX_SWEEP];
+  int fft_log2[MAX_SWEEP];
+  uint decim_rates[MAX_SWEEP];
+  float thresholds[MAX_SWEEP];
+  char path[512];
+  char latency_file[64];
+  char k_arg[16], d_arg[16], t_arg[32], n_arg[16];
+  char *args[16];
+  struct run_result result;
+  FILE *fp;
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"strategies",  required_argument, 0, 's'},
+      {"fft sizes",   required_argument, 0, 'k'},
+      {"decims",      required_argument, 0, 'd'},
+      {"thresholds",  required_argument, 0, 't'},
+      {"loops",       required_argument, 0, 'N'},
+      {"timeout",     required_argument, 0, 'T'},
+      {"bin-dir",     required_argument, 0, 'b'},
+      {"output",      required_argument, 0, 'o'},
+      {"verbose",     no_argument,       0, 'v'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // 'n' is the short option, ':' means it requires an argument
+    c = getopt_long (argc, argv, "s:k:d:t:N:T:b:o:v",
+                     long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+
+    switch (c) {
+      case 's':
+        strategy_list = optarg;
+        break;
+      case 'k':
+        fft_list = optarg;
+        break;
+      case 'd':
+        decim_list = optarg;
+        break;
+      case 't':
+        threshold_list = optarg;
+        break;
+      case 'N':
+        num_loops = atoi(optarg);
+        break;
+      case 'T':
+        timeout_sec = atoi(optarg);
+        break;
+      case 'b':
+        bin_dir = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      case '?':
+        /* getopt_long already printed an error message. */
+        break;
+      default:
+        abort ();
+    }
+  }
+  /* Print any remaining command line arguments (not options). */
+  if (optind < argc)
+  {
+    printf ("Invalid options:\n");
+    while (optind < argc) {
+      printf ("\t%s\n", argv[optind++]);
+    }
+    return -1;
+  }
+
+  // Check arguments
+  if (strategy_list == NULL) {
+    default_strategies[0] = '\0';
+    for (i = 0; i < NUM_STRATEGIES; i++) {
+      if (i > 0) strcat(default_strategies, ",");
+      strcat(default_strategies, strategy_names[i]);
+    }
+    strategy_list = default_strategies;
+  }
+
+  num_strategies = sweep_parse_list(strategy_list, strategies, MAX_SWEEP);
+  num_ffts = sweep_parse_list(fft_list, fft_strs, MAX_SWEEP);
+  num_decims = sweep_parse_list(decim_list, decim_strs, MAX_SWEEP);
+  num_thresholds = sweep_parse_list(threshold_list, threshold_strs, MAX_SWEEP);
+  if (num_strategies <= 0 || num_ffts <= 0 || num_decims <= 0 || num_thresholds <= 0) {
+    printf("ERROR: Empty or invalid sweep list\n");
+    return -1;
+  }
+
+  for (i = 0; i < (uint)num_strategies; i++) {
+    for (j = 0; j < NUM_STRATEGIES; j++) {
+      if (strcmp(strategies[i], strategy_names[j]) == 0) break;
+    }
+    if (j == NUM_STRATEGIES) {
+      printf("ERROR: Unknown strategy %s\n",strategies[i]);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < (uint)num_ffts; i++) {
+    fft_sizes[i] = atoi(fft_strs[i]);
+    fft_log2[i] = sweep_fft_log2(fft_sizes[i]);
+    if (fft_log2[i] < 6 || fft_log2[i] > 12) {
+      printf("ERROR: FFT size %s must be a power of 2 from 64 to 4096\n",fft_strs[i]);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < (uint)num_decims; i++) {
+    decim_rates[i] = atoi(decim_strs[i]);
+    if (decim_rates[i] == 0 || decim_rates[i] > 2047) {
+      printf("ERROR: Decimation rate %s must be from 1 to 2047\n",decim_strs[i]);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < (uint)num_thresholds; i++) {
+    thresholds[i] = atof(threshold_strs[i]);
+    if (thresholds[i] <= 0.0) {
+      printf("ERROR: Threshold %s must be greater than 0\n",threshold_strs[i]);
+      return -1;
+    }
+  }
+
+  if (num_loops == 0) {
+    printf("INFO: Number of loops not specified, defaulting to %d\n",DEFAULT_LOOPS);
+    num_loops = DEFAULT_LOOPS;
+  }
+
+  if (timeout_sec == 0) {
+    printf("INFO: Timeout not specified, defaulting to %d seconds\n",DEFAULT_TIMEOUT_SEC);
+    timeout_sec = DEFAULT_TIMEOUT_SEC;
+  }
+
+  fp = fopen(output_file, "w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s\n",output_file);
+    return -1;
+  }
+  fprintf(fp,"strategy,fft_size,decim,threshold,status,loops,wall_s,cpu_util,decisions_per_s,"
+             "stage,count,mean_us,p50_us,p99_us,p999_us,max_us\n");
+
+  snprintf(latency_file, sizeof(latency_file), "/tmp/crash-bench-%d.csv", (int)getpid());
+  snprintf(n_arg, sizeof(n_arg), "%d", num_loops);
+
+  // Set Ctrl-C handler
+  signal(SIGINT, ctrl_c);
+
+  printf("Runs:\t\t\t\t%d\n",num_strategies*num_ffts*num_decims*num_thresholds);
+  printf("Loops per run:\t\t\t%d\n",num_loops);
+  printf("\n%-40s%6s%6s%10s%14s%8s%8s%12s\n","Strategy","FFT","Decim","Threshold",
+         "Status","Loops","CPU %","Decisions/s");
+
+  for (i = 0; i < (uint)num_strategies && loop_prog; i++) {
+    snprintf(path, sizeof(path), "%s/%s/%s", bin_dir, strategies[i], strategies[i]);
+    if (access(path, X_OK) != 0) {
+      printf("ERROR: %s not found or not executable, skipping\n",path);
+      continue;
+    }
+    for (j = 0; j < (uint)num_ffts && loop_prog; j++) {
+      for (k = 0; k < (uint)num_decims && loop_prog; k++) {
+        for (m = 0; m < (uint)num_thresholds && loop_prog; m++) {
+          snprintf(k_arg, sizeof(k_arg), "%d", fft_sizes[j]);
+          snprintf(d_arg, sizeof(d_arg), "%d", decim_rates[k]);
+          snprintf(t_arg, sizeof(t_arg), "%f", thresholds[m]);
+          args[0] = path;
+          args[1] = "-k"; args[2] = k_arg;
+          args[3] = "-d"; args[4] = d_arg;
+          args[5] = "-t"; args[6] = t_arg;
+          args[7] = "-N"; args[8] = n_arg;
+          args[9] = "-L"; args[10] = latency_file;
+          args[11] = NULL;
+
+          unlink(latency_file);
+          memset(&result, 0, sizeof(struct run_result));
+          if (run_strategy(path, args, timeout_sec, verbose, &result) != 0) {
+            fclose(fp);
+            return -1;
+          }
+          read_latency_csv(latency_file, &result);
+          write_result(fp, strategies[i], fft_sizes[j], decim_rates[k], thresholds[m], &result);
+        }
+      }
+    }
+  }
+
+  unlink(latency_file);
+  fclose(fp);
+  printf("Results written to %s\n",output_file);
+  return 0;
+}
@@ -0,0 +1,1022 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-emu.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  libcrash API on top of an emulated register file, sample
+**                stream, spec_sense plblock and DMA (see crash-emu.h).
+**
+**                Hardware state is evaluated lazily: register reads and DMA
+**                calls work out what the hardware would have done by now from
+**                CLOCK_MONOTONIC. One mutex protects all of it, DMA_DEBUG_CNT
+**                is read without it. Blocking DMA sleeps outside the mutex.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "crash-emu.h"
+
+#define EMU_MAX_OPEN              8
+#define EMU_DMA_FIFO_DEPTH        64
+#define EMU_MM2S                  0
+#define EMU_S2MM                  1
+
+// Datamover status byte
+#define EMU_STS_OKAY              0x80
+#define EMU_STS_SLVERR            0x40
+#define EMU_STS_DECERR            0x20
+
+struct emu_plblock {
+  struct crash_plblock plblock;   // First, the tools only see this part
+  uint slot;
+  bool ring_running;
+  uint ring_id;
+  uint ring_buffs;
+  uint ring_words;
+  uint ring_samples;              // Stream samples per frame
+  uint64_t ring_start;            // Stream position of frame 0
+  uint64_t ring_frames;           // Frames handed out or overwritten
+  uint64_t ring_xfers;            // Frames counted in DMA_S2MM_XFER_CNT
+};
+
+struct emu_dma_cmd {
+  uint64_t done_ns;
+  uint8_t sts;
+};
+
+struct emu_dma_chan {
+  struct emu_dma_cmd cmds[EMU_DMA_FIFO_DEPTH];
+  uint head;
+  uint count;
+  uint32_t cmd_addr;
+  uint32_t xfer_cnt;
+  uint8_t sts[EMU_DMA_FIFO_DEPTH];
+  uint sts_head;
+  uint sts_count;
+  uint64_t busy_ns;               // When the last queued transfer finishes
+};
+
+static struct {
+  pthread_mutex_t lock;
+  bool ready;
+  uint64_t start_ns;
+  uint64_t cnt_start_ns;          // Last reset, DMA_DEBUG_CNT counts from here
+  double adc_rate;
+  uint64_t cal_ns;
+  uint64_t uart_ns;
+  double dma_ns_per_byte;
+  struct crash_emu_source src;
+  uint32_t regs[CRASH_NUM_REGS];
+  uint64_t rx_cal_done_ns;
+  uint64_t tx_cal_done_ns;
+  uint64_t uart_done_ns;
+  uint rx_mode;
+  uint tx_mode;
+  uint64_t rx_start_ns;           // USRP_RX_ENABLE rising edge
+  uint64_t rx_pos;                // Next RX sample not yet delivered
+  float *tx_wave;                 // Last waveform written to usrp_intf
+  uint tx_len;
+  uint tx_alloc;
+  bool tx_on;
+  uint64_t tx_on_pos;             // RX sample positions TX was on for, for loopback
+  uint64_t tx_off_pos;
+  uint fft_log2;
+  uint64_t spec_frame;            // Last frame evaluated for the status registers + 1
+  bool spec_live;                 // Threshold exceeded in the latest frame
+  float *scratch;
+  size_t scratch_len;
+  uint32_t *frame_out;
+  size_t frame_out_len;
+  struct emu_dma_chan dma[2];
+  uint8_t *loop_fifo;             // MM2S to S2MM through tdest DMA_PLBLOCK_ID
+  uint loop_head;
+  uint loop_count;
+  struct emu_plblock *open[EMU_MAX_OPEN];
+  bool warned_reg;
+} emu = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t emu_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void emu_sleep_until(uint64_t ns)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ns/1000000000ULL;
+  ts.tv_nsec = ns%1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static float *emu_scratch(size_t floats)
+{
+  if (floats > emu.scratch_len) {
+    free(emu.scratch);
+    emu.scratch = (float *)malloc(floats*sizeof(float));
+    emu.scratch_len = (emu.scratch != NULL) ? floats : 0;
+  }
+  return emu.scratch;
+}
+
+static uint32_t *emu_frame_out(size_t words)
+{
+  if (words > emu.frame_out_len) {
+    free(emu.frame_out);
+    emu.frame_out = (uint32_t *)malloc(2*words*sizeof(uint32_t));
+    emu.frame_out_len = (emu.frame_out != NULL) ? words : 0;
+  }
+  return emu.frame_out;
+}
+
+// Global reset, as crash_reset() on the hardware
+static void emu_reset_state(uint64_t now)
+{
+  uint i;
+
+  memset(emu.regs, 0, sizeof(emu.regs));
+  emu.cnt_start_ns = now;
+  emu.rx_cal_done_ns = now + emu.cal_ns;
+  emu.tx_cal_done_ns = now + emu.cal_ns;
+  emu.uart_done_ns = 0;
+  emu.rx_mode = RX_ADC_DSP_MODE;
+  emu.tx_mode = TX_PASSTHRU_MODE;
+  emu.rx_start_ns = now;
+  emu.rx_pos = 0;
+  emu.tx_len = 0;
+  emu.tx_on = false;
+  emu.tx_on_pos = UINT64_MAX;
+  emu.tx_off_pos = UINT64_MAX;
+  emu.fft_log2 = 8;
+  emu.spec_frame = 0;
+  emu.spec_live = false;
+  memset(emu.dma, 0, sizeof(emu.dma));
+  emu.loop_head = 0;
+  emu.loop_count = 0;
+  for (i = 0; i < EMU_MAX_OPEN; i++) {
+    if (emu.open[i] != NULL) emu.open[i]->ring_running = false;
+  }
+}
+
+static int emu_init(void)
+{
+  if (emu.ready) return 0;
+  if (emu_source_init(&emu.src) != 0) return -1;
+  emu.adc_rate = emu_env("CRASH_EMU_ADC_RATE", CRASH_EMU_DEFAULT_ADC_RATE);
+  emu.cal_ns = 1000*(uint64_t)emu_env("CRASH_EMU_CAL_US", CRASH_EMU_DEFAULT_CAL_US);
+  emu.uart_ns = 1000*(uint64_t)emu_env("CRASH_EMU_UART_US", CRASH_EMU_DEFAULT_UART_US);
+  emu.dma_ns_per_byte = 1e3/emu_env("CRASH_EMU_DMA_MBPS", CRASH_EMU_DEFAULT_DMA_MBPS);
+  emu.loop_fifo = (uint8_t *)malloc(CRASH_EMU_LOOP_FIFO_BYTES);
+  if (emu.loop_fifo == NULL || emu.adc_rate <= 0.0) {
+    printf("ERROR: crash-emu: Bad configuration\n");
+    return -1;
+  }
+  emu.start_ns = emu_now_ns();
+  emu_reset_state(emu.start_ns);
+  // Calibrated since power up
+  emu.rx_cal_done_ns = emu.start_ns;
+  emu.tx_cal_done_ns = emu.start_ns;
+  printf("INFO: crash-emu: Emulated CRASH hardware, %s source, ADC %.1f MSPS\n",
+         emu.src.name,emu.adc_rate/1e6);
+  emu.ready = true;
+  return 0;
+}
+
+static double emu_rx_rate(void)
+{
+  uint decim = 1;
+
+  if (!emu.regs[USRP_RX_CIC_BYPASS] && emu.regs[USRP_RX_CIC_DECIM] > 1) {
+    decim *= emu.regs[USRP_RX_CIC_DECIM];
+  }
+  if (!emu.regs[USRP_RX_HB_BYPASS]) decim *= 2;
+  return emu.adc_rate/decim;
+}
+
+static double emu_tx_rate(void)
+{
+  uint interp = 1;
+
+  if (!emu.regs[USRP_TX_CIC_BYPASS] && emu.regs[USRP_TX_CIC_INTERP] > 1) {
+    interp *= emu.regs[USRP_TX_CIC_INTERP];
+  }
+  if (!emu.regs[USRP_TX_HB_BYPASS]) interp *= 2;
+  return emu.adc_rate/interp;
+}
+
+// RX samples produced since USRP_RX_ENABLE was set
+static uint64_t emu_rx_avail(uint64_t now)
+{
+  if (!emu.regs[USRP_RX_ENABLE] || now < emu.rx_start_ns) return 0;
+  return (uint64_t)((now - emu.rx_start_ns)*1e-9*emu_rx_rate());
+}
+
+// Time RX sample pos - 1 arrived
+static uint64_t emu_rx_time(uint64_t pos)
+{
+  return emu.rx_start_ns + (uint64_t)(pos*1e9/emu_rx_rate());
+}
+
+// Reserve n samples of the RX stream, starting on a multiple of align. Samples that
+// fell out of the RX FIFO are skipped. Returns the first one.
+static uint64_t emu_rx_take(uint64_t now, uint n, uint align, uint64_t *done_ns)
+{
+  uint64_t avail = emu_rx_avail(now);
+  uint64_t fifo = emu.regs[USRP_RX_FIFO_BYPASS] ? 0 : CRASH_EMU_RX_FIFO_SAMPLES;
+  uint64_t pos = emu.rx_pos;
+
+  if (avail > fifo && pos < avail - fifo) pos = avail - fifo;
+  pos = (pos + align - 1)/align*align;
+  emu.rx_pos = pos + n;
+  *done_ns = emu_rx_time(pos + n);
+  return pos;
+}
+
+static bool emu_tx_wanted(void)
+{
+  if (emu.regs[USRP_TX_ENABLE]) return true;
+  if (!emu.regs[USRP_TX_ENABLE_SIDEBAND]) return false;
+  return (emu.regs[SPEC_SENSE_ENABLE_NOT_THRESH_SIDEBAND] && !emu.spec_live) ||
+         (emu.regs[SPEC_SENSE_ENABLE_THRESH_SIDEBAND] && emu.spec_live);
+}
+
+// Track TX on / off in RX sample positions so loopback sees it at the right sample
+static void emu_tx_update(uint64_t now)
+{
+  bool on = emu_tx_wanted();
+
+  if (on == emu.tx_on) return;
+  emu.tx_on = on;
+  if (on) {
+    emu.tx_on_pos = emu_rx_avail(now);
+    emu.tx_off_pos = UINT64_MAX;
+  } else {
+    emu.tx_off_pos = emu_rx_avail(now);
+  }
+}
+
+// Complex float RX samples pos .. pos + n - 1
+static void emu_rx_generate(uint64_t pos, float *out, uint n)
+{
+  uint64_t k;
+  uint64_t idx;
+  uint i;
+
+  if (emu.rx_mode != RX_TX_LOOPBACK_MODE) {
+    emu_source_generate(&emu.src, pos, emu_rx_rate(), out, n);
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    k = pos + i;
+    if (emu.tx_len > 0 && k >= emu.tx_on_pos && k < emu.tx_off_pos) {
+      idx = (k - emu.tx_on_pos) % emu.tx_len;
+      out[2*i] = emu.tx_wave[2*idx];
+      out[2*i+1] = emu.tx_wave[2*idx+1];
+    } else {
+      out[2*i] = 0.0;
+      out[2*i+1] = 0.0;
+    }
+  }
+}
+
+static uint emu_fft_size(void)
+{
+  return 1 << emu.fft_log2;
+}
+
+static bool emu_spec_sense_running(void)
+{
+  return emu.regs[SPEC_SENSE_ENABLE_FFT] && emu.regs[USRP_RX_ENABLE] &&
+         emu.regs[USRP_AXIS_MASTER_TDEST] == SPEC_SENSE_PLBLOCK_ID;
+}
+
+// FFT one frame of the RX stream and update the threshold status. With out set, also
+// write the frame in the current output mode.
+static void emu_spec_sense_frame(uint64_t pos, uint32_t *out)
+{
+  uint n = emu_fft_size();
+  float *buff = emu_scratch(2*n);
+  float threshold;
+  float mag;
+  float exceeded_mag = 0.0;
+  uint exceeded_index = 0;
+  bool exceeded = false;
+  bool over;
+  uint i;
+
+  if (buff == NULL) return;
+  emu_rx_generate(pos, buff, n);
+  emu_fft(buff, n);
+  memcpy(&threshold, &emu.regs[SPEC_SENSE_THRESHOLD], sizeof(float));
+  for (i = 0; i < n; i++) {
+    mag = sqrtf(buff[2*i]*buff[2*i] + buff[2*i+1]*buff[2*i+1]);
+    over = mag > threshold;
+    if (over && !exceeded) {
+      exceeded = true;
+      exceeded_index = i;
+      exceeded_mag = mag;
+    }
+    if (out == NULL) continue;
+    if (emu.regs[SPEC_SENSE_OUTPUT_MODE] == 1) {
+      // Lower 32-bits magnitude, upper 32-bits bin index with bit 31 set if over threshold
+      memcpy(&out[2*i], &mag, sizeof(float));
+      out[2*i+1] = i | (over ? 0x80000000 : 0);
+    } else {
+      memcpy(&out[2*i], &buff[2*i], 2*sizeof(float));
+    }
+  }
+
+  emu.spec_live = exceeded;
+  if (exceeded && (emu.regs[SPEC_SENSE_CLEAR_THRESHOLD_LATCHED] || !emu.regs[SPEC_SENSE_THRESHOLD_EXCEEDED])) {
+    emu.regs[SPEC_SENSE_THRESHOLD_EXCEEDED] = 1;
+    emu.regs[SPEC_SENSE_THRESHOLD_EXCEEDED_INDEX] = exceeded_index;
+    memcpy(&emu.regs[SPEC_SENSE_THRESHOLD_EXCEEDED_MAG], &exceeded_mag, sizeof(float));
+  } else if (!exceeded && emu.regs[SPEC_SENSE_CLEAR_THRESHOLD_LATCHED]) {
+    emu.regs[SPEC_SENSE_THRESHOLD_EXCEEDED] = 0;
+  }
+  emu_tx_update(emu_rx_time(pos + n));
+}
+
+// Bring the threshold status up to the latest complete frame
+static void emu_spec_sense_update(uint64_t now)
+{
+  uint n = emu_fft_size();
+  uint64_t latency = (uint64_t)n*CRASH_EMU_FFT_NS_PER_POINT;
+  uint64_t avail;
+  uint64_t frame;
+
+  if (!emu_spec_sense_running() || now < latency) return;
+  avail = emu_rx_avail(now - latency);
+  if (avail < n) return;
+  frame = avail/n - 1;
+  if (frame + 1 == emu.spec_frame) return;
+  emu.spec_frame = frame + 1;
+  emu_spec_sense_frame(frame*n, NULL);
+}
+
+// Why plblock_id is not routed to the DMA, NULL if it is
+static const char *emu_stream_route_error(uint plblock_id)
+{
+  switch (plblock_id) {
+    case USRP_INTF_PLBLOCK_ID:
+      if (emu.regs[USRP_AXIS_MASTER_TDEST] != DMA_PLBLOCK_ID) return "usrp_intf RX is not sent to the DMA";
+      return NULL;
+    case SPEC_SENSE_PLBLOCK_ID:
+      if (emu.regs[SPEC_SENSE_AXIS_MASTER_TDEST] != DMA_PLBLOCK_ID) return "spec_sense output is not sent to the DMA";
+      if (emu.regs[SPEC_SENSE_OUTPUT_MODE] > 1) return "spec_sense output mode discards the FFT";
+      return NULL;
+    case DMA_PLBLOCK_ID:
+      return NULL;
+    default:
+      return "plblock has no emulated output";
+  }
+}
+
+// Why plblock_id cannot deliver data to the DMA right now, NULL if it can
+static const char *emu_stream_error(uint plblock_id)
+{
+  switch (plblock_id) {
+    case USRP_INTF_PLBLOCK_ID:
+      if (!emu.regs[USRP_RX_ENABLE]) return "usrp_intf RX is not enabled";
+      break;
+    case SPEC_SENSE_PLBLOCK_ID:
+      if (!emu_spec_sense_running()) return "spec_sense is not enabled or not fed by usrp_intf";
+      break;
+  }
+  return emu_stream_route_error(plblock_id);
+}
+
+static uint emu_samples_per_word(void)
+{
+  return emu.regs[USRP_RX_PACK16] ? 2 : 1;
+}
+
+// Stream samples making up num_words words of plblock_id output
+static uint emu_stream_samples(uint plblock_id, uint num_words)
+{
+  uint n = emu_fft_size();
+
+  if (plblock_id == SPEC_SENSE_PLBLOCK_ID) return (num_words + n - 1)/n*n;
+  return num_words*emu_samples_per_word();
+}
+
+static int16_t emu_q15(float x)
+{
+  if (x > 32767.0/32768.0) return 32767;
+  if (x < -1.0) return -32768;
+  return (int16_t)lrintf(x*32768.0);
+}
+
+// num_words words of plblock_id output, starting at stream sample pos
+static void emu_stream_fill(uint plblock_id, uint64_t pos, uint32_t *dst, uint num_words)
+{
+  uint n = emu_fft_size();
+  uint32_t *out;
+  float *buff;
+  int32_t value;
+  uint words;
+  uint i;
+
+  if (plblock_id == SPEC_SENSE_PLBLOCK_ID) {
+    out = emu_frame_out(n);
+    if (out == NULL) return;
+    for (i = 0; i < num_words; i += n) {
+      words = (num_words - i < n) ? num_words - i : n;
+      emu_spec_sense_frame(pos + i, out);
+      memcpy(&dst[2*i], out, 2*words*sizeof(uint32_t));
+    }
+    return;
+  }
+
+  buff = emu_scratch(2*emu_stream_samples(plblock_id, num_words));
+  if (buff == NULL) return;
+  emu_rx_generate(pos, buff, emu_stream_samples(plblock_id, num_words));
+  if (emu.regs[USRP_RX_PACK16]) {
+    // Two q15 I/Q samples per word
+    for (i = 0; i < 4*num_words; i++) {
+      ((int16_t *)dst)[i] = emu_q15(buff[i]);
+    }
+  } else if (emu.regs[USRP_RX_FIX2FLOAT_BYPASS]) {
+    // 16-bit fixed point, sign extended to 32 bits
+    for (i = 0; i < 2*num_words; i++) {
+      value = emu_q15(buff[i]);
+      dst[i] = (uint32_t)value;
+    }
+  } else {
+    memcpy(dst, buff, 2*num_words*sizeof(float));
+  }
+}
+
+static void emu_loop_push(const uint8_t *src, uint bytes)
+{
+  uint i;
+
+  for (i = 0; i < bytes && emu.loop_count < CRASH_EMU_LOOP_FIFO_BYTES; i++) {
+    emu.loop_fifo[(emu.loop_head + emu.loop_count) % CRASH_EMU_LOOP_FIFO_BYTES] = src[i];
+    emu.loop_count++;
+  }
+}
+
+static void emu_loop_pop(uint8_t *dst, uint bytes)
+{
+  uint i;
+
+  for (i = 0; i < bytes; i++) {
+    if (emu.loop_count > 0) {
+      dst[i] = emu.loop_fifo[emu.loop_head];
+      emu.loop_head = (emu.loop_head + 1) % CRASH_EMU_LOOP_FIFO_BYTES;
+      emu.loop_count--;
+    } else {
+      dst[i] = 0;
+    }
+  }
+}
+
+// S2MM of bytes from plblock_id, starting at time start. done_ns is when the last
+// word is written.
+static int emu_dma_in(uint plblock_id, uint8_t *dst, uint bytes, uint64_t start, uint64_t *done_ns)
+{
+  const char *error = emu_stream_error(plblock_id);
+  uint num_words = bytes/sizeof(uint64_t);
+  uint64_t min_done = start + (uint64_t)(bytes*emu.dma_ns_per_byte);
+  uint64_t pos;
+
+  if (error != NULL) {
+    printf("ERROR: crash-emu: %s\n",error);
+    return -1;
+  }
+  if (plblock_id == DMA_PLBLOCK_ID) {
+    emu_loop_pop(dst, bytes);
+    *done_ns = min_done;
+    return 0;
+  }
+  if (plblock_id == SPEC_SENSE_PLBLOCK_ID) {
+    pos = emu_rx_take(start, emu_stream_samples(plblock_id, num_words), emu_fft_size(), done_ns);
+    *done_ns += (uint64_t)emu_fft_size()*CRASH_EMU_FFT_NS_PER_POINT;
+  } else {
+    pos = emu_rx_take(start, emu_stream_samples(plblock_id, num_words), 1, done_ns);
+  }
+  emu_stream_fill(plblock_id, pos, (uint32_t *)dst, num_words);
+  if (*done_ns < min_done) *done_ns = min_done;
+  return 0;
+}
+
+// MM2S of bytes to plblock_id, starting at time start
+static int emu_dma_out(uint plblock_id, const uint8_t *src, uint bytes, uint64_t start, uint64_t *done_ns)
+{
+  uint num_words = bytes/sizeof(uint64_t);
+  float *wave;
+  uint i;
+
+  *done_ns = start + (uint64_t)(bytes*emu.dma_ns_per_byte);
+  if (plblock_id == DMA_PLBLOCK_ID) {
+    emu_loop_push(src, bytes);
+  } else if (plblock_id == USRP_INTF_PLBLOCK_ID) {
+    if (num_words > emu.tx_alloc) {
+      wave = (float *)realloc(emu.tx_wave, 2*num_words*sizeof(float));
+      if (wave == NULL) return -1;
+      emu.tx_wave = wave;
+      emu.tx_alloc = num_words;
+    }
+    if (emu.regs[USRP_TX_FIX2FLOAT_BYPASS]) {
+      for (i = 0; i < 2*num_words; i++) {
+        emu.tx_wave[i] = ((const int32_t *)src)[i]/32768.0;
+      }
+    } else {
+      memcpy(emu.tx_wave, src, 2*num_words*sizeof(float));
+    }
+    emu.tx_len = num_words;
+    // While transmitting the DAC drains the FIFO at the sample rate
+    if (emu.tx_on) {
+      *done_ns = start + (uint64_t)(num_words*1e9/emu_tx_rate());
+    }
+  }
+  return 0;
+}
+
+static uint8_t *emu_phys_to_virt(uint32_t addr, uint bytes)
+{
+  struct crash_plblock *p;
+  uint i;
+
+  for (i = 0; i < EMU_MAX_OPEN; i++) {
+    if (emu.open[i] == NULL) continue;
+    p = &emu.open[i]->plblock;
+    if (addr >= p->dma_phys_addr && (uint64_t)addr - p->dma_phys_addr + bytes <= p->dma_buff_size) {
+      return (uint8_t *)p->dma_buff + (addr - p->dma_phys_addr);
+    }
+  }
+  return NULL;
+}
+
+// Retire finished Datamover commands
+static void emu_dma_update(uint dir, uint64_t now)
+{
+  struct emu_dma_chan *chan = &emu.dma[dir];
+
+  while (chan->count > 0 && chan->cmds[chan->head].done_ns <= now) {
+    if (!emu.regs[DMA_STS_FIFO_AUTO_READ] && chan->sts_count < EMU_DMA_FIFO_DEPTH) {
+      chan->sts[(chan->sts_head + chan->sts_count) % EMU_DMA_FIFO_DEPTH] = chan->cmds[chan->head].sts;
+      chan->sts_count++;
+    }
+    chan->head = (chan->head + 1) % EMU_DMA_FIFO_DEPTH;
+    chan->count--;
+    chan->xfer_cnt++;
+  }
+}
+
+// Datamover command, bit 31 start, bits 25:23 tdest / tid, bits 22:0 bytes. Commands run
+// back to back, the data moves when the command is queued and completion is reported
+// when it would have finished.
+static void emu_dma_submit(uint dir, uint32_t cmd, uint64_t now)
+{
+  struct emu_dma_chan *chan = &emu.dma[dir];
+  struct emu_dma_cmd *c;
+  uint bytes = cmd & 0x7FFFFF;
+  uint tag = (cmd >> 23) & 0x7;
+  uint8_t *mem;
+  uint64_t start;
+  uint64_t done;
+  int ret;
+
+  emu_dma_update(dir, now);
+  if (chan->count == EMU_DMA_FIFO_DEPTH) {
+    // Command FIFO full, lost as on the hardware
+    return;
+  }
+  start = (chan->busy_ns > now) ? chan->busy_ns : now;
+  c = &chan->cmds[(chan->head + chan->count) % EMU_DMA_FIFO_DEPTH];
+  mem = emu_phys_to_virt(chan->cmd_addr, bytes);
+  if (mem == NULL) {
+    c->sts = EMU_STS_DECERR | tag;
+    done = start;
+  } else {
+    if (dir == EMU_MM2S) {
+      ret = emu_dma_out(tag, mem, bytes, start, &done);
+    } else {
+      ret = emu_dma_in(tag, mem, bytes, start, &done);
+    }
+    c->sts = (ret == 0) ? (EMU_STS_OKAY | tag) : (EMU_STS_SLVERR | tag);
+    if (ret != 0) done = start;
+  }
+  c->done_ns = done;
+  chan->busy_ns = done;
+  chan->count++;
+}
+
+// Frames a running ring's DMA has finished writing by now
+static uint64_t emu_ring_produced(struct emu_plblock *ep, uint64_t now)
+{
+  uint64_t avail;
+  uint64_t latency = 0;
+
+  if (ep->ring_id == SPEC_SENSE_PLBLOCK_ID) {
+    latency = (uint64_t)emu_fft_size()*CRASH_EMU_FFT_NS_PER_POINT;
+  }
+  avail = (now > latency) ? emu_rx_avail(now - latency) : 0;
+  return (avail > ep->ring_start) ? (avail - ep->ring_start)/ep->ring_samples : 0;
+}
+
+// Every ring frame is an S2MM transfer on the hardware, count them in DMA_S2MM_XFER_CNT
+static void emu_ring_update(uint64_t now)
+{
+  struct emu_plblock *ep;
+  uint64_t produced;
+  uint i;
+
+  for (i = 0; i < EMU_MAX_OPEN; i++) {
+    ep = emu.open[i];
+    if (ep == NULL || !ep->ring_running) continue;
+    produced = emu_ring_produced(ep, now);
+    if (produced > ep->ring_xfers) {
+      emu.dma[EMU_S2MM].xfer_cnt += produced - ep->ring_xfers;
+      ep->ring_xfers = produced;
+    }
+  }
+}
+
+static uint32_t emu_dma_pop_sts(uint dir, uint64_t now)
+{
+  struct emu_dma_chan *chan = &emu.dma[dir];
+  uint8_t sts;
+
+  emu_dma_update(dir, now);
+  if (chan->sts_count == 0) return 0;
+  sts = chan->sts[chan->sts_head];
+  chan->sts_head = (chan->sts_head + 1) % EMU_DMA_FIFO_DEPTH;
+  chan->sts_count--;
+  return sts;
+}
+
+// 150 MHz since the last reset, wrapping at 30 bits
+static uint32_t emu_cnt(uint64_t now)
+{
+  return (uint32_t)(((now - emu.cnt_start_ns)*3/20) % (1 << CRASH_EMU_CNT_BITS));
+}
+
+static uint32_t emu_read(uint reg, uint64_t now)
+{
+  if (reg >= CRASH_NUM_REGS) {
+    if (!emu.warned_reg) printf("ERROR: crash-emu: Unknown register %d\n",reg);
+    emu.warned_reg = true;
+    return 0;
+  }
+  switch (reg) {
+    case DMA_DEBUG_CNT:
+      return emu_cnt(now);
+    case USRP_RX_CAL_COMPLETE:
+      return now >= emu.rx_cal_done_ns;
+    case USRP_TX_CAL_COMPLETE:
+      return now >= emu.tx_cal_done_ns;
+    case USRP_UART_BUSY:
+      return now < emu.uart_done_ns;
+    case DMA_MM2S_XFER_CNT:
+      emu_dma_update(EMU_MM2S, now);
+      return emu.dma[EMU_MM2S].xfer_cnt;
+    case DMA_S2MM_XFER_CNT:
+      emu_dma_update(EMU_S2MM, now);
+      emu_ring_update(now);
+      return emu.dma[EMU_S2MM].xfer_cnt;
+    case DMA_MM2S_STS:
+      return emu_dma_pop_sts(EMU_MM2S, now);
+    case DMA_S2MM_STS:
+      return emu_dma_pop_sts(EMU_S2MM, now);
+    case DMA_MM2S_STS_FIFO_EMPTY:
+      emu_dma_update(EMU_MM2S, now);
+      return emu.dma[EMU_MM2S].sts_count == 0;
+    case DMA_S2MM_STS_FIFO_EMPTY:
+      emu_dma_update(EMU_S2MM, now);
+      return emu.dma[EMU_S2MM].sts_count == 0;
+    case SPEC_SENSE_THRESHOLD_EXCEEDED:
+    case SPEC_SENSE_THRESHOLD_EXCEEDED_INDEX:
+    case SPEC_SENSE_THRESHOLD_EXCEEDED_MAG:
+      emu_spec_sense_update(now);
+      emu_tx_update(now);
+      return emu.regs[reg];
+    default:
+      return emu.regs[reg];
+  }
+}
+
+static void emu_write(uint reg, uint32_t value, uint64_t now)
+{
+  uint i;
+
+  if (reg >= CRASH_NUM_REGS) {
+    if (!emu.warned_reg) printf("ERROR: crash-emu: Unknown register %d\n",reg);
+    emu.warned_reg = true;
+    return;
+  }
+  switch (reg) {
+    // Read only
+    case DMA_DEBUG_CNT:
+    case USRP_RX_CAL_COMPLETE:
+    case USRP_TX_CAL_COMPLETE:
+    case USRP_UART_BUSY:
+    case DMA_MM2S_XFER_CNT:
+    case DMA_S2MM_XFER_CNT:
+    case DMA_MM2S_STS:
+    case DMA_S2MM_STS:
+    case DMA_MM2S_STS_FIFO_EMPTY:
+    case DMA_S2MM_STS_FIFO_EMPTY:
+    case SPEC_SENSE_THRESHOLD_EXCEEDED:
+    case SPEC_SENSE_THRESHOLD_EXCEEDED_INDEX:
+    case SPEC_SENSE_THRESHOLD_EXCEEDED_MAG:
+      return;
+    // Self clearing
+    case USRP_RX_RESET_CAL:
+      if (value) emu.rx_cal_done_ns = now + emu.cal_ns;
+      return;
+    case USRP_TX_RESET_CAL:
+      if (value) emu.tx_cal_done_ns = now + emu.cal_ns;
+      return;
+    case USRP_USRP_MODE_CTRL:
+      emu.regs[reg] = value;
+      emu.uart_done_ns = now + emu.uart_ns;
+      if ((value & CMD_MASK) == CMD_RX_MODE) emu.rx_mode = value & ~CMD_MASK;
+      if ((value & CMD_MASK) == CMD_TX_MODE) emu.tx_mode = value & ~CMD_MASK;
+      return;
+    case USRP_RX_ENABLE:
+      if (value && !emu.regs[reg]) {
+        emu.rx_start_ns = now;
+        emu.rx_pos = 0;
+        emu.spec_frame = 0;
+        emu.tx_on = false;
+        emu.tx_on_pos = UINT64_MAX;
+        emu.tx_off_pos = UINT64_MAX;
+        // Running rings fill from the start of the new RX stream
+        for (i = 0; i < EMU_MAX_OPEN; i++) {
+          if (emu.open[i] != NULL && emu.open[i]->ring_running) {
+            emu.open[i]->ring_start = 0;
+            emu.open[i]->ring_frames = 0;
+            emu.open[i]->ring_xfers = 0;
+          }
+        }
+      }
+      emu.regs[reg] = (value != 0);
+      emu_tx_update(now);
+      return;
+    case SPEC_SENSE_AXIS_CONFIG_TVALID:
+      // FFT size is taken on the rising edge
+      if (value && !emu.regs[reg]) {
+        emu.fft_log2 = emu.regs[SPEC_SENSE_AXIS_CONFIG_TDATA];
+        if (emu.fft_log2 < CRASH_EMU_MIN_FFT_LOG2) emu.fft_log2 = CRASH_EMU_MIN_FFT_LOG2;
+        if (emu.fft_log2 > CRASH_EMU_MAX_FFT_LOG2) emu.fft_log2 = CRASH_EMU_MAX_FFT_LOG2;
+        emu.spec_frame = 0;
+      }
+      emu.regs[reg] = value;
+      return;
+    case DMA_MM2S_CMD_ADDR:
+      emu.dma[EMU_MM2S].cmd_addr = value;
+      emu.regs[reg] = value;
+      return;
+    case DMA_S2MM_CMD_ADDR:
+      emu.dma[EMU_S2MM].cmd_addr = value;
+      emu.regs[reg] = value;
+      return;
+    case DMA_MM2S_CMD_DATA:
+      emu.regs[reg] = value;
+      if (value & 0x80000000) emu_dma_submit(EMU_MM2S, value, now);
+      return;
+    case DMA_S2MM_CMD_DATA:
+      emu.regs[reg] = value;
+      if (value & 0x80000000) emu_dma_submit(EMU_S2MM, value, now);
+      return;
+    case USRP_TX_ENABLE:
+    case USRP_TX_ENABLE_SIDEBAND:
+    case SPEC_SENSE_ENABLE_THRESH_SIDEBAND:
+    case SPEC_SENSE_ENABLE_NOT_THRESH_SIDEBAND:
+      emu.regs[reg] = value;
+      emu_tx_update(now);
+      return;
+    default:
+      emu.regs[reg] = value;
+      return;
+  }
+}
+
+struct crash_plblock *crash_open(uint plblock_id, uint dir)
+{
+  struct emu_plblock *ep;
+  uint slot;
+  void *buff;
+
+  pthread_mutex_lock(&emu.lock);
+  if (emu_init() != 0) {
+    pthread_mutex_unlock(&emu.lock);
+    return NULL;
+  }
+  for (slot = 0; slot < EMU_MAX_OPEN && emu.open[slot] != NULL; slot++);
+  ep = (struct emu_plblock *)calloc(1, sizeof(struct emu_plblock));
+  if (slot == EMU_MAX_OPEN || ep == NULL ||
+      posix_memalign(&buff, 4096, CRASH_EMU_DMA_BUFF_SIZE) != 0) {
+    printf("ERROR: crash-emu: Failed to allocate plblock\n");
+    free(ep);
+    pthread_mutex_unlock(&emu.lock);
+    return NULL;
+  }
+  memset(buff, 0, CRASH_EMU_DMA_BUFF_SIZE);
+  ep->slot = slot;
+  ep->plblock.fd = -1;
+  ep->plblock.plblock_id = plblock_id;
+  ep->plblock.dir = dir;
+  ep->plblock.regs = emu.regs;
+  ep->plblock.dma_buff = buff;
+  ep->plblock.dma_phys_addr = CRASH_EMU_PHYS_BASE + slot*CRASH_EMU_DMA_BUFF_SIZE;
+  ep->plblock.dma_buff_size = CRASH_EMU_DMA_BUFF_SIZE;
+  emu.open[slot] = ep;
+  pthread_mutex_unlock(&emu.lock);
+  return &ep->plblock;
+}
+
+void crash_close(struct crash_plblock *plblock)
+{
+  struct emu_plblock *ep = (struct emu_plblock *)plblock;
+
+  if (plblock == NULL) return;
+  pthread_mutex_lock(&emu.lock);
+  emu.open[ep->slot] = NULL;
+  pthread_mutex_unlock(&emu.lock);
+  free(plblock->dma_buff);
+  free(ep);
+}
+
+void crash_reset(struct crash_plblock *plblock)
+{
+  pthread_mutex_lock(&emu.lock);
+  emu_reset_state(emu_now_ns());
+  pthread_mutex_unlock(&emu.lock);
+}
+
+int crash_read(struct crash_plblock *plblock, uint plblock_id, uint num_words)
+{
+  uint64_t done;
+  int ret;
+
+  if ((uint64_t)num_words*sizeof(uint64_t) > plblock->dma_buff_size) {
+    printf("ERROR: crash-emu: Read of %d words does not fit the DMA buffer\n",num_words);
+    return -1;
+  }
+  pthread_mutex_lock(&emu.lock);
+  ret = emu_dma_in(plblock_id, (uint8_t *)plblock->dma_buff, num_words*sizeof(uint64_t),
+                   emu_now_ns(), &done);
+  pthread_mutex_unlock(&emu.lock);
+  if (ret == 0) emu_sleep_until(done);
+  return ret;
+}
+
+int crash_write(struct crash_plblock *plblock, uint plblock_id, uint num_words)
+{
+  uint64_t done;
+  int ret;
+
+  if ((uint64_t)num_words*sizeof(uint64_t) > plblock->dma_buff_size) {
+    printf("ERROR: crash-emu: Write of %d words does not fit the DMA buffer\n",num_words);
+    return -1;
+  }
+  pthread_mutex_lock(&emu.lock);
+  ret = emu_dma_out(plblock_id, (const uint8_t *)plblock->dma_buff, num_words*sizeof(uint64_t),
+                    emu_now_ns(), &done);
+  pthread_mutex_unlock(&emu.lock);
+  if (ret == 0) emu_sleep_until(done);
+  return ret;
+}
+
+int crash_start_dma(struct crash_plblock *plblock, uint plblock_id, uint num_buffs, uint num_words)
+{
+  struct emu_plblock *ep = (struct emu_plblock *)plblock;
+  const char *error;
+  uint64_t now;
+  uint64_t start;
+  uint align;
+
+  if (num_buffs == 0 || (uint64_t)num_buffs*num_words*sizeof(uint64_t) > plblock->dma_buff_size) {
+    printf("ERROR: crash-emu: %d buffers of %d words do not fit the DMA buffer\n",num_buffs,num_words);
+    return -1;
+  }
+  pthread_mutex_lock(&emu.lock);
+  // Like the hardware, a ring may be started before RX is enabled and fills once it is
+  error = emu_stream_route_error(plblock_id);
+  if (error != NULL || plblock_id == DMA_PLBLOCK_ID) {
+    printf("ERROR: crash-emu: %s\n",(error != NULL) ? error : "DMA loopback ring not supported");
+    pthread_mutex_unlock(&emu.lock);
+    return -1;
+  }
+  now = emu_now_ns();
+  align = (plblock_id == SPEC_SENSE_PLBLOCK_ID) ? emu_fft_size() : 1;
+  start = emu_rx_avail(now);
+  if (start < emu.rx_pos) start = emu.rx_pos;
+  ep->ring_id = plblock_id;
+  ep->ring_buffs = num_buffs;
+  ep->ring_words = num_words;
+  ep->ring_samples = emu_stream_samples(plblock_id, num_words);
+  ep->ring_start = (start + align - 1)/align*align;
+  ep->ring_frames = 0;
+  ep->ring_xfers = 0;
+  ep->ring_running = true;
+  pthread_mutex_unlock(&emu.lock);
+  return 0;
+}
+
+int crash_stop_dma(struct crash_plblock *plblock)
+{
+  struct emu_plblock *ep = (struct emu_plblock *)plblock;
+
+  pthread_mutex_lock(&emu.lock);
+  if (ep->ring_running) {
+    emu.rx_pos = ep->ring_start + ep->ring_frames*ep->ring_samples;
+  }
+  ep->ring_running = false;
+  pthread_mutex_unlock(&emu.lock);
+  return 0;
+}
+
+struct dma_buff crash_get_dma_buffer(struct crash_plblock *plblock, uint num_words)
+{
+  struct emu_plblock *ep = (struct emu_plblock *)plblock;
+  struct dma_buff rx_dma_buff = { NULL, 0 };
+  uint64_t now;
+  uint64_t produced;
+
+  pthread_mutex_lock(&emu.lock);
+  if (!ep->ring_running) {
+    pthread_mutex_unlock(&emu.lock);
+    return rx_dma_buff;
+  }
+  now = emu_now_ns();
+  emu_ring_update(now);
+  produced = ep->ring_xfers;
+  if (produced > ep->ring_frames) {
+    // Only the last ring_buffs frames are still in the ring
+    if (produced - ep->ring_frames > ep->ring_buffs) {
+      ep->ring_frames = produced - ep->ring_buffs;
+    }
+    rx_dma_buff.buff = (uint32_t *)plblock->dma_buff +
+                       2*(ep->ring_frames % ep->ring_buffs)*ep->ring_words;
+    rx_dma_buff.num_words = ep->ring_words;
+    emu_stream_fill(ep->ring_id, ep->ring_start + ep->ring_frames*ep->ring_samples,
+                    rx_dma_buff.buff, ep->ring_words);
+    ep->ring_frames++;
+  }
+  pthread_mutex_unlock(&emu.lock);
+  return rx_dma_buff;
+}
+
+uint32_t crash_read_reg(uint32_t *regs, uint reg)
+{
+  uint32_t value;
+
+  // Timing reads skip the lock
+  if (reg == DMA_DEBUG_CNT) return emu.ready ? emu_cnt(emu_now_ns()) : 0;
+  pthread_mutex_lock(&emu.lock);
+  value = emu_read(reg, emu_now_ns());
+  pthread_mutex_unlock(&emu.lock);
+  return value;
+}
+
+void crash_write_reg(uint32_t *regs, uint reg, uint32_t value)
+{
+  pthread_mutex_lock(&emu.lock);
+  emu_write(reg, value, emu_now_ns());
+  pthread_mutex_unlock(&emu.lock);
+}
+
+void crash_set_bit(uint32_t *regs, uint bit)
+{
+  crash_write_reg(regs, bit, 1);
+}
+
+void crash_clear_bit(uint32_t *regs, uint bit)
+{
+  crash_write_reg(regs, bit, 0);
+}
+
+uint32_t crash_get_bit(uint32_t *regs, uint bit)
+{
+  return crash_read_reg(regs, bit) != 0;
+}
@@ -0,0 +1,124 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-emu.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Software emulation of the CRASH programmable logic behind the
+**                libcrash API, so the tools and benchmarks run on a PC.
+**
+**                Build any tool with make EMU=1 (see emu.mk). It then links
+**                libcrash-emu.a instead of libcrash and uses the headers in
+**                include/ instead of the kernel module's.
+**
+**                What is emulated:
+**                  - One register file shared by all plblocks. DMA_DEBUG_CNT
+**                    counts at 150 MHz, is 30 bits wide and is cleared by
+**                    crash_reset(), as on the hardware. *_CAL_COMPLETE goes high CRASH_EMU_CAL_US
+**                    after a reset or RESET_CAL. USRP_UART_BUSY stays high for
+**                    CRASH_EMU_UART_US after each USRP_USRP_MODE_CTRL write.
+**                  - usrp_intf RX: a sample stream that starts when USRP_RX_ENABLE
+**                    is set and runs at the ADC rate over the CIC / halfband
+**                    decimation set in the registers. Float, q15 (USRP_RX_PACK16)
+**                    or 16-bit fixed point in 32-bit words (fix2float bypass).
+**                    A read completes when its last sample would have arrived, so
+**                    DMA times match the sample rate. Without USRP_RX_FIFO_BYPASS
+**                    up to CRASH_EMU_RX_FIFO_SAMPLES old samples are delivered first.
+**                    In RX_TX_LOOPBACK_MODE RX gets the last TX waveform, repeated,
+**                    while TX is enabled, and zeros otherwise.
+**                  - usrp_intf TX: keeps the last waveform written, for loopback.
+**                  - spec_sense: FFT of each frame of the RX stream (when it is the
+**                    usrp_intf tdest), output modes 0 (complex) and 1 (magnitude /
+**                    index, bit 31 = over threshold), threshold exceeded status,
+**                    index and magnitude, latched until CLEAR_THRESHOLD_LATCHED.
+**                  - DMA: crash_read() / crash_write(), crash_start_dma() rings and
+**                    the Datamover command / status FIFOs used by dma-queue.h.
+**                    Ring frames and Datamover commands count in the *_XFER_CNT
+**                    registers when they complete.
+**                    Memory to memory speed is CRASH_EMU_DMA_MBPS. tdest / tid
+**                    DMA_PLBLOCK_ID loops MM2S data back to S2MM.
+**
+**                Environment variables (all optional):
+**                  CRASH_EMU_SOURCE      pulse (default), tone, noise or the name of
+**                                        a file of interleaved float I/Q to replay
+**                  CRASH_EMU_TONE_FREQ   Tone frequency in cycles per output sample,
+**                                        default 0.125 (bin N/8, no leakage)
+**                  CRASH_EMU_TONE_AMP    Default 0.5
+**                  CRASH_EMU_NOISE_AMP   Default 0.001, below a threshold of 1.0 up
+**                                        to the largest FFT size
+**                  CRASH_EMU_PULSE_ON_MS / CRASH_EMU_PULSE_OFF_MS
+**                                        Pulse timing, default 4900 / 100 as in the
+**                                        lab setups
+**                  CRASH_EMU_ADC_RATE    Samples per second before decimation,
+**                                        default 100e6
+**                  CRASH_EMU_CAL_US, CRASH_EMU_UART_US, CRASH_EMU_DMA_MBPS
+**
+**                Not emulated: gains, filtering (decimation only changes the rate),
+**                interrupts (fd is -1, so waits sleep), BPSK and cache policies.
+**
+******************************************************************************/
+#ifndef CRASH_EMU_H
+#define CRASH_EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CRASH_EMU_CNT_HZ                  150e6
+#define CRASH_EMU_CNT_BITS                30
+#define CRASH_EMU_DEFAULT_ADC_RATE        100e6
+#define CRASH_EMU_DEFAULT_CAL_US          1000
+#define CRASH_EMU_DEFAULT_UART_US         200       // Two command bytes at 115200 baud
+#define CRASH_EMU_DEFAULT_DMA_MBPS        800
+#define CRASH_EMU_DMA_BUFF_SIZE           (8*1024*1024)
+#define CRASH_EMU_PHYS_BASE               0x10000000
+#define CRASH_EMU_RX_FIFO_SAMPLES         8192
+#define CRASH_EMU_LOOP_FIFO_BYTES         (1024*1024)
+#define CRASH_EMU_FFT_NS_PER_POINT        10        // spec_sense pipeline latency
+#define CRASH_EMU_MIN_FFT_LOG2            6
+#define CRASH_EMU_MAX_FFT_LOG2            13
+#define CRASH_EMU_NOISE_LEN               65536     // Power of 2
+
+#define CRASH_EMU_SRC_NOISE               0
+#define CRASH_EMU_SRC_TONE                1
+#define CRASH_EMU_SRC_PULSE               2
+#define CRASH_EMU_SRC_FILE                3
+
+struct crash_emu_source {
+  uint type;
+  const char *name;
+  double tone_freq;
+  float tone_amp;
+  float noise_amp;
+  double pulse_on_ns;
+  double pulse_off_ns;
+  const float *file_samples;      // Interleaved I/Q, mmap()ed
+  uint64_t file_len;              // Complex samples
+  float *noise;                   // CRASH_EMU_NOISE_LEN complex Gaussian samples
+};
+
+// Numeric environment variable, def if not set
+double emu_env(const char *name, double def);
+// Configure from the environment. Returns -1 if a replay file cannot be opened.
+int emu_source_init(struct crash_emu_source *src);
+// Complex samples pos .. pos + n - 1 of the stream at rate samples per second, as
+// interleaved floats. The stream is a function of the sample index only, so any
+// part of it can be generated again.
+void emu_source_generate(const struct crash_emu_source *src, uint64_t pos, double rate,
+                         float *out, uint n);
+// In place radix-2 complex FFT of interleaved floats, n a power of 2
+void emu_fft(float *data, uint n);
+
+#endif
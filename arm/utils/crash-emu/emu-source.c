@@ -0,0 +1,198 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         emu-source.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Synthetic and file replayed IQ samples for the libcrash
+**                emulator, and the FFT of the emulated spec_sense plblock.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crash-emu.h"
+
+double emu_env(const char *name, double def)
+{
+  const char *value = getenv(name);
+
+  return (value != NULL && *value != '\0') ? atof(value) : def;
+}
+
+static int emu_source_open_file(struct crash_emu_source *src, const char *filename)
+{
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("ERROR: crash-emu: Failed to open %s\n",filename);
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)(2*sizeof(float))) {
+    printf("ERROR: crash-emu: %s is empty\n",filename);
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("ERROR: crash-emu: Failed to map %s\n",filename);
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  src->file_samples = (const float *)map;
+  src->file_len = st.st_size/(2*sizeof(float));
+  return 0;
+}
+
+int emu_source_init(struct crash_emu_source *src)
+{
+  const char *name = getenv("CRASH_EMU_SOURCE");
+  unsigned int seed = 1;
+  double u1, u2, r;
+  uint i;
+
+  memset(src, 0, sizeof(struct crash_emu_source));
+  src->tone_freq = emu_env("CRASH_EMU_TONE_FREQ", 0.125);
+  src->tone_amp = emu_env("CRASH_EMU_TONE_AMP", 0.5);
+  src->noise_amp = emu_env("CRASH_EMU_NOISE_AMP", 0.001);
+  src->pulse_on_ns = 1e6*emu_env("CRASH_EMU_PULSE_ON_MS", 4900);
+  src->pulse_off_ns = 1e6*emu_env("CRASH_EMU_PULSE_OFF_MS", 100);
+
+  if (name == NULL || *name == '\0' || strcmp(name, "pulse") == 0) {
+    src->type = CRASH_EMU_SRC_PULSE;
+    src->name = "pulse";
+  } else if (strcmp(name, "tone") == 0) {
+    src->type = CRASH_EMU_SRC_TONE;
+    src->name = "tone";
+  } else if (strcmp(name, "noise") == 0) {
+    src->type = CRASH_EMU_SRC_NOISE;
+    src->name = "noise";
+  } else {
+    src->type = CRASH_EMU_SRC_FILE;
+    src->name = name;
+    if (emu_source_open_file(src, name) != 0) return -1;
+  }
+
+  // Box-Muller, from a fixed seed so every run sees the same noise
+  src->noise = (float *)malloc(2*CRASH_EMU_NOISE_LEN*sizeof(float));
+  if (src->noise == NULL) {
+    printf("ERROR: crash-emu: Failed to allocate noise table\n");
+    return -1;
+  }
+  for (i = 0; i < CRASH_EMU_NOISE_LEN; i++) {
+    u1 = (rand_r(&seed) + 1.0)/(RAND_MAX + 2.0);
+    u2 = (double)rand_r(&seed)/RAND_MAX;
+    r = sqrt(-2.0*log(u1));
+    src->noise[2*i] = r*cos(2*M_PI*u2);
+    src->noise[2*i+1] = r*sin(2*M_PI*u2);
+  }
+  return 0;
+}
+
+void emu_source_generate(const struct crash_emu_source *src, uint64_t pos, double rate,
+                         float *out, uint n)
+{
+  double period_ns = src->pulse_on_ns + src->pulse_off_ns;
+  double phase, rot_i, rot_q, ph_i, ph_q, tmp;
+  uint64_t k, idx;
+  bool on;
+  uint i;
+
+  if (src->type == CRASH_EMU_SRC_FILE) {
+    for (i = 0; i < n; i++) {
+      idx = (pos + i) % src->file_len;
+      out[2*i] = src->file_samples[2*idx];
+      out[2*i+1] = src->file_samples[2*idx+1];
+    }
+    return;
+  }
+
+  // Noise table is walked with a stride that changes every pass, so frames do not repeat
+  for (i = 0; i < n; i++) {
+    k = pos + i;
+    idx = (k + (k/CRASH_EMU_NOISE_LEN)*40503) & (CRASH_EMU_NOISE_LEN - 1);
+    out[2*i] = src->noise_amp*src->noise[2*idx];
+    out[2*i+1] = src->noise_amp*src->noise[2*idx+1];
+  }
+  if (src->type == CRASH_EMU_SRC_NOISE) return;
+
+  // Tone by phase rotation, starting from the exact phase of sample pos
+  phase = 2*M_PI*fmod(src->tone_freq*(double)pos, 1.0);
+  ph_i = cos(phase);
+  ph_q = sin(phase);
+  rot_i = cos(2*M_PI*src->tone_freq);
+  rot_q = sin(2*M_PI*src->tone_freq);
+  for (i = 0; i < n; i++) {
+    on = true;
+    if (src->type == CRASH_EMU_SRC_PULSE) {
+      on = fmod((pos + i)*1e9/rate, period_ns) < src->pulse_on_ns;
+    }
+    if (on) {
+      out[2*i] += src->tone_amp*ph_i;
+      out[2*i+1] += src->tone_amp*ph_q;
+    }
+    tmp = ph_i*rot_i - ph_q*rot_q;
+    ph_q = ph_i*rot_q + ph_q*rot_i;
+    ph_i = tmp;
+  }
+}
+
+void emu_fft(float *data, uint n)
+{
+  uint i, j, bit, len, k;
+  double w_i, w_q, wl_i, wl_q, tmp;
+  float t_i, t_q, u_i, u_q;
+
+  // Bit reversal
+  for (i = 1, j = 0; i < n; i++) {
+    for (bit = n >> 1; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      t_i = data[2*i]; data[2*i] = data[2*j]; data[2*j] = t_i;
+      t_q = data[2*i+1]; data[2*i+1] = data[2*j+1]; data[2*j+1] = t_q;
+    }
+  }
+  for (len = 2; len <= n; len <<= 1) {
+    wl_i = cos(-2*M_PI/len);
+    wl_q = sin(-2*M_PI/len);
+    for (i = 0; i < n; i += len) {
+      w_i = 1.0;
+      w_q = 0.0;
+      for (k = 0; k < len/2; k++) {
+        u_i = data[2*(i+k)];
+        u_q = data[2*(i+k)+1];
+        t_i = w_i*data[2*(i+k+len/2)] - w_q*data[2*(i+k+len/2)+1];
+        t_q = w_i*data[2*(i+k+len/2)+1] + w_q*data[2*(i+k+len/2)];
+        data[2*(i+k)] = u_i + t_i;
+        data[2*(i+k)+1] = u_q + t_q;
+        data[2*(i+k+len/2)] = u_i - t_i;
+        data[2*(i+k+len/2)+1] = u_q - t_q;
+        tmp = w_i*wl_i - w_q*wl_q;
+        w_q = w_i*wl_q + w_q*wl_i;
+        w_i = tmp;
+      }
+    }
+  }
+}
@@ -0,0 +1,14 @@
+# Build against the libcrash emulator instead of the hardware: make EMU=1
+# Included at the end of a tool Makefile. NEON is dropped so it builds on a PC,
+# objects go into the tool's own build-emu directory.
+EMU_DIR = ../crash-emu
+EMU_LIB = $(EMU_DIR)/libcrash-emu.a
+
+CFLAGS := $(filter-out -mfpu=neon,$(CFLAGS)) -I$(EMU_DIR)/include
+LIBS := $(filter-out -lcrash,$(LIBS)) $(EMU_LIB) -lm -lpthread
+
+$(BUILD)/$(TARGET): $(EMU_LIB)
+
+$(EMU_LIB): FORCE
+	$(MAKE) -C $(EMU_DIR)
+
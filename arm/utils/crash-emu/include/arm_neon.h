@@ -0,0 +1,56 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         arm_neon.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Host stand-in for the NEON types and intrinsics that tools use
+**                outside of __ARM_NEON__ guards, so they build for the emulator
+**                on a PC. GCC vector extensions give the same lane indexing.
+**
+**                On ARM the real header is used.
+**
+******************************************************************************/
+#ifdef __ARM_NEON__
+#include_next <arm_neon.h>
+#else
+#ifndef CRASH_EMU_ARM_NEON_H
+#define CRASH_EMU_ARM_NEON_H
+
+#include <stdint.h>
+
+typedef float float32x4_t __attribute__ ((vector_size (16)));
+typedef uint32_t uint32x4_t __attribute__ ((vector_size (16)));
+typedef int32_t int32x4_t __attribute__ ((vector_size (16)));
+
+// |a| >= |b|, all ones per true lane
+static inline uint32x4_t vcageq_f32(float32x4_t a, float32x4_t b)
+{
+  uint32x4_t r;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    r[i] = (__builtin_fabsf(a[i]) >= __builtin_fabsf(b[i])) ? 0xFFFFFFFF : 0;
+  }
+  return r;
+}
+
+static inline uint32x4_t vcgeq_u32(uint32x4_t a, uint32x4_t b)
+{
+  return (uint32x4_t)(a >= b);
+}
+
+#endif
+#endif
@@ -0,0 +1,128 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         crash-kmod.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Register and plblock names for the libcrash emulator (see
+**                crash-emu.h). Same names as the kernel module header, so the
+**                tools build unchanged with make EMU=1.
+**
+**                Every name is its own word in the emulated register file. The
+**                values are the emulator's own and do not match the hardware
+**                header, only the names and how they are used do.
+**
+******************************************************************************/
+#ifndef CRASH_KMOD_H
+#define CRASH_KMOD_H
+
+// plblock IDs, also the AXI-Stream tdest of each plblock
+#define DMA_PLBLOCK_ID                    0
+#define USRP_INTF_PLBLOCK_ID              1
+#define SPEC_SENSE_PLBLOCK_ID             2
+#define BPSK_PLBLOCK_ID                   3
+#define CRASH_NUM_PLBLOCKS                8
+
+// USRP UART commands, written to USRP_USRP_MODE_CTRL as command + mode
+#define CMD_RX_MODE                       0x100
+#define CMD_TX_MODE                       0x200
+#define CMD_MASK                          0xF00
+#define RX_ADC_RAW_MODE                   0
+#define RX_ADC_DSP_MODE                   1
+#define RX_ADC_DC_OFF_MODE                2
+#define RX_TX_LOOPBACK_MODE               3
+#define TX_PASSTHRU_MODE                  0
+#define TX_DAC_RAW_MODE                   1
+#define TX_RX_LOOPBACK_MODE               2
+
+// DDR interface phase calibration values
+#define RX_PHASE_CAL                      0
+#define TX_PHASE_CAL                      0
+
+enum crash_reg {
+  // ps_pl_interface
+  DMA_DEBUG_CNT = 0,
+  DMA_MM2S_CMD_ADDR,
+  DMA_MM2S_CMD_DATA,
+  DMA_MM2S_XFER_EN,
+  DMA_MM2S_XFER_CNT,
+  DMA_MM2S_STS,
+  DMA_MM2S_STS_FIFO_EMPTY,
+  DMA_MM2S_INTERRUPT,
+  DMA_S2MM_CMD_ADDR,
+  DMA_S2MM_CMD_DATA,
+  DMA_S2MM_XFER_EN,
+  DMA_S2MM_XFER_CNT,
+  DMA_S2MM_STS,
+  DMA_S2MM_STS_FIFO_EMPTY,
+  DMA_S2MM_INTERRUPT,
+  DMA_STS_FIFO_AUTO_READ,
+  DMA_AWCACHE,
+  DMA_AWUSER,
+  DMA_ARCACHE,
+  DMA_ARUSER,
+  // usrp_intf
+  USRP_USRP_MODE_CTRL,
+  USRP_UART_BUSY,
+  USRP_RX_ENABLE,
+  USRP_RX_RESET_CAL,
+  USRP_RX_CAL_COMPLETE,
+  USRP_RX_PHASE_INIT,
+  USRP_RX_FIFO_RESET,
+  USRP_RX_FIFO_BYPASS,
+  USRP_RX_FIX2FLOAT_BYPASS,
+  USRP_RX_CIC_BYPASS,
+  USRP_RX_CIC_DECIM,
+  USRP_RX_HB_BYPASS,
+  USRP_RX_GAIN,
+  USRP_RX_PACKET_SIZE,
+  USRP_AXIS_MASTER_TDEST,
+  USRP_TX_ENABLE,
+  USRP_TX_ENABLE_SIDEBAND,
+  USRP_TX_RESET_CAL,
+  USRP_TX_CAL_COMPLETE,
+  USRP_TX_PHASE_INIT,
+  USRP_TX_FIX2FLOAT_BYPASS,
+  USRP_TX_CIC_BYPASS,
+  USRP_TX_CIC_INTERP,
+  USRP_TX_GAIN,
+  USRP_TX_HB_BYPASS,
+  USRP_RX_PACK16,                 // The bit after USRP_TX_HB_BYPASS, see sample-format.c
+  // spec_sense
+  SPEC_SENSE_AXIS_CONFIG_TDATA,
+  SPEC_SENSE_AXIS_CONFIG_TVALID,
+  SPEC_SENSE_AXIS_MASTER_TDEST,
+  SPEC_SENSE_ENABLE_FFT,
+  SPEC_SENSE_OUTPUT_MODE,
+  SPEC_SENSE_THRESHOLD,
+  SPEC_SENSE_ENABLE_THRESH_SIDEBAND,
+  SPEC_SENSE_ENABLE_NOT_THRESH_SIDEBAND,
+  SPEC_SENSE_CLEAR_THRESHOLD_LATCHED,
+  SPEC_SENSE_THRESHOLD_EXCEEDED,
+  SPEC_SENSE_THRESHOLD_EXCEEDED_INDEX,
+  SPEC_SENSE_THRESHOLD_EXCEEDED_MAG,
+  CRASH_NUM_REGS
+};
+
+// Names older kernel module headers lack, the emulator has them as registers. Without
+// DMA_AWCACHE and friends dma-cache.c refuses to set a cache policy, without
+// USRP_RX_PACK16 sample-format.c falls back to the bit after USRP_TX_HB_BYPASS.
+#define DMA_AWCACHE                       DMA_AWCACHE
+#define DMA_AWUSER                        DMA_AWUSER
+#define DMA_ARCACHE                       DMA_ARCACHE
+#define DMA_ARUSER                        DMA_ARUSER
+#define USRP_RX_PACK16                    USRP_RX_PACK16
+
+#endif
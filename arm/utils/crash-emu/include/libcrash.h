@@ -0,0 +1,70 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         libcrash.h
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  libcrash API, implemented by the emulator (see crash-emu.h).
+**
+**                Drop-in for the libcrash header: same functions, same
+**                crash_plblock fields the tools use. There is no device, fd is
+**                -1, so crash_wait_bit() and friends sleep with nanosleep().
+**
+******************************************************************************/
+#ifndef LIBCRASH_H
+#define LIBCRASH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// crash_open() direction
+#define READ                      0
+#define WRITE                     1
+
+struct crash_plblock {
+  int fd;
+  uint plblock_id;
+  uint dir;
+  uint32_t *regs;
+  void *dma_buff;
+  uint32_t dma_phys_addr;
+  uint32_t dma_buff_size;
+};
+
+struct dma_buff {
+  uint32_t *buff;
+  uint num_words;                 // 0 if no frame is ready
+};
+
+struct crash_plblock *crash_open(uint plblock_id, uint dir);
+void crash_close(struct crash_plblock *plblock);
+void crash_reset(struct crash_plblock *plblock);
+
+// Blocking DMA of num_words 64-bit words to / from plblock_id through dma_buff
+int crash_read(struct crash_plblock *plblock, uint plblock_id, uint num_words);
+int crash_write(struct crash_plblock *plblock, uint plblock_id, uint num_words);
+
+// Continuous S2MM into a ring of num_buffs frames of num_words words in dma_buff
+int crash_start_dma(struct crash_plblock *plblock, uint plblock_id, uint num_buffs, uint num_words);
+int crash_stop_dma(struct crash_plblock *plblock);
+struct dma_buff crash_get_dma_buffer(struct crash_plblock *plblock, uint num_words);
+
+uint32_t crash_read_reg(uint32_t *regs, uint reg);
+void crash_write_reg(uint32_t *regs, uint reg, uint32_t value);
+void crash_set_bit(uint32_t *regs, uint bit);
+void crash_clear_bit(uint32_t *regs, uint bit);
+uint32_t crash_get_bit(uint32_t *regs, uint bit);
+
+#endif
@@ -20,6 +20,19 @@
 **                Spectrum decision is simple: If all FFT bins are behold
 **                the threshold -> transmit.
 **
+**                The FPGA makes the decision, so the only software visible stages are
+**                Detect Time (RX enable until the threshold exceeded status is seen)
+**                and Clear Time (from then until the status drops and TX triggers).
+**                Both go into latency histograms (see latency-hist.h), --latency file
+**                writes them out, JSON for a .json name, otherwise CSV.
+**
+**                --loops N runs N loops back to back (no 1 second pause) and exits,
+**                for benchmarking (see crash-bench).
+**
+**                --trace file records the RX / TX register writes, the threshold
+**                exceeded transitions and the noise floor thread's DMA and threshold
+**                updates, written out as a Chrome trace (see trace.h).
+**
 **                Lab setup for this program
 **                  Run GNU Radio Companion program that has both a USRP Source and Sink.
 **                  USRP Source should be tuned to 130MHz with +30 gain, USRP Sink 75MHz with 0 gain.
@@ -30,6 +43,14 @@
 **                  to measure the turn around time.
 **                  Make sure to check the USRP input / output power levels to not
 **
+**                With --adaptive the threshold tracks the noise floor: the spectrum
+**                sense block streams magnitude frames (output mode 1) into a DMA
+**                ring buffer and a background thread estimates the noise floor
+**                from them, rewriting SPEC_SENSE_THRESHOLD right after a frame
+**                completes. The FFT and the hardware decision keep running. The
+**                floor moves slowly, so the thread samples at most one frame per
+**                ADAPTIVE_PERIOD_US and sleeps in between.
+**
 ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,22 +67,113 @@
 #include <fcntl.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "frame-ring.h"
+#include "dma-debug-cnt.h"
+#include "noise-floor.h"
+#include "crash-wait.h"
+#include "latency-hist.h"
+#include "trace.h"
+
+#define ADAPTIVE_NUM_BUFFS 4
+#define ADAPTIVE_PERIOD_US 1000
+#define THRESHOLD_TIMEOUT_US 11000000
+#define CLEAR_WAIT_SLICE_US 100000
 
 // Global variable used to kill final loop
 int loop_prog = 0;
+// Set by Ctrl-C, also ends a single run stuck in the clear wait
+int stop_prog = 0;
+
+struct adaptive_ctx {
+  struct noise_floor nf;
+  struct frame_ring ring;
+  struct crash_plblock *spec_sense;
+  pthread_t thread;
+  int running;
+  uint64_t timeouts;
+  uint64_t stale;                 // Frames the DMA was already overwriting
+};
 
 void ctrl_c(int dummy)
 {
     loop_prog = 0;
+    stop_prog = 1;
     return;
 }
 
+// The spectrum sense block compares each bin against SPEC_SENSE_THRESHOLD as the FFT
+// streams out, so a write in the middle of a frame splits that frame between the old and
+// the new threshold. Wait for the next frame to complete and write right after it. Like
+// frame_ring_next(), the wait spins briefly and then sleeps on the DMA interrupt of the
+// ring this thread owns, so a long frame does not burn the core. This costs at most a
+// frame per update and the hysteresis keeps updates rare.
+static void adaptive_write_threshold(struct adaptive_ctx *ctx)
+{
+  struct frame_ring *ring = &ctx->ring;
+  uint32_t xfer = crash_read_reg(ring->plblock->regs,DMA_S2MM_XFER_CNT);
+  uint32_t start = crash_read_reg(ring->plblock->regs,DMA_DEBUG_CNT);
+  uint32_t waited;
+  uint temp_int;
+
+  while (crash_read_reg(ring->plblock->regs,DMA_S2MM_XFER_CNT) == xfer) {
+    waited = dma_debug_cnt_delta(start, crash_read_reg(ring->plblock->regs,DMA_DEBUG_CNT));
+    if (waited > 2*ring->frame_cycles + FRAME_RING_TIMEOUT_CYCLES) {
+      ctx->timeouts++;
+      break;
+    }
+    // Past the spin period, sleep until the DMA interrupt or at most half a frame
+    if (waited > CRASH_WAIT_SPIN_CYCLES) {
+      crash_wait_event(ring->plblock, ring->frame_cycles/300);
+    }
+  }
+  memcpy(&temp_int,&ctx->nf.threshold,sizeof(float));
+  trace_write_reg(ctx->spec_sense->regs,SPEC_SENSE_THRESHOLD,temp_int);
+}
+
+// Background noise floor estimator. The DMA ring keeps accepting magnitude frames even
+// when this thread is asleep, so the FFT is never back pressured. Frames that were
+// overwritten are simply not sampled.
+void *adaptive_thread(void *arg)
+{
+  struct adaptive_ctx *ctx = (struct adaptive_ctx *)arg;
+  struct timespec period;
+  float *fft_mag;
+
+  trace_thread_name("Noise Floor");
+
+  period.tv_sec = 0;
+  period.tv_nsec = ADAPTIVE_PERIOD_US*1000;
+  while (__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE)) {
+    fft_mag = (float *)frame_ring_next(&ctx->ring);
+    if (fft_mag == NULL) {
+      ctx->timeouts++;
+      continue;
+    }
+    // After a sleep the oldest buffer in the ring may be the one the DMA is writing
+    if (frame_ring_overwritten(&ctx->ring, ctx->ring.seq)) {
+      ctx->stale++;
+      continue;
+    }
+    // Magnitude is the lower half of each 64-bit word
+    if (noise_floor_push_frame(&ctx->nf, fft_mag, 2)) {
+      adaptive_write_threshold(ctx);
+    }
+    nanosleep(&period, NULL);
+  }
+  trace_thread_exit();
+  return NULL;
+}
+
 int main (int argc, char **argv) {
   int c;
   int i;
   bool interrupt_flag = false;
+  uint num_loops = 0;
+  uint num_timeouts = 0;
+  uint max_loops = 0;
   uint number_samples = 0;
   uint decim_rate = 0;
   uint fft_size = 0;
@@ -69,6 +181,22 @@ int main (int argc, char **argv) {
   uint temp_int;
   float temp_float;
   double gain = 0.0;
+  bool adaptive = false;
+  float margin_db = 0.0;
+  float quantile = 0.0;
+  float smoothing = 0.0;
+  float hysteresis_db = -1.0;
+  struct adaptive_ctx adapt;
+  uint32_t overhead;
+  uint32_t start_detect, stop_detect, stop_clear;
+  char *latency_file = NULL;
+  char *trace_file = NULL;
+  struct latency_hist *hists[3];
+  struct latency_hist detect_hist;
+  struct latency_hist clear_hist;
+  struct latency_hist loop_hist;
+  struct timespec loop_start_ts;
+  struct timespec loop_stop_ts;
   struct crash_plblock *spec_sense;
   struct crash_plblock *usrp_intf_tx;
 
@@ -79,16 +207,24 @@ int main (int argc, char **argv) {
          We distinguish them by their indices. */
       {"interrupt",   no_argument,       0, 'i'},
       {"loop prog",   no_argument,       0, 'l'},
+      {"loops",       required_argument, 0, 'N'},
       {"samples",     required_argument, 0, 'n'},
       {"decim",       required_argument, 0, 'd'},
       {"fft size",    required_argument, 0, 'k'},
       {"threshold",   required_argument, 0, 't'},
+      {"adaptive",    no_argument,       0, 'a'},
+      {"margin",      required_argument, 0, 'm'},
+      {"quantile",    required_argument, 0, 'q'},
+      {"smoothing",   required_argument, 0, 's'},
+      {"hysteresis",  required_argument, 0, 'y'},
+      {"latency",     required_argument, 0, 'L'},
+      {"trace",       required_argument, 0, 'T'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "ild:k:t:",
+    c = getopt_long (argc, argv, "ilN:d:k:t:am:q:s:y:L:T:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -100,6 +236,10 @@ int main (int argc, char **argv) {
       case 'l':
         loop_prog = 1;
         break;
+      case 'N':
+        max_loops = atoi(optarg);
+        loop_prog = 1;
+        break;
       case 'd':
         decim_rate = atoi(optarg);
         break;
@@ -109,6 +249,27 @@ int main (int argc, char **argv) {
       case 't':
         threshold = atof(optarg);
         break;
+      case 'a':
+        adaptive = true;
+        break;
+      case 'm':
+        margin_db = atof(optarg);
+        break;
+      case 'q':
+        quantile = atof(optarg);
+        break;
+      case 's':
+        smoothing = atof(optarg);
+        break;
+      case 'y':
+        hysteresis_db = atof(optarg);
+        break;
+      case 'L':
+        latency_file = optarg;
+        break;
+      case 'T':
+        trace_file = optarg;
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -154,6 +315,31 @@ int main (int argc, char **argv) {
 
   number_samples = (uint)pow(2.0,(double)fft_size);
 
+  memset(&adapt, 0, sizeof(struct adaptive_ctx));
+  if (adaptive) {
+    if (margin_db == 0.0) {
+      printf("INFO: Noise floor margin not set, defaulting to 10 dB\n");
+      margin_db = 10.0;
+    }
+    if (quantile == 0.0) {
+      printf("INFO: Noise floor quantile not set, defaulting to 0.5 (median)\n");
+      quantile = 0.5;
+    }
+    if (smoothing == 0.0) {
+      printf("INFO: Noise floor smoothing not set, defaulting to 0.1\n");
+      smoothing = 0.1;
+    }
+    if (hysteresis_db < 0.0) {
+      printf("INFO: Threshold hysteresis not set, defaulting to 1 dB\n");
+      hysteresis_db = 1.0;
+    }
+    // Check the settings once here, the estimator is restarted every loop
+    if (noise_floor_init(&adapt.nf, number_samples, quantile, margin_db, smoothing,
+                         hysteresis_db, threshold) != 0) {
+      return -1;
+    }
+  }
+
   // Set Ctrl-C handler
   signal(SIGINT, ctrl_c);
 
@@ -171,7 +357,25 @@ int main (int argc, char **argv) {
     return -1;
   }
 
+  // Every loop starts with crash_reset(), so the trace uses CLOCK_MONOTONIC_RAW
+  if (trace_file != NULL && trace_init(trace_file, "fpga-spectrum-decision", NULL) != 0) {
+    crash_close(usrp_intf_tx);
+    crash_close(spec_sense);
+    return -1;
+  }
+
+  // Calculate overhead of reading the counter
+  overhead = latency_read_overhead(usrp_intf_tx);
+  latency_hist_init(&detect_hist, "Detect Time", overhead);
+  hists[0] = &detect_hist;
+  latency_hist_init(&clear_hist, "Clear Time", overhead);
+  hists[1] = &clear_hist;
+  // Whole loop, the measured decision rate in crash-bench
+  latency_hist_init(&loop_hist, "Loop Time", 0);
+  hists[2] = &loop_hist;
+
   do {
+    clock_gettime(CLOCK_MONOTONIC, &loop_start_ts);
     // Global Reset to get us to a clean slate
     crash_reset(usrp_intf_tx);
 
@@ -181,28 +385,28 @@ int main (int argc, char **argv) {
     // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
     // as the next steps recalibrate the interface and are ignored if issued while it is
     // currently calibrating.
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set RX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_RX_RESET_CAL);
     //printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_RX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set TX phase
     crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
     crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
     //printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT));
-    while(!crash_get_bit(usrp_intf_tx->regs,USRP_TX_CAL_COMPLETE));
+    crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
     // Set USRP TX / RX Modes
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
     crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-    while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+    crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
     // Setup RX path
     crash_set_bit(usrp_intf_tx->regs, USRP_RX_FIFO_BYPASS);                       // Bypass RX FIFO so stale data in the FIFO does not cause latency
@@ -257,7 +461,12 @@ int main (int argc, char **argv) {
     crash_write(usrp_intf_tx, USRP_INTF_PLBLOCK_ID, 4096);
 
     // Setup Spectrum Sense
-    crash_write_reg(spec_sense->regs,SPEC_SENSE_OUTPUT_MODE,3);                   // Throw away FFT output
+    if (adaptive) {
+      crash_write_reg(spec_sense->regs,SPEC_SENSE_AXIS_MASTER_TDEST,DMA_PLBLOCK_ID);  // Send magnitudes to the DMA
+      crash_write_reg(spec_sense->regs,SPEC_SENSE_OUTPUT_MODE,1);                 // FFT Magnitude Data
+    } else {
+      crash_write_reg(spec_sense->regs,SPEC_SENSE_OUTPUT_MODE,3);                 // Throw away FFT output
+    }
     crash_write_reg(spec_sense->regs,SPEC_SENSE_AXIS_CONFIG_TDATA,fft_size);      // FFT Size
     crash_set_bit(spec_sense->regs,SPEC_SENSE_AXIS_CONFIG_TVALID);                // FFT Size Enable
     crash_set_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                        // Enable FFT
@@ -267,23 +476,58 @@ int main (int argc, char **argv) {
     memcpy(&temp_int,&threshold,sizeof(float));                                   // Copy float value to an int without a cast
     crash_write_reg(spec_sense->regs,SPEC_SENSE_THRESHOLD,temp_int);              // Threshold level in single precision floating point
 
+    if (adaptive) {
+      // Start from the command line threshold every loop and adapt from there
+      noise_floor_init(&adapt.nf, number_samples, quantile, margin_db, smoothing,
+                       hysteresis_db, threshold);
+      adapt.spec_sense = spec_sense;
+      adapt.timeouts = 0;
+      adapt.stale = 0;
+    }
 
-    crash_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
-
-    i = 0;
-    while(crash_get_bit(spec_sense->regs,SPEC_SENSE_THRESHOLD_EXCEEDED) == 0) {
-      sleep(1);
-      if (i > 10) {
-        printf("TIMEOUT\n");
+    trace_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
+    if (adaptive) {
+      // Until the ring runs the magnitude output holds up the FFT, so start it right away
+      if (frame_ring_start(&adapt.ring, spec_sense, SPEC_SENSE_PLBLOCK_ID, ADAPTIVE_NUM_BUFFS,
+                           number_samples, decim_rate) != 0) {
         goto cleanup;
       }
-      i++;
+      adapt.running = 1;
+      if (pthread_create(&adapt.thread, NULL, adaptive_thread, &adapt) != 0) {
+        printf("ERROR: Failed to start noise floor thread\n");
+        adapt.running = 0;
+        frame_ring_stop(&adapt.ring);
+        goto cleanup;
+      }
+    }
+    start_detect = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
+
+    // Sleeps until the threshold is exceeded instead of checking once a second
+    if (crash_wait_bit(spec_sense,SPEC_SENSE_THRESHOLD_EXCEEDED,1,THRESHOLD_TIMEOUT_US) != 0) {
+      printf("TIMEOUT\n");
+      num_timeouts++;
+      goto cleanup;
     }
+    stop_detect = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
+    TRACE(TRACE_DECISION, "Decision", 1);
 
-    crash_set_bit(spec_sense->regs,SPEC_SENSE_CLEAR_THRESHOLD_LATCHED);           // Enable clear threshold latched
-    crash_set_bit(usrp_intf_tx->regs,USRP_TX_ENABLE_SIDEBAND);                    // Enable TX Sideband
+    trace_set_bit(spec_sense->regs,SPEC_SENSE_CLEAR_THRESHOLD_LATCHED);           // Enable clear threshold latched
+    trace_set_bit(usrp_intf_tx->regs,USRP_TX_ENABLE_SIDEBAND);                    // Enable TX Sideband
 
-    while(crash_get_bit(spec_sense->regs,SPEC_SENSE_THRESHOLD_EXCEEDED) == 1);
+    // Waits in slices so Ctrl-C still gets through if the threshold never clears
+    while (crash_wait_bit(spec_sense,SPEC_SENSE_THRESHOLD_EXCEEDED,0,CLEAR_WAIT_SLICE_US) != 0) {
+      if (stop_prog) {
+        printf("INTERRUPTED: Threshold never cleared\n");
+        num_timeouts++;
+        goto cleanup;
+      }
+    }
+    stop_clear = crash_read_reg(usrp_intf_tx->regs,DMA_DEBUG_CNT);
+    // The FPGA makes the decision and triggers TX through the sideband, this is when we see it
+    TRACE(TRACE_DECISION, "Decision", 0);
+    TRACE(TRACE_TX_ENABLE, "TX Enable", 1);
+    latency_hist_record_interval(&detect_hist, start_detect, stop_detect);
+    latency_hist_record_interval(&clear_hist, stop_detect, stop_clear);
 
     // Print threshold information
     temp_int = crash_read_reg(spec_sense->regs,SPEC_SENSE_THRESHOLD);
@@ -300,13 +544,48 @@ int main (int argc, char **argv) {
     }
 
   cleanup:
-    crash_set_bit(spec_sense->regs,SPEC_SENSE_CLEAR_THRESHOLD_LATCHED);           // Enable clear threshold latched
-    crash_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
-    crash_clear_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                      // Disable FFT
-    crash_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE_SIDEBAND);                  // Disable TX Sideband
+    // Timed out loops count too, so --loops always ends
+    num_loops++;
+    if (adapt.running) {
+      __atomic_store_n(&adapt.running, 0, __ATOMIC_RELEASE);
+      pthread_join(adapt.thread, NULL);
+      frame_ring_stop(&adapt.ring);
+      noise_floor_print_stats(&adapt.nf);
+      frame_ring_print_stats(&adapt.ring);
+      if (adapt.timeouts > 0) {
+        printf("Noise Floor Timeouts:\t\t%llu\n",(unsigned long long)adapt.timeouts);
+      }
+      printf("Noise Floor Stale Frames:\t%llu\n",(unsigned long long)adapt.stale);
+    }
+    trace_set_bit(spec_sense->regs,SPEC_SENSE_CLEAR_THRESHOLD_LATCHED);           // Enable clear threshold latched
+    trace_clear_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                           // Disable RX
+    trace_clear_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                      // Disable FFT
+    trace_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE_SIDEBAND);                  // Disable TX Sideband
+    TRACE(TRACE_TX_ENABLE, "TX Enable", 0);
     crash_clear_bit(usrp_intf_tx->regs,USRP_TX_ENABLE);                           // Disable TX
-    sleep(1);
-  } while (loop_prog == 1);
+    clock_gettime(CLOCK_MONOTONIC, &loop_stop_ts);
+    latency_hist_record_timespec(&loop_hist, &loop_start_ts, &loop_stop_ts);
+    // --loops runs back to back, so the loop rate and CPU use are not diluted by the pause
+    if (max_loops == 0) {
+      sleep(1);
+    }
+  } while (loop_prog == 1 && (max_loops == 0 || num_loops < max_loops));
+
+  printf("Number of loops: %d\n",num_loops);
+  if (num_timeouts > 0) {
+    printf("Number of timeouts: %d\n",num_timeouts);
+  }
+  latency_hist_print(&detect_hist);
+  latency_hist_print(&clear_hist);
+  latency_hist_print(&loop_hist);
+  if (latency_file != NULL) {
+    latency_hist_export(latency_file, hists, 3);
+  }
+  if (trace_file != NULL) {
+    trace_print_stats();
+    trace_dump();
+    trace_free();
+  }
 
   crash_close(usrp_intf_tx);
   crash_close(spec_sense);
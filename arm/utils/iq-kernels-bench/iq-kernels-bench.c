@@ -0,0 +1,422 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         iq-kernels-bench.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Microbenchmark for the iq-kernels conversion library. Times
+**                each kernel against a plain C reference loop and a memcpy of
+**                the same number of bytes (the memory bandwidth bound), and
+**                checks the kernel output matches the reference.
+**
+**                Buffers are --samples complex samples. Use a size larger than
+**                the L2 cache (512 KB on the Zynq) to measure streaming
+**                throughput, or a DMA frame sized one for the in-cache rate.
+**
+**                Built with NEON by default, "make NEON=" builds the generic C
+**                kernels.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "iq-kernels.h"
+
+#define BENCH_SCALE               1000.5f
+
+struct bench_bufs {
+  uint n;                         // Complex samples
+  float *f_in;
+  float *f_out;
+  float *f_ref;
+  float *re;
+  float *im;
+  int16_t *s16;
+  int16_t *s16_out;
+  int32_t *s32;
+  int32_t *s32_out;
+};
+
+struct bench {
+  const char *name;
+  uint bytes_per_sample;          // Bytes read plus written per complex sample
+  void (*kernel)(struct bench_bufs *b);
+  void (*reference)(struct bench_bufs *b);
+  bool (*check)(struct bench_bufs *b);
+};
+
+static double now_sec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Same truncate and saturate rules as the kernels
+static int32_t ref_sat_s32(float x)
+{
+  if (x != x) return 0;
+  if (x >= 2147483647.0f) return INT32_MAX;
+  if (x <= -2147483648.0f) return INT32_MIN;
+  return (int32_t)x;
+}
+
+static int16_t ref_sat_s16(float x)
+{
+  int32_t y = ref_sat_s32(x);
+
+  return (y > INT16_MAX) ? INT16_MAX : ((y < INT16_MIN) ? INT16_MIN : y);
+}
+
+static void k_memcpy(struct bench_bufs *b) { memcpy(b->f_out, b->f_in, 2*b->n*sizeof(float)); }
+static bool c_none(struct bench_bufs *b) { return true; }
+
+static void k_deinterleave(struct bench_bufs *b) { iq_deinterleave(b->f_in, b->re, b->im, b->n); }
+static void r_deinterleave(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < b->n; i++) {
+    b->re[i] = b->f_in[2*i];
+    b->im[i] = b->f_in[2*i+1];
+  }
+}
+static bool c_deinterleave(struct bench_bufs *b)
+{
+  uint i;
+  iq_deinterleave(b->f_in, b->re, b->im, b->n);
+  for (i = 0; i < b->n; i++) {
+    if (b->re[i] != b->f_in[2*i] || b->im[i] != b->f_in[2*i+1]) return false;
+  }
+  return true;
+}
+
+static void k_interleave(struct bench_bufs *b) { iq_interleave(b->re, b->im, b->f_out, b->n); }
+static void r_interleave(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < b->n; i++) {
+    b->f_out[2*i] = b->re[i];
+    b->f_out[2*i+1] = b->im[i];
+  }
+}
+static bool c_interleave(struct bench_bufs *b)
+{
+  iq_interleave(b->re, b->im, b->f_out, b->n);
+  r_interleave(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  iq_interleave(b->re, b->im, b->f_out, b->n);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_conj(struct bench_bufs *b) { iq_conj(b->f_in, b->f_out, b->n); }
+static void r_conj(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < b->n; i++) {
+    b->f_out[2*i] = b->f_in[2*i];
+    b->f_out[2*i+1] = -b->f_in[2*i+1];
+  }
+}
+static bool c_conj(struct bench_bufs *b)
+{
+  r_conj(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  iq_conj(b->f_in, b->f_out, b->n);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_fill(struct bench_bufs *b) { iq_fill(b->f_out, b->n, 0.9, 0.0); }
+static void r_fill(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < b->n; i++) {
+    b->f_out[2*i] = 0.9;
+    b->f_out[2*i+1] = 0.0;
+  }
+}
+static bool c_fill(struct bench_bufs *b)
+{
+  r_fill(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  iq_fill(b->f_out, b->n, 0.9, 0.0);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_ramp(struct bench_bufs *b) { iq_ramp_s32(b->s32_out, b->n, 256, 0); }
+static void r_ramp(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < b->n; i++) {
+    b->s32_out[2*i] = i+256;
+    b->s32_out[2*i+1] = i;
+  }
+}
+static bool c_ramp(struct bench_bufs *b)
+{
+  uint i;
+  iq_ramp_s32(b->s32_out, b->n, 256, 0);
+  for (i = 0; i < b->n; i++) {
+    if (b->s32_out[2*i] != i+256 || b->s32_out[2*i+1] != i) return false;
+  }
+  return true;
+}
+
+static void k_scale(struct bench_bufs *b) { iq_scale(b->f_in, b->f_out, 2*b->n, BENCH_SCALE); }
+static void r_scale(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < 2*b->n; i++) {
+    b->f_out[i] = b->f_in[i]*BENCH_SCALE;
+  }
+}
+static bool c_scale(struct bench_bufs *b)
+{
+  r_scale(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  iq_scale(b->f_in, b->f_out, 2*b->n, BENCH_SCALE);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_s16_to_float(struct bench_bufs *b) { iq_s16_to_float(b->s16, b->f_out, 2*b->n, 1.0/32768); }
+static void r_s16_to_float(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < 2*b->n; i++) {
+    b->f_out[i] = b->s16[i]*(float)(1.0/32768);
+  }
+}
+static bool c_s16_to_float(struct bench_bufs *b)
+{
+  r_s16_to_float(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  k_s16_to_float(b);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_float_to_s16(struct bench_bufs *b) { iq_float_to_s16(b->f_in, b->s16_out, 2*b->n, BENCH_SCALE); }
+static void r_float_to_s16(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < 2*b->n; i++) {
+    b->s16_out[i] = ref_sat_s16(b->f_in[i]*BENCH_SCALE);
+  }
+}
+static bool c_float_to_s16(struct bench_bufs *b)
+{
+  uint i;
+  k_float_to_s16(b);
+  for (i = 0; i < 2*b->n; i++) {
+    if (b->s16_out[i] != ref_sat_s16(b->f_in[i]*BENCH_SCALE)) return false;
+  }
+  return true;
+}
+
+static void k_s32_to_float(struct bench_bufs *b) { iq_s32_to_float(b->s32, b->f_out, 2*b->n, 1.0/2147483648.0); }
+static void r_s32_to_float(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < 2*b->n; i++) {
+    b->f_out[i] = b->s32[i]*(float)(1.0/2147483648.0);
+  }
+}
+static bool c_s32_to_float(struct bench_bufs *b)
+{
+  r_s32_to_float(b);
+  memcpy(b->f_ref, b->f_out, 2*b->n*sizeof(float));
+  k_s32_to_float(b);
+  return memcmp(b->f_ref, b->f_out, 2*b->n*sizeof(float)) == 0;
+}
+
+static void k_float_to_s32(struct bench_bufs *b) { iq_float_to_s32(b->f_in, b->s32_out, 2*b->n, 2147483648.0); }
+static void r_float_to_s32(struct bench_bufs *b)
+{
+  uint i;
+  for (i = 0; i < 2*b->n; i++) {
+    b->s32_out[i] = ref_sat_s32(b->f_in[i]*2147483648.0f);
+  }
+}
+static bool c_float_to_s32(struct bench_bufs *b)
+{
+  uint i;
+  k_float_to_s32(b);
+  for (i = 0; i < 2*b->n; i++) {
+    if (b->s32_out[i] != ref_sat_s32(b->f_in[i]*2147483648.0f)) return false;
+  }
+  return true;
+}
+
+static const struct bench benches[] = {
+  {"memcpy",        16, k_memcpy,        NULL,            c_none},
+  {"deinterleave",  16, k_deinterleave,  r_deinterleave,  c_deinterleave},
+  {"interleave",    16, k_interleave,    r_interleave,    c_interleave},
+  {"conj",          16, k_conj,          r_conj,          c_conj},
+  {"fill",          8,  k_fill,          r_fill,          c_fill},
+  {"ramp_s32",      8,  k_ramp,          r_ramp,          c_ramp},
+  {"scale",         16, k_scale,         r_scale,         c_scale},
+  {"s16_to_float",  12, k_s16_to_float,  r_s16_to_float,  c_s16_to_float},
+  {"float_to_s16",  12, k_float_to_s16,  r_float_to_s16,  c_float_to_s16},
+  {"s32_to_float",  16, k_s32_to_float,  r_s32_to_float,  c_s32_to_float},
+  {"float_to_s32",  16, k_float_to_s32,  r_float_to_s32,  c_float_to_s32},
+};
+
+#define NUM_BENCHES               (sizeof(benches)/sizeof(benches[0]))
+
+// Best time of runs calls, in seconds
+static double time_runs(void (*fn)(struct bench_bufs *b), struct bench_bufs *b, uint runs)
+{
+  double best = 1e30;
+  double start;
+  double t;
+  uint run;
+
+  for (run = 0; run < runs; run++) {
+    start = now_sec();
+    fn(b);
+    t = now_sec() - start;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+int main (int argc, char **argv) {
+  int c;
+  uint i;
+  uint k;
+  uint number_samples = 0;
+  uint runs = 0;
+  double t_kernel;
+  double t_ref;
+  bool ok;
+  bool all_ok = true;
+  struct bench_bufs b;
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"samples",     required_argument, 0, 'n'},
+      {"runs",        required_argument, 0, 'r'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // 'n' is the short option, ':' means it requires an argument
+    c = getopt_long (argc, argv, "n:r:",
+                     long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+
+    switch (c) {
+      case 'n':
+        number_samples = atoi(optarg);
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case '?':
+        /* getopt_long already printed an error message. */
+        break;
+      default:
+        abort ();
+    }
+  }
+  /* Print any remaining command line arguments (not options). */
+  if (optind < argc)
+  {
+    printf ("Invalid options:\n");
+    while (optind < argc) {
+      printf ("\t%s\n", argv[optind++]);
+    }
+    return -1;
+  }
+
+  // Check arguments
+  if (number_samples == 0) {
+    printf("INFO: Number of samples not specified, defaulting to 4096\n");
+    number_samples = 4096;
+  }
+
+  if (runs == 0) {
+    printf("INFO: Number of runs not specified, defaulting to 1000\n");
+    runs = 1000;
+  }
+
+  memset(&b, 0, sizeof(struct bench_bufs));
+  b.n = number_samples;
+  b.f_in = malloc(2*number_samples*sizeof(float));
+  b.f_out = malloc(2*number_samples*sizeof(float));
+  b.f_ref = malloc(2*number_samples*sizeof(float));
+  b.re = malloc(number_samples*sizeof(float));
+  b.im = malloc(number_samples*sizeof(float));
+  b.s16 = malloc(2*number_samples*sizeof(int16_t));
+  b.s16_out = malloc(2*number_samples*sizeof(int16_t));
+  b.s32 = malloc(2*number_samples*sizeof(int32_t));
+  b.s32_out = malloc(2*number_samples*sizeof(int32_t));
+  if (!b.f_in || !b.f_out || !b.f_ref || !b.re || !b.im || !b.s16 || !b.s16_out || !b.s32 || !b.s32_out) {
+    printf("ERROR: Failed to allocate buffers\n");
+    return -1;
+  }
+  // Include values out of range of the integer formats to exercise saturation
+  for (i = 0; i < 2*number_samples; i++) {
+    b.f_in[i] = 2.0*rand()/RAND_MAX - 1.0;
+    if ((i % 97) == 0) b.f_in[i] *= 50.0;
+    b.s16[i] = rand();
+    b.s32[i] = rand() - RAND_MAX/2;
+  }
+  for (i = 0; i < number_samples; i++) {
+    b.re[i] = b.f_in[2*i];
+    b.im[i] = b.f_in[2*i+1];
+  }
+
+#ifdef __ARM_NEON__
+  printf("Kernels:\t\t\tNEON\n");
+#else
+  printf("Kernels:\t\t\tGeneric C\n");
+#endif
+  printf("Samples:\t\t\t%d\n",number_samples);
+  printf("Runs:\t\t\t\t%d\n",runs);
+  printf("\n%-16s%12s%12s%12s%10s%8s\n","Kernel","ns/sample","MB/s","Ref MB/s","Speedup","Check");
+  for (k = 0; k < NUM_BENCHES; k++) {
+    ok = benches[k].check(&b);
+    all_ok = all_ok && ok;
+    t_kernel = time_runs(benches[k].kernel, &b, runs);
+    if (benches[k].reference != NULL) {
+      t_ref = time_runs(benches[k].reference, &b, runs);
+      printf("%-16s%12.3f%12.1f%12.1f%10.2f%8s\n",benches[k].name,1e9*t_kernel/number_samples,
+             benches[k].bytes_per_sample*number_samples/t_kernel/1e6,
+             benches[k].bytes_per_sample*number_samples/t_ref/1e6,t_ref/t_kernel,ok ? "ok" : "FAIL");
+    } else {
+      printf("%-16s%12.3f%12.1f%12s%10s%8s\n",benches[k].name,1e9*t_kernel/number_samples,
+             benches[k].bytes_per_sample*number_samples/t_kernel/1e6,"-","-",ok ? "ok" : "FAIL");
+    }
+  }
+
+  free(b.f_in);
+  free(b.f_out);
+  free(b.f_ref);
+  free(b.re);
+  free(b.im);
+  free(b.s16);
+  free(b.s16_out);
+  free(b.s32);
+  free(b.s32_out);
+  return all_ok ? 0 : -1;
+}
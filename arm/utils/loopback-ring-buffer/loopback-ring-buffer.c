@@ -36,6 +36,7 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "crash-wait.h"
 
 int main (int argc, char **argv) {
   int c;
@@ -107,28 +108,28 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_PASSTHRU_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_TX_LOOPBACK_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   // Setup RX path
   crash_write_reg(usrp_intf_rx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to ps_pl_interface
@@ -19,6 +19,15 @@
 **  Description:  Test transmit and receive by looping back received data
 **                to transmit data.
 **
+**                With --forward, received frames are not copied: a pool of
+**                --pool buffers rotates between S2MM and MM2S, each MM2S
+**                command pointing at the buffer S2MM just filled. The --scale
+**                is still applied by the CPU, in place, before each frame is
+**                sent. It cannot move into the USRP TX gain multiplier, as the
+**                TX path quantizes to fix1_19 before the multiplier and the
+**                unscaled samples are far below its resolution. --scale 1
+**                leaves the frames untouched.
+**
 ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +47,13 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "crash-wait.h"
+#include "dma-queue.h"
+#include "iq-kernels.h"
+#include "dma-debug-cnt.h"
+
+#define FORWARD_DEFAULT_BUFFS     4
+#define LOOPBACK_SCALE            100000.0    // Applied to received samples before transmit
 
 // Global variable used to kill final loop
 int loop_prog = 0;
@@ -48,13 +64,108 @@ void ctrl_c(int dummy)
     return;
 }
 
+// Queue the pool buffers for frames first to first + n - 1
+static void queue_frames(struct dma_queue *q, struct crash_plblock *usrp_intf, uint32_t first, uint n,
+                         uint number_samples, uint pool_buffs)
+{
+  struct dma_desc descs[DMA_QUEUE_FIFO_DEPTH];
+  uint i;
+
+  for (i = 0; i < n; i++) {
+    descs[i].addr = usrp_intf->dma_phys_addr + ((first + i) % pool_buffs)*number_samples*sizeof(uint64_t);
+    descs[i].bytes = number_samples*sizeof(uint64_t);
+    descs[i].tdest = USRP_INTF_PLBLOCK_ID;
+  }
+  dma_queue_submit(q, descs, n);
+}
+
+// Scale frames first to first + n - 1 in place
+static void scale_frames(struct crash_plblock *usrp_intf, uint32_t first, uint n,
+                         uint number_samples, uint pool_buffs, double scale)
+{
+  float *frame;
+  uint i;
+
+  for (i = 0; i < n; i++) {
+    frame = (float *)((char *)usrp_intf->dma_buff +
+                      (size_t)((first + i) % pool_buffs)*number_samples*sizeof(uint64_t));
+    iq_scale(frame, frame, 2*number_samples, scale);
+  }
+}
+
+// Forward received frames to transmit without copying them. Frame k lives in pool buffer
+// k % pool_buffs: S2MM fills it, it is scaled in place, MM2S sends it, then it is handed
+// back to S2MM.
+int forward_samples(struct crash_plblock *usrp_intf, uint number_samples, uint pool_buffs,
+                    double scale)
+{
+  struct dma_queue rx_queue;
+  struct dma_queue tx_queue;
+  struct dma_queue *wait_queue;
+  uint32_t start_cnt;
+  uint32_t elapsed;
+  uint64_t elapsed_cycles = 0;
+  int ret = 0;
+
+  // Neither queue verifies, the status FIFO auto read is shared by both directions
+  dma_queue_init(&rx_queue, usrp_intf, DMA_QUEUE_S2MM, false);
+  dma_queue_init(&tx_queue, usrp_intf, DMA_QUEUE_MM2S, false);
+  start_cnt = crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT);
+
+  // S2MM owns the whole pool to start
+  queue_frames(&rx_queue, usrp_intf, 0, pool_buffs, number_samples, pool_buffs);
+
+  while (loop_prog == 1) {
+    // Wait on S2MM, unless every buffer is waiting to be sent
+    wait_queue = (dma_queue_outstanding(&rx_queue) > 0) ? &rx_queue : &tx_queue;
+    if (dma_queue_reap(wait_queue, 1, CRASH_WAIT_TIMEOUT_US) < 0) {
+      printf("TIMEOUT: %s transfer did not complete\n",(wait_queue == &rx_queue) ? "S2MM" : "MM2S");
+      ret = -1;
+      break;
+    }
+    dma_queue_reap(&rx_queue, 0, 0);
+    dma_queue_reap(&tx_queue, 0, 0);
+    // Filled buffers go straight out
+    if (scale != 1.0) {
+      scale_frames(usrp_intf, tx_queue.submitted, rx_queue.completed - tx_queue.submitted,
+                   number_samples, pool_buffs, scale);
+    }
+    queue_frames(&tx_queue, usrp_intf, tx_queue.submitted, rx_queue.completed - tx_queue.submitted,
+                 number_samples, pool_buffs);
+    // Sent buffers are refilled, S2MM runs at most pool_buffs frames ahead of MM2S
+    queue_frames(&rx_queue, usrp_intf, rx_queue.submitted,
+                 tx_queue.completed + pool_buffs - rx_queue.submitted, number_samples, pool_buffs);
+    elapsed = crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT);
+    elapsed_cycles += dma_debug_cnt_delta(start_cnt, elapsed);
+    start_cnt = elapsed;
+  }
+
+  if (dma_queue_stop(&tx_queue, CRASH_WAIT_TIMEOUT_US) != 0 ||
+      dma_queue_stop(&rx_queue, CRASH_WAIT_TIMEOUT_US) != 0) {
+    printf("TIMEOUT: Forwarded transfers did not complete\n");
+    ret = -1;
+  }
+
+  printf("Pool Buffers:\t\t\t%d\n",pool_buffs);
+  printf("Frames Forwarded:\t\t%u\n",tx_queue.completed);
+  if (elapsed_cycles > 0) {
+    printf("Frame Rate (frames/s):\t\t%f\n",tx_queue.completed/(elapsed_cycles/150e6));
+  }
+  dma_queue_print_stats(&rx_queue);
+  dma_queue_print_stats(&tx_queue);
+  crash_wait_print_stats();
+  return ret;
+}
+
 int main (int argc, char **argv) {
   int c;
-  int i;
   bool interrupt_flag = false;
   uint number_samples = 0;
   uint decim_rate = 0;
   uint interp_rate = 0;
+  bool forward = false;
+  uint pool_buffs = FORWARD_DEFAULT_BUFFS;
+  double scale = LOOPBACK_SCALE;
   double gain = 0.0;
   struct crash_plblock *usrp_intf_rx;
   struct crash_plblock *usrp_intf_tx;
@@ -69,12 +180,15 @@ int main (int argc, char **argv) {
       {"samples",     required_argument, 0, 'n'},
       {"decim",       required_argument, 0, 'd'},
       {"interp",      required_argument, 0, 'u'},
+      {"forward",     no_argument,       0, 'f'},
+      {"pool",        required_argument, 0, 'p'},
+      {"scale",       required_argument, 0, 's'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "iln:d:u:",
+    c = getopt_long (argc, argv, "iln:d:u:fp:s:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -95,6 +209,15 @@ int main (int argc, char **argv) {
       case 'u':
         interp_rate = atoi(optarg);
         break;
+      case 'f':
+        forward = true;
+        break;
+      case 'p':
+        pool_buffs = atoi(optarg);
+        break;
+      case 's':
+        scale = atof(optarg);
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -138,6 +261,22 @@ int main (int argc, char **argv) {
     return -1;
   }
 
+  if (forward && (pool_buffs < 2 || pool_buffs > DMA_QUEUE_FIFO_DEPTH)) {
+    printf("ERROR: Forwarding pool needs 2 to %d buffers\n",DMA_QUEUE_FIFO_DEPTH);
+    return -1;
+  }
+
+  if (number_samples*sizeof(uint64_t) > DMA_QUEUE_MAX_BYTES) {
+    printf("ERROR: Number of samples too large\n");
+    return -1;
+  }
+
+  if (forward && (uint64_t)pool_buffs*number_samples*sizeof(uint64_t) > CRASH_DMA_BUFF_SIZE) {
+    printf("ERROR: Forwarding pool of %d x %d samples does not fit in the DMA buffer\n",
+           pool_buffs,number_samples);
+    return -1;
+  }
+
   // Set Ctrl-C handler
   signal(SIGINT, ctrl_c);
 
@@ -174,28 +313,28 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   // Setup RX path
   crash_write_reg(usrp_intf_rx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to ps_pl_interface
@@ -237,11 +376,11 @@ int main (int argc, char **argv) {
   if (interp_rate == 1) {
     crash_set_bit(usrp_intf_rx->regs, USRP_TX_CIC_BYPASS);                      // Bypass CIC Filter
     crash_set_bit(usrp_intf_rx->regs, USRP_TX_HB_BYPASS);                       // Bypass HB Filter
-    crash_write_reg(usrp_intf_rx->regs, USRP_TX_GAIN, 1);                       // Set gain = 1
+    gain = 1.0;                                                                 // Gain = 1
   } else if (interp_rate == 2) {
     crash_set_bit(usrp_intf_rx->regs, USRP_TX_CIC_BYPASS);                      // Bypass CIC Filter
     crash_clear_bit(usrp_intf_rx->regs, USRP_TX_HB_BYPASS);                     // Enable HB Filter
-    crash_write_reg(usrp_intf_rx->regs, USRP_TX_GAIN, 1);                       // Set gain = 1
+    gain = 1.0;                                                                 // Gain = 1
   // Even, use both CIC and Halfband filters
   } else if ((interp_rate % 2) == 0) {
     crash_clear_bit(usrp_intf_rx->regs, USRP_TX_CIC_BYPASS);                    // Enable CIC Filter
@@ -251,7 +390,6 @@ int main (int argc, char **argv) {
     // to scale the CIC output.
     gain = 32.0-3.0*log2(interp_rate/2);
     gain = (gain > 1.0) ? (ceil(pow(2.0,gain))) : (1.0);                        // Do not allow gain to be set to 0
-    crash_write_reg(usrp_intf_rx->regs, USRP_TX_GAIN, (uint32_t)gain);          // Set gain
   // Odd, use only CIC filter
   } else {
     crash_clear_bit(usrp_intf_rx->regs, USRP_TX_CIC_BYPASS);                    // Enable CIC Filter
@@ -260,8 +398,8 @@ int main (int argc, char **argv) {
     //
     gain = 32.0-3.0*log2(interp_rate);
     gain = (gain > 1.0) ? (ceil(pow(2.0,gain))) : (1.0);                        // Do not allow gain to be set to 0
-    crash_write_reg(usrp_intf_rx->regs, USRP_TX_GAIN, (uint32_t)gain);          // Set gain
   }
+  crash_write_reg(usrp_intf_rx->regs, USRP_TX_GAIN, (uint32_t)gain);            // Set gain
 
 
   volatile float *tx_sample = (volatile float*)(usrp_intf_tx->dma_buff);
@@ -279,25 +417,40 @@ int main (int argc, char **argv) {
 
   crash_set_bit(usrp_intf_rx->regs, USRP_TX_ENABLE);                            // Enable TX
 
-  uint cmd;
+  if (forward) {
+    forward_samples(usrp_intf_rx, number_samples, pool_buffs, scale);
+  } else {
+    struct dma_queue tx_queue;
+    struct dma_desc tx_desc;
 
-  while (loop_prog == 1) {
+    // MM2S stays enabled for the whole run, each frame is a single queued command
+    tx_desc.addr = usrp_intf_tx->dma_phys_addr;
+    tx_desc.bytes = number_samples*sizeof(uint64_t);
+    tx_desc.tdest = USRP_INTF_PLBLOCK_ID;
+    dma_queue_init(&tx_queue, usrp_intf_tx, DMA_QUEUE_MM2S, true);
 
-    crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
+    while (loop_prog == 1) {
 
-    // Copy received data to transmit buffer
-    for (i = 0; i < number_samples; i++) {
-      tx_sample[2*i] = rx_sample[2*i]*100000;
-      tx_sample[2*i+1] = rx_sample[2*i+1]*100000;
-    }
+      crash_read(usrp_intf_rx, USRP_INTF_PLBLOCK_ID, number_samples);
 
-    cmd = (1 << 31) + ((USRP_INTF_PLBLOCK_ID & 0x7) << 23) + (number_samples*8 & 0x7FFFFF);
-    crash_write_reg(usrp_intf_tx->regs, DMA_MM2S_CMD_ADDR, usrp_intf_tx->dma_phys_addr);
-    crash_write_reg(usrp_intf_tx->regs, DMA_MM2S_CMD_DATA, cmd);
-    crash_set_bit(usrp_intf_rx->regs, DMA_MM2S_XFER_EN);
-    while(crash_get_bit(usrp_intf_rx->regs, DMA_MM2S_STS_FIFO_EMPTY));
-    crash_clear_bit(usrp_intf_rx->regs, DMA_MM2S_XFER_EN);
+      // Copy received data to transmit buffer
+      iq_scale((const float *)rx_sample, (float *)tx_sample, 2*number_samples, scale);
 
+      dma_queue_submit(&tx_queue, &tx_desc, 1);
+      // The transmit buffer is refilled next iteration, so wait for this transfer
+      if (dma_queue_reap(&tx_queue, 1, CRASH_WAIT_TIMEOUT_US) < 0) {
+        printf("TIMEOUT: MM2S transfer did not complete\n");
+        break;
+      }
+      if (tx_queue.errors > 0) {
+        printf("ERROR: MM2S transfer failed, status 0x%02X\n",tx_queue.last_error);
+        break;
+      }
+
+    }
+    if (dma_queue_stop(&tx_queue, CRASH_WAIT_TIMEOUT_US) != 0) {
+      printf("TIMEOUT: MM2S transfers did not complete\n");
+    }
   }
 
   crash_clear_bit(usrp_intf_rx->regs, USRP_RX_ENABLE);                          // Disable RX
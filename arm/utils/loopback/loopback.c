@@ -36,6 +36,8 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "crash-wait.h"
+#include "iq-kernels.h"
 
 int main (int argc, char **argv) {
   int c;
@@ -161,28 +163,28 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf_rx->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf_rx->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf_rx->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf_rx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP TX / RX Modes
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_PASSTHRU_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_TX_LOOPBACK_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   // Setup RX path
   crash_write_reg(usrp_intf_rx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set tdest to ps_pl_interface
@@ -252,10 +254,7 @@ int main (int argc, char **argv) {
 
   // Create and Send a CW signal
   int *tx_sample = (int*)(usrp_intf_tx->dma_buff);
-  for (i = 0; i < number_samples; i++) {
-    tx_sample[2*i+1] = i;//cos(2.0*M_PI*(freq/100e6)*i);
-    tx_sample[2*i] = i+256;//sin(2.0*M_PI*(freq/100e6)*i);
-  }
+  iq_ramp_s32(tx_sample, number_samples, 256, 0);
 
   for (i = 0; i < 1e6; i++) {
     asm("nop");
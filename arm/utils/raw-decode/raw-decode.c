@@ -0,0 +1,219 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         raw-decode.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Decode a compressed raw ADC capture made with
+**                record-samples --raw --compress.
+**
+**                Blocks are unpacked back into interleaved 32-bit I/Q words.
+**                By default those words are written unchanged (as record-samples
+**                would have written them uncompressed), --float writes them as
+**                floats scaled to +/-1.0 so read_complex.m can load the file.
+**
+**                Corrupt blocks are skipped by scanning for the next block magic,
+**                gaps in the block sequence numbers (DMA frame numbers) are reported
+**                as dropped frames, whether the ring or the writer dropped them.
+**                Plain C, builds on the host.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "raw-codec.h"
+
+int find_block(FILE *fp, struct raw_codec_block_header *hdr)
+{
+  uint32_t word = 0;
+  int c;
+
+  // Slide a byte at a time until the block magic lines up
+  while ((c = fgetc(fp)) != EOF) {
+    word = (word >> 8) | ((uint32_t)c << 24);
+    if (word == RAW_CODEC_BLOCK_MAGIC) {
+      hdr->magic = word;
+      if (fread((uint8_t *)hdr + sizeof(uint32_t),sizeof(*hdr) - sizeof(uint32_t),1,fp) != 1) {
+        return -1;
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int main (int argc, char **argv) {
+  int c;
+  uint i;
+  char *input_file = NULL;
+  char *output_file = "data.txt";
+  bool write_float = false;
+  FILE *in_fp;
+  FILE *out_fp;
+  struct raw_codec_file_header file_header;
+  struct raw_codec_block_header hdr;
+  uint8_t *payload = NULL;
+  int32_t *values = NULL;
+  float *float_values = NULL;
+  uint max_values = 0;
+  bool first_block = true;
+  bool resync = false;
+  uint32_t next_seq = 0;
+  uint64_t blocks = 0;
+  uint64_t bad_blocks = 0;
+  uint64_t dropped_blocks = 0;
+  uint64_t samples = 0;
+  uint64_t bytes_in = sizeof(file_header);
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"input",       required_argument, 0, 'i'},
+      {"output",      required_argument, 0, 'o'},
+      {"float",       no_argument,       0, 'f'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // `":" means argument required
+    c = getopt_long (argc, argv, "i:o:f",long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+    switch (c) {
+      case 'i':
+        input_file = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'f':
+        write_float = true;
+        break;
+      default:
+        abort();
+    }
+  }
+
+  if (input_file == NULL) {
+    printf("ERROR: No input file, use --input\n");
+    return -1;
+  }
+
+  in_fp = fopen(input_file,"rb");
+  if (in_fp == NULL) {
+    printf("ERROR: Failed to open %s\n",input_file);
+    return -1;
+  }
+  if (fread(&file_header,sizeof(file_header),1,in_fp) != 1 ||
+      file_header.magic != RAW_CODEC_MAGIC) {
+    printf("ERROR: %s is not a compressed capture\n",input_file);
+    fclose(in_fp);
+    return -1;
+  }
+  if (file_header.version != RAW_CODEC_VERSION) {
+    printf("ERROR: Unsupported capture version %d\n",file_header.version);
+    fclose(in_fp);
+    return -1;
+  }
+  // Skip any header fields added by later versions
+  fseek(in_fp,file_header.header_size,SEEK_SET);
+  bytes_in = file_header.header_size;
+
+  out_fp = fopen(output_file,"wb");
+  if (out_fp == NULL) {
+    printf("ERROR: Failed to open %s\n",output_file);
+    fclose(in_fp);
+    return -1;
+  }
+
+  printf("Decimation Rate:\t%d\n",file_header.decim_rate);
+  printf("Delta Encoding:\t\t%s\n",(file_header.flags & RAW_CODEC_FLAG_DELTA) ? "yes" : "no");
+
+  while (1) {
+    if (resync) {
+      if (find_block(in_fp,&hdr) != 0) break;
+      resync = false;
+    } else if (fread(&hdr,sizeof(hdr),1,in_fp) != 1) {
+      break;
+    }
+    if (hdr.magic != RAW_CODEC_BLOCK_MAGIC || (hdr.num_values & 1) ||
+        hdr.payload_bytes > ((uint64_t)hdr.num_values*32 + 7)/8) {
+      bad_blocks++;
+      resync = true;
+      continue;
+    }
+    if (hdr.num_values > max_values) {
+      max_values = hdr.num_values;
+      free(payload);
+      free(values);
+      free(float_values);
+      payload = (uint8_t *)malloc(raw_codec_max_block_bytes(max_values));
+      values = (int32_t *)malloc(max_values*sizeof(int32_t));
+      float_values = (float *)malloc(max_values*sizeof(float));
+      if (payload == NULL || values == NULL || float_values == NULL) {
+        printf("ERROR: Failed to allocate %d value block\n",max_values);
+        break;
+      }
+    }
+    if (fread(payload,1,hdr.payload_bytes,in_fp) != hdr.payload_bytes) {
+      printf("WARNING: Capture ends in the middle of block %d\n",hdr.seq);
+      break;
+    }
+    if (raw_codec_decode(&hdr,payload,values) != 0) {
+      bad_blocks++;
+      resync = true;
+      continue;
+    }
+    if (!first_block && hdr.seq != next_seq) {
+      printf("WARNING: Dropped %d frame(s) before block %d\n",hdr.seq - next_seq,hdr.seq);
+      dropped_blocks += hdr.seq - next_seq;
+    }
+    first_block = false;
+    next_seq = hdr.seq + 1;
+
+    if (write_float) {
+      // Q31 to +/-1.0
+      for (i = 0; i < hdr.num_values; i++) {
+        float_values[i] = values[i]*(1.0f/2147483648.0f);
+      }
+      fwrite(float_values,sizeof(float),hdr.num_values,out_fp);
+    } else {
+      fwrite(values,sizeof(int32_t),hdr.num_values,out_fp);
+    }
+    blocks++;
+    samples += hdr.num_values/2;
+    bytes_in += sizeof(hdr) + hdr.payload_bytes;
+  }
+
+  printf("Blocks:\t\t\t%llu\n",(unsigned long long)blocks);
+  printf("Samples:\t\t%llu\n",(unsigned long long)samples);
+  printf("Dropped Frames:\t\t%llu\n",(unsigned long long)dropped_blocks);
+  printf("Corrupt Blocks:\t\t%llu\n",(unsigned long long)bad_blocks);
+  if (bytes_in > 0) {
+    printf("Compression Ratio:\t%f\n",(double)samples*sizeof(uint64_t)/bytes_in);
+  }
+
+  free(payload);
+  free(values);
+  free(float_values);
+  fclose(out_fp);
+  fclose(in_fp);
+  return 0;
+}
@@ -18,11 +18,23 @@
 **  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
 **  Description:  Record FFT data from CRASH
 **
+**                By default one frame of spectrum_sense output mode "01" words
+**                (magnitude / index / threshold flag) is written to data.txt.
+**
+**                --duration (seconds, Ctrl-C ends early) switches to a continuous
+**                waterfall logger: magnitude frames are pulled back to back from
+**                a DMA ring, reduced to --bits (8 or 16) dB codes starting at
+**                --db-min in --db-step steps, optionally combined over --average
+**                frames per row (mean, or max with --peak), and written in
+**                chunks of --chunk rows with an index to --output. See
+**                waterfall.h for the format and waterfall-dump for a reader.
+**
 ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <signal.h>
 #include <time.h>
 #include <math.h>
 #include <unistd.h>
@@ -35,6 +47,76 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "frame-ring.h"
+#include "dma-debug-cnt.h"
+#include "stream-writer.h"
+#include "waterfall.h"
+#include "crash-wait.h"
+
+#define WATERFALL_DEFAULT_BUFFS   8
+#define WATERFALL_DEFAULT_DB_MIN  -90.0
+#define WATERFALL_DEFAULT_STEP_8  0.5         // -90 to +37.5 dB
+#define WATERFALL_DEFAULT_STEP_16 0.01
+#define WATERFALL_DEFAULT_CHUNK   64
+#define WATERFALL_BLOCK_SIZE      (1024*1024)
+#define WATERFALL_NUM_BLOCKS      8
+
+// Global variable used to end the waterfall logger early
+int loop_prog = 0;
+
+void ctrl_c(int dummy)
+{
+    loop_prog = 0;
+    return;
+}
+
+// Log magnitude frames until the duration is reached or Ctrl-C
+int log_waterfall(struct crash_plblock *usrp_intf, struct crash_plblock *spec_sense,
+                  uint number_samples, uint decim_rate, uint ring_buffs, double duration,
+                  struct waterfall *wf)
+{
+  struct frame_ring ring;
+  struct timespec start;
+  struct timespec now;
+  uint64_t dropped = 0;
+  uint32_t start_quantize;
+  float *fft_mag;
+  int ret = 0;
+
+  loop_prog = 1;
+  crash_set_bit(usrp_intf->regs, USRP_RX_ENABLE);                             // Enable RX
+  if (frame_ring_start(&ring, spec_sense, SPEC_SENSE_PLBLOCK_ID, ring_buffs, number_samples,
+                       decim_rate) != 0) {
+    crash_clear_bit(usrp_intf->regs, USRP_RX_ENABLE);                         // Disable RX
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (loop_prog == 1) {
+    fft_mag = (float *)frame_ring_next(&ring);
+    if (fft_mag == NULL) {
+      printf("TIMEOUT: No frames from DMA ring\n");
+      ret = -1;
+      break;
+    }
+    // Lower 32-bits of each word is the floating point magnitude
+    start_quantize = crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT);
+    if (waterfall_push_frame(wf, fft_mag, 2, (uint)(ring.dropped_frames - dropped)) == 1) {
+      printf(".");
+      fflush(stdout);
+    }
+    wf->quantize_cycles += dma_debug_cnt_delta(start_quantize,crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT));
+    dropped = ring.dropped_frames;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)/1e9 >= duration) {
+      break;
+    }
+  }
+  printf("\n");
+  crash_clear_bit(usrp_intf->regs, USRP_RX_ENABLE);                           // Disable RX
+  frame_ring_stop(&ring);
+  frame_ring_print_stats(&ring);
+  return ret;
+}
 
 int main (int argc, char **argv) {
   int c;
@@ -44,6 +126,18 @@ int main (int argc, char **argv) {
   uint number_samples = 0;
   uint decim_rate = 0;
   double gain = 0.0;
+  double duration = 0.0;
+  char *output_file = "waterfall.bin";
+  uint bits = 8;
+  float db_min = WATERFALL_DEFAULT_DB_MIN;
+  float db_step = 0.0;
+  uint frames_per_row = 1;
+  uint row_mode = WATERFALL_ROW_MEAN;
+  uint rows_per_chunk = WATERFALL_DEFAULT_CHUNK;
+  uint ring_buffs = WATERFALL_DEFAULT_BUFFS;
+  bool direct = false;
+  struct stream_writer writer;
+  struct waterfall wf;
   struct crash_plblock *usrp_intf;
   struct crash_plblock *spec_sense;
 
@@ -55,12 +149,22 @@ int main (int argc, char **argv) {
       {"interrupt",   no_argument,       0, 'i'},
       {"fft size",    required_argument, 0, 'k'},
       {"decim",       required_argument, 0, 'd'},
+      {"duration",    required_argument, 0, 'T'},
+      {"output",      required_argument, 0, 'o'},
+      {"bits",        required_argument, 0, 'b'},
+      {"db-min",      required_argument, 0, 'm'},
+      {"db-step",     required_argument, 0, 's'},
+      {"average",     required_argument, 0, 'a'},
+      {"peak",        no_argument,       0, 'p'},
+      {"chunk",       required_argument, 0, 'c'},
+      {"ring",        required_argument, 0, 'r'},
+      {"direct",      no_argument,       0, 'D'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "ik:d:",
+    c = getopt_long (argc, argv, "ik:d:T:o:b:m:s:a:pc:r:D",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -75,6 +179,36 @@ int main (int argc, char **argv) {
       case 'd':
         decim_rate = atoi(optarg);
         break;
+      case 'T':
+        duration = atof(optarg);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'b':
+        bits = atoi(optarg);
+        break;
+      case 'm':
+        db_min = atof(optarg);
+        break;
+      case 's':
+        db_step = atof(optarg);
+        break;
+      case 'a':
+        frames_per_row = atoi(optarg);
+        break;
+      case 'p':
+        row_mode = WATERFALL_ROW_PEAK;
+        break;
+      case 'c':
+        rows_per_chunk = atoi(optarg);
+        break;
+      case 'r':
+        ring_buffs = atoi(optarg);
+        break;
+      case 'D':
+        direct = true;
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -116,6 +250,9 @@ int main (int argc, char **argv) {
 
   number_samples = (uint)pow(2.0,(double)fft_size);
 
+  if (db_step == 0.0) {
+    db_step = (bits == 16) ? WATERFALL_DEFAULT_STEP_16 : WATERFALL_DEFAULT_STEP_8;
+  }
 
   usrp_intf = crash_open(USRP_INTF_PLBLOCK_ID,READ);
   if (usrp_intf == 0) {
@@ -140,28 +277,28 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   crash_write_reg(usrp_intf->regs, USRP_AXIS_MASTER_TDEST, SPEC_SENSE_PLBLOCK_ID);  // Set tdest to spectrum sense block
   crash_write_reg(usrp_intf->regs, USRP_RX_PACKET_SIZE, number_samples);            // Set packet size
@@ -202,6 +339,31 @@ int main (int argc, char **argv) {
   crash_write_reg(spec_sense->regs, SPEC_SENSE_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);  // Set destination of FFT output to DMA plblock
   crash_set_bit(spec_sense->regs, SPEC_SENSE_ENABLE_FFT);                           // Enable FFT
 
+  if (duration > 0.0) {
+    if (stream_writer_open(&writer, output_file, WATERFALL_BLOCK_SIZE, WATERFALL_NUM_BLOCKS,
+                           direct) != 0) {
+      crash_close(spec_sense);
+      crash_close(usrp_intf);
+      return -1;
+    }
+    if (waterfall_open(&wf, &writer, number_samples, decim_rate, bits, db_min, db_step,
+                       row_mode, frames_per_row, rows_per_chunk) != 0) {
+      stream_writer_close(&writer);
+      crash_close(spec_sense);
+      crash_close(usrp_intf);
+      return -1;
+    }
+    signal(SIGINT, ctrl_c);
+    log_waterfall(usrp_intf, spec_sense, number_samples, decim_rate, ring_buffs, duration, &wf);
+    waterfall_close(&wf);
+    stream_writer_close(&writer);
+    stream_writer_print_stats(&writer);
+    waterfall_print_stats(&wf);
+    crash_close(spec_sense);
+    crash_close(usrp_intf);
+    return 0;
+  }
+
   crash_set_bit(usrp_intf->regs, USRP_RX_ENABLE);                             // Enable RX
 
   // Read from spectrum sensing plblock
@@ -18,11 +18,31 @@
 **  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
 **  Description:  Record data from CRASH
 **
+**                By default one frame of --samples samples is written to data.txt.
+**
+**                --duration (seconds) or --total (samples) switches to a continuous
+**                streaming capture: the DMA runs on a ring of --ring buffers and a
+**                writer thread saves the frames to --output in large aligned
+**                blocks (--block-size KB, --blocks, --direct for O_DIRECT). DMA
+**                frame drops, writer overruns and the sustained MB/s are reported.
+**                Ctrl-C ends the capture early.
+**
+**                --raw records the ADC directly (RX_ADC_RAW_MODE, fix2float
+**                bypassed). --compress then encodes each frame inline with the
+**                lossless raw-codec (--delta adds delta encoding) so long
+**                recordings need less than half the storage bandwidth. Use
+**                raw-decode on the host to unpack the file.
+**
+**                --format q15 receives packed 16-bit I/Q samples (see
+**                sample-format.h), int16 I, Q per sample, which halves the DMA
+**                and storage bandwidth. Not available with --compress.
+**
 ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <signal.h>
 #include <time.h>
 #include <math.h>
 #include <unistd.h>
@@ -35,6 +55,82 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "frame-ring.h"
+#include "dma-debug-cnt.h"
+#include "stream-writer.h"
+#include "raw-codec.h"
+#include "crash-wait.h"
+#include "sample-format.h"
+
+#define STREAM_DEFAULT_BUFFS      8
+#define STREAM_DEFAULT_BLOCK_KB   1024
+#define STREAM_DEFAULT_BLOCKS     16
+
+// Global variable used to end a streaming capture early
+int loop_prog = 0;
+
+void ctrl_c(int dummy)
+{
+    loop_prog = 0;
+    return;
+}
+
+// Capture frames back to back until the duration / sample count is reached or Ctrl-C
+// number_words is the frame size in 64-bit DMA words, samples_per_word is 2 for packed Q15
+int stream_samples(struct crash_plblock *usrp_intf, uint number_words, uint samples_per_word,
+                   uint decim_rate, uint ring_buffs, double duration, uint64_t total_samples,
+                   struct stream_writer *writer, struct raw_codec *codec, uint8_t *encoded)
+{
+  struct frame_ring ring;
+  uint32_t start_encode;
+  size_t len;
+  struct timespec start;
+  struct timespec now;
+  uint64_t samples = 0;
+  void *buff;
+  int ret = 0;
+
+  loop_prog = 1;
+  crash_set_bit(usrp_intf->regs, USRP_RX_ENABLE);                             // Enable RX
+  // Packed frames are fewer words, scale the decimation so the expected frame rate
+  // stays the same
+  if (frame_ring_start(&ring, usrp_intf, USRP_INTF_PLBLOCK_ID, ring_buffs, number_words,
+                       decim_rate*samples_per_word) != 0) {
+    crash_clear_bit(usrp_intf->regs, USRP_RX_ENABLE);                         // Disable RX
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (loop_prog == 1) {
+    buff = frame_ring_next(&ring);
+    if (buff == NULL) {
+      printf("TIMEOUT: No frames from DMA ring\n");
+      ret = -1;
+      break;
+    }
+    if (codec != NULL) {
+      start_encode = crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT);
+      len = raw_codec_encode(codec, (int32_t *)buff, 2*number_words, ring.seq, encoded);
+      codec->encode_cycles += dma_debug_cnt_delta(start_encode,crash_read_reg(usrp_intf->regs,DMA_DEBUG_CNT));
+      stream_writer_append(writer, encoded, len);
+    } else {
+      stream_writer_append(writer, buff, number_words*sizeof(uint64_t));
+    }
+    samples += number_words*samples_per_word;
+    if (total_samples > 0 && samples >= total_samples) {
+      break;
+    }
+    if (duration > 0.0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)/1e9 >= duration) {
+        break;
+      }
+    }
+  }
+  crash_clear_bit(usrp_intf->regs, USRP_RX_ENABLE);                           // Disable RX
+  frame_ring_stop(&ring);
+  frame_ring_print_stats(&ring);
+  return ret;
+}
 
 int main (int argc, char **argv) {
   int c;
@@ -43,6 +139,25 @@ int main (int argc, char **argv) {
   uint number_samples = 0;
   uint decim_rate = 0;
   double gain = 0.0;
+  double duration = 0.0;
+  uint64_t total_samples = 0;
+  char *output_file = "data.txt";
+  bool direct = false;
+  uint ring_buffs = 0;
+  uint block_kb = 0;
+  uint num_blocks = 0;
+  bool stream = false;
+  bool raw = false;
+  bool compress = false;
+  uint codec_flags = 0;
+  int format = SAMPLE_FORMAT_FLOAT;
+  uint rx_format = SAMPLE_FORMAT_FLOAT;
+  uint samples_per_word = 1;
+  uint number_words = 0;
+  struct raw_codec codec;
+  struct raw_codec_file_header file_header;
+  uint8_t *encoded = NULL;
+  struct stream_writer writer;
   struct crash_plblock *usrp_intf;
 
   // Parse command line arguments
@@ -53,12 +168,23 @@ int main (int argc, char **argv) {
       {"interrupt",   no_argument,       0, 'i'},
       {"samples",     required_argument, 0, 'n'},
       {"decim",       required_argument, 0, 'd'},
+      {"duration",    required_argument, 0, 'T'},
+      {"total",       required_argument, 0, 'N'},
+      {"output",      required_argument, 0, 'o'},
+      {"direct",      no_argument,       0, 'D'},
+      {"ring",        required_argument, 0, 'r'},
+      {"block-size",  required_argument, 0, 'b'},
+      {"blocks",      required_argument, 0, 'B'},
+      {"raw",         no_argument,       0, 'R'},
+      {"compress",    no_argument,       0, 'z'},
+      {"delta",       no_argument,       0, 'e'},
+      {"format",      required_argument, 0, 'f'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "in:d:",
+    c = getopt_long (argc, argv, "in:d:T:N:o:Dr:b:B:Rzef:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -73,6 +199,40 @@ int main (int argc, char **argv) {
       case 'd':
         decim_rate = atoi(optarg);
         break;
+      case 'T':
+        duration = atof(optarg);
+        break;
+      case 'N':
+        total_samples = strtoull(optarg, NULL, 0);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'D':
+        direct = true;
+        break;
+      case 'r':
+        ring_buffs = atoi(optarg);
+        break;
+      case 'b':
+        block_kb = atoi(optarg);
+        break;
+      case 'B':
+        num_blocks = atoi(optarg);
+        break;
+      case 'R':
+        raw = true;
+        break;
+      case 'z':
+        compress = true;
+        break;
+      case 'e':
+        compress = true;
+        codec_flags |= RAW_CODEC_FLAG_DELTA;
+        break;
+      case 'f':
+        format = sample_format_lookup(optarg);
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -106,6 +266,39 @@ int main (int argc, char **argv) {
     return -1;
   }
 
+  stream = (duration > 0.0 || total_samples > 0);
+  if (stream) {
+    if (ring_buffs == 0) {
+      printf("INFO: Ring size not specified, defaulting to %d buffers\n",STREAM_DEFAULT_BUFFS);
+      ring_buffs = STREAM_DEFAULT_BUFFS;
+    }
+    if (ring_buffs < FRAME_RING_MIN_BUFFS) {
+      printf("ERROR: Ring needs at least %d buffers\n",FRAME_RING_MIN_BUFFS);
+      return -1;
+    }
+    if (block_kb == 0) {
+      block_kb = STREAM_DEFAULT_BLOCK_KB;
+    }
+    if (num_blocks == 0) {
+      num_blocks = STREAM_DEFAULT_BLOCKS;
+    }
+  }
+
+  if (compress && !(stream && raw)) {
+    printf("ERROR: Compression needs a streaming (--duration / --total) --raw capture\n");
+    return -1;
+  }
+
+  if (format < 0) {
+    printf("ERROR: Invalid sample format, must be float or q15\n");
+    return -1;
+  }
+
+  if (format == SAMPLE_FORMAT_Q15 && (compress || (number_samples % 2) != 0)) {
+    printf("ERROR: Q15 samples need an even number of samples and cannot be compressed\n");
+    return -1;
+  }
+
 
   usrp_intf = crash_open(USRP_INTF_PLBLOCK_ID,READ);
   if (usrp_intf == 0) {
@@ -123,31 +316,41 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
   crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-  while(crash_get_bit(usrp_intf->regs,USRP_UART_BUSY));
-  crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DC_OFF_MODE);
-  while(crash_get_bit(usrp_intf->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  if (raw) {
+    crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_RAW_MODE);
+  } else {
+    crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DC_OFF_MODE);
+  }
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   crash_write_reg(usrp_intf->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);   // Set tdest to ps_pl_interface
-  crash_write_reg(usrp_intf->regs, USRP_RX_PACKET_SIZE, number_samples);      // Set packet size
-  crash_clear_bit(usrp_intf->regs, USRP_RX_FIX2FLOAT_BYPASS);                 // Do not bypass fix2float
+  rx_format = sample_format_set(usrp_intf, format);                           // Float or packed Q15 samples
+  if (raw && rx_format == SAMPLE_FORMAT_FLOAT) {
+    crash_set_bit(usrp_intf->regs, USRP_RX_FIX2FLOAT_BYPASS);                 // Keep raw fixed point samples
+  }
+  samples_per_word = sample_format_samples_per_word(rx_format);
+  number_words = number_samples/samples_per_word;
+  crash_write_reg(usrp_intf->regs, USRP_RX_PACKET_SIZE, number_words);        // Set packet size
+  printf("Sample Format: %s\n",sample_format_names[rx_format]);
   if (decim_rate == 1) {
     crash_set_bit(usrp_intf->regs, USRP_RX_CIC_BYPASS);                       // Bypass CIC Filter
     crash_set_bit(usrp_intf->regs, USRP_RX_HB_BYPASS);                        // Bypass HB Filter
@@ -177,27 +380,64 @@ int main (int argc, char **argv) {
     crash_write_reg(usrp_intf->regs, USRP_RX_GAIN, (uint32_t)gain);           // Set gain
   }
 
+  if (stream) {
+    if (stream_writer_open(&writer, output_file, (size_t)block_kb*1024, num_blocks, direct) != 0) {
+      crash_close(usrp_intf);
+      return -1;
+    }
+    if (compress) {
+      encoded = (uint8_t *)malloc(raw_codec_max_block_bytes(2*number_samples));
+      if (encoded == NULL || raw_codec_init(&codec, codec_flags, 2*number_samples) != 0) {
+        printf("ERROR: Failed to allocate codec buffers\n");
+        free(encoded);
+        stream_writer_close(&writer);
+        crash_close(usrp_intf);
+        return -1;
+      }
+      raw_codec_file_header_init(&file_header, codec_flags, decim_rate, RX_ADC_RAW_MODE);
+      stream_writer_append(&writer, &file_header, sizeof(file_header));
+    }
+    signal(SIGINT, ctrl_c);
+    stream_samples(usrp_intf, number_words, samples_per_word, decim_rate, ring_buffs, duration, total_samples,
+                   &writer, compress ? &codec : NULL, encoded);
+    stream_writer_close(&writer);
+    stream_writer_print_stats(&writer);
+    if (compress) {
+      raw_codec_print_stats(&codec, number_samples, decim_rate);
+      raw_codec_free(&codec);
+      free(encoded);
+    }
+    printf("Input Rate (MB/s):\t\t%f\n",100e6/decim_rate*sizeof(uint64_t)/samples_per_word/1e6);
+    crash_close(usrp_intf);
+    return 0;
+  }
+
   crash_set_bit(usrp_intf->regs, USRP_RX_ENABLE);                             // Enable RX
 
   // Read from usrp_intf
-  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_samples);
-  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_samples);
-  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_samples);
-  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_samples);
+  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_words);
+  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_words);
+  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_words);
+  crash_read(usrp_intf, USRP_INTF_PLBLOCK_ID, number_words);
 
   crash_clear_bit(usrp_intf->regs, USRP_RX_ENABLE);                           // Disable RX
 
   float *sample = (float*)(usrp_intf->dma_buff);
+  int16_t *packed = (int16_t*)(usrp_intf->dma_buff);
 
   printf("I:\tQ:\n");
   for (i = 32; i < 63; i++) {
-    printf("%f\t%f\n",(sample[2*i+1]), (sample[2*i]));
+    if (rx_format == SAMPLE_FORMAT_Q15) {
+      printf("%d\t%d\n",packed[2*i], packed[2*i+1]);
+    } else {
+      printf("%f\t%f\n",(sample[2*i+1]), (sample[2*i]));
+    }
   }
 
   // Write number_samples complex samples to file
   FILE *fp = 0;
-  fp = fopen("data.txt","w");
-  fwrite(sample,number_samples,sizeof(uint64_t),fp);
+  fp = fopen(output_file,"w");
+  fwrite(sample,number_words,sizeof(uint64_t),fp);
   fclose(fp);
 
   crash_close(usrp_intf);
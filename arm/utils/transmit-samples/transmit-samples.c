@@ -18,11 +18,21 @@
 **  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
 **  Description:  Transmit data via CRASH
 **
+**                By default --samples samples of a constant 0.9 + j0 are sent once.
+**
+**                --file replays a waveform file of interleaved float I/Q samples
+**                (the record-samples data.txt layout) of any size. The file is
+**                mmap'd a window at a time with sequential read-ahead and copied
+**                into a ring of --ring MM2S transfers of --samples samples each,
+**                which are kept queued so the DAC does not run dry. --loop
+**                repeats the file until Ctrl-C. Underruns are reported.
+**
 ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <signal.h>
 #include <time.h>
 #include <math.h>
 #include <unistd.h>
@@ -35,6 +45,79 @@
 #include <getopt.h>
 #include <crash-kmod.h>
 #include <libcrash.h>
+#include "tx-ring.h"
+#include "file-source.h"
+#include "crash-wait.h"
+#include "iq-kernels.h"
+
+#define TX_DEFAULT_BUFFS          8
+
+// Global variable used to end a file replay early
+int loop_prog = 0;
+
+void ctrl_c(int dummy)
+{
+    loop_prog = 0;
+    return;
+}
+
+// Keep the MM2S ring full from the waveform file until it ends or Ctrl-C
+int stream_file(struct crash_plblock *usrp_intf, uint number_samples, uint interp_rate,
+                uint ring_buffs, struct file_source *src)
+{
+  struct tx_ring ring;
+  size_t frame_bytes = number_samples*sizeof(uint64_t);
+  ssize_t len;
+  void *buff;
+  bool tx_enabled = false;
+  int ret = 0;
+
+  if (tx_ring_start(&ring, usrp_intf, USRP_INTF_PLBLOCK_ID, ring_buffs, number_samples,
+                    interp_rate) != 0) {
+    return -1;
+  }
+  loop_prog = 1;
+  while (loop_prog == 1) {
+    buff = tx_ring_next(&ring);
+    if (buff == NULL) {
+      printf("TIMEOUT: No MM2S transfers completed\n");
+      ret = -1;
+      break;
+    }
+    len = file_source_read(src, buff, frame_bytes);
+    if (len < 0) {
+      ret = -1;
+      break;
+    }
+    if (len == 0) {
+      break;
+    }
+    // Pad the last partial frame with zeros
+    if ((size_t)len < frame_bytes) {
+      memset((char *)buff + len, 0, frame_bytes - len);
+    }
+    tx_ring_submit(&ring);
+    // Enable TX once the whole ring is queued, so the DAC starts with the most slack
+    if (!tx_enabled && ring.queued == ring_buffs) {
+      crash_set_bit(usrp_intf->regs, USRP_TX_ENABLE);                       // Enable TX
+      tx_enabled = true;
+    }
+    if ((size_t)len < frame_bytes) {
+      break;
+    }
+  }
+  if (!tx_enabled) {
+    crash_set_bit(usrp_intf->regs, USRP_TX_ENABLE);                         // Enable TX
+  }
+  if (tx_ring_drain(&ring) != 0) {
+    printf("TIMEOUT: MM2S transfers did not complete\n");
+    ret = -1;
+  }
+  crash_clear_bit(usrp_intf->regs, USRP_TX_ENABLE);                         // Disable TX
+  tx_ring_stop(&ring);
+  tx_ring_print_stats(&ring);
+  return ret;
+}
 
 int main (int argc, char **argv) {
   int c;
@@ -43,6 +126,10 @@ int main (int argc, char **argv) {
   uint number_samples = 0;
   uint interp_rate = 0;
   double gain = 0.0;
+  char *input_file = NULL;
+  bool loop = false;
+  uint ring_buffs = TX_DEFAULT_BUFFS;
+  struct file_source src;
   struct crash_plblock *usrp_intf;
 
   // Parse command line arguments
@@ -53,12 +140,15 @@ int main (int argc, char **argv) {
       {"interrupt",   no_argument,       0, 'i'},
       {"samples",     required_argument, 0, 'n'},
       {"interp",      required_argument, 0, 'u'},
+      {"file",        required_argument, 0, 'f'},
+      {"loop",        no_argument,       0, 'l'},
+      {"ring",        required_argument, 0, 'r'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
     // 'n' is the short option, ':' means it requires an argument
-    c = getopt_long (argc, argv, "in:u:",
+    c = getopt_long (argc, argv, "in:u:f:lr:",
                      long_options, &option_index);
     /* Detect the end of the options. */
     if (c == -1) break;
@@ -73,6 +163,15 @@ int main (int argc, char **argv) {
       case 'u':
         interp_rate = atoi(optarg);
         break;
+      case 'f':
+        input_file = optarg;
+        break;
+      case 'l':
+        loop = true;
+        break;
+      case 'r':
+        ring_buffs = atoi(optarg);
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -123,28 +222,28 @@ int main (int argc, char **argv) {
   // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
   // as the next steps recalibrate the interface and are ignored if issued while it is
   // currently calibrating.
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set RX phase
   crash_write_reg(usrp_intf->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_RX_RESET_CAL);
   printf("RX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_RX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_RX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set TX phase
   crash_write_reg(usrp_intf->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
   crash_set_bit(usrp_intf->regs,USRP_TX_RESET_CAL);
   printf("TX PHASE INIT: %d\n",crash_read_reg(usrp_intf->regs,USRP_TX_PHASE_INIT));
-  while(!crash_get_bit(usrp_intf->regs,USRP_TX_CAL_COMPLETE));
+  crash_wait_bit(usrp_intf,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
 
   // Set USRP Mode
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
-  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
-  while(crash_get_bit(usrp_intf_tx->regs,USRP_UART_BUSY));
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_DAC_RAW_MODE);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_ADC_DSP_MODE);
+  crash_wait_bit(usrp_intf,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
 
   crash_clear_bit(usrp_intf->regs, USRP_TX_FIX2FLOAT_BYPASS);                 // Do not bypass fix2float
   if (interp_rate == 1) {
@@ -173,15 +272,26 @@ int main (int argc, char **argv) {
     //
     gain = 20.0-2.0*log2(interp_rate);
     gain = (gain > 1.0) ? (ceil(pow(2.0,gain))) : (1.0);                      // Do not allow gain to be set to 0
-    crash_write_reg(usrp_intf->regs, USRP_RX_GAIN, (uint32_t)gain);           // Set gain
+    crash_write_reg(usrp_intf->regs, USRP_TX_GAIN, (uint32_t)gain);           // Set gain
+  }
+
+  if (input_file != NULL) {
+    if (file_source_open(&src, input_file, FILE_SOURCE_DEFAULT_WINDOW,
+                         FILE_SOURCE_DEFAULT_READAHEAD, loop) != 0) {
+      crash_close(usrp_intf);
+      return -1;
+    }
+    signal(SIGINT, ctrl_c);
+    stream_file(usrp_intf, number_samples, interp_rate, ring_buffs, &src);
+    file_source_print_stats(&src);
+    file_source_close(&src);
+    crash_close(usrp_intf);
+    return 0;
   }
 
     // Create and Send a CW signal
   float *tx_sample = (float *)usrp_intf->dma_buff;
-  for (i = 0; i < number_samples; i++) {
-    tx_sample[2*i+1] = 0.0;
-    tx_sample[2*i] = 0.9;
-  }
+  iq_fill(tx_sample, number_samples, 0.9, 0.0);
 
   // Read from usrp_intf
   crash_write(usrp_intf, USRP_INTF_PLBLOCK_ID, number_samples);
@@ -0,0 +1,761 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         turnaround.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Measure sense-to-transmit turnaround of every spectrum sensing /
+**                decision strategy with the USRP looping TX back into RX, so no
+**                signal generator or scope is needed.
+**
+**                The USRP is put in RX_TX_LOOPBACK_MODE: RX sees the TX waveform
+**                while TX is enabled and nothing otherwise. Each trial turns a
+**                CW burst on with USRP_TX_ENABLE, waits for the strategy to
+**                detect it, turns it off and waits for the strategy to see the
+**                channel clear and transmit. Timestamps are DMA_DEBUG_CNT, read
+**                right after each register write:
+**                  - Detect:     burst on -> threshold exceeded
+**                  - Turnaround: burst off -> TX enabled in response
+**
+**                Strategies:
+**                  fpga            FFT and threshold in the FPGA, TX through the
+**                                  NOT_THRESH sideband. The response is taken as
+**                                  the moment THRESHOLD_EXCEEDED drops, which is
+**                                  when the sideband enables TX.
+**                  arm-decision    FFT in the FPGA, NEON magnitude compare on the
+**                                  ARM (arm-spectrum-decision)
+**                  arm-flags       FFT and threshold in the FPGA, NEON scan of the
+**                                  flags (arm-spectrum-decision-no-thresholding)
+**                  arm-sensing     FFTW and the original sqrt kernel on the ARM
+**                                  (arm-spectrum-sensing)
+**                  arm-sensing-opt FFTW and the --kernel threshold kernel, squared
+**                                  magnitudes by default (arm-spectrum-sensing-opt)
+**
+**                --mask file checks only the masked bins in every strategy that
+**                decides on the ARM, as the tools do. --cfar ca|os (--guard, --ref,
+**                --alpha, --os-rank) replaces the fixed threshold of arm-decision.
+**
+**                TX_RX_LOOPBACK_MODE is not used, it sends RX to the DAC so the
+**                response transmit would not be seen by RX.
+**
+**                A trial that does not complete within TRIAL_TIMEOUT_CYCLES is
+**                counted as a miss. Before each trial the strategy must see a
+**                clear channel, so the previous response does not leak into it.
+**
+**                Results are printed as a table and written as CSV, one row per
+**                strategy x FFT size x decimation rate point. --latency also
+**                writes the full histograms.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <string.h>
+#include <getopt.h>
+#include <arm_neon.h>
+#include <fftw3.h>
+#include <crash-kmod.h>
+#include <libcrash.h>
+#include "crash-wait.h"
+#include "dma-debug-cnt.h"
+#include "fft-plan-cache.h"
+#include "threshold-kernels.h"
+#include "latency-hist.h"
+#include "cfar.h"
+#include "spectral-mask.h"
+#include "sweep.h"
+
+#define MAX_SWEEP                 16
+#define MAX_POINTS                (NUM_STRATEGIES*MAX_SWEEP*MAX_SWEEP)
+#define DEFAULT_TRIALS            100
+#define TRIAL_TIMEOUT_CYCLES      75000000    // 0.5 seconds of DMA_DEBUG_CNT
+#define TRIAL_GAP_US              1000
+
+#define STRATEGY_FPGA             0
+#define STRATEGY_ARM_DECISION     1
+#define STRATEGY_ARM_FLAGS        2
+#define STRATEGY_ARM_SENSING      3
+#define STRATEGY_ARM_SENSING_OPT  4
+
+static const char *strategy_names[] = {
+  "fpga",
+  "arm-decision",
+  "arm-flags",
+  "arm-sensing",
+  "arm-sensing-opt",
+};
+#define NUM_STRATEGIES (sizeof(strategy_names)/sizeof(strategy_names[0]))
+
+struct turnaround {
+  int strategy;
+  uint fft_size;                  // log2
+  uint number_samples;
+  uint decim_rate;
+  float threshold;
+  threshold_kernel_t kernel;      // arm-sensing(-opt)
+  struct cfar *cfar;              // arm-decision, NULL for the fixed threshold
+  struct spectral_mask *mask;     // NULL to check every bin
+  struct crash_plblock *usrp_intf_tx;
+  struct crash_plblock *usrp_intf_rx;
+  struct crash_plblock *spec_sense;
+  fftwf_plan plan;
+  fftwf_complex *out;
+  uint misses;
+  struct latency_hist detect_hist;
+  struct latency_hist turnaround_hist;
+  char detect_name[64];
+  char turnaround_name[64];
+};
+
+// Global variable used to stop the sweep after the current trial
+int loop_prog = 1;
+
+void ctrl_c(int dummy)
+{
+    loop_prog = 0;
+    return;
+}
+
+// Reset, calibrate and set up the loopback for one sweep point, then enable RX.
+// TX is left disabled.
+void turnaround_setup(struct turnaround *ta)
+{
+  struct crash_plblock *usrp_intf_tx = ta->usrp_intf_tx;
+  struct crash_plblock *spec_sense = ta->spec_sense;
+  uint decim_rate = ta->decim_rate;
+  uint32_t temp_int;
+  double gain;
+  float *tx_sample;
+  uint i;
+
+  // Global Reset to get us to a clean slate
+  crash_reset(usrp_intf_tx);
+
+  // Wait for USRP DDR interface to finish calibrating (due to reset). This is necessary
+  // as the next steps recalibrate the interface and are ignored if issued while it is
+  // currently calibrating.
+  crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+
+  // Set RX phase
+  crash_write_reg(usrp_intf_tx->regs,USRP_RX_PHASE_INIT,RX_PHASE_CAL);
+  crash_set_bit(usrp_intf_tx->regs,USRP_RX_RESET_CAL);
+  crash_wait_bit(usrp_intf_tx,USRP_RX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+
+  // Set TX phase
+  crash_write_reg(usrp_intf_tx->regs,USRP_TX_PHASE_INIT,TX_PHASE_CAL);
+  crash_set_bit(usrp_intf_tx->regs,USRP_TX_RESET_CAL);
+  crash_wait_bit(usrp_intf_tx,USRP_TX_CAL_COMPLETE,1,CRASH_WAIT_FOREVER);
+
+  // Set USRP TX / RX Modes, RX sees whatever we transmit
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_TX_MODE + TX_PASSTHRU_MODE);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+  crash_write_reg(usrp_intf_tx->regs,USRP_USRP_MODE_CTRL,CMD_RX_MODE + RX_TX_LOOPBACK_MODE);
+  crash_wait_bit(usrp_intf_tx,USRP_UART_BUSY,0,CRASH_WAIT_FOREVER);
+
+  // Setup RX path
+  crash_set_bit(usrp_intf_tx->regs, USRP_RX_FIFO_BYPASS);                       // Bypass RX FIFO so stale data in the FIFO does not cause latency
+  if (ta->strategy == STRATEGY_ARM_SENSING || ta->strategy == STRATEGY_ARM_SENSING_OPT) {
+    crash_write_reg(usrp_intf_tx->regs, USRP_AXIS_MASTER_TDEST, DMA_PLBLOCK_ID);   // Set tdest to ps_pl_interface
+  } else {
+    crash_write_reg(usrp_intf_tx->regs, USRP_AXIS_MASTER_TDEST, SPEC_SENSE_PLBLOCK_ID);  // Set tdest to spec_sense
+  }
+  crash_write_reg(usrp_intf_tx->regs, USRP_RX_PACKET_SIZE, ta->number_samples);  // Set packet size
+  crash_clear_bit(usrp_intf_tx->regs, USRP_RX_FIX2FLOAT_BYPASS);                // Do not bypass fix2float
+  if (decim_rate == 1) {
+    crash_set_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                      // Bypass CIC Filter
+    crash_set_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                       // Bypass HB Filter
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_GAIN, 1);                       // Set gain = 1
+  } else if (decim_rate == 2) {
+    crash_set_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                      // Bypass CIC Filter
+    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                     // Enable HB Filter
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_GAIN, 1);                       // Set gain = 1
+  // Even, use both CIC and Halfband filters
+  } else if ((decim_rate % 2) == 0) {
+    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                    // Enable CIC Filter
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_CIC_DECIM, decim_rate/2);       // Set CIC decimation rate (div by 2 as we are using HB filter)
+    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                     // Enable HB Filter
+    // Offset CIC bit growth. A 32-bit multiplier in the receive chain allows us
+    // to scale the CIC output.
+    gain = 26.0-3.0*log2(decim_rate/2);
+    gain = (gain > 1.0) ? (ceil(pow(2.0,gain))) : (1.0);                        // Do not allow gain to be set to 0
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_GAIN, (uint32_t)gain);          // Set gain
+  // Odd, use only CIC filter
+  } else {
+    crash_clear_bit(usrp_intf_tx->regs, USRP_RX_CIC_BYPASS);                    // Enable CIC Filter
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_CIC_DECIM, decim_rate);         // Set CIC decimation rate
+    crash_set_bit(usrp_intf_tx->regs, USRP_RX_HB_BYPASS);                       // Bypass HB Filter
+    //
+    gain = 26.0-3.0*log2(decim_rate);
+    gain = (gain > 1.0) ? (ceil(pow(2.0,gain))) : (1.0);                        // Do not allow gain to be set to 0
+    crash_write_reg(usrp_intf_tx->regs, USRP_RX_GAIN, (uint32_t)gain);          // Set gain
+  }
+
+  // Setup TX path
+  crash_clear_bit(usrp_intf_tx->regs, USRP_TX_FIX2FLOAT_BYPASS);                // Do not bypass fix2float
+  crash_set_bit(usrp_intf_tx->regs, USRP_TX_CIC_BYPASS);                        // Bypass CIC Filter
+  crash_set_bit(usrp_intf_tx->regs, USRP_TX_HB_BYPASS);                         // Bypass HB Filter
+  crash_write_reg(usrp_intf_tx->regs, USRP_TX_GAIN, 1);                         // Set gain = 1
+
+  // Create a CW signal to transmit, used for both the burst and the response
+  tx_sample = (float*)(usrp_intf_tx->dma_buff);
+  for (i = 0; i < 4095; i++) {
+    tx_sample[2*i+1] = 0;
+    tx_sample[2*i] = 0.5;
+  }
+  tx_sample[2*4095+1] = 0;
+  tx_sample[2*4095] = 0;
+
+  // Load waveform into TX FIFO so it can immediately trigger
+  crash_write(usrp_intf_tx, USRP_INTF_PLBLOCK_ID, 4096);
+
+  // Setup Spectrum Sense
+  if (ta->strategy != STRATEGY_ARM_SENSING && ta->strategy != STRATEGY_ARM_SENSING_OPT) {
+    crash_write_reg(spec_sense->regs,SPEC_SENSE_AXIS_MASTER_TDEST,DMA_PLBLOCK_ID);  // Set Spectrum Sense block output destimation
+    if (ta->strategy == STRATEGY_FPGA) {
+      crash_write_reg(spec_sense->regs,SPEC_SENSE_OUTPUT_MODE,3);               // Throw away FFT output
+    } else {
+      crash_write_reg(spec_sense->regs,SPEC_SENSE_OUTPUT_MODE,1);               // FFT Magnitude Data
+    }
+    crash_write_reg(spec_sense->regs,SPEC_SENSE_AXIS_CONFIG_TDATA,ta->fft_size);  // FFT Size
+    crash_set_bit(spec_sense->regs,SPEC_SENSE_AXIS_CONFIG_TVALID);              // FFT Size Enable
+    crash_set_bit(spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                      // Enable FFT
+    crash_clear_bit(spec_sense->regs,SPEC_SENSE_AXIS_CONFIG_TVALID);
+    crash_set_bit(spec_sense->regs,SPEC_SENSE_ENABLE_NOT_THRESH_SIDEBAND);      // Enable sideband threshold NOT exceeded output (to trigger TX)
+    memcpy(&temp_int,&ta->threshold,sizeof(float));                             // Copy float value to an int without a cast
+    crash_write_reg(spec_sense->regs,SPEC_SENSE_THRESHOLD,temp_int);            // Threshold level in single precision floating point
+    crash_set_bit(spec_sense->regs,SPEC_SENSE_CLEAR_THRESHOLD_LATCHED);         // Threshold exceeded follows the current frame
+  }
+
+  crash_set_bit(usrp_intf_tx->regs,USRP_RX_ENABLE);                             // Enable RX
+}
+
+void turnaround_cleanup(struct turnaround *ta)
+{
+  crash_clear_bit(ta->usrp_intf_tx->regs,USRP_TX_ENABLE_SIDEBAND);              // Disable TX Sideband
+  crash_clear_bit(ta->usrp_intf_tx->regs,USRP_TX_ENABLE);                       // Disable TX
+  crash_clear_bit(ta->usrp_intf_tx->regs,USRP_RX_ENABLE);                       // Disable RX
+  if (ta->strategy != STRATEGY_ARM_SENSING && ta->strategy != STRATEGY_ARM_SENSING_OPT) {
+    crash_clear_bit(ta->spec_sense->regs,SPEC_SENSE_ENABLE_FFT);                // Disable FFT
+  }
+}
+
+// Read one frame and decide on it the way the strategy's tool does. Returns 1 if the
+// threshold was exceeded.
+int turnaround_decide(struct turnaround *ta)
+{
+  float *fft_data;
+  uint32_t *flags;
+  float32x4_t floats;
+  float32x4_t thresholds;
+  uint32x4_t integers;
+  uint32x4_t flag_thresholds;
+  uint32x4_t compares;
+  uint i;
+
+  switch (ta->strategy) {
+    case STRATEGY_FPGA:
+      return crash_get_bit(ta->spec_sense->regs,SPEC_SENSE_THRESHOLD_EXCEEDED);
+    case STRATEGY_ARM_DECISION:
+      crash_read(ta->spec_sense, SPEC_SENSE_PLBLOCK_ID, ta->number_samples);
+      // Lower 32-bits of 64-bit AXI xfer is FFT magnitude data
+      fft_data = (float *)ta->spec_sense->dma_buff;
+      if (ta->cfar != NULL) {
+        return cfar_detect(ta->cfar, fft_data, 2, NULL, NULL) >= 0;
+      }
+      if (ta->mask != NULL) {
+        return spectral_mask_mag(ta->mask, fft_data, 2, ta->threshold, NULL) >= 0;
+      }
+      thresholds[0] = ta->threshold;
+      thresholds[1] = ta->threshold;
+      thresholds[2] = ta->threshold;
+      thresholds[3] = ta->threshold;
+      for (i = 0; i < ta->number_samples/4; i++) {
+        // NEON GCC Intrinsic to do a 4x floating point greater-than or equal to compare
+        floats[0] = fft_data[8*i];
+        floats[1] = fft_data[8*i+2];
+        floats[2] = fft_data[8*i+4];
+        floats[3] = fft_data[8*i+6];
+        compares = vcageq_f32(floats,thresholds);
+        if (compares[0] == -1 || compares[1] == -1 || compares[2] == -1 || compares[3] == -1) {
+          return 1;
+        }
+      }
+      return 0;
+    case STRATEGY_ARM_FLAGS:
+      crash_read(ta->spec_sense, SPEC_SENSE_PLBLOCK_ID, ta->number_samples);
+      // Bit 31 of the upper 32-bits is the threshold exceeded flag
+      flags = (uint32_t *)ta->spec_sense->dma_buff;
+      if (ta->mask != NULL) {
+        return spectral_mask_flags(ta->mask, flags) >= 0;
+      }
+      flag_thresholds[0] = 0x80000000;
+      flag_thresholds[1] = 0x80000000;
+      flag_thresholds[2] = 0x80000000;
+      flag_thresholds[3] = 0x80000000;
+      for (i = 0; i < ta->number_samples/4; i++) {
+        // NEON GCC Intrinsic to do a 4x unsigned integer greater-than or equal to compare
+        integers[0] = flags[8*i+1];
+        integers[1] = flags[8*i+3];
+        integers[2] = flags[8*i+5];
+        integers[3] = flags[8*i+7];
+        compares = vcgeq_u32(integers,flag_thresholds);
+        if (compares[0] == -1 || compares[1] == -1 || compares[2] == -1 || compares[3] == -1) {
+          return 1;
+        }
+      }
+      return 0;
+    default:
+      crash_read(ta->usrp_intf_rx, USRP_INTF_PLBLOCK_ID, ta->number_samples);
+      fft_plan_cache_execute(ta->plan, (fftwf_complex *)ta->usrp_intf_rx->dma_buff, ta->out);
+      if (ta->mask != NULL) {
+        return spectral_mask_complex(ta->mask, (float *)ta->out, ta->threshold, NULL) >= 0;
+      }
+      return ta->kernel((float *)ta->out, ta->number_samples, ta->threshold, NULL) >= 0;
+  }
+}
+
+// Decide until the decision equals value. Returns -1 on timeout.
+int turnaround_wait(struct turnaround *ta, int value)
+{
+  uint32_t start = crash_read_reg(ta->usrp_intf_tx->regs,DMA_DEBUG_CNT);
+
+  while (turnaround_decide(ta) != value) {
+    if (dma_debug_cnt_delta(start, crash_read_reg(ta->usrp_intf_tx->regs,DMA_DEBUG_CNT)) >
+        TRIAL_TIMEOUT_CYCLES) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// One burst / response. Returns -1 if the strategy missed the burst or the clear channel.
+int turnaround_trial(struct turnaround *ta)
+{
+  uint *regs = ta->usrp_intf_tx->regs;
+  uint32_t start_burst, stop_detect, stop_burst, start_tx;
+
+  // Start from a clear channel, the last response may still be in the pipeline
+  if (turnaround_wait(ta, 0) != 0) return -1;
+
+  crash_set_bit(regs,USRP_TX_ENABLE);                                           // Burst on
+  start_burst = crash_read_reg(regs,DMA_DEBUG_CNT);
+  if (turnaround_wait(ta, 1) != 0) {
+    crash_clear_bit(regs,USRP_TX_ENABLE);
+    return -1;
+  }
+  stop_detect = crash_read_reg(regs,DMA_DEBUG_CNT);
+
+  if (ta->strategy == STRATEGY_FPGA) {
+    // The FPGA enables TX through the sideband as soon as the channel is clear
+    crash_set_bit(regs,USRP_TX_ENABLE_SIDEBAND);
+    crash_clear_bit(regs,USRP_TX_ENABLE);                                       // Burst off
+    stop_burst = crash_read_reg(regs,DMA_DEBUG_CNT);
+    if (turnaround_wait(ta, 0) != 0) {
+      crash_clear_bit(regs,USRP_TX_ENABLE_SIDEBAND);
+      return -1;
+    }
+    start_tx = crash_read_reg(regs,DMA_DEBUG_CNT);
+    crash_clear_bit(regs,USRP_TX_ENABLE_SIDEBAND);
+  } else {
+    crash_clear_bit(regs,USRP_TX_ENABLE);                                       // Burst off
+    stop_burst = crash_read_reg(regs,DMA_DEBUG_CNT);
+    if (turnaround_wait(ta, 0) != 0) return -1;
+    crash_set_bit(regs,USRP_TX_ENABLE);                                         // Response
+    start_tx = crash_read_reg(regs,DMA_DEBUG_CNT);
+    crash_clear_bit(regs,USRP_TX_ENABLE);
+  }
+
+  latency_hist_record_interval(&ta->detect_hist, start_burst, stop_detect);
+  latency_hist_record_interval(&ta->turnaround_hist, stop_burst, start_tx);
+  return 0;
+}
+
+void write_result(FILE *fp, const struct turnaround *ta, uint trials)
+{
+  const struct latency_hist *d = &ta->detect_hist;
+  const struct latency_hist *t = &ta->turnaround_hist;
+
+  fprintf(fp,"%s,%d,%d,%f,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+          strategy_names[ta->strategy],ta->number_samples,ta->decim_rate,ta->threshold,trials,
+          ta->misses,latency_hist_mean(d),latency_hist_percentile(d,50.0),
+          latency_hist_percentile(d,99.0),d->max/LATENCY_HIST_CLK_MHZ,
+          latency_hist_mean(t),latency_hist_percentile(t,50.0),latency_hist_percentile(t,99.0),
+          latency_hist_percentile(t,99.9),t->count ? t->min/LATENCY_HIST_CLK_MHZ : 0.0,
+          t->max/LATENCY_HIST_CLK_MHZ);
+  fflush(fp);
+
+  printf("%-16s%6d%6d%8d%8d%10.1f%10.1f%10.1f%10.1f%10.1f%10.1f\n",strategy_names[ta->strategy],
+         ta->number_samples,ta->decim_rate,trials,ta->misses,latency_hist_percentile(d,50.0),
+         latency_hist_percentile(d,99.0),latency_hist_percentile(t,50.0),
+         latency_hist_percentile(t,99.0),latency_hist_percentile(t,99.9),
+         t->max/LATENCY_HIST_CLK_MHZ);
+}
+
+int main (int argc, char **argv) {
+  int c;
+  uint i, j, k, n;
+  uint num_trials = 0;
+  float threshold = -1.0;
+  uint kernel = THRESHOLD_KERNEL_SQR;
+  int cfar_type = -1;
+  uint cfar_guard = 2;
+  uint cfar_ref = 16;
+  float cfar_alpha = 4.0;
+  uint cfar_os_rank = 0;
+  char *mask_file = NULL;
+  struct cfar cf;
+  struct spectral_mask mask;
+  char *output_file = "turnaround.csv";
+  char *latency_file = NULL;
+  char default_strategies[256];
+  char default_fft_sizes[] = "64,128,256,512,1024,2048,4096";
+  char default_decims[] = "1,2,16";
+  char *strategy_list = NULL;
+  char *fft_list = default_fft_sizes;
+  char *decim_list = default_decims;
+  char *strategy_strs[MAX_SWEEP];
+  char *fft_strs[MAX_SWEEP];
+  char *decim_strs[MAX_SWEEP];
+  int num_strategies, num_ffts, num_decims;
+  int strategies[MAX_SWEEP];
+  int fft_log2[MAX_SWEEP];
+  uint decim_rates[MAX_SWEEP];
+  bool need_fftw = false;
+  uint32_t overhead;
+  struct crash_plblock *usrp_intf_tx;
+  struct crash_plblock *usrp_intf_rx;
+  struct crash_plblock *spec_sense;
+  fftwf_complex *out;
+  struct turnaround *points[MAX_POINTS];
+  struct latency_hist *hists[2*MAX_POINTS];
+  uint num_points = 0;
+  struct turnaround *ta;
+  FILE *fp;
+  int ret = 0;
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"strategies",  required_argument, 0, 's'},
+      {"fft sizes",   required_argument, 0, 'k'},
+      {"decims",      required_argument, 0, 'd'},
+      {"trials",      required_argument, 0, 'n'},
+      {"threshold",   required_argument, 0, 't'},
+      {"kernel",      required_argument, 0, 'm'},
+      {"cfar",        required_argument, 0, 'c'},
+      {"guard",       required_argument, 0, 'g'},
+      {"ref",         required_argument, 0, 'r'},
+      {"alpha",       required_argument, 0, 'a'},
+      {"os-rank",     required_argument, 0, 'R'},
+      {"mask",        required_argument, 0, 'M'},
+      {"output",      required_argument, 0, 'o'},
+      {"latency",     required_argument, 0, 'L'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // 'n' is the short option, ':' means it requires an argument
+    c = getopt_long (argc, argv, "s:k:d:n:t:m:c:g:r:a:R:M:o:L:",
+                     long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+
+    switch (c) {
+      case 's':
+        strategy_list = optarg;
+        break;
+      case 'k':
+        fft_list = optarg;
+        break;
+      case 'd':
+        decim_list = optarg;
+        break;
+      case 'n':
+        num_trials = atoi(optarg);
+        break;
+      case 't':
+        threshold = atof(optarg);
+        break;
+      case 'm':
+        kernel = atoi(optarg);
+        break;
+      case 'c':
+        cfar_type = cfar_type_lookup(optarg);
+        if (cfar_type < 0) {
+          printf("ERROR: Invalid CFAR type, must be ca or os\n");
+          return -1;
+        }
+        break;
+      case 'g':
+        cfar_guard = atoi(optarg);
+        break;
+      case 'r':
+        cfar_ref = atoi(optarg);
+        break;
+      case 'a':
+        cfar_alpha = atof(optarg);
+        break;
+      case 'R':
+        cfar_os_rank = atoi(optarg);
+        break;
+      case 'M':
+        mask_file = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'L':
+        latency_file = optarg;
+        break;
+      case '?':
+        /* getopt_long already printed an error message. */
+        break;
+      default:
+        abort ();
+    }
+  }
+  /* Print any remaining command line arguments (not options). */
+  if (optind < argc)
+  {
+    printf ("Invalid options:\n");
+    while (optind < argc) {
+      printf ("\t%s\n", argv[optind++]);
+    }
+    return -1;
+  }
+
+  // Check arguments
+  if (strategy_list == NULL) {
+    default_strategies[0] = '\0';
+    for (i = 0; i < NUM_STRATEGIES; i++) {
+      if (i > 0) strcat(default_strategies, ",");
+      strcat(default_strategies, strategy_names[i]);
+    }
+    strategy_list = default_strategies;
+  }
+
+  num_strategies = sweep_parse_list(strategy_list, strategy_strs, MAX_SWEEP);
+  num_ffts = sweep_parse_list(fft_list, fft_strs, MAX_SWEEP);
+  num_decims = sweep_parse_list(decim_list, decim_strs, MAX_SWEEP);
+  if (num_strategies <= 0 || num_ffts <= 0 || num_decims <= 0) {
+    printf("ERROR: Empty or invalid sweep list\n");
+    return -1;
+  }
+  if (num_strategies > (int)NUM_STRATEGIES) {
+    printf("ERROR: Too many strategies (max %d)\n",(int)NUM_STRATEGIES);
+    return -1;
+  }
+
+  for (i = 0; i < (uint)num_strategies; i++) {
+    for (j = 0; j < NUM_STRATEGIES; j++) {
+      if (strcmp(strategy_strs[i], strategy_names[j]) == 0) break;
+    }
+    if (j == NUM_STRATEGIES) {
+      printf("ERROR: Unknown strategy %s\n",strategy_strs[i]);
+      return -1;
+    }
+    strategies[i] = j;
+    if (j == STRATEGY_ARM_SENSING || j == STRATEGY_ARM_SENSING_OPT) need_fftw = true;
+  }
+
+  for (i = 0; i < (uint)num_ffts; i++) {
+    fft_log2[i] = sweep_fft_log2(atoi(fft_strs[i]));
+    if (fft_log2[i] < 6 || fft_log2[i] > 12) {
+      printf("ERROR: FFT size %s must be a power of 2 from 64 to 4096\n",fft_strs[i]);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < (uint)num_decims; i++) {
+    decim_rates[i] = atoi(decim_strs[i]);
+    if (decim_rates[i] == 0 || decim_rates[i] > 2047) {
+      printf("ERROR: Decimation rate %s must be from 1 to 2047\n",decim_strs[i]);
+      return -1;
+    }
+  }
+
+  if (num_trials == 0) {
+    printf("INFO: Number of trials not specified, defaulting to %d\n",DEFAULT_TRIALS);
+    num_trials = DEFAULT_TRIALS;
+  }
+
+  if (threshold == -1.0) {
+    printf("INFO: Threshold not set, default to 1.0\n");
+    threshold = 1.0;
+  }
+
+  if (threshold <= 0.0) {
+    printf("ERROR: Threshold must be greater than 0\n");
+    return -1;
+  }
+
+  if (kernel >= NUM_THRESHOLD_KERNELS) {
+    printf("ERROR: Invalid kernel, must be 0 (sqrt) or 1 (sqr)\n");
+    return -1;
+  }
+
+  if (mask_file != NULL && cfar_type >= 0) {
+    printf("ERROR: Spectral mask cannot be used with CFAR\n");
+    return -1;
+  }
+
+  usrp_intf_tx = crash_open(USRP_INTF_PLBLOCK_ID,WRITE);
+  if (usrp_intf_tx == 0) {
+    printf("ERROR: Failed to allocate usrp_intf_tx plblock\n");
+    return -1;
+  }
+
+  usrp_intf_rx = crash_open(USRP_INTF_PLBLOCK_ID,READ);
+  if (usrp_intf_rx == 0) {
+    crash_close(usrp_intf_tx);
+    printf("ERROR: Failed to allocate usrp_intf_rx plblock\n");
+    return -1;
+  }
+
+  spec_sense = crash_open(SPEC_SENSE_PLBLOCK_ID,READ);
+  if (spec_sense == 0) {
+    crash_close(usrp_intf_tx);
+    crash_close(usrp_intf_rx);
+    printf("ERROR: Failed to allocate spec_sense plblock\n");
+    return -1;
+  }
+
+  out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*4096);
+  if (need_fftw && fft_plan_cache_init(NULL, FFTW_MEASURE) == 1) {
+    printf("INFO: Imported FFTW wisdom\n");
+  }
+
+  fp = fopen(output_file, "w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s\n",output_file);
+    ret = -1;
+    goto cleanup;
+  }
+  fprintf(fp,"strategy,fft_size,decim,threshold,trials,misses,detect_mean_us,detect_p50_us,"
+             "detect_p99_us,detect_max_us,turnaround_mean_us,turnaround_p50_us,"
+             "turnaround_p99_us,turnaround_p999_us,turnaround_min_us,turnaround_max_us\n");
+
+  // Cost of the counter reads around each interval, subtracted from every sample
+  overhead = latency_read_overhead(usrp_intf_tx);
+
+  // Set Ctrl-C handler
+  signal(SIGINT, ctrl_c);
+
+  printf("Points:\t\t\t\t%d\n",num_strategies*num_ffts*num_decims);
+  printf("Trials per point:\t\t%d\n",num_trials);
+  printf("\n%-16s%6s%6s%8s%8s%10s%10s%10s%10s%10s%10s\n","Strategy","FFT","Decim","Trials",
+         "Misses","Det p50","Det p99","TA p50","TA p99","TA p99.9","TA max");
+
+  for (i = 0; i < (uint)num_strategies && loop_prog; i++) {
+    for (j = 0; j < (uint)num_ffts && loop_prog; j++) {
+      for (k = 0; k < (uint)num_decims && loop_prog; k++) {
+        ta = (struct turnaround *)calloc(1, sizeof(struct turnaround));
+        if (ta == NULL) {
+          printf("ERROR: Failed to allocate sweep point\n");
+          ret = -1;
+          goto cleanup;
+        }
+        points[num_points++] = ta;
+        ta->strategy = strategies[i];
+        ta->fft_size = fft_log2[j];
+        ta->number_samples = 1 << fft_log2[j];
+        ta->decim_rate = decim_rates[k];
+        ta->threshold = threshold;
+        ta->kernel = threshold_kernels[(ta->strategy == STRATEGY_ARM_SENSING) ? THRESHOLD_KERNEL_SQRT : kernel];
+        ta->usrp_intf_tx = usrp_intf_tx;
+        ta->usrp_intf_rx = usrp_intf_rx;
+        ta->spec_sense = spec_sense;
+        ta->out = out;
+        snprintf(ta->detect_name, sizeof(ta->detect_name), "%s %d/%d Detect Time",
+                 strategy_names[ta->strategy], ta->number_samples, ta->decim_rate);
+        snprintf(ta->turnaround_name, sizeof(ta->turnaround_name), "%s %d/%d Turnaround Time",
+                 strategy_names[ta->strategy], ta->number_samples, ta->decim_rate);
+        latency_hist_init(&ta->detect_hist, ta->detect_name, overhead);
+        latency_hist_init(&ta->turnaround_hist, ta->turnaround_name, overhead);
+
+        // Both depend on the FFT size, so they are set up again for every point
+        if (cfar_type >= 0 && ta->strategy == STRATEGY_ARM_DECISION) {
+          if (cfar_init(&cf, cfar_type, ta->number_samples, cfar_guard, cfar_ref, cfar_alpha, cfar_os_rank) != 0) {
+            ret = -1;
+            goto cleanup;
+          }
+          ta->cfar = &cf;
+        }
+        if (mask_file != NULL && ta->strategy != STRATEGY_FPGA) {
+          if (spectral_mask_load(&mask, mask_file, ta->number_samples) != 0) {
+            ret = -1;
+            goto cleanup;
+          }
+          ta->mask = &mask;
+        }
+
+        if (ta->strategy == STRATEGY_ARM_SENSING || ta->strategy == STRATEGY_ARM_SENSING_OPT) {
+          // Planning overwrites the buffers, which is fine as neither holds data yet
+          ta->plan = fft_plan_cache_get(ta->number_samples, (fftwf_complex *)usrp_intf_rx->dma_buff, out);
+          if (ta->plan == NULL) {
+            ret = -1;
+            goto cleanup;
+          }
+        }
+
+        turnaround_setup(ta);
+        for (n = 0; n < num_trials && loop_prog; n++) {
+          if (turnaround_trial(ta) != 0) ta->misses++;
+          usleep(TRIAL_GAP_US);
+        }
+        turnaround_cleanup(ta);
+        write_result(fp, ta, n);
+        if (ta->cfar != NULL) cfar_free(ta->cfar);
+        if (ta->mask != NULL) spectral_mask_free(ta->mask);
+        ta->cfar = NULL;
+        ta->mask = NULL;
+      }
+    }
+  }
+
+  if (latency_file != NULL) {
+    for (i = 0; i < num_points; i++) {
+      hists[2*i] = &points[i]->detect_hist;
+      hists[2*i+1] = &points[i]->turnaround_hist;
+    }
+    latency_hist_export(latency_file, hists, 2*num_points);
+  }
+  printf("Results written to %s\n",output_file);
+
+cleanup:
+  if (fp != NULL) fclose(fp);
+  for (i = 0; i < num_points; i++) {
+    // Only set if the sweep stopped on an error
+    if (points[i]->cfar != NULL) cfar_free(points[i]->cfar);
+    if (points[i]->mask != NULL) spectral_mask_free(points[i]->mask);
+    free(points[i]);
+  }
+  if (need_fftw) fft_plan_cache_cleanup();
+  fftwf_free(out);
+  crash_close(usrp_intf_tx);
+  crash_close(usrp_intf_rx);
+  crash_close(spec_sense);
+  return ret;
+}
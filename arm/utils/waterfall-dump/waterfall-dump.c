@@ -0,0 +1,213 @@
+/******************************************************************************
+**  This is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this code.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+**  File:         waterfall-dump.c
+**  Author(s):    Jonathon Pendlum (jon.pendlum@gmail.com)
+**  Description:  Extract rows from a waterfall log made with record-fft --duration.
+**
+**                The index at the end of the file is used to seek straight to
+**                the chunks overlapping --start / --stop (seconds from the start
+**                of the log), so a short time range is pulled out of a long
+**                survey without reading the rest of it. Rows are converted back
+**                to dB and written as float32, num_bins per row. --list prints
+**                the index instead.
+**
+**                Plain C, builds on the host.
+**
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "waterfall.h"
+
+int main (int argc, char **argv) {
+  int c;
+  int i;
+  uint row;
+  uint bin;
+  char *input_file = NULL;
+  char *output_file = "data.txt";
+  bool list = false;
+  double start = 0.0;
+  double stop = -1.0;
+  FILE *in_fp;
+  FILE *out_fp;
+  struct waterfall_index_entry *index;
+  struct waterfall_chunk_header hdr;
+  int num_chunks;
+  uint64_t t0;
+  uint64_t start_ns;
+  uint64_t stop_ns;
+  uint64_t row_ns;
+  uint8_t *codes = NULL;
+  float *db = NULL;
+  size_t codes_size = 0;
+  size_t row_bytes;
+  uint num_bins = 0;
+  uint64_t rows = 0;
+  uint64_t dropped = 0;
+  uint chunks_read = 0;
+
+  // Parse command line arguments
+  while (1) {
+    static struct option long_options[] = {
+      /* These options don't set a flag.
+         We distinguish them by their indices. */
+      {"input",       required_argument, 0, 'i'},
+      {"output",      required_argument, 0, 'o'},
+      {"start",       required_argument, 0, 's'},
+      {"stop",        required_argument, 0, 'e'},
+      {"list",        no_argument,       0, 'l'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    // `":" means argument required
+    c = getopt_long (argc, argv, "i:o:s:e:l",long_options, &option_index);
+    /* Detect the end of the options. */
+    if (c == -1) break;
+    switch (c) {
+      case 'i':
+        input_file = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 's':
+        start = atof(optarg);
+        break;
+      case 'e':
+        stop = atof(optarg);
+        break;
+      case 'l':
+        list = true;
+        break;
+      default:
+        abort();
+    }
+  }
+
+  if (input_file == NULL) {
+    printf("ERROR: No input file, use --input\n");
+    return -1;
+  }
+
+  in_fp = fopen(input_file,"rb");
+  if (in_fp == NULL) {
+    printf("ERROR: Failed to open %s\n",input_file);
+    return -1;
+  }
+  num_chunks = waterfall_read_index(in_fp,&index);
+  if (num_chunks < 0) {
+    printf("ERROR: %s is not a complete waterfall log\n",input_file);
+    fclose(in_fp);
+    return -1;
+  }
+  if (num_chunks == 0) {
+    printf("INFO: Waterfall log is empty\n");
+    free(index);
+    fclose(in_fp);
+    return 0;
+  }
+
+  t0 = index[0].start_time_ns;
+  if (list) {
+    printf("Chunk\tOffset\t\tTime (s)\tRows\n");
+    for (i = 0; i < num_chunks; i++) {
+      printf("%d\t%llu\t\t%f\t%d\n",i,(unsigned long long)index[i].offset,
+             (index[i].start_time_ns - t0)/1e9,index[i].num_rows);
+    }
+    free(index);
+    fclose(in_fp);
+    return 0;
+  }
+
+  out_fp = fopen(output_file,"wb");
+  if (out_fp == NULL) {
+    printf("ERROR: Failed to open %s\n",output_file);
+    free(index);
+    fclose(in_fp);
+    return -1;
+  }
+
+  start_ns = t0 + (uint64_t)(start*1e9);
+  stop_ns = (stop < 0.0) ? UINT64_MAX : t0 + (uint64_t)(stop*1e9);
+  for (i = 0; i < num_chunks; i++) {
+    // Chunks are in time order, skip the ones ending before the range
+    if (i + 1 < num_chunks && index[i+1].start_time_ns <= start_ns) continue;
+    if (index[i].start_time_ns >= stop_ns) break;
+    if (fseek(in_fp,(long)index[i].offset,SEEK_SET) != 0 ||
+        fread(&hdr,sizeof(hdr),1,in_fp) != 1 || hdr.magic != WATERFALL_CHUNK_MAGIC ||
+        (hdr.bits != 8 && hdr.bits != 16)) {
+      printf("WARNING: Chunk %d is corrupt, skipping\n",i);
+      continue;
+    }
+    if (num_bins != 0 && hdr.num_bins != num_bins) {
+      printf("WARNING: FFT size changes at chunk %d, stopping\n",i);
+      break;
+    }
+    num_bins = hdr.num_bins;
+    row_bytes = (size_t)hdr.num_bins*(hdr.bits/8);
+    if (row_bytes*hdr.num_rows > codes_size) {
+      codes_size = row_bytes*hdr.num_rows;
+      free(codes);
+      free(db);
+      codes = (uint8_t *)malloc(codes_size);
+      db = (float *)malloc(hdr.num_bins*sizeof(float));
+      if (codes == NULL || db == NULL) {
+        printf("ERROR: Failed to allocate chunk buffers\n");
+        break;
+      }
+    }
+    if (fread(codes,row_bytes,hdr.num_rows,in_fp) != hdr.num_rows) {
+      printf("WARNING: Chunk %d is truncated, stopping\n",i);
+      break;
+    }
+    if (hdr.dropped_frames > 0) {
+      printf("WARNING: %d frame(s) dropped before chunk %d\n",hdr.dropped_frames,i);
+    }
+    dropped += hdr.dropped_frames;
+    chunks_read++;
+    for (row = 0; row < hdr.num_rows; row++) {
+      row_ns = hdr.start_time_ns + row*hdr.row_period_ns;
+      if (row_ns < start_ns || row_ns >= stop_ns) continue;
+      for (bin = 0; bin < hdr.num_bins; bin++) {
+        if (hdr.bits == 8) {
+          db[bin] = hdr.db_min + codes[row*row_bytes + bin]*hdr.db_step;
+        } else {
+          db[bin] = hdr.db_min + ((uint16_t *)(codes + row*row_bytes))[bin]*hdr.db_step;
+        }
+      }
+      fwrite(db,sizeof(float),hdr.num_bins,out_fp);
+      rows++;
+    }
+  }
+
+  printf("FFT Size:\t\t%d\n",num_bins);
+  printf("Chunks Read:\t\t%d of %d\n",chunks_read,num_chunks);
+  printf("Rows Written:\t\t%llu\n",(unsigned long long)rows);
+  printf("Dropped Frames:\t\t%llu\n",(unsigned long long)dropped);
+
+  free(codes);
+  free(db);
+  free(index);
+  fclose(out_fp);
+  fclose(in_fp);
+  return 0;
+}
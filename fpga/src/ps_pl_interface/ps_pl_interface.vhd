@@ -1261,7 +1261,7 @@ begin
             else
               mm2s_xfer_cnt       <= 0;
             end if;
-          elsif (axis_s2mm_sts_tvalid = '1') then
+          elsif (axis_mm2s_sts_tvalid = '1') then
             mm2s_xfer_cnt         <= mm2s_xfer_cnt + 1;
           end if;
         end loop;
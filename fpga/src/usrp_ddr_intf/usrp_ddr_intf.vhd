@@ -75,6 +75,7 @@ entity usrp_ddr_intf is
     rx_cic_decim_en         : in    std_logic;                      -- Set receive CIC decimation rate
     rx_cic_decim_ack        : out   std_logic;                      -- Set receive CIC decimation rate acknowledge
     rx_fix2float_bypass     : in    std_logic;                      -- Bypass RX fixed to floating point conversion
+    rx_pack16               : in    std_logic;                      -- Pack two 16 bit I/Q samples per word (requires rx_fix2float_bypass)
     rx_cic_bypass           : in    std_logic;                      -- Bypass RX CIC filter
     rx_hb_bypass            : in    std_logic;                      -- Bypass RX half band filter
     tx_enable               : in    std_logic;                      -- Enable TX processing chain (clears resets)
@@ -409,8 +410,8 @@ architecture RTL of usrp_ddr_intf is
   signal rx_mmcm_phase                : integer range 0 to 559;
   signal tx_mmcm_phase                : integer range 0 to 559;
 
-  signal rx_async                     : std_logic_vector(67 downto 0);
-  signal rx_sync                      : std_logic_vector(67 downto 0);
+  signal rx_async                     : std_logic_vector(68 downto 0);
+  signal rx_sync                      : std_logic_vector(68 downto 0);
   signal rx_async_rising              : std_logic_vector(4 downto 0);
   signal rx_sync_rising               : std_logic_vector(4 downto 0);
   signal tx_async                     : std_logic_vector(58 downto 0);
@@ -427,6 +428,9 @@ architecture RTL of usrp_ddr_intf is
   signal usrp_mode_ctrl_en_sync       : std_logic;
   signal usrp_mode_ctrl_stb           : std_logic;
   signal rx_fix2float_bypass_sync     : std_logic;
+  signal rx_pack16_sync               : std_logic;
+  signal rx_pack16_toggle             : std_logic;
+  signal rx_pack16_hold               : std_logic_vector(31 downto 0);
   signal rx_cic_bypass_sync           : std_logic;
   signal rx_hb_bypass_sync            : std_logic;
   signal rx_cic_decim_sync            : std_logic_vector(10 downto 0);
@@ -986,11 +990,35 @@ begin
 
   -- FIFO for clock crossing and buffering (Receive)
   -- Bypass fixed to float conversion and output raw data when decimation is set to 0
-  rx_fifo_din                         <= rx_fix2float_din_i & rx_fix2float_din_q when rx_fix2float_bypass_sync = '1' else
+  -- In packed mode, the upper 16 bits (Q15) of two consecutive samples share one word. The word is
+  -- ordered so the AXI-Stream output lands in memory as I0, Q0, I1, Q1 (int16).
+  rx_fifo_din                         <= rx_pack16_hold & rx_fix2float_din_q(31 downto 16) & rx_fix2float_din_i(31 downto 16)
+                                           when rx_fix2float_bypass_sync = '1' AND rx_pack16_sync = '1' else
+                                         rx_fix2float_din_i & rx_fix2float_din_q when rx_fix2float_bypass_sync = '1' else
                                          rx_fix2float_dout_i & rx_fix2float_dout_q;
   rx_fifo_wr_en                       <= rx_fifo_wr_en_int AND NOT(rx_fifo_full);
-  rx_fifo_wr_en_int                   <= rx_fix2float_nd when rx_fix2float_bypass_sync = '1' else
+  rx_fifo_wr_en_int                   <= rx_fix2float_nd AND rx_pack16_toggle
+                                           when rx_fix2float_bypass_sync = '1' AND rx_pack16_sync = '1' else
+                                         rx_fix2float_nd when rx_fix2float_bypass_sync = '1' else
                                          rx_fix2float_rdy_i;
+
+  -- Hold the first sample of each packed pair, the FIFO is written on the second
+  proc_rx_pack16 : process(clk_rx,rx_enable_n)
+  begin
+    if (rx_enable_n = '1') then
+      rx_pack16_toggle                <= '0';
+      rx_pack16_hold                  <= (others=>'0');
+    else
+      if rising_edge(clk_rx) then
+        if (rx_fix2float_nd = '1') then
+          rx_pack16_toggle            <= NOT(rx_pack16_toggle);
+          if (rx_pack16_toggle = '0') then
+            rx_pack16_hold            <= rx_fix2float_din_q(31 downto 16) & rx_fix2float_din_i(31 downto 16);
+          end if;
+        end if;
+      end if;
+    end if;
+  end process;
   rx_fifo_rd_en_int                   <= rx_fifo_rd_en AND NOT(rx_fifo_empty_int);
   rx_fifo_data_i                      <= rx_fifo_dout(63 downto 32);
   rx_fifo_data_q                      <= rx_fifo_dout(31 downto 0);
@@ -1445,6 +1473,7 @@ begin
   rx_async(65)                        <= rx_enable;
   rx_async(66)                        <= rx_cic_decim_en;
   rx_async(67)                        <= usrp_mode_ctrl_en;
+  rx_async(68)                        <= rx_pack16;
   usrp_mode_ctrl_sync                 <= rx_sync(7 downto 0);
   rx_phase_incdec_sync                <= rx_sync(8);
   rx_cic_decim_sync                   <= rx_sync(19 downto 9);
@@ -1456,6 +1485,7 @@ begin
   rx_enable_sync                      <= rx_sync(65);
   rx_cic_decim_en_sync                <= rx_sync(66);
   usrp_mode_ctrl_en_sync              <= rx_sync(67);
+  rx_pack16_sync                      <= rx_sync(68);
 
   rx_enable_n                         <= NOT(rx_enable_sync);
 
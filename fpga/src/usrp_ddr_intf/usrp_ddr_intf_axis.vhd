@@ -91,6 +91,7 @@ architecture RTL of usrp_ddr_intf_axis is
       rx_cic_decim_en         : in    std_logic;                      -- Set receive CIC decimation rate
       rx_cic_decim_ack        : out   std_logic;                      -- Set receive CIC decimation rate acknowledge
       rx_fix2float_bypass     : in    std_logic;                      -- Bypass RX fixed to floating point conversion
+      rx_pack16               : in    std_logic;                      -- Pack two 16 bit I/Q samples per word (requires rx_fix2float_bypass)
       rx_cic_bypass           : in    std_logic;                      -- Bypass RX CIC filter
       rx_hb_bypass            : in    std_logic;                      -- Bypass RX half band filter
       tx_enable               : in    std_logic;                      -- Enable TX processing chain (clears resets)
@@ -212,6 +213,7 @@ architecture RTL of usrp_ddr_intf_axis is
   signal rx_cic_decim_en                : std_logic;
   signal rx_cic_decim_ack               : std_logic;
   signal rx_fix2float_bypass            : std_logic;
+  signal rx_pack16                      : std_logic;
   signal rx_cic_bypass                  : std_logic;
   signal rx_hb_bypass                   : std_logic;
   signal tx_enable                      : std_logic;
@@ -423,6 +425,7 @@ begin
       rx_cic_decim_en                           => rx_cic_decim_en,
       rx_cic_decim_ack                          => rx_cic_decim_ack,
       rx_fix2float_bypass                       => rx_fix2float_bypass,
+      rx_pack16                                 => rx_pack16,
       rx_cic_bypass                             => rx_cic_bypass,
       rx_hb_bypass                              => rx_hb_bypass,
       tx_enable                                 => tx_enable,
@@ -535,7 +538,7 @@ begin
   axis_master_tdest_hold                <= ctrl_reg(0)(31 downto 29);
   -- Bank 1 (USRP Mode)
   usrp_mode_ctrl                        <= ctrl_reg(1)(7 downto 0);
-  -- Bank 2 (RX & TX Floating Point Bypass, RX Packet Size)
+  -- Bank 2 (RX & TX Floating Point Bypass, RX 16-bit Packing, RX Packet Size)
   rx_packet_size                        <= ctrl_reg(2)(23 downto 0);
   rx_fix2float_bypass                   <= ctrl_reg(2)(24);
   rx_cic_bypass                         <= ctrl_reg(2)(25);
@@ -543,6 +546,7 @@ begin
   tx_float2fix_bypass                   <= ctrl_reg(2)(27);
   tx_cic_bypass                         <= ctrl_reg(2)(28);
   tx_hb_bypass                          <= ctrl_reg(2)(29);
+  rx_pack16                             <= ctrl_reg(2)(30);
   -- Bank 3 (Decimation and Interpolation Rate)
   rx_cic_decim                          <= ctrl_reg(3)(10 downto 0);
   tx_cic_interp                         <= ctrl_reg(3)(26 downto 16);
@@ -574,7 +578,7 @@ begin
   status_reg(0)(31 downto 29)           <= axis_master_tdest_safe;
   -- Bank 1 (USRP Mode Readback)
   status_reg(1)(7 downto 0)             <= usrp_mode_ctrl;
-  -- Bank 2 (RX & TX Floating Point Bypass, RX Packet Size Readback)
+  -- Bank 2 (RX & TX Floating Point Bypass, RX 16-bit Packing, RX Packet Size Readback)
   status_reg(2)(23 downto 0)            <= rx_packet_size;
   status_reg(2)(24)                     <= rx_fix2float_bypass;
   status_reg(2)(25)                     <= rx_cic_bypass;
@@ -582,6 +586,7 @@ begin
   status_reg(2)(27)                     <= tx_float2fix_bypass;
   status_reg(2)(28)                     <= tx_cic_bypass;
   status_reg(2)(29)                     <= tx_hb_bypass;
+  status_reg(2)(30)                     <= rx_pack16;
   -- Bank 3 (Decimation and Interpolation Rate Readback)
   status_reg(3)(10 downto 0)            <= rx_cic_decim;
   status_reg(3)(26 downto 16)           <= tx_cic_interp;